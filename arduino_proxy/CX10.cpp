@@ -1,5 +1,6 @@
 // Update : a xn297 is not required anymore, it can be emulated with a nRF24l01 :
 // https://gist.github.com/goebish/ab4bc5f2dfb1ac404d3e
+// (define CX10_NRF24L01 in CX10.h)
 
 // **************************************************************
 // ****************** CX-10 Tx Code (blue PCB) ******************
@@ -20,6 +21,8 @@
 // XN297 datasheet: http://www.foxware-cn.com/UploadFile/20140808155134.pdf
 
 #include "CX10.h"
+#include "profile.h"
+#include "xn297.h"
 
 //Spi Comm.pins with XN297/PPM, direct port access, do not change
 #define MOSI_pin  5             // MOSI-D5
@@ -45,7 +48,25 @@
 #define NOP() __asm__ __volatile__("nop")
 
 #define PACKET_LENGTH 19
-#define PACKET_INTERVAL 6 // interval of time between start of 2 packets, in ms
+#define HEAD_LENGTH 9 // type, txid and aid: the same in every packet
+#define PACKET_INTERVAL 6000 // interval of time between start of 2 packets, in us
+#define SLOT_INTERVAL (PACKET_INTERVAL/CX10_MAX_CRAFT) // each craft gets its own slice of the interval
+#define CONFIRM_ROUNDS 20 // bind rounds to wait for a craft to confirm before looking for another
+#define LISTEN_TIME 4000 // us to listen for replies after each bind packet
+#define AIR_TIME 400 // us to leave a packet going out before touching the radio again
+#define RX_POLL_INTERVAL 500 // us between looks at an empty RX FIFO, under the 3 replies it holds
+
+#ifdef CX10_NRF24L01
+#define CONFIG_TX 0x02 // Power on, TX mode, CRC done by the emulation
+#define CONFIG_RX 0x03
+#define TX_ADDR_CHECK 0x55 // first byte of the preamble
+#define RX_LENGTH (PACKET_LENGTH + XN297_CRC_LEN) // the CRC is checked here
+#else
+#define CONFIG_TX 0x0e // Power on, TX mode, 2 byte CRC
+#define CONFIG_RX 0x0f
+#define TX_ADDR_CHECK 0xcc
+#define RX_LENGTH PACKET_LENGTH // the XN297 drops frames with a bad CRC itself
+#endif
 
 
 // PPM stream settings
@@ -59,26 +80,70 @@ enum chan_order{  // TAER -> Spektrum/FrSky chan order
     AUX2,  // flip control
 };
 
+enum trace_state {
+    TRACE_NONE,
+    TRACE_PENDING, // waiting for the next packet to the craft
+    TRACE_DONE,    // on air, waiting for traced()
+};
+
+enum bind_state {
+    BIND_NONE,
+    BIND_SEARCH,  // waiting to be given an aircraft ID
+    BIND_CONFIRM, // sending its ID, waiting for that craft to confirm
+};
+
 //########## Variables #################
-static uint8_t aid[4]={0xFF,0xFF,0xFF,0xFF}; // aircraft ID
-static uint8_t txid[4]; // transmitter ID
-static uint8_t freq[4]; // frequency hopping table
+struct Craft {
+    uint8_t aid[4]; // aircraft ID
+    uint8_t txid[4]; // transmitter ID
+    uint8_t freq[4]; // frequency hopping table
+    uint8_t chan; // next entry of freq to use
+    bool active; // bound, so send it packets
+    uint8_t bind; // bind_state
+    uint8_t bindRounds; // spent in BIND_CONFIRM
+    uint8_t trace; // trace_state
+    uint16_t traceSeq; // sequence number of the traced stick values
+    uint32_t traceAir; // micros() when they went on air
+    uint16_t Servo_data[CHANNELS];
+#ifdef CX10_NRF24L01
+    // Address and HEAD_LENGTH bytes encoded for headType packets, and the
+    // CRC up to there.
+    uint8_t head[XN297_ADDR_LEN + HEAD_LENGTH];
+    uint16_t headCrc;
+    uint8_t headType;
+#endif
+};
+static Craft craft[CX10_MAX_CRAFT];
 static uint8_t packet[PACKET_LENGTH];
-static uint32_t nextPacket;
-static uint16_t Servo_data[CHANNELS] = {0,};
+static uint32_t nextPacket; // micros()
+static uint8_t nextSlot;
 int ledPin = 13;
+static const uint8_t address[5] = { 0xcc, 0xcc, 0xcc, 0xcc, 0xcc };
+static uint8_t rxBurst; // frames drained since the RX FIFO was last empty
+#ifdef CX10_NRF24L01
+static uint16_t rxAddrCrc; // CRC of the encoded address replies come to
+#endif
+
+// txid or aid changed, so the head needs encoding again.
+static void changed(Craft* c) {
+#ifdef CX10_NRF24L01
+    c->headType = 0;
+#else
+    (void)c;
+#endif
+}
 
 CX10::CX10()
 {
     randomSeed((analogRead(A0) & 0x1F) | (analogRead(A1) << 5));
-    for(uint8_t i=0;i<4;i++) {
-        txid[i] = random();
+    for(uint8_t slot=0;slot<CX10_MAX_CRAFT;slot++) {
+        uint8_t id[4];
+        for(uint8_t i=0;i<4;i++) {
+            id[i] = random();
+        }
+        setTxid(slot, id);
+        memset(craft[slot].aid, 0xFF, 4);
     }
-    txid[1] %= 0x30;
-    freq[0] = (txid[0] & 0x0F) + 0x03;
-    freq[1] = (txid[0] >> 4) + 0x16;
-    freq[2] = (txid[1] & 0x0F) + 0x2D;
-    freq[3] = (txid[1] >> 4) + 0x40;
     pinMode(ledPin, OUTPUT);
     //RF module pins
     pinMode(MOSI_pin, OUTPUT);
@@ -101,6 +166,23 @@ CX10::CX10()
     delay(10);
 
     //############ INIT1 ##############
+#ifdef CX10_NRF24L01
+    uint8_t rxAddr[XN297_ADDR_LEN], encoded[XN297_ADDR_LEN];
+    xn297RxAddress(rxAddr, address);
+    rxAddrCrc = xn297EncodeAddress(encoded, address);
+    CS_off;
+    _spi_write(0x30); // Set TX address to the XN297 preamble
+    for (uint8_t i = 0; i < XN297_ADDR_LEN; i++)
+        _spi_write(xn297Preamble[i]);
+    CS_on;
+    delayMicroseconds(5);
+    CS_off;
+    _spi_write(0x2a); // Set RX pipe 0 address to what an XN297 sends for 0xCCCCCCCCCC
+    for (uint8_t i = 0; i < XN297_ADDR_LEN; i++)
+        _spi_write(rxAddr[i]);
+    CS_on;
+    delayMicroseconds(5);
+#else
     CS_off;
     _spi_write(0x3f); // Set Baseband parameters (debug registers) - BB_CAL
     _spi_write(0x4c);
@@ -148,6 +230,7 @@ CX10::CX10()
     _spi_write(0xcc);
     CS_on;
     delayMicroseconds(5);
+#endif
     _spi_write_address(0xe1, 0x00); // Clear TX buffer
     _spi_write_address(0xe2, 0x00); // Clear RX buffer
     _spi_write_address(0x27, 0x70); // Clear interrupts
@@ -156,7 +239,7 @@ CX10::CX10()
     _spi_write_address(0x23, 0x03); // Set 5 byte rx/tx address field width
     _spi_write_address(0x25, 0x02); // Set channel frequency
     _spi_write_address(0x24, 0x00); // No auto-retransmit
-    _spi_write_address(0x31, PACKET_LENGTH); // 19-byte payload
+    _spi_write_address(0x31, RX_LENGTH); // 19-byte payload, and the CRC when emulating
     _spi_write_address(0x26, 0x07); // 1 Mbps air data rate, 5dbm RF power
     _spi_write_address(0x50, 0x73); // Activate extra feature register
     _spi_write_address(0x3c, 0x00); // Disable dynamic payload length
@@ -165,77 +248,274 @@ CX10::CX10()
     delay(100);//100ms delay
 
     //############ INIT2 ##############
-    healthy = _spi_read_address(0x10) == 0xCC;
+    healthy = _spi_read_address(0x10) == TX_ADDR_CHECK;
     
-    _spi_write_address(0x20, 0x0e); // Power on, TX mode, 2 byte CRC
+    _spi_write_address(0x20, CONFIG_TX); // Power on, TX mode
     MOSI_off;
     delay(100);
-    nextPacket = millis();
+    nextPacket = micros();
 
 }
 
-void CX10::bind(int slot) {
-    //Bind to Receiver
-    bind_XN297();
+void CX10::setTxid(uint8_t slot, const uint8_t* id) {
+    Craft* c = &craft[slot];
+    memcpy(c->txid, id, 4);
+    c->txid[1] %= 0x30;
+    c->freq[0] = (c->txid[0] & 0x0F) + 0x03;
+    c->freq[1] = (c->txid[0] >> 4) + 0x16;
+    c->freq[2] = (c->txid[1] & 0x0F) + 0x2D;
+    c->freq[3] = (c->txid[1] >> 4) + 0x40;
+    c->chan = 0;
+    changed(c);
+}
+
+void CX10::startBind(int slot, const uint8_t* txid) {
+    if (slot < 0 || slot >= CX10_MAX_CRAFT)
+        return;
+    craft[slot].active = false;
+    if (txid)
+        setTxid(slot, txid);
+    memset(craft[slot].aid, 0xFF, 4);
+    changed(&craft[slot]);
+    craft[slot].bind = BIND_SEARCH;
+}
+
+void CX10::cancelBind(int slot) {
+    if (slot >= 0 && slot < CX10_MAX_CRAFT && craft[slot].bind != BIND_NONE) {
+        craft[slot].bind = BIND_NONE;
+        memset(craft[slot].aid, 0xFF, 4);
+        changed(&craft[slot]);
+    }
+}
+
+bool CX10::binding(int slot) {
+    return slot >= 0 && slot < CX10_MAX_CRAFT && craft[slot].bind != BIND_NONE;
+}
+
+void CX10::restore(int slot, const uint8_t* txid, const uint8_t* aid) {
+    if (slot < 0 || slot >= CX10_MAX_CRAFT)
+        return;
+    craft[slot].bind = BIND_NONE;
+    setTxid(slot, txid);
+    memcpy(craft[slot].aid, aid, 4);
+    changed(&craft[slot]);
+    craft[slot].active = true;
+}
+
+void CX10::release(int slot) {
+    if (slot >= 0 && slot < CX10_MAX_CRAFT) {
+        craft[slot].active = false;
+        cancelBind(slot);
+    }
+}
+
+bool CX10::getBind(int slot, uint8_t* txid, uint8_t* aid) {
+    if (slot < 0 || slot >= CX10_MAX_CRAFT)
+        return false;
+    memcpy(txid, craft[slot].txid, 4);
+    memcpy(aid, craft[slot].aid, 4);
+    return craft[slot].active;
 }
 
 
 //############ MAIN LOOP ##############
+// Sends at most one packet per call, so the caller can keep servicing the
+// serial port between packets.
+// Every craft gets a packet each PACKET_INTERVAL, in its own time slice.
 void CX10::loop() {
-    for (int chan = 0; chan < 4; chan++) {
-        while(millis() < nextPacket) {} // wait
-        nextPacket = millis()+PACKET_INTERVAL;
-        CE_off;
-        delayMicroseconds(5);
-        _spi_write_address(0x20, 0x0e); // TX mode
-        _spi_write_address(0x25, freq[chan]); // Set RF chan
-        _spi_write_address(0x27, 0x70); // Clear interrupts
-        _spi_write_address(0xe1, 0x00); // Flush TX
-        Write_Packet(0x55); // servo_data timing is updated in interrupt (ISR routine for decoding PPM signal)
+    uint32_t now = micros();
+    if ((int32_t)(now - nextPacket) < 0)
+        return; // not due yet
+    uint8_t slot = nextSlot;
+    nextSlot = (nextSlot + 1) % CX10_MAX_CRAFT;
+    Craft* c = &craft[slot];
+    if (!c->active) {
+        nextPacket += SLOT_INTERVAL;
+        return;
     }
+    PROFILE_VALUE(PROF_LATE, now - nextPacket);
+    // Don't try to catch up after a stall (a bind, say); just carry on.
+    if ((uint32_t)(now - nextPacket) > SLOT_INTERVAL)
+        nextPacket = now;
+    nextPacket += SLOT_INTERVAL;
+    sendData(slot);
 }
 
-void CX10::setAileron(int slot, int value){ Servo_data[AILERON] = value + 1000; }
-void CX10::setElevator(int slot, int value){ Servo_data[ELEVATOR] = value + 1000; }
-void CX10::setThrottle(int slot, int value){ Servo_data[THROTTLE] = value + 1000; }
-void CX10::setRudder(int slot, int value){ Servo_data[RUDDER] = value + 1000; }
+// Sends slot its stick values on its next hopping channel.
+void CX10::sendData(uint8_t slot) {
+    Craft* c = &craft[slot];
+    CE_off;
+    delayMicroseconds(5);
+    _spi_write_address(0x20, CONFIG_TX); // TX mode
+    _spi_write_address(0x25, c->freq[c->chan]); // Set RF chan
+    _spi_write_address(0x27, 0x70); // Clear interrupts
+    _spi_write_address(0xe1, 0x00); // Flush TX
+    PROFILE_START(write);
+    Write_Packet(slot, 0x55); // servo_data timing is updated in interrupt (ISR routine for decoding PPM signal)
+    PROFILE_END(PROF_WRITE_PACKET, write);
+    if (c->trace == TRACE_PENDING) {
+        c->traceAir = micros();
+        c->trace = TRACE_DONE;
+    }
+    c->chan = (c->chan + 1) % 4;
+}
+
+void CX10::trace(int slot, uint16_t seq) {
+    if (slot < 0 || slot >= CX10_MAX_CRAFT)
+        return;
+    craft[slot].traceSeq = seq;
+    craft[slot].trace = TRACE_PENDING;
+}
+
+bool CX10::traced(uint8_t* slot, uint16_t* seq, uint32_t* air_us) {
+    for (uint8_t s = 0; s < CX10_MAX_CRAFT; s++) {
+        Craft* c = &craft[s];
+        if (c->trace != TRACE_DONE)
+            continue;
+        c->trace = TRACE_NONE;
+        *slot = s;
+        *seq = c->traceSeq;
+        *air_us = c->traceAir;
+        return true;
+    }
+    return false;
+}
+
+void CX10::setAileron(int slot, int value){ if (slot < CX10_MAX_CRAFT) craft[slot].Servo_data[AILERON] = value + 1000; }
+void CX10::setElevator(int slot, int value){ if (slot < CX10_MAX_CRAFT) craft[slot].Servo_data[ELEVATOR] = value + 1000; }
+void CX10::setThrottle(int slot, int value){ if (slot < CX10_MAX_CRAFT) craft[slot].Servo_data[THROTTLE] = value + 1000; }
+void CX10::setRudder(int slot, int value){ if (slot < CX10_MAX_CRAFT) craft[slot].Servo_data[RUDDER] = value + 1000; }
   
 //BIND_TX
-void CX10::bind_XN297() {
+// Every craft in bind mode answers every bind packet on channel 2 with its
+// aircraft ID, and confirms (packet[9] == 1) once it hears bind packets
+// carrying that ID.  So each round sends a bind packet for every slot
+// being bound and listens after each, noting every ID heard once, leaving
+// out those a slot already has; then hands the new IDs to the searching
+// slots in turn.  Each slot then sends its own craft's ID until that craft
+// confirms, so craft powered on together each get a slot, and one can't
+// take a slot meant for another.  A slot whose craft doesn't confirm in
+// CONFIRM_ROUNDS goes back to searching.  Replies are drained from the RX
+// FIFO every RX_POLL_INTERVAL rather than polled for continuously, and
+// anything that isn't one (a bad flag, no ID) is counted and dropped.
+// Craft already flying get a packet after each bind packet's listening
+// time, every 6 ms or so as usual, so they fly on while this runs.
+void CX10::runBind(bool (*service)(), void (*bound)(uint8_t slot)) {
     byte counter=255;
-    bool bound=false;
-    while(!bound){
-        CE_off;
-        delayMicroseconds(5);
-        _spi_write_address(0x20, 0x0e); // Power on, TX mode, 2 byte CRC
-        _spi_write_address(0x25, 0x02); // set RF channel 2
-        _spi_write_address(0x27, 0x70); // Clear interrupts
-        _spi_write_address(0xe1, 0x00); // Flush TX
-        Write_Packet(0xaa); // send bind packet
-        delay(2);
-        _spi_write_address(0x27, 0x70); // Clear interrupts
-        _spi_write_address(0x25, 0x02); // Set RF channel
-        _spi_write_address(0x20, 0x0F); // Power on, RX mode, 2 byte CRC
-        CE_on; // RX mode
-        uint32_t timeout = millis()+4;
-        while(millis()<timeout) {
-            if(_spi_read_address(0x07) == 0x40) { // data received
-                CE_off;
-                Read_Packet();
-                aid[0] = packet[5];
-                aid[1] = packet[6];
-                aid[2] = packet[7];
-                aid[3] = packet[8];
-                if(packet[9]==1) {
-                    bound=true;
-                    break;
+    for (;;) {
+        if (service && service())
+            break;
+        uint8_t slot, waiting = 0, heard = 0;
+        uint8_t seen[CX10_MAX_CRAFT][4];
+        for (slot = 0; slot < CX10_MAX_CRAFT; slot++) {
+            if (craft[slot].bind == BIND_NONE)
+                continue;
+            waiting++;
+            CE_off;
+            delayMicroseconds(5);
+            _spi_write_address(0x20, CONFIG_TX); // Power on, TX mode
+            _spi_write_address(0x25, 0x02); // set RF channel 2
+            _spi_write_address(0x27, 0x70); // Clear interrupts
+            _spi_write_address(0xe1, 0x00); // Flush TX
+            Write_Packet(slot, 0xaa); // send bind packet
+            delay(2);
+            _spi_write_address(0x27, 0x70); // Clear interrupts
+            _spi_write_address(0x25, 0x02); // Set RF channel
+            _spi_write_address(0x20, CONFIG_RX); // Power on, RX mode
+            CE_on; // RX mode
+            uint32_t listen = micros();
+            for (;;) {
+                if (!readReply()) {
+                    if (micros() - listen >= LISTEN_TIME)
+                        break;
+                    delayMicroseconds(RX_POLL_INTERVAL);
+                    continue;
+                }
+                const uint8_t* aid = packet + 5;
+                if (packet[9] > 1 || (aid[0] & aid[1] & aid[2] & aid[3]) == 0xFF) {
+                    PROFILE_VALUE(PROF_RX_JUNK, packet[9]);
+                    continue;
+                }
+                int8_t owner = aidOwner(aid);
+                if (packet[9] == 1) {
+                    if (owner < 0 || craft[owner].bind != BIND_CONFIRM)
+                        continue;
+                    craft[owner].bind = BIND_NONE;
+                    craft[owner].active = true;
+                    if (bound)
+                        bound(owner);
+                    continue;
                 }
+                if (owner >= 0)
+                    continue;
+                uint8_t i = 0;
+                while (i < heard && memcmp(seen[i], aid, 4))
+                    i++;
+                if (i == heard && heard < CX10_MAX_CRAFT)
+                    memcpy(seen[heard++], aid, 4);
+            }
+            CE_off;
+            for (uint8_t flying = 0; flying < CX10_MAX_CRAFT; flying++) {
+                if (!craft[flying].active)
+                    continue;
+                sendData(flying);
+                delayMicroseconds(AIR_TIME);
+            }
+        }
+        if (!waiting)
+            break;
+        uint8_t next = 0;
+        for (slot = 0; slot < CX10_MAX_CRAFT; slot++) {
+            Craft* c = &craft[slot];
+            if (c->bind == BIND_CONFIRM && ++c->bindRounds > CONFIRM_ROUNDS) {
+                c->bind = BIND_SEARCH;
+                memset(c->aid, 0xFF, 4);
+                changed(c);
+            }
+            if (c->bind == BIND_SEARCH && next < heard) {
+                memcpy(c->aid, seen[next++], 4);
+                changed(c);
+                c->bind = BIND_CONFIRM;
+                c->bindRounds = 0;
             }
         }
-        CE_off;
         digitalWrite(ledPin, bitRead(--counter,3)); //check for 0bxxxx1xxx to flash LED
     }
-    digitalWrite(ledPin, HIGH);//LED on at end of bind
+    bool any = false;
+    for (uint8_t slot = 0; slot < CX10_MAX_CRAFT; slot++)
+        any = any || craft[slot].active;
+    digitalWrite(ledPin, any);//LED on if anything is bound
+    nextPacket = micros();
+}
+
+// Reads the next good reply in the RX FIFO into packet, if there is one.
+// STATUS bits 3:1 give the pipe of the frame at the head of the FIFO, 7
+// when it's empty, so one register read per frame drains it, and RX_DR
+// needs clearing only once it is empty.  Call until false.
+bool CX10::readReply() {
+    for (;;) {
+        uint8_t status = _spi_read_address(0x07);
+        if ((status & 0x0e) == 0x0e) { // RX FIFO empty
+            if (rxBurst) {
+                PROFILE_VALUE(PROF_RX_BURST, rxBurst);
+                rxBurst = 0;
+            }
+            if (status & 0x40)
+                _spi_write_address(0x27, 0x40); // Clear data received
+            return false;
+        }
+        rxBurst++;
+        if (Read_Packet())
+            return true;
+    }
+}
+
+// The slot, bound or binding, with aircraft ID aid, or -1.
+int8_t CX10::aidOwner(const uint8_t* aid) {
+    for (uint8_t slot = 0; slot < CX10_MAX_CRAFT; slot++)
+        if ((craft[slot].active || craft[slot].bind == BIND_CONFIRM) && !memcmp(craft[slot].aid, aid, 4))
+            return slot;
+    return -1;
 }
 
 //-------------------------------
@@ -243,19 +523,22 @@ void CX10::bind_XN297() {
 //XN297 SPI routines
 //-------------------------------
 //-------------------------------
-void CX10::Write_Packet(uint8_t init){//24 bytes total per packet
+#ifdef CX10_NRF24L01
+static void encodeHead(Craft* c, uint8_t type) {
+    const uint8_t msg[HEAD_LENGTH] = { type, c->txid[0], c->txid[1], c->txid[2], c->txid[3],
+                                       c->aid[0], c->aid[1], c->aid[2], c->aid[3] };
+    uint16_t crc = xn297EncodeAddress(c->head, address);
+    for (uint8_t i = 0; i < HEAD_LENGTH; i++)
+        c->head[XN297_ADDR_LEN + i] = xn297Encode(msg[i], i, &crc);
+    c->headCrc = crc;
+    c->headType = type;
+}
+#endif
+
+void CX10::Write_Packet(uint8_t slot, uint8_t init){//24 bytes total per packet
     uint8_t i;
-    CS_off;
-    _spi_write(0xa0); // Write TX payload
-    _spi_write(init); // packet type: 0xaa or 0x55 aka bind packet or data packet)
-    _spi_write(txid[0]); 
-    _spi_write(txid[1]); 
-    _spi_write(txid[2]);
-    _spi_write(txid[3]);
-    _spi_write(aid[0]); // Aircraft ID
-    _spi_write(aid[1]);
-    _spi_write(aid[2]);
-    _spi_write(aid[3]);
+    Craft* c = &craft[slot];
+    uint16_t* Servo_data = c->Servo_data;
     // channels data
     if (Servo_data[5] > 1500)
         bitSet(Servo_data[3], 12);// Set flip mode based on chan6 input
@@ -269,33 +552,70 @@ void CX10::Write_Packet(uint8_t init){//24 bytes total per packet
     packet[6]=lowByte(Servo_data[RUDDER]);
     packet[7]=highByte(Servo_data[RUDDER]);
     sei(); // enable interrupts
-    for(i=0;i<4;i++){
-        _spi_write(packet[0+2*i]);
-        _spi_write(packet[1+2*i]);
-    }
     // Set mode based on chan5 input
     if (Servo_data[4] > 1800)
-        i = 0x02;// mode 3
+        packet[8] = 0x02;// mode 3
     else if (Servo_data[4] > 1300)
-        i = 0x01;// mode 2
+        packet[8] = 0x01;// mode 2
     else
-        i= 0x00;// mode 1
-    
-    _spi_write(i);
-    _spi_write(0x00);
+        packet[8] = 0x00;// mode 1
+    packet[9] = 0x00;
+    CS_off;
+    _spi_write(0xa0); // Write TX payload
+#ifdef CX10_NRF24L01
+    if (c->headType != init)
+        encodeHead(c, init);
+    for(i=0;i<sizeof(c->head);i++)
+        _spi_write(c->head[i]);
+    uint16_t crc = c->headCrc;
+    for(i=0;i<PACKET_LENGTH-HEAD_LENGTH;i++)
+        _spi_write(xn297Encode(packet[i], HEAD_LENGTH + i, &crc));
+    crc = xn297CrcEnd(crc, PACKET_LENGTH);
+    _spi_write(crc >> 8);
+    _spi_write(crc & 0xff);
+#else
+    _spi_write(init); // packet type: 0xaa or 0x55 aka bind packet or data packet)
+    for(i=0;i<4;i++)
+        _spi_write(c->txid[i]);
+    for(i=0;i<4;i++)
+        _spi_write(c->aid[i]); // Aircraft ID
+    for(i=0;i<PACKET_LENGTH-HEAD_LENGTH;i++)
+        _spi_write(packet[i]);
+#endif
     MOSI_off;
     CS_on;
     CE_on; // transmit
 }
 
-void CX10::Read_Packet() {
+// False if the frame fails the XN297 CRC, which is only checked here when
+// emulating; packet is garbage then.
+bool CX10::Read_Packet() {
     uint8_t i;
     CS_off;
     _spi_write(0x61); // Read RX payload
-    for (i=0;i<PACKET_LENGTH;i++) {
-        packet[i]=_spi_read();
+#ifdef CX10_NRF24L01
+    uint16_t crc = rxAddrCrc;
+    for (i=0;i<PACKET_LENGTH;i++)
+        packet[i]=xn297DecodeCrc(_spi_read(), i, &crc);
+    crc = xn297CrcEnd(crc, PACKET_LENGTH);
+    crc ^= _spi_read() << 8;
+    crc ^= _spi_read();
+    CS_on;
+    if (crc) {
+#ifdef PROXY_PROFILE
+        uint8_t bits = 0;
+        for (; crc; crc &= crc - 1)
+            bits++;
+        PROFILE_VALUE(PROF_RX_BAD_CRC, bits);
+#endif
+        return false;
     }
+#else
+    for (i=0;i<PACKET_LENGTH;i++)
+        packet[i]=_spi_read();
     CS_on;
+#endif
+    return true;
 }
 
 void CX10::_spi_write(uint8_t command) {
@@ -1,33 +1,61 @@
 /*
   cx10.h - Library for sending commands to a fleet of CX10 quadcopters
-  
-  TODO:  Actually only currently supports 1 craft, despite API 
-         being designed for more.
+
+  Each slot is one craft, with its own transmitter ID (and so hopping
+  table) and aircraft ID.  Packets to the slots are interleaved, each craft
+  getting one every 6ms.
 */
 #ifndef CX10_h
 #define CX10_h
 
 #include "Arduino.h"
 
+#define CX10_MAX_CRAFT 4
+
+// Uncomment to drive an nRF24L01+ (PA/LNA modules work) in place of an
+// XN297, which is then emulated; see xn297.h.  The wiring is the same.
+// #define CX10_NRF24L01
+
 
 class CX10 {
 public:
   CX10();
   void loop();
-  void bind(int slot);
+  // Marks slot to be bound by the next runBind(), or the one running,
+  // using txid if given or the slot's random one otherwise.
+  void startBind(int slot, const uint8_t* txid = NULL);
+  void cancelBind(int slot);
+  bool binding(int slot);
+  // Binds every marked slot in one go, a craft to each, until none are
+  // left or service returns true, keeping bound slots' packets going.  service is called every round (to keep
+  // the serial port going, and cancel slots whose time is up); bound is
+  // told of each slot as its craft confirms.
+  void runBind(bool (*service)(), void (*bound)(uint8_t slot));
+  // Restores a binding made earlier (maybe by another transmitter).
+  void restore(int slot, const uint8_t* txid, const uint8_t* aid);
+  void release(int slot);
+  bool getBind(int slot, uint8_t* txid, uint8_t* aid);
   void setAileron(int slot, int value);
   void setElevator(int slot, int value);
   void setThrottle(int slot, int value);
   void setRudder(int slot, int value);
+  // Stamp the next packet sent to slot with seq; traced() reports it once it
+  // has gone on air.  Each slot keeps one trace, a later one replacing it.
+  void trace(int slot, uint16_t seq);
+  // A slot whose trace has gone on air, if any; call until false.
+  bool traced(uint8_t* slot, uint16_t* seq, uint32_t* air_us);
   bool healthy;
 private:
   uint8_t _spi_read_address(uint8_t address);
   uint8_t _spi_read();
   void _spi_write_address(uint8_t address, uint8_t data);
   void _spi_write(uint8_t command);
-  void Read_Packet();
-  void Write_Packet(uint8_t init);
-  void bind_XN297();
+  bool Read_Packet();
+  void Write_Packet(uint8_t slot, uint8_t init);
+  void sendData(uint8_t slot);
+  bool readReply();
+  int8_t aidOwner(const uint8_t* aid);
+  void setTxid(uint8_t slot, const uint8_t* id);
 
 
 };
@@ -1,8 +1,20 @@
 #include "CX10.h"
+#include "protocol.h"
+#include "profile.h"
 
 CX10* transmitter;
 
-void setup()                   
+// Binding blocks, so it's run from loop() rather than in the middle of
+// parsing a frame.  Every slot asked for is bound in the one run, and
+// slots asked for while it runs join in.
+bool bootBind;     // the bind in setup() is running
+bool hostInCharge; // a binding command has arrived, so linkd manages the slots
+uint32_t bindDeadline[CX10_MAX_CRAFT]; // millis(), 0 for none
+
+bool bindService();
+void bindDone(uint8_t slot);
+
+void setup()
 {
   Serial.begin(115200);
   Serial.println("Arduino alive");
@@ -13,34 +25,229 @@ void setup()
     Serial.println("XN297 alive");
   else
     Serial.println("XN297 is dead");
-  
-  transmitter->bind(0);
-  Serial.println("found a craft!");
-  
+
+  // Bind slot 0 as before, unless a host starts sending commands, in which
+  // case it's in charge of binding.
+  bootBind = true;
+  transmitter->startBind(0);
+  transmitter->runBind(bindService, bindDone);
+  bootBind = false;
+
   // TODO:  auto-arm  (throttle from 0 -> 1000 -> 0 again)
 }
 
 
-uint16_t read16() {  // assumes MSB first.
-  uint16_t result = Serial.read();
-  result = (result << 8) + Serial.read();
+uint16_t get16(const uint8_t* p) {  // assumes MSB first.
+  return (p[0] << 8) | p[1];
+}
+
+void put16(uint8_t* p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+void put32(uint8_t* p, uint32_t v) {
+  put16(p, v >> 16);
+  put16(p + 2, v);
+}
+
+void sendTelemetry(uint8_t type, const uint8_t* payload, uint8_t len) {
+  uint8_t csum = type ^ len;
+  Serial.write(TLM_SYNC);
+  Serial.write(type);
+  Serial.write(len);
+  for (uint8_t i = 0; i < len; i++)
+    csum ^= payload[i];
+  Serial.write(payload, len);
+  Serial.write(csum);
+}
+
+void setSticks(uint8_t slot, const uint8_t* p) {
+  transmitter->setAileron(slot, get16(p));
+  transmitter->setElevator(slot, get16(p + 2));
+  transmitter->setThrottle(slot, get16(p + 4));
+  transmitter->setRudder(slot, get16(p + 6));
+}
+
+// When each slot's latest CMD_TRACE_STICKS arrived, echoed once it has
+// gone on air.
+uint32_t traceRx[CX10_MAX_CRAFT];
+
+void sendBound(uint8_t slot) {
+  uint8_t p[TLM_BOUND_LEN];
+  p[0] = slot;
+  p[1] = CX10_MAX_CRAFT;
+  p[2] = transmitter->getBind(slot, p + 3, p + 7) ? BOUND_OK : BOUND_FREE;
+  if (transmitter->binding(slot))
+    p[2] = BOUND_BINDING;
+  sendTelemetry(TLM_BOUND, p, sizeof(p));
+}
+
+void command(uint8_t cmd, const uint8_t* p, uint8_t len) {
+  uint32_t now = micros();
+  // Only a host managing bindings (linkd) takes over from the boot bind;
+  // sticks, traces and pings come straight from the Lua scripts too.
+  if (cmd == CMD_BIND || cmd == CMD_RESTORE || cmd == CMD_RELEASE || cmd == CMD_STATUS)
+    hostInCharge = true;
+  switch (cmd) {
+  case CMD_TRACE_STICKS:
+    if (len != CMD_TRACE_STICKS_LEN)
+      break;
+    if (p[0] < CX10_MAX_CRAFT)
+      traceRx[p[0]] = now;
+    setSticks(p[0], p + 3);
+    transmitter->trace(p[0], get16(p + 1));
+    break;
+  case CMD_PING: {
+    if (len != CMD_PING_LEN)
+      break;
+    uint8_t pong[TLM_PONG_LEN];
+    pong[0] = p[0];
+    pong[1] = p[1];
+    put32(pong + 2, now);
+    put32(pong + 6, micros());
+    sendTelemetry(TLM_PONG, pong, sizeof(pong));
+    break;
+  }
+  case CMD_PROFILE:
+    profileSnapshot(sendTelemetry);
+    break;
+  case CMD_STICKS:
+    if (len == CMD_STICKS_LEN)
+      setSticks(p[0], p + 1);
+    break;
+  case CMD_BIND:
+    if (len != CMD_BIND_LEN || p[0] >= CX10_MAX_CRAFT)
+      break;
+    if (p[0] == 0)
+      bootBind = false; // the host wants slot 0 bound after all
+    bindDeadline[p[0]] = p[5] ? (millis() + p[5] * 1000UL) | 1 : 0; // never 0 if set
+    transmitter->startBind(p[0], p + 1);
+    break;
+  case CMD_RESTORE:
+    if (len != CMD_RESTORE_LEN || p[0] >= CX10_MAX_CRAFT)
+      break;
+    transmitter->restore(p[0], p + 1, p + 5);
+    sendBound(p[0]);
+    break;
+  case CMD_RELEASE:
+    if (len != CMD_RELEASE_LEN || p[0] >= CX10_MAX_CRAFT)
+      break;
+    transmitter->release(p[0]);
+    sendBound(p[0]);
+    break;
+  case CMD_STATUS:
+    for (uint8_t slot = 0; slot < CX10_MAX_CRAFT; slot++)
+      sendBound(slot);
+    break;
+  }
+}
+
+// Incoming frame, starting with the byte after PROTO_SYNC.
+uint8_t frame[PROTO_MAX_PAYLOAD + 3];
+uint8_t frameLen;
+bool inFrame;
+uint16_t hunted; // bytes skipped looking for PROTO_SYNC
+
+void receive(uint8_t c) {
+  if (!inFrame) {
+    // This acts as a start marker, and in the common case
+    // will cause a lost byte to be eventually resynced.
+    if (c == PROTO_SYNC) {
+      if (hunted)
+        PROFILE_VALUE(PROF_RESYNC, hunted);
+      hunted = 0;
+      inFrame = true;
+      frameLen = 0;
+    } else {
+      hunted++;
+    }
+    return;
+  }
+  frame[frameLen++] = c;
+  if (frame[0] < PROTO_CMD_MIN) {
+    if (frameLen == PROTO_LEGACY_LEN) {
+      inFrame = false;
+      setSticks(0, frame);
+      Serial.print(get16(frame + 4));
+    }
+    return;
+  }
+  if (frameLen < 2)
+    return;
+  if (frame[1] > PROTO_MAX_PAYLOAD) {
+    inFrame = false;
+    PROFILE_VALUE(PROF_BAD_CSUM, frameLen + 1);
+    return;
+  }
+  if (frameLen < frame[1] + 3)
+    return;
+  inFrame = false;
+  uint8_t csum = 0;
+  for (uint8_t i = 0; i < frameLen - 1; i++)
+    csum ^= frame[i];
+  if (csum == frame[frameLen - 1])
+    command(frame[0], frame + 2, frame[1]);
+  else
+    PROFILE_VALUE(PROF_BAD_CSUM, frameLen + 1);
+}
+
+// Keeps the serial port serviced while a bind runs, and gives up on slots
+// whose time is up.  The bind at boot is given up once the host is
+// heard from.
+bool bindService() {
+  while (Serial.available())
+    receive(Serial.read());
+  if (bootBind && hostInCharge) {
+    bootBind = false;
+    transmitter->cancelBind(0);
+  }
+  for (uint8_t slot = 0; slot < CX10_MAX_CRAFT; slot++) {
+    if (!transmitter->binding(slot) || !bindDeadline[slot] || (int32_t)(millis() - bindDeadline[slot]) <= 0)
+      continue;
+    transmitter->cancelBind(slot);
+    bindDeadline[slot] = 0;
+    sendBound(slot);
+  }
+  return false;
+}
+
+void bindDone(uint8_t slot) {
+  bindDeadline[slot] = 0;
+  if (bootBind)
+    Serial.println("found a craft!");
+  else
+    sendBound(slot);
 }
 
 void loop()
 {
+#ifdef PROXY_PROFILE
+  static uint32_t lastLoop;
+  uint32_t now = micros();
+  if (lastLoop)
+    PROFILE_VALUE(PROF_LOOP, now - lastLoop);
+  lastLoop = now;
+#endif
   transmitter->loop();
-  //Serial.println("hello");
-  if (Serial.available() >= 8) {
-    // This acts as a start marker, and in the common case
-    // will cause a lost byte to be eventually resynced.
-    if (Serial.read() == 255) {
-      //digitalWrite(13, LOW);
-      transmitter->setAileron(0, read16());
-      transmitter->setElevator(0, read16());
-      uint16_t th = read16();
-      transmitter->setThrottle(0, th);
-      transmitter->setRudder(0, read16());
-      Serial.print(th);
+  while (Serial.available())
+    receive(Serial.read());
+
+  for (uint8_t slot = 0; slot < CX10_MAX_CRAFT; slot++)
+    if (transmitter->binding(slot)) {
+      transmitter->runBind(bindService, bindDone);
+      break;
     }
+
+  uint8_t slot;
+  uint16_t seq;
+  uint32_t air;
+  while (transmitter->traced(&slot, &seq, &air)) {
+    uint8_t p[TLM_TRACE_LEN];
+    p[0] = slot;
+    put16(p + 1, seq);
+    put32(p + 3, traceRx[slot]);
+    put32(p + 7, air);
+    sendTelemetry(TLM_TRACE, p, sizeof(p));
   }
 };
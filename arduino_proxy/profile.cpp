@@ -0,0 +1,57 @@
+#include "profile.h"
+
+#ifdef PROXY_PROFILE
+
+ProfileCounter profileCounters[PROF_COUNTERS];
+
+void profileRecord(uint8_t id, uint32_t v) {
+  ProfileCounter* c = &profileCounters[id];
+  uint16_t value = v > 0xFFFF ? 0xFFFF : v;
+  if (!c->count || value < c->min)
+    c->min = value;
+  if (value > c->max)
+    c->max = value;
+  if (c->count != 0xFFFFFFFF)
+    c->count++;
+  c->sum = c->sum > 0xFFFFFFFF - value ? 0xFFFFFFFF : c->sum + value;
+  uint8_t b = 0;
+  uint16_t limit = 16;
+  while (b < PROF_BUCKETS - 1 && value >= limit) {
+    b++;
+    limit <<= 1;
+  }
+  if (c->buckets[b] != 0xFFFF)
+    c->buckets[b]++;
+}
+
+#endif
+
+void profileSnapshot(void (*send)(uint8_t type, const uint8_t* payload, uint8_t len)) {
+  uint8_t p[TLM_PROFILE_LEN];
+#ifdef PROXY_PROFILE
+  for (uint8_t id = 0; id < PROF_COUNTERS; id++) {
+    const ProfileCounter* c = &profileCounters[id];
+    p[0] = id;
+    p[1] = c->count >> 24;
+    p[2] = c->count >> 16;
+    p[3] = c->count >> 8;
+    p[4] = c->count;
+    p[5] = c->min >> 8;
+    p[6] = c->min;
+    p[7] = c->max >> 8;
+    p[8] = c->max;
+    p[9] = c->sum >> 24;
+    p[10] = c->sum >> 16;
+    p[11] = c->sum >> 8;
+    p[12] = c->sum;
+    for (uint8_t b = 0; b < PROF_BUCKETS; b++) {
+      p[13 + 2 * b] = c->buckets[b] >> 8;
+      p[14 + 2 * b] = c->buckets[b];
+    }
+    send(TLM_PROFILE, p, TLM_PROFILE_LEN);
+  }
+  memset(profileCounters, 0, sizeof(profileCounters));
+#endif
+  p[0] = PROF_END;
+  send(TLM_PROFILE, p, 1);
+}
@@ -0,0 +1,47 @@
+/*
+  profile.h - Low overhead counters for the hot paths, read back over
+  serial with CMD_PROFILE (see host/proxyprof).
+
+  Uncomment PROXY_PROFILE to enable.  Without it every macro compiles to
+  nothing and the counters take no RAM.
+*/
+#ifndef profile_h
+#define profile_h
+
+#include "Arduino.h"
+#include "protocol.h"
+
+// #define PROXY_PROFILE
+
+#ifdef PROXY_PROFILE
+
+// Counts and sums stop at their maximum, as does each bucket, which
+// proxyprof takes to mean saturated.
+struct ProfileCounter {
+  uint32_t count;
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;
+  uint16_t buckets[PROF_BUCKETS];
+};
+
+extern ProfileCounter profileCounters[PROF_COUNTERS];
+void profileRecord(uint8_t id, uint32_t value); // clamps to 0xFFFF
+
+#define PROFILE_START(var)   uint32_t var = micros()
+#define PROFILE_END(id, var) profileRecord(id, micros() - (var))
+#define PROFILE_VALUE(id, v) profileRecord(id, v)
+
+#else
+
+#define PROFILE_START(var)
+#define PROFILE_END(id, var) do {} while (0)
+#define PROFILE_VALUE(id, v) do {} while (0)
+
+#endif
+
+// Sends every counter as a TLM_PROFILE frame, then PROF_END, and resets
+// them.  Only the end marker is sent when profiling is compiled out.
+void profileSnapshot(void (*send)(uint8_t type, const uint8_t* payload, uint8_t len));
+
+#endif
@@ -0,0 +1,84 @@
+/*
+  protocol.h - Serial protocol between the host and arduino_proxy.
+
+  Shared by the sketch and the host tools, so keep it plain C.
+
+  Host -> Arduino
+    Legacy stick frame (slot 0):
+      0xFF ail ele thr rud                    (u16 each, MSB first, 0-1000)
+    Extended frame:
+      0xFF cmd len payload[len] csum          (cmd >= 0x80)
+    A legacy frame's first byte is the aileron high byte, which is never
+    above 0x03, so the two can't be confused.
+
+  Arduino -> Host
+    Plain ASCII text lines (debug chatter, never has the top bit set), and
+    binary telemetry frames:
+      0xA5 type len payload[len] csum
+
+  csum is the XOR of cmd/type, len and every payload byte.  All multi-byte
+  fields are MSB first.
+*/
+#ifndef protocol_h
+#define protocol_h
+
+#define PROTO_SYNC       0xFF  // host -> arduino frame start
+#define PROTO_CMD_MIN    0x80  // anything below this after PROTO_SYNC is a legacy stick frame
+#define PROTO_LEGACY_LEN 8
+#define PROTO_MAX_PAYLOAD 32
+
+#define TLM_SYNC         0xA5  // arduino -> host frame start
+
+// Host -> Arduino commands
+#define CMD_TRACE_STICKS 0x80  // slot u8, seq u16, ail, ele, thr, rud u16
+#define CMD_TRACE_STICKS_LEN 11
+#define CMD_PING         0x81  // seq u16; answered with TLM_PONG
+#define CMD_PING_LEN     2
+#define CMD_PROFILE      0x82  // no payload; snapshot and reset the profile counters
+#define CMD_STICKS       0x83  // slot u8, ail, ele, thr, rud u16
+#define CMD_STICKS_LEN   9
+#define CMD_BIND         0x84  // slot u8, txid[4], timeout u8 (seconds, 0 = forever); TLM_BOUND when done
+#define CMD_BIND_LEN     6
+#define CMD_RESTORE      0x85  // slot u8, txid[4], aid[4]; take over a craft bound elsewhere
+#define CMD_RESTORE_LEN  9
+#define CMD_RELEASE      0x86  // slot u8; stop sending to it
+#define CMD_RELEASE_LEN  1
+#define CMD_STATUS       0x87  // no payload; TLM_BOUND for every slot
+
+// Host-only commands.  These are consumed by linkd and never reach the
+// serial port.
+#define CMD_HOST_MIN     0xC0
+#define CMD_TRACE_MARK   0xC0  // seq u16, capture/inference/controller age u32 (us before enqueue)
+#define CMD_TRACE_MARK_LEN 14
+#define CMD_HOST_BIND    0xC1  // craft u8: bind a new craft to this global ID on any node
+#define CMD_HOST_BIND_LEN 1
+
+// Arduino -> Host telemetry
+#define TLM_TRACE        0x01  // slot u8, seq u16, rx_us u32, air_us u32 (Arduino micros())
+#define TLM_TRACE_LEN    11
+#define TLM_PONG         0x02  // seq u16, rx_us u32 (ping parsed), tx_us u32 (pong queued)
+#define TLM_PONG_LEN     10
+#define TLM_PROFILE      0x03  // id u8, count u32, min u16, max u16, sum u32, buckets u16[PROF_BUCKETS]
+#define TLM_PROFILE_LEN  (13 + 2 * PROF_BUCKETS)
+#define PROF_END         0xFF  // id of the one byte TLM_PROFILE closing a snapshot
+#define TLM_BOUND        0x04  // slot u8, slots u8, state u8, txid[4], aid[4]
+#define TLM_BOUND_LEN    11
+#define BOUND_FREE       0
+#define BOUND_OK         1
+#define BOUND_BINDING    2     // a CMD_BIND for it is queued or running
+
+// Profile counters (see profile.h).  Values are microseconds unless noted.
+enum {
+    PROF_LATE,          // how late each packet went out relative to nextPacket
+    PROF_WRITE_PACKET,  // time spent bit-banging Write_Packet
+    PROF_LOOP,          // time between calls to the sketch's loop()
+    PROF_RESYNC,        // bytes dropped each time the serial parser lost sync
+    PROF_BAD_CSUM,      // length of each frame dropped for a bad checksum
+    PROF_RX_BURST,      // radio frames drained from the RX FIFO at each poll that found any
+    PROF_RX_BAD_CRC,    // bits wrong in the CRC of each radio frame that failed it (emulated XN297 only)
+    PROF_RX_JUNK,       // flag byte of each radio frame with a good CRC that is no bind reply
+    PROF_COUNTERS
+};
+#define PROF_BUCKETS     8     // bucket i counts values below 16 << i, the last everything else
+
+#endif
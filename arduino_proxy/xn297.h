@@ -0,0 +1,60 @@
+/*
+  xn297.h - XN297 emulation for nRF24L01+ modules, after the one in
+  buspirate/nrf24l01.c and goebish's gist.
+
+  The nRF24L01 is given the XN297 preamble as its address and sends
+  everything after it as payload: the XN297 address, then the payload bit
+  reversed, all scrambled with a fixed sequence and followed by the XN297's
+  CRC.  Only 5 byte addresses are handled, which is all the CX-10 uses.
+
+  Everything is table driven so a packet costs a couple of lookups per
+  byte, and a caller that sends the same leading bytes every time can
+  encode them once and carry on from the saved CRC.  Received packets are
+  decoded the same way, the nRF24L01 reading XN297_CRC_LEN more bytes than
+  the payload so the CRC can be checked here.
+*/
+#ifndef xn297_h
+#define xn297_h
+
+#include "Arduino.h"
+
+#define XN297_ADDR_LEN 5
+#define XN297_CRC_LEN 2
+#define XN297_CRC_INIT 0xb5d2
+
+extern const uint8_t xn297Preamble[XN297_ADDR_LEN];
+extern const uint8_t xn297Scramble[];
+extern const uint8_t xn297Reverse[256];
+extern const uint16_t xn297CrcTable[256];
+
+// The nRF24L01 RX address that matches what an XN297 sends to addr.
+void xn297RxAddress(uint8_t* out, const uint8_t* addr);
+// Encodes addr into out, returning the CRC so far.
+uint16_t xn297EncodeAddress(uint8_t* out, const uint8_t* addr);
+// Final CRC for a payload of len bytes.
+uint16_t xn297CrcEnd(uint16_t crc, uint8_t len);
+
+// The CRC covers the bytes as sent: address and payload encoded.
+static inline uint16_t xn297Crc(uint16_t crc, uint8_t sent) {
+  return (crc << 8) ^ pgm_read_word(&xn297CrcTable[(crc >> 8) ^ sent]);
+}
+
+// Encodes payload byte b, which is at offset pos in the payload.
+static inline uint8_t xn297Encode(uint8_t b, uint8_t pos, uint16_t* crc) {
+  uint8_t out = pgm_read_byte(&xn297Reverse[b]) ^ pgm_read_byte(&xn297Scramble[XN297_ADDR_LEN + pos]);
+  *crc = xn297Crc(*crc, out);
+  return out;
+}
+
+static inline uint8_t xn297Decode(uint8_t b, uint8_t pos) {
+  return pgm_read_byte(&xn297Reverse[b ^ pgm_read_byte(&xn297Scramble[XN297_ADDR_LEN + pos])]);
+}
+
+// Decodes received byte b as xn297Decode, adding it to the CRC, which
+// starts from xn297EncodeAddress() of the address it was sent to.
+static inline uint8_t xn297DecodeCrc(uint8_t b, uint8_t pos, uint16_t* crc) {
+  *crc = xn297Crc(*crc, b);
+  return xn297Decode(b, pos);
+}
+
+#endif
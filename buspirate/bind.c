@@ -69,6 +69,7 @@ static const u8 rx_tx_addr[] = {0xcc, 0xcc, 0xcc, 0xcc, 0xcc};
 static u8 current_chan = 0;
 static u8 txid[4];
 static u8 rf_chans[4];
+static u8 aid[4];
 
 enum {
     CX10_INIT1 = 0,
@@ -181,7 +182,7 @@ static void cx10_init()
     NRF24L01_WriteReg(NRF24L01_01_EN_AA, 0x00);      // No Auto Acknowldgement on all data pipes
     NRF24L01_WriteReg(NRF24L01_02_EN_RXADDR, 0x01);  // Enable data pipe 0 only
     NRF24L01_WriteReg(NRF24L01_04_SETUP_RETR,0);     // No auto retransmits
-    NRF24L01_WriteReg(NRF24L01_11_RX_PW_P0, packet_size); // bytes of data payload for rx pipe 1 
+    XN297_SetRxPayloadWidth(packet_size);            // bytes of data payload for rx pipe 0, and CRC if emulated
     NRF24L01_WriteReg(NRF24L01_05_RF_CH, RF_BIND_CHANNEL);
     NRF24L01_WriteReg(NRF24L01_06_RF_SETUP, 0x07);
     NRF24L01_SetBitrate(NRF24L01_BR_1M);             // 1Mbps
@@ -201,6 +202,9 @@ static void cx10_init()
 static u16 cx10_callback()
 {
     static int try = 0;
+    static int rx_bad_crc = 0, rx_junk = 0;
+    u8 reply[CX10A_PACKET_SIZE];
+    u8 status;
     try++;
     switch (phase) {
     case CX10_INIT1:
@@ -218,15 +222,32 @@ static u16 cx10_callback()
         break;
         
     case CX10_BIND2:
-        if( (NRF24L01_ReadReg(NRF24L01_07_STATUS) & 0xF)==0) { // RX fifo data ready  //& BV(NRF24L01_07_RX_DR)
-            printf("reply!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-            XN297_ReadPayload(packet, packet_size);
-            // NRF24L01_SetTxRxMode(TXRX_OFF);
-            if(packet[9] == 1) {
-                NRF24L01_SetTxRxMode(TX_EN);
-                phase = CX10_BIND1;
-                while(1);
+        status = NRF24L01_ReadReg(NRF24L01_07_STATUS);
+        if ((status & 0x0E) != 0x0E) { // RX_P_NO is 7 when the RX FIFO is empty
+            // Drain the FIFO: STATUS after each read says whether there is more.
+            while ((status & 0x0E) != 0x0E && phase == CX10_BIND2) {
+                if (!XN297_ReadPayload(reply, packet_size)) {
+                    printf("bad crc (%d)\n", ++rx_bad_crc);
+                } else if (reply[9] > 1 || (reply[5] & reply[6] & reply[7] & reply[8]) == 0xFF) {
+                    printf("junk reply (%d)\n", ++rx_junk);
+                } else {
+                    printf("reply from %02x%02x%02x%02x\n", reply[5], reply[6], reply[7], reply[8]);
+                    // Its aircraft id goes back out in the next bind
+                    // packet.  Take the first craft to answer and ignore
+                    // the rest: anything else bound is another craft
+                    // answering too.
+                    if (aid[0] == 0xFF && aid[1] == 0xFF && aid[2] == 0xFF && aid[3] == 0xFF)
+                        memcpy(aid, &reply[5], 4);
+                    if(reply[9] == 1 && memcmp(aid, &reply[5], 4) == 0) {
+                        printf("bound to %02x%02x%02x%02x\n", aid[0], aid[1], aid[2], aid[3]);
+                        NRF24L01_SetTxRxMode(TX_EN);
+                        phase = CX10_DATA;
+                    }
+                }
+                status = NRF24L01_ReadReg(NRF24L01_07_STATUS);
             }
+            NRF24L01_WriteReg(NRF24L01_07_STATUS, BV(NRF24L01_07_RX_DR));
+            memcpy(&packet[5], aid, 4);
             
         } else {
             //NRF24L01_SetTxRxMode(TXRX_OFF);
@@ -235,7 +256,7 @@ static u16 cx10_callback()
 		    NRF24L01_SetTxRxMode(TX_EN);
 		    if (try%300 == 0) {
 		      for(u8 i=0; i<4; i++)
-		        packet[5+i] = 0xFF; // clear aircraft id
+		        packet[5+i] = aid[i] = 0xFF; // clear aircraft id
 		    }
 		    send_packet(1);
 		    //usleep(300);
@@ -283,7 +304,7 @@ static void initialize()
     bind_phase = CX10_BIND2;
     bind_counter=0;
     for(u8 i=0; i<4; i++)
-        packet[5+i] = 0xFF; // clear aircraft id
+        packet[5+i] = aid[i] = 0xFF; // clear aircraft id
     packet[9] = 0;
 
 
@@ -104,6 +104,8 @@ void XN297_SetTXAddr(const u8* addr, int len);
 void XN297_SetRXAddr(const u8* addr, int len);
 void XN297_Configure(u8 flags);
 u8 XN297_WritePayload(u8* msg, int len);
+void XN297_SetRxPayloadWidth(u8 len);
+// 0 if the emulated CRC check failed; see nrf24l01.c.
 u8 XN297_ReadPayload(u8* msg, int len);
 
 #endif
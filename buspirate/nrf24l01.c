@@ -375,13 +375,40 @@ u8 XN297_WritePayload(u8* msg, int len)
 }
 
 
+// Emulating, the CRC comes after the payload, so read it too.
+void XN297_SetRxPayloadWidth(u8 len)
+{
+    NRF24L01_WriteReg(NRF24L01_11_RX_PW_P0, is_xn297 ? len : len + 2);
+}
+
+
+// Returns 0 if the CRC is checked (emulating, with EN_CRC configured) and
+// fails, in which case *msg is left alone.  RX_PW must have been set with
+// XN297_SetRxPayloadWidth().
 u8 XN297_ReadPayload(u8* msg, int len)
 {
-    // TODO: if xn297_crc==1, check CRC before filling *msg 
-    u8 res = NRF24L01_ReadPayload(msg, len);
+    u8 buf[32 + 2];
+    if (is_xn297) {
+        NRF24L01_ReadPayload(msg, len);
+        return 1;
+    }
+    NRF24L01_ReadPayload(buf, len + 2);
+    if (xn297_crc) {
+        // Over the address and payload as sent, as in XN297_WritePayload.
+        u16 crc = initial;
+        for (int i = 0; i < xn297_addr_len; ++i) {
+            crc = crc16_update(crc, xn297_rx_addr[xn297_addr_len-i-1] ^ xn297_scramble[i]);
+        }
+        for (int i = 0; i < len; ++i) {
+            crc = crc16_update(crc, buf[i]);
+        }
+        crc ^= xn297_crc_xorout[xn297_addr_len - 3 + len];
+        if (buf[len] != (crc >> 8) || buf[len + 1] != (crc & 0xff))
+            return 0;
+    }
     for(u8 i=0; i<len; i++)
-      msg[i] = bit_reverse(msg[i])^bit_reverse(xn297_scramble[i+xn297_addr_len]);
-    return res;
+      msg[i] = bit_reverse(buf[i]^xn297_scramble[i+xn297_addr_len]);
+    return 1;
 }
 
 
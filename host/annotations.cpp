@@ -0,0 +1,255 @@
+#include "annotations.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Structs are written as they are in memory, so this assumes a little
+// endian host, as x86 and ARM Linux are.
+
+Annotations::Annotations()
+    : _journal(-1), _map(NULL), _mapSize(0), _records(NULL), _mapped(0), _frames(0) {
+}
+
+Annotations::~Annotations() {
+    close();
+}
+
+void Annotations::close() {
+    if (_map)
+        munmap((void*)_map, _mapSize);
+    if (_journal >= 0)
+        ::close(_journal);
+    _map = NULL;
+    _records = NULL;
+    _journal = -1;
+    _mapSize = _mapped = _frames = 0;
+    _changed.clear();
+}
+
+bool Annotations::open(const char* path, bool writable) {
+    close();
+    _path = path;
+    uint32_t folded = 0;
+    int fd = ::open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        const AnnotationsHeader* h = NULL;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= offsetof(AnnotationsHeader, folded)) {
+            _mapSize = st.st_size;
+            void* m = mmap(NULL, _mapSize, PROT_READ, MAP_SHARED, fd, 0);
+            if (m != MAP_FAILED) {
+                _map = (const char*)m;
+                h = (const AnnotationsHeader*)_map;
+            }
+        }
+        ::close(fd);
+        size_t hsize = h && h->version == 1 ? offsetof(AnnotationsHeader, folded) : sizeof(*h);
+        if (!h || memcmp(h->magic, ANNOTATIONS_MAGIC, 8) != 0
+            || (h->version != 1 && h->version != ANNOTATIONS_VERSION)
+            || h->recordSize != sizeof(FrameLabels) || h->maxPoints != FrameLabels::MAX_POINTS
+            || _mapSize < hsize + (size_t)h->frames * h->recordSize) {
+            fprintf(stderr, "%s: not an annotation store\n", path);
+            close();
+            return false;
+        }
+        if (h->version != 1)
+            folded = h->folded;
+        _records = (const FrameLabels*)(_map + hsize);
+        _mapped = _frames = h->frames;
+    } else if (!writable) {
+        perror(path);
+        return false;
+    }
+
+    std::string journal = _path + ".journal";
+    _journal = ::open(journal.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (_journal < 0) {
+        if (!writable)
+            return true; // nothing added since the last compact
+        perror(journal.c_str());
+        close();
+        return false;
+    }
+    // The journal only shrinks when compact() empties it, so if it is
+    // shorter than what the records hold it has been emptied since.
+    struct stat st;
+    off_t good = 0;
+    if (fstat(_journal, &st) == 0 && st.st_size >= (off_t)folded)
+        good = folded;
+    else if (writable && !_resetFolded()) {
+        close();
+        return false;
+    }
+    if (lseek(_journal, good, SEEK_SET) != good) {
+        perror(journal.c_str());
+        close();
+        return false;
+    }
+    std::vector<JournalEntry> entries(4096);
+    ssize_t n;
+    while ((n = read(_journal, &entries[0], entries.size() * sizeof(JournalEntry))) > 0) {
+        size_t whole = n / sizeof(JournalEntry);
+        for (size_t i = 0; i < whole; i++)
+            _apply(entries[i]);
+        good += whole * sizeof(JournalEntry);
+        if (whole * sizeof(JournalEntry) != (size_t)n)
+            break;
+    }
+    if (!writable) {
+        ::close(_journal);
+        _journal = -1;
+        return true;
+    }
+    // Drop any entry cut short by a crash, so appends stay aligned.
+    if (ftruncate(_journal, good) != 0 || lseek(_journal, good, SEEK_SET) != good) {
+        perror(journal.c_str());
+        close();
+        return false;
+    }
+    return true;
+}
+
+// Zeroes the store's count of folded journal bytes, before anything is
+// appended to the emptied journal.
+bool Annotations::_resetFolded() {
+    int fd = ::open(_path.c_str(), O_WRONLY);
+    uint32_t zero = 0;
+    bool ok = fd >= 0
+              && pwrite(fd, &zero, sizeof(zero), offsetof(AnnotationsHeader, folded)) == sizeof(zero);
+    if (fd >= 0)
+        ok = ::close(fd) == 0 && ok;
+    if (!ok)
+        perror(_path.c_str());
+    return ok;
+}
+
+const FrameLabels* Annotations::frame(uint32_t frame) const {
+    std::unordered_map<uint32_t, FrameLabels>::const_iterator it = _changed.find(frame);
+    if (it != _changed.end())
+        return &it->second;
+    if (frame >= _mapped)
+        return NULL;
+    const FrameLabels* l = _records + frame;
+    return l->flags || l->count ? l : NULL;
+}
+
+void Annotations::_apply(const JournalEntry& e) {
+    std::unordered_map<uint32_t, FrameLabels>::iterator it = _changed.find(e.frame);
+    if (it == _changed.end()) {
+        const FrameLabels* old = frame(e.frame);
+        FrameLabels l;
+        if (old)
+            l = *old;
+        else
+            memset(&l, 0, sizeof(l));
+        it = _changed.insert(std::make_pair(e.frame, l)).first;
+    }
+    FrameLabels& l = it->second;
+    l.flags = e.flags;
+    if (e.op == JOURNAL_CLEAR)
+        l.count = 0;
+    else if (e.op == JOURNAL_ADD && l.count < FrameLabels::MAX_POINTS)
+        l.points[l.count++] = e.point;
+    if (e.frame >= _frames)
+        _frames = e.frame + 1;
+}
+
+bool Annotations::_append(const JournalEntry& e) {
+    if (_journal < 0)
+        return false;
+    if (::write(_journal, &e, sizeof(e)) != sizeof(e)) {
+        perror("journal");
+        return false;
+    }
+    _apply(e);
+    return true;
+}
+
+static uint16_t flagsOf(const FrameLabels* l) {
+    return l ? l->flags : 0;
+}
+
+bool Annotations::add(uint32_t frame, const LabelPoint& point) {
+    const FrameLabels* l = this->frame(frame);
+    if (l && l->count >= FrameLabels::MAX_POINTS)
+        return false;
+    JournalEntry e = { frame, JOURNAL_ADD, (uint16_t)(flagsOf(l) | FRAME_LABELLED), point };
+    return _append(e);
+}
+
+bool Annotations::clear(uint32_t frame) {
+    JournalEntry e;
+    memset(&e, 0, sizeof(e));
+    e.frame = frame;
+    e.op = JOURNAL_CLEAR;
+    e.flags = flagsOf(this->frame(frame)) | FRAME_LABELLED;
+    return _append(e);
+}
+
+bool Annotations::setFlags(uint32_t frame, uint16_t flags) {
+    JournalEntry e;
+    memset(&e, 0, sizeof(e));
+    e.frame = frame;
+    e.op = JOURNAL_FLAGS;
+    e.flags = flags;
+    return _append(e);
+}
+
+bool Annotations::write(const char* path, const FrameLabels* labels, uint32_t frames,
+                        uint32_t folded) {
+    std::string tmp = std::string(path) + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        perror(tmp.c_str());
+        return false;
+    }
+    AnnotationsHeader h;
+    memcpy(h.magic, ANNOTATIONS_MAGIC, 8);
+    h.version = ANNOTATIONS_VERSION;
+    h.recordSize = sizeof(FrameLabels);
+    h.frames = frames;
+    h.maxPoints = FrameLabels::MAX_POINTS;
+    h.folded = folded;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+              && fwrite(labels, sizeof(FrameLabels), frames, f) == frames;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path) != 0) {
+        perror(path);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Annotations::compact() {
+    if (_journal < 0)
+        return false;
+    std::vector<FrameLabels> all(_frames);
+    memset(all.data(), 0, all.size() * sizeof(FrameLabels));
+    for (uint32_t i = 0; i < _frames; i++) {
+        const FrameLabels* l = frame(i);
+        if (l)
+            all[i] = *l;
+    }
+    // The new store says the whole journal is in it, so a crash before the
+    // journal is emptied doesn't replay it over its own points.
+    off_t end = lseek(_journal, 0, SEEK_END);
+    if (end < 0) {
+        perror("journal");
+        return false;
+    }
+    if (!write(_path.c_str(), all.data(), _frames, end))
+        return false;
+    if (ftruncate(_journal, 0) != 0) {
+        perror("journal");
+        return false;
+    }
+    std::string path = _path;
+    return open(path.c_str(), true);
+}
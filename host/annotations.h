@@ -0,0 +1,125 @@
+/*
+  annotations.h - Where the craft are in each training frame.
+
+  The store is a header followed by one fixed size record per frame, so
+  it is memory mapped and a frame's labels are found by indexing, however
+  many there are.  New labels don't rewrite it: each is appended to a
+  journal beside it (path.journal) and replayed over the mapped records on
+  open.  compact() folds the journal in.  vision/annotations.lua reads and
+  appends the same files.
+
+  compact() can't replace the store and empty the journal in one step, so
+  the header records how many journal bytes its records already hold and
+  open skips them.  A journal shorter than that has been emptied since,
+  and the count is zeroed before anything more is appended.
+
+  All fields are little endian.
+
+    header   "QCANNOT1", uint32 version, uint32 record size, uint32 frames,
+             uint32 points per record, uint32 journal bytes folded in
+             (version 2 on; version 1 stores have no such field)
+    record   uint16 flags, uint16 count, count of MAX_POINTS points
+    point    float x, float y (input pixels), int16 craft, uint16 flags
+    journal  uint32 frame, uint16 op, uint16 frame flags, point
+*/
+#ifndef Annotations_h
+#define Annotations_h
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#define ANNOTATIONS_MAGIC "QCANNOT1"
+#define ANNOTATIONS_VERSION 2
+
+#pragma pack(push, 1)
+struct LabelPoint {
+    float x, y;
+    int16_t craft;  // router ID, or -1 if not known
+    uint16_t flags; // POINT_*
+};
+
+struct FrameLabels {
+    enum { MAX_POINTS = 16 };
+    uint16_t flags; // FRAME_*
+    uint16_t count;
+    LabelPoint points[MAX_POINTS];
+};
+
+struct AnnotationsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t frames;
+    uint32_t maxPoints;
+    uint32_t folded; // journal bytes already in the records
+};
+
+struct JournalEntry {
+    uint32_t frame;
+    uint16_t op;    // JOURNAL_*
+    uint16_t flags; // the frame's, after this entry
+    LabelPoint point;
+};
+#pragma pack(pop)
+
+// Frame flags
+#define FRAME_LABELLED 0x01 // looked at, even if there are no points
+#define FRAME_SKIP 0x02     // unusable: blurred, cut, ...
+
+// Point flags
+#define POINT_OCCLUDED 0x01
+#define POINT_UNSURE 0x02
+
+// Journal ops
+#define JOURNAL_ADD 0   // append point
+#define JOURNAL_CLEAR 1 // drop all points
+#define JOURNAL_FLAGS 2 // just set the frame's flags
+
+class Annotations {
+public:
+    Annotations();
+    ~Annotations();
+
+    // Maps path and replays its journal.  A missing store is an empty one
+    // if writable.
+    bool open(const char* path, bool writable = false);
+    void close();
+
+    // One past the last frame with a record or journal entry.
+    uint32_t frames() const { return _frames; }
+    // The labels for frame, or 0 if it has none.
+    const FrameLabels* frame(uint32_t frame) const;
+
+    // These append to the journal, and are seen by frame() at once.
+    bool add(uint32_t frame, const LabelPoint& point);
+    // Drops frame's points, leaving it labelled as having no craft.
+    bool clear(uint32_t frame);
+    bool setFlags(uint32_t frame, uint16_t flags);
+
+    // Rewrites the store with the journal folded in, and empties the
+    // journal.
+    bool compact();
+
+    // Writes labels as a new store at path.  labels is indexed by frame.
+    // folded is how much of path's journal they include: none for a new
+    // store.
+    static bool write(const char* path, const FrameLabels* labels, uint32_t frames,
+                      uint32_t folded = 0);
+
+private:
+    bool _append(const JournalEntry& e);
+    void _apply(const JournalEntry& e);
+    bool _resetFolded();
+
+    std::string _path;
+    int _journal;
+    const char* _map;
+    size_t _mapSize;
+    const FrameLabels* _records;
+    uint32_t _mapped; // records in the map
+    uint32_t _frames;
+    std::unordered_map<uint32_t, FrameLabels> _changed;
+};
+
+#endif
@@ -0,0 +1,195 @@
+/*
+  annotool - converts and inspects annotation stores.
+
+    annotool convert trainingdata annotations
+    annotool dump annotations [first [last]]
+    annotool compact annotations
+
+  convert reads the table vision.lua used to torch.save() in ascii, frame
+  number to {x=, y=}, and writes it as a store (see annotations.h).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "annotations.h"
+
+// Just enough of Torch's ascii serialisation for tables of numbers and
+// strings.
+enum { TORCH_NIL = 0, TORCH_NUMBER = 1, TORCH_STRING = 2, TORCH_TABLE = 3, TORCH_BOOLEAN = 5 };
+
+struct TorchValue {
+    int type;
+    double number;
+    std::string string;
+    int table; // index into TorchReader::tables
+};
+
+class TorchReader {
+public:
+    TorchReader(FILE* f) : _f(f) {}
+    bool read(TorchValue& v);
+
+    std::vector<std::vector<std::pair<TorchValue, TorchValue> > > tables;
+
+private:
+    FILE* _f;
+    std::map<int, int> _seen; // Torch's reference to a table we've read
+};
+
+bool TorchReader::read(TorchValue& v) {
+    v.number = 0;
+    v.table = -1;
+    v.string.clear();
+    if (fscanf(_f, "%d", &v.type) != 1)
+        return false;
+    switch (v.type) {
+    case TORCH_NIL:
+        return true;
+    case TORCH_NUMBER:
+        return fscanf(_f, "%lf", &v.number) == 1;
+    case TORCH_BOOLEAN: {
+        int b;
+        if (fscanf(_f, "%d", &b) != 1)
+            return false;
+        v.number = b;
+        return true;
+    }
+    case TORCH_STRING: {
+        int len;
+        if (fscanf(_f, "%d", &len) != 1 || len < 0 || fgetc(_f) != '\n')
+            return false;
+        v.string.resize(len);
+        return len == 0 || fread(&v.string[0], 1, len, _f) == (size_t)len;
+    }
+    case TORCH_TABLE: {
+        int ref, size;
+        if (fscanf(_f, "%d", &ref) != 1)
+            return false;
+        std::map<int, int>::iterator it = _seen.find(ref);
+        if (it != _seen.end()) {
+            v.table = it->second;
+            return true;
+        }
+        if (fscanf(_f, "%d", &size) != 1 || size < 0)
+            return false;
+        v.table = _seen[ref] = tables.size();
+        tables.resize(tables.size() + 1);
+        for (int i = 0; i < size; i++) {
+            TorchValue key, value;
+            if (!read(key) || !read(value))
+                return false;
+            tables[v.table].push_back(std::make_pair(key, value));
+        }
+        return true;
+    }
+    default:
+        fprintf(stderr, "unsupported torch type %d\n", v.type);
+        return false;
+    }
+}
+
+static int convert(const char* from, const char* to) {
+    FILE* f = fopen(from, "r");
+    if (!f) {
+        perror(from);
+        return 1;
+    }
+    TorchReader reader(f);
+    TorchValue top;
+    bool ok = reader.read(top) && top.type == TORCH_TABLE;
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "%s: not a torch ascii table\n", from);
+        return 1;
+    }
+    std::vector<FrameLabels> labels;
+    int skipped = 0;
+    const std::vector<std::pair<TorchValue, TorchValue> >& frames = reader.tables[top.table];
+    for (size_t i = 0; i < frames.size(); i++) {
+        const TorchValue& k = frames[i].first;
+        const TorchValue& v = frames[i].second;
+        bool hasX = false, hasY = false;
+        LabelPoint p = { 0, 0, -1, 0 };
+        if (k.type == TORCH_NUMBER && k.number >= 0 && v.type == TORCH_TABLE) {
+            const std::vector<std::pair<TorchValue, TorchValue> >& fields = reader.tables[v.table];
+            for (size_t j = 0; j < fields.size(); j++) {
+                const TorchValue& name = fields[j].first;
+                const TorchValue& value = fields[j].second;
+                if (name.type != TORCH_STRING || value.type != TORCH_NUMBER)
+                    continue;
+                if (name.string == "x") {
+                    p.x = value.number;
+                    hasX = true;
+                } else if (name.string == "y") {
+                    p.y = value.number;
+                    hasY = true;
+                }
+            }
+        }
+        if (!hasX || !hasY) {
+            skipped++;
+            continue;
+        }
+        uint32_t frame = k.number;
+        if (frame >= labels.size()) {
+            FrameLabels empty;
+            memset(&empty, 0, sizeof(empty));
+            labels.resize(frame + 1, empty);
+        }
+        FrameLabels& l = labels[frame];
+        l.flags |= FRAME_LABELLED;
+        if (l.count < FrameLabels::MAX_POINTS)
+            l.points[l.count++] = p;
+    }
+    if (!Annotations::write(to, labels.data(), labels.size()))
+        return 1;
+    printf("%zu frames labelled, %zu records, %d entries skipped\n", frames.size() - skipped, labels.size(),
+           skipped);
+    return 0;
+}
+
+static int dump(const char* path, uint32_t first, uint32_t last) {
+    Annotations a;
+    if (!a.open(path))
+        return 1;
+    for (uint32_t i = first; i < a.frames() && i <= last; i++) {
+        const FrameLabels* l = a.frame(i);
+        if (!l)
+            continue;
+        printf("%u", i);
+        if (l->flags & FRAME_SKIP)
+            printf(" skip");
+        for (int k = 0; k < l->count; k++) {
+            const LabelPoint& p = l->points[k];
+            printf(" %g,%g", p.x, p.y);
+            if (p.craft >= 0)
+                printf(" craft %d", p.craft);
+            if (p.flags & POINT_OCCLUDED)
+                printf(" occluded");
+            if (p.flags & POINT_UNSURE)
+                printf(" unsure");
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && strcmp(argv[1], "convert") == 0)
+        return convert(argv[2], argv[3]);
+    if (argc >= 3 && argc <= 5 && strcmp(argv[1], "dump") == 0)
+        return dump(argv[2], argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? atoi(argv[4]) : UINT32_MAX);
+    if (argc == 3 && strcmp(argv[1], "compact") == 0) {
+        Annotations a;
+        return a.open(argv[2], true) && a.compact() ? 0 : 1;
+    }
+    fprintf(stderr, "usage: %s convert trainingdata annotations\n"
+                    "       %s dump annotations [first [last]]\n"
+                    "       %s compact annotations\n",
+            argv[0], argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,108 @@
+/*
+  capture - reads frames from a camera or a file and reports on them.
+
+    capture [-n frames] [-s WxH] [-r fps] [-p] [-o frame.pgm] source
+
+  source is a V4L2 device (/dev/video0) or a video file; a YUV4MPEG2 file
+  is read directly and anything else through ffmpeg.  -s and -r are asked
+  of the camera, or scale the video; -p paces a file at its frame rate.
+  Prints the size, the rate frames arrived at, the spread of the intervals
+  between their capture times, how long after capture each was delivered,
+  and how many were lost (an unpaced file runs ahead of its stamps, so its
+  delays are negative).  -o saves the last frame.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "clock.h"
+#include "framesource.h"
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty())
+        return 0;
+    size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+int main(int argc, char** argv) {
+    int frames = 300, width = 0, height = 0, fps = 0;
+    bool pace = false;
+    const char* save = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:r:po:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+                frames = 0;
+            break;
+        case 'r':
+            fps = atoi(optarg);
+            break;
+        case 'p':
+            pace = true;
+            break;
+        case 'o':
+            save = optarg;
+            break;
+        default:
+            frames = 0;
+        }
+    }
+    if (frames <= 0 || optind + 1 != argc) {
+        fprintf(stderr, "usage: %s [-n frames] [-s WxH] [-r fps] [-p] [-o frame.pgm] source\n", argv[0]);
+        return 1;
+    }
+    FrameSource* src = FrameSource::open(argv[optind], width, height, fps, pace);
+    if (!src)
+        return 1;
+
+    std::vector<double> intervals, latency;
+    std::vector<float> plane(src->width() * src->height());
+    Frame f;
+    uint64_t start = 0, last = 0, first = 0;
+    int n = 0;
+    while (n < frames && src->next(f)) {
+        uint64_t now = monotonicMicros();
+        latency.push_back((int64_t)(now - f.time_us) * 1e-3);
+        if (n)
+            intervals.push_back((f.time_us - last) * 1e-3);
+        else
+            start = now, first = f.index;
+        last = f.time_us;
+        lumaToPlane(f, &plane[0], src->width());
+        n++;
+    }
+    uint64_t elapsed = monotonicMicros() - start;
+    if (!n) {
+        fprintf(stderr, "%s: no frames\n", argv[optind]);
+        delete src;
+        return 1;
+    }
+    printf("%s: %dx%d, %d frames (%llu to %llu), %.1f frames/s, %llu lost\n", argv[optind], src->width(),
+           src->height(), n, (unsigned long long)first, (unsigned long long)f.index,
+           n > 1 ? (n - 1) * 1e6 / elapsed : 0.0, (unsigned long long)src->dropped);
+    printf("interval ms  p50 %.2f  p99 %.2f  max %.2f\n", percentile(intervals, 0.5), percentile(intervals, 0.99),
+           percentile(intervals, 1));
+    printf("latency ms   p50 %.2f  p99 %.2f  max %.2f\n", percentile(latency, 0.5), percentile(latency, 0.99),
+           percentile(latency, 1));
+    if (save) {
+        FILE* out = fopen(save, "wb");
+        if (!out) {
+            perror(save);
+        } else {
+            fprintf(out, "P5\n%d %d\n255\n", f.width, f.height);
+            for (int y = 0; y < f.height; y++)
+                fwrite(f.luma + y * f.stride, 1, f.width, out);
+            fclose(out);
+        }
+    }
+    delete src;
+    return 0;
+}
@@ -0,0 +1,16 @@
+/*
+  clock.h - Host monotonic clock, in microseconds.
+*/
+#ifndef Clock_h
+#define Clock_h
+
+#include <stdint.h>
+#include <time.h>
+
+inline uint64_t monotonicMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif
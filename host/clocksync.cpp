@@ -0,0 +1,131 @@
+#include "clocksync.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "../arduino_proxy/protocol.h"
+
+#define WINDOW 64      // pings remembered
+#define BEST 16        // lowest delay pings used for the fit
+#define MIN_SPAN 10000000 // don't trust a rate fitted over less than 10s
+#define MAX_STEP 1000000  // Arduino and host may disagree by this much, plus 1%, between pings
+
+// Time for a frame to clock through the UART at 115200 8N1.  Ping and pong
+// aren't the same size, so without this the offset would be biased by half
+// the difference.
+static uint64_t serialMicros(int payload) {
+    return (uint64_t)(payload + 4) * 10 * 1000000 / 115200;
+}
+
+ClockSync::ClockSync()
+    : _lastArduino(0), _started(false), _fitted(false), _minDelay(0),
+      _baseArduino(0), _baseHost(0), _rate(1) {}
+
+void ClockSync::reset() {
+    _samples.clear();
+    _lastArduino = 0;
+    _started = false;
+    _fitted = false;
+    _minDelay = 0;
+    _baseArduino = 0;
+    _baseHost = 0;
+    _rate = 1;
+}
+
+int64_t ClockSync::_unwrap(uint32_t arduino_us) const {
+    return (int64_t)_lastArduino + (int32_t)(arduino_us - (uint32_t)_lastArduino);
+}
+
+void ClockSync::addSample(uint64_t t1, uint32_t t2, uint32_t t3, uint64_t t4) {
+    if (!_started) {
+        _lastArduino = t2;
+        _started = true;
+    }
+    int64_t a2 = _unwrap(t2);
+    int64_t a3 = _unwrap(t3);
+    if (a3 < a2)
+        return;
+
+    uint64_t h1 = t1 + serialMicros(CMD_PING_LEN);
+    uint64_t h4 = t4 - serialMicros(TLM_PONG_LEN);
+    if (h4 < h1)
+        h4 = h1;
+    Sample s;
+    s.arduino = (a2 + a3) / 2;
+    s.host = (h1 + h4) / 2;
+    if (!_samples.empty()) {
+        // micros() restarting shows up as the Arduino going backwards, or
+        // as a jump the host didn't see if it had been up past a wrap.
+        const Sample& last = _samples.back();
+        int64_t host = (int64_t)(s.host - last.host);
+        int64_t step = (a2 + a3) / 2 - (int64_t)last.arduino;
+        if (a2 < 0 || llabs(step - host) > MAX_STEP + llabs(host) / 100) {
+            reset();
+            addSample(t1, t2, t3, t4);
+            return;
+        }
+    }
+    if (a2 < 0)
+        return;
+    _lastArduino = a3;
+    uint64_t turnaround = a3 - a2;
+    s.delay = h4 - h1 > turnaround ? h4 - h1 - turnaround : 0;
+    _samples.push_back(s);
+    if (_samples.size() > WINDOW)
+        _samples.pop_front();
+    _fit();
+}
+
+static bool byDelay(const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+    return a.first < b.first;
+}
+
+void ClockSync::_fit() {
+    std::vector<std::pair<uint64_t, size_t> > order;
+    for (size_t i = 0; i < _samples.size(); i++)
+        order.push_back(std::make_pair(_samples[i].delay, i));
+    std::sort(order.begin(), order.end(), byDelay);
+    if (order.size() > BEST)
+        order.resize(BEST);
+    _minDelay = order[0].first;
+
+    // Work relative to the first sample so doubles keep microsecond precision.
+    const Sample& origin = _samples[order[0].second];
+    double mx = 0, my = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        const Sample& s = _samples[order[i].second];
+        mx += (double)(int64_t)(s.arduino - origin.arduino);
+        my += (double)(int64_t)(s.host - origin.host);
+    }
+    mx /= order.size();
+    my /= order.size();
+    double sxx = 0, sxy = 0, lo = 0, hi = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        const Sample& s = _samples[order[i].second];
+        double dx = (double)(int64_t)(s.arduino - origin.arduino) - mx;
+        double dy = (double)(int64_t)(s.host - origin.host) - my;
+        sxx += dx * dx;
+        sxy += dx * dy;
+        lo = std::min(lo, dx);
+        hi = std::max(hi, dx);
+    }
+    double rate = 1;
+    if (hi - lo >= MIN_SPAN && sxx > 0) {
+        rate = sxy / sxx;
+        // Ceramic resonators are good to 0.5% or so; anything worse is noise.
+        if (fabs(rate - 1) > 0.01)
+            rate = _fitted ? _rate : 1;
+    } else if (_fitted) {
+        rate = _rate;
+    }
+    _rate = rate;
+    _baseArduino = origin.arduino + (int64_t)llround(mx);
+    _baseHost = (double)origin.host + my;
+    _fitted = true;
+}
+
+uint64_t ClockSync::toHost(uint32_t arduino_us) const {
+    int64_t dt = _unwrap(arduino_us) - (int64_t)_baseArduino;
+    return (uint64_t)llround(_baseHost + dt * _rate);
+}
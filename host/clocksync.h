@@ -0,0 +1,56 @@
+/*
+  clocksync.h - Maps the Arduino's micros() onto the host monotonic clock.
+
+  NTP style: the host sends CMD_PING at t1, the Arduino stamps t2 when it
+  parses it and t3 when it queues TLM_PONG, which lands at t4.  The two
+  clocks drift (the Arduino crystal is only good to a few hundred ppm), so
+  offset and rate are fitted by least squares over the recent exchanges with
+  the smallest round trip, which are the ones least disturbed by USB
+  latency.
+*/
+#ifndef ClockSync_h
+#define ClockSync_h
+
+#include <stdint.h>
+#include <deque>
+
+class ClockSync {
+public:
+    ClockSync();
+    // t1/t4 are host times, t2/t3 Arduino micros().
+    // A sample whose Arduino time has moved too far from the host's since
+    // the last one (it went backwards, say) starts the fit again.
+    void addSample(uint64_t t1, uint32_t t2, uint32_t t3, uint64_t t4);
+    // Forgets every sample, for when the Arduino's micros() has restarted:
+    // it rebooted, or its port was reopened.
+    void reset();
+    bool synced() const { return _fitted; }
+    // Host time for an Arduino timestamp.  Must be no more than ~35 minutes
+    // either side of the last ping, so micros() wrapping is unambiguous.
+    uint64_t toHost(uint32_t arduino_us) const;
+    // How fast the Arduino clock runs, in ppm (positive is fast).
+    double driftPpm() const { return (1 / _rate - 1) * 1e6; }
+    // Smallest round trip in the window, which bounds the error.
+    uint64_t minDelay() const { return _minDelay; }
+
+private:
+    struct Sample {
+        uint64_t arduino; // unwrapped midpoint of t2 and t3
+        uint64_t host;    // midpoint of t1 and t4
+        uint64_t delay;   // round trip less the Arduino's turnaround
+    };
+    void _fit();
+    int64_t _unwrap(uint32_t arduino_us) const;
+
+    std::deque<Sample> _samples;
+    uint64_t _lastArduino; // most recent unwrapped Arduino time seen
+    bool _started;
+    bool _fitted;
+    uint64_t _minDelay;
+    // host = _baseHost + (arduino - _baseArduino) * _rate
+    uint64_t _baseArduino;
+    double _baseHost;
+    double _rate;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "cmaes.h"
+
+#include <math.h>
+#include <algorithm>
+
+Cmaes::Cmaes(const std::vector<double>& mean, double sigma, int lambda, unsigned seed)
+    : _n((int)mean.size()), _lambda(lambda), _mean(mean), _sigma(sigma), _generation(0), _bestCost(HUGE_VAL),
+      _rng(seed), _normal(0, 1) {
+    int n = _n;
+    if (_lambda <= 0)
+        _lambda = 4 + (int)(3 * log(n));
+    _mu = _lambda / 2;
+    double sum = 0, sumSq = 0;
+    for (int i = 0; i < _mu; i++) {
+        _weights.push_back(log(_mu + 0.5) - log(i + 1));
+        sum += _weights[i];
+    }
+    for (int i = 0; i < _mu; i++) {
+        _weights[i] /= sum;
+        sumSq += _weights[i] * _weights[i];
+    }
+    _mueff = 1 / sumSq;
+    _cc = (4 + _mueff / n) / (n + 4 + 2 * _mueff / n);
+    _cs = (_mueff + 2) / (n + _mueff + 5);
+    _c1 = 2 / ((n + 1.3) * (n + 1.3) + _mueff);
+    _cmu = std::min(1 - _c1, 2 * (_mueff - 2 + 1 / _mueff) / ((n + 2) * (n + 2) + _mueff));
+    _damps = 1 + 2 * std::max(0.0, sqrt((_mueff - 1) / (n + 1)) - 1) + _cs;
+    _chiN = sqrt(n) * (1 - 1.0 / (4 * n) + 1.0 / (21 * n * n));
+    _pc.assign(n, 0);
+    _ps.assign(n, 0);
+    _C.assign(n * n, 0);
+    _B.assign(n * n, 0);
+    _D.assign(n, 1);
+    for (int i = 0; i < n; i++)
+        _C[i * n + i] = _B[i * n + i] = 1;
+    _x.assign(_lambda, std::vector<double>(n));
+    _y.assign(_lambda, std::vector<double>(n));
+    _best = mean;
+}
+
+const std::vector<std::vector<double> >& Cmaes::ask() {
+    int n = _n;
+    std::vector<double> z(n);
+    for (int k = 0; k < _lambda; k++) {
+        for (int i = 0; i < n; i++)
+            z[i] = _D[i] * _normal(_rng);
+        for (int i = 0; i < n; i++) {
+            double y = 0;
+            for (int j = 0; j < n; j++)
+                y += _B[i * n + j] * z[j];
+            _y[k][i] = y;
+            _x[k][i] = _mean[i] + _sigma * y;
+        }
+    }
+    return _x;
+}
+
+void Cmaes::tell(const std::vector<double>& costs) {
+    int n = _n;
+    std::vector<int> order(_lambda);
+    for (int k = 0; k < _lambda; k++)
+        order[k] = k;
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return costs[a] < costs[b]; });
+    if (costs[order[0]] < _bestCost) {
+        _bestCost = costs[order[0]];
+        _best = _x[order[0]];
+    }
+
+    // The weighted step of the best mu, and the mean moved along it.
+    std::vector<double> yw(n, 0);
+    for (int k = 0; k < _mu; k++)
+        for (int i = 0; i < n; i++)
+            yw[i] += _weights[k] * _y[order[k]][i];
+    for (int i = 0; i < n; i++)
+        _mean[i] += _sigma * yw[i];
+
+    // Evolution paths: ps through C^-1/2 = B D^-1 B', to judge the step
+    // size by; pc as it is, to learn the shape by.
+    std::vector<double> t(n, 0), invSqrt(n, 0);
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++)
+            t[j] += _B[i * n + j] * yw[i];
+        t[j] /= _D[j];
+    }
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            invSqrt[i] += _B[i * n + j] * t[j];
+    double psNorm = 0;
+    for (int i = 0; i < n; i++) {
+        _ps[i] = (1 - _cs) * _ps[i] + sqrt(_cs * (2 - _cs) * _mueff) * invSqrt[i];
+        psNorm += _ps[i] * _ps[i];
+    }
+    psNorm = sqrt(psNorm);
+    _generation++;
+    bool hsig = psNorm / sqrt(1 - pow(1 - _cs, 2 * _generation)) / _chiN < 1.4 + 2.0 / (n + 1);
+    for (int i = 0; i < n; i++)
+        _pc[i] = (1 - _cc) * _pc[i] + (hsig ? sqrt(_cc * (2 - _cc) * _mueff) : 0) * yw[i];
+
+    // Rank one update from pc, rank mu from the best steps.
+    double keep = 1 - _c1 - _cmu + (hsig ? 0 : _c1 * _cc * (2 - _cc));
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j <= i; j++) {
+            double rankMu = 0;
+            for (int k = 0; k < _mu; k++)
+                rankMu += _weights[k] * _y[order[k]][i] * _y[order[k]][j];
+            double c = keep * _C[i * n + j] + _c1 * _pc[i] * _pc[j] + _cmu * rankMu;
+            _C[i * n + j] = _C[j * n + i] = c;
+        }
+
+    _sigma *= exp(_cs / _damps * (psNorm / _chiN - 1));
+    decompose();
+}
+
+// Eigenvectors of C into the columns of B, and the square roots of its
+// eigenvalues into D, by cyclic Jacobi rotations.
+void Cmaes::decompose() {
+    int n = _n;
+    std::vector<double> a(_C);
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            _B[i * n + j] = i == j;
+    for (int sweep = 0; sweep < 50; sweep++) {
+        double off = 0;
+        for (int p = 0; p < n; p++)
+            for (int q = p + 1; q < n; q++)
+                off += a[p * n + q] * a[p * n + q];
+        if (off < 1e-30)
+            break;
+        for (int p = 0; p < n; p++)
+            for (int q = p + 1; q < n; q++) {
+                double apq = a[p * n + q];
+                if (fabs(apq) < 1e-300)
+                    continue;
+                double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+                double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1), s = t * c;
+                for (int k = 0; k < n; k++) {
+                    double akp = a[k * n + p], akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < n; k++) {
+                    double apk = a[p * n + k], aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < n; k++) {
+                    double bkp = _B[k * n + p], bkq = _B[k * n + q];
+                    _B[k * n + p] = c * bkp - s * bkq;
+                    _B[k * n + q] = s * bkp + c * bkq;
+                }
+            }
+    }
+    for (int i = 0; i < n; i++)
+        _D[i] = sqrt(std::max(a[i * n + i], 1e-20));
+}
@@ -0,0 +1,55 @@
+/*
+  cmaes.h - Minimising a noisy function of a few variables by CMA-ES.
+
+  The covariance matrix adaptation evolution strategy, after Hansen's
+  tutorial (arXiv:1604.00772): each generation samples lambda points from
+  a normal distribution round the mean, and moves the mean towards the
+  best half of them, while learning the shape (covariance) and size
+  (sigma) of the distribution from the steps it takes.  It needs only the
+  ranking of the points, so it copes with noisy costs and doesn't need
+  them scaled.  For the ten or so variables it is used for here the
+  covariance is decomposed afresh every generation, by Jacobi rotations.
+
+  ask() gives the points to try and tell() takes their costs, in the same
+  order, so the caller can evaluate them however it likes, in parallel.
+*/
+#ifndef Cmaes_h
+#define Cmaes_h
+
+#include <random>
+#include <vector>
+
+class Cmaes {
+public:
+    // lambda 0 for the usual 4 + 3 ln n.
+    Cmaes(const std::vector<double>& mean, double sigma, int lambda = 0, unsigned seed = 1);
+
+    const std::vector<std::vector<double> >& ask();
+    void tell(const std::vector<double>& costs);
+
+    const std::vector<double>& mean() const { return _mean; }
+    double sigma() const { return _sigma; }
+    int lambda() const { return _lambda; }
+    int generation() const { return _generation; }
+    // The lowest cost point told so far.
+    const std::vector<double>& best() const { return _best; }
+    double bestCost() const { return _bestCost; }
+
+private:
+    void decompose();
+
+    int _n, _lambda, _mu;
+    std::vector<double> _weights;
+    double _mueff, _cc, _cs, _c1, _cmu, _damps, _chiN;
+    std::vector<double> _mean, _pc, _ps;
+    std::vector<double> _C, _B, _D; // C = B diag(D^2) B', row major
+    double _sigma;
+    int _generation;
+    std::vector<std::vector<double> > _x, _y; // points, and their steps / sigma
+    std::vector<double> _best;
+    double _bestCost;
+    std::mt19937 _rng;
+    std::normal_distribution<double> _normal;
+};
+
+#endif
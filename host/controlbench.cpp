@@ -0,0 +1,171 @@
+/*
+  controlbench - times FleetController and checks it flies.
+
+    controlbench [-n ticks]
+
+  Times step() for fleets of 1 to 4096 craft with each kernel the CPU
+  supports, and checks that the kernels give the same sticks.  Then flies
+  a fleet of point masses (sticks setting acceleration, with a hover
+  throttle to find) to targets 100 pixels away in fixed steps, twice, and
+  reports how long they took to settle, how far they overshot, and whether
+  the two runs agreed exactly.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+
+#include "clock.h"
+#include "controller.h"
+
+#define SETTLE 5 // pixels from the target counts as there
+
+static void randomise(FleetController& c, std::mt19937& rng) {
+    std::uniform_real_distribution<float> u(-100, 100);
+    for (int i = 0; i < c.size(); i++) {
+        float p[3] = { u(rng), u(rng), u(rng) }, v[3] = { u(rng), u(rng), u(rng) };
+        c.setState(i, p, v);
+    }
+}
+
+// Flies craft point masses from the origin to (100, -100, 100) for
+// seconds, in fixed steps.  Fills in the sticks at every step, and per
+// craft when it settled and how far past it went.
+static void fly(int craft, float seconds, std::vector<uint16_t>& sticks, std::vector<float>& settled,
+                std::vector<float>& overshoot) {
+    FleetController c;
+    c.resize(craft);
+    std::vector<float> pos(3 * craft, 0), vel(3 * craft, 0);
+    // Each craft is a little different: the hover throttle, and how hard
+    // a stick accelerates it.
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> u(0.8f, 1.2f);
+    std::vector<float> hover(craft), gain(craft);
+    for (int i = 0; i < craft; i++) {
+        hover[i] = 450 * u(rng);
+        gain[i] = 2 * u(rng);
+        c.setTarget(i, 100, -100, 100);
+        c.setState(i, &pos[3 * i], &vel[3 * i]);
+        c.arm(i, true);
+    }
+    settled.assign(craft, -1);
+    overshoot.assign(craft, 0);
+    sticks.clear();
+    uint64_t t = 0, dtUs = (uint64_t)lround(c.fixedDt * 1e6);
+    c.advance(t);
+    for (int s = 0; s * c.fixedDt < seconds; s++) {
+        t += dtUs;
+        c.advance(t);
+        for (int i = 0; i < craft; i++) {
+            float* p = &pos[3 * i];
+            float* v = &vel[3 * i];
+            float a[3] = { gain[i] * (c.stick(i, FleetController::AILERON) - 500.0f),
+                           gain[i] * (c.stick(i, FleetController::ELEVATOR) - 500.0f),
+                           gain[i] * (c.stick(i, FleetController::THROTTLE) - hover[i]) };
+            float err = 0;
+            for (int k = 0; k < 3; k++) {
+                v[k] += a[k] * c.fixedDt;
+                p[k] += v[k] * c.fixedDt;
+                float target = k == 1 ? -100 : 100;
+                overshoot[i] = fmaxf(overshoot[i], (p[k] - target) * (target > 0 ? 1 : -1));
+                err = fmaxf(err, fabsf(p[k] - target));
+            }
+            if (err > SETTLE)
+                settled[i] = -1;
+            else if (settled[i] < 0)
+                settled[i] = s * c.fixedDt;
+            c.setState(i, p, v);
+            for (int ch = 0; ch < FleetController::CHANNELS; ch++)
+                sticks.push_back(c.stick(i, (FleetController::Channel)ch));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int ticks = 10000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n')
+            ticks = atoi(optarg);
+        else
+            ticks = 0;
+    }
+    if (ticks <= 0) {
+        fprintf(stderr, "usage: %s [-n ticks]\n", argv[0]);
+        return 1;
+    }
+
+    bool agree = true;
+    printf("craft  kernel   us/tick  ns/craft\n");
+    int sizes[] = { 1, 16, 256, 4096 };
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        std::vector<uint16_t> first;
+        for (int k = FleetController::SCALAR; k <= FleetController::best(); k++) {
+            FleetController c;
+            c.setKernel((FleetController::Kernel)k);
+            c.resize(n);
+            std::mt19937 rng(1);
+            randomise(c, rng);
+            for (int i = 0; i < n; i++) {
+                c.setTarget(i, 10, 20, 30);
+                c.arm(i, i % 5 != 0);
+            }
+            int reps = std::max(10, ticks / std::max(1, n / 16));
+            uint64_t start = monotonicMicros();
+            for (int r = 0; r < reps; r++)
+                c.step(0.033f);
+            double us = (double)(monotonicMicros() - start) / reps;
+            printf("%5d  %-6s %9.3f %9.2f\n", n, FleetController::kernelName((FleetController::Kernel)k), us,
+                   us * 1e3 / n);
+            // The same inputs from here on, so the kernels should agree.
+            FleetController a;
+            a.setKernel((FleetController::Kernel)k);
+            a.resize(n);
+            std::mt19937 rng2(2);
+            for (int i = 0; i < n; i++) {
+                a.setTarget(i, 10, 20, 30);
+                a.arm(i, i % 5 != 0);
+            }
+            std::vector<uint16_t> sticks;
+            for (int r = 0; r < 100; r++) {
+                randomise(a, rng2);
+                a.step(0.033f);
+                for (int i = 0; i < n; i++)
+                    for (int ch = 0; ch < FleetController::CHANNELS; ch++)
+                        sticks.push_back(a.stick(i, (FleetController::Channel)ch));
+            }
+            if (k == FleetController::SCALAR)
+                first = sticks;
+            else if (sticks != first)
+                agree = false;
+        }
+    }
+
+    std::vector<uint16_t> a, b;
+    std::vector<float> settled, overshoot, s2, o2;
+    fly(64, 20, a, settled, overshoot);
+    fly(64, 20, b, s2, o2);
+    double sumSettle = 0, worstSettle = 0, sumOver = 0, worstOver = 0;
+    int unsettled = 0;
+    for (size_t i = 0; i < settled.size(); i++) {
+        if (settled[i] < 0) {
+            unsettled++;
+            continue;
+        }
+        sumSettle += settled[i];
+        worstSettle = fmax(worstSettle, settled[i]);
+        sumOver += overshoot[i];
+        worstOver = fmax(worstOver, overshoot[i]);
+    }
+    int ok = settled.size() - unsettled;
+    printf("64 point masses, 100 px steps: settled in %.2f s (worst %.2f), overshoot %.1f px (worst %.1f), "
+           "%d unsettled\n", ok ? sumSettle / ok : 0, worstSettle, ok ? sumOver / ok : 0, worstOver, unsettled);
+    printf("fixed step runs %s\n", a == b ? "identical" : "differ");
+    if (!agree)
+        printf("kernels disagree\n");
+    return agree && a == b && !unsettled ? 0 : 1;
+}
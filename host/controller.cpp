@@ -0,0 +1,264 @@
+#include "controller.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define STICK_MIN 0.0f
+#define STICK_MAX 1000.0f
+#define STICK_CENTRE 500.0f
+
+// Contracting a multiply and add into an FMA would round differently in
+// the two kernels, so neither may.
+#define NO_FMA __attribute__((optimize("fp-contract=off")))
+
+void FleetController::Lanes::resize(int n) {
+    std::vector<float>* all[] = { &pos, &vel, &target, &kp, &maxSpeed, &vkp, &vki, &vkd, &trim, &maxRate,
+                                  &integral, &lastVel, &out };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+        all[i]->resize(n, 0);
+}
+
+// Steps lanes first to last of one axis on by dt.  idle is the stick for
+// a disarmed craft.
+typedef void (*AxisKernel)(FleetController::Lanes& a, const float* armed, int first, int last, float dt, float idle);
+
+NO_FMA static void axisScalar(FleetController::Lanes& a, const float* armed, int first, int last, float dt,
+                              float idle) {
+    float invDt = 1 / dt;
+    for (int i = first; i < last; i++) {
+        float vsp = a.kp[i] * (a.target[i] - a.pos[i]);
+        vsp = fminf(fmaxf(vsp, -a.maxSpeed[i]), a.maxSpeed[i]);
+        float e = vsp - a.vel[i];
+        float d = (a.lastVel[i] - a.vel[i]) * invDt;
+        float p = a.trim[i] + a.vkp[i] * e;
+        float in = a.integral[i] + a.vki[i] * e * dt;
+        float u = p + in + a.vkd[i] * d;
+        // Don't integrate further into saturation.
+        if ((u > STICK_MAX && e > 0) || (u < STICK_MIN && e < 0)) {
+            in = a.integral[i];
+            u = p + in + a.vkd[i] * d;
+        }
+        float step = a.maxRate[i] * dt;
+        u = fminf(fmaxf(u, a.out[i] - step), a.out[i] + step);
+        u = fminf(fmaxf(u, STICK_MIN), STICK_MAX);
+        bool on = armed[i] != 0;
+        a.out[i] = on ? u : idle;
+        a.integral[i] = on ? in : 0;
+        a.lastVel[i] = a.vel[i];
+    }
+}
+
+#if defined(__x86_64__)
+NO_FMA __attribute__((target("avx2"))) static void axisAvx2(FleetController::Lanes& a, const float* armed, int first,
+                                                             int last, float dt, float idle) {
+    const __m256 vdt = _mm256_set1_ps(dt), invDt = _mm256_set1_ps(1 / dt), zero = _mm256_setzero_ps();
+    const __m256 lo = _mm256_set1_ps(STICK_MIN), hi = _mm256_set1_ps(STICK_MAX), vidle = _mm256_set1_ps(idle);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    for (int i = first; i < last; i += 8) {
+        __m256 pos = _mm256_loadu_ps(&a.pos[i]), vel = _mm256_loadu_ps(&a.vel[i]);
+        __m256 maxSpeed = _mm256_loadu_ps(&a.maxSpeed[i]);
+        __m256 vsp = _mm256_mul_ps(_mm256_loadu_ps(&a.kp[i]), _mm256_sub_ps(_mm256_loadu_ps(&a.target[i]), pos));
+        vsp = _mm256_min_ps(_mm256_max_ps(vsp, _mm256_xor_ps(maxSpeed, sign)), maxSpeed);
+        __m256 e = _mm256_sub_ps(vsp, vel);
+        __m256 d = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&a.lastVel[i]), vel), invDt);
+        __m256 p = _mm256_add_ps(_mm256_loadu_ps(&a.trim[i]), _mm256_mul_ps(_mm256_loadu_ps(&a.vkp[i]), e));
+        __m256 old = _mm256_loadu_ps(&a.integral[i]);
+        __m256 in = _mm256_add_ps(old, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(&a.vki[i]), e), vdt));
+        __m256 dterm = _mm256_mul_ps(_mm256_loadu_ps(&a.vkd[i]), d);
+        __m256 u = _mm256_add_ps(_mm256_add_ps(p, in), dterm);
+        __m256 sat = _mm256_or_ps(
+            _mm256_and_ps(_mm256_cmp_ps(u, hi, _CMP_GT_OQ), _mm256_cmp_ps(e, zero, _CMP_GT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(u, lo, _CMP_LT_OQ), _mm256_cmp_ps(e, zero, _CMP_LT_OQ)));
+        in = _mm256_blendv_ps(in, old, sat);
+        u = _mm256_blendv_ps(u, _mm256_add_ps(_mm256_add_ps(p, old), dterm), sat);
+        __m256 out = _mm256_loadu_ps(&a.out[i]);
+        __m256 step = _mm256_mul_ps(_mm256_loadu_ps(&a.maxRate[i]), vdt);
+        u = _mm256_min_ps(_mm256_max_ps(u, _mm256_sub_ps(out, step)), _mm256_add_ps(out, step));
+        u = _mm256_min_ps(_mm256_max_ps(u, lo), hi);
+        __m256 on = _mm256_cmp_ps(_mm256_loadu_ps(&armed[i]), zero, _CMP_NEQ_OQ);
+        _mm256_storeu_ps(&a.out[i], _mm256_blendv_ps(vidle, u, on));
+        _mm256_storeu_ps(&a.integral[i], _mm256_and_ps(in, on));
+        _mm256_storeu_ps(&a.lastVel[i], vel);
+    }
+}
+#endif
+
+FleetController::FleetController()
+    : fixedDt(1 / 30.0f), maxSteps(4), _kernel(best()), _n(0), _clock(0), _steps(0), _started(false) {
+    // A starting point, settling controlbench's point masses in a few
+    // seconds; real craft want tuning each.
+    AxisGains flat = { 1, 150, 3, 1, 0.1f, STICK_CENTRE, 2000 };
+    AxisGains lift = { 1, 150, 3, 1, 0.1f, STICK_CENTRE, 1000 };
+    defaults[X] = defaults[Y] = flat;
+    defaults[Z] = lift;
+}
+
+void FleetController::resize(int craft) {
+    int old = _n;
+    _n = craft;
+    int padded = (craft + 7) & ~7;
+    for (int a = 0; a < AXES; a++)
+        _axes[a].resize(padded);
+    _armed.resize(padded, 0);
+    _rudder.resize(padded, STICK_CENTRE);
+    for (int i = old; i < craft; i++) {
+        for (int a = 0; a < AXES; a++) {
+            setGains(i, (Axis)a, defaults[a]);
+            _axes[a].out[i] = a == Z ? STICK_MIN : STICK_CENTRE;
+            _axes[a].integral[i] = 0;
+        }
+        _armed[i] = 0;
+        _rudder[i] = STICK_CENTRE;
+    }
+}
+
+void FleetController::setGains(int craft, Axis axis, const AxisGains& g) {
+    Lanes& l = _axes[axis];
+    l.kp[craft] = g.kp;
+    l.maxSpeed[craft] = g.maxSpeed;
+    l.vkp[craft] = g.vkp;
+    l.vki[craft] = g.vki;
+    l.vkd[craft] = g.vkd;
+    l.trim[craft] = g.trim;
+    l.maxRate[craft] = g.maxRate;
+}
+
+AxisGains FleetController::gains(int craft, Axis axis) const {
+    const Lanes& l = _axes[axis];
+    AxisGains g = { l.kp[craft], l.maxSpeed[craft], l.vkp[craft], l.vki[craft], l.vkd[craft], l.trim[craft],
+                    l.maxRate[craft] };
+    return g;
+}
+
+bool FleetController::loadGains(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    char line[1024];
+    bool ok = true;
+    for (int n = 1; ok && fgets(line, sizeof(line), f); n++) {
+        char* hash = strchr(line, '#');
+        if (hash)
+            *hash = 0;
+        int slot;
+        char axis;
+        AxisGains g;
+        int got = sscanf(line, "%d %c %f %f %f %f %f %f %f", &slot, &axis, &g.kp, &g.maxSpeed, &g.vkp, &g.vki,
+                         &g.vkd, &g.trim, &g.maxRate);
+        if (got <= 0)
+            continue;
+        if (got != 9 || slot < 0 || axis < 'x' || axis > 'z') {
+            fprintf(stderr, "%s:%d: expected slot x|y|z kp maxSpeed vkp vki vkd trim maxRate\n", path, n);
+            ok = false;
+            break;
+        }
+        if (slot >= _n)
+            resize(slot + 1);
+        setGains(slot, (Axis)(axis - 'x'), g);
+    }
+    fclose(f);
+    return ok;
+}
+
+bool FleetController::saveGains(const char* path) const {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    fprintf(f, "# slot axis kp maxSpeed vkp vki vkd trim maxRate\n");
+    for (int i = 0; i < _n; i++)
+        for (int a = 0; a < AXES; a++)
+            writeGains(f, i, (Axis)a, gains(i, (Axis)a));
+    if (fclose(f) != 0) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+void FleetController::writeGains(FILE* f, int craft, Axis axis, const AxisGains& g) {
+    fprintf(f, "%d %c %g %g %g %g %g %g %g\n", craft, 'x' + axis, g.kp, g.maxSpeed, g.vkp, g.vki, g.vkd, g.trim,
+            g.maxRate);
+}
+
+void FleetController::setTarget(int craft, float x, float y, float z) {
+    _axes[X].target[craft] = x;
+    _axes[Y].target[craft] = y;
+    _axes[Z].target[craft] = z;
+}
+
+void FleetController::setState(int craft, const float position[3], const float velocity[3]) {
+    for (int a = 0; a < AXES; a++) {
+        _axes[a].pos[craft] = position[a];
+        _axes[a].vel[craft] = velocity[a];
+    }
+}
+
+void FleetController::arm(int craft, bool on) {
+    _armed[craft] = on;
+    for (int a = 0; a < AXES; a++) {
+        _axes[a].integral[craft] = 0;
+        _axes[a].lastVel[craft] = _axes[a].vel[craft];
+    }
+}
+
+void FleetController::step(float dt) {
+    if (dt <= 0 || !_n)
+        return;
+    static const AxisKernel kernels[] = {
+        axisScalar,
+#if defined(__x86_64__)
+        axisAvx2,
+#else
+        axisScalar,
+#endif
+    };
+    int padded = (_n + 7) & ~7;
+    for (int a = 0; a < AXES; a++)
+        kernels[_kernel](_axes[a], &_armed[0], 0, padded, dt, a == Z ? STICK_MIN : STICK_CENTRE);
+}
+
+int FleetController::advance(uint64_t time) {
+    if (!_started) {
+        _started = true;
+        _clock = time;
+        _steps = 0;
+        return 0;
+    }
+    uint64_t stepUs = (uint64_t)lround(fixedDt * 1e6);
+    if (time < _clock || !stepUs)
+        return 0;
+    uint64_t due = (time - _clock) / stepUs;
+    int run = 0;
+    for (; _steps < due && run < maxSteps; run++, _steps++)
+        step(fixedDt);
+    // Too far behind to catch up: drop the missed steps rather than
+    // stepping in a burst later.
+    _steps = std::max(_steps, due);
+    return run;
+}
+
+uint16_t FleetController::stick(int craft, Channel c) const {
+    float v = c == RUDDER ? _rudder[craft] : _axes[c].out[craft];
+    return (uint16_t)lroundf(v);
+}
+
+FleetController::Kernel FleetController::best() {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+#endif
+    return SCALAR;
+}
+
+const char* FleetController::kernelName(Kernel k) {
+    return k == AVX2 ? "avx2" : "scalar";
+}
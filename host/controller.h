@@ -0,0 +1,113 @@
+/*
+  controller.h - Position control for a whole fleet at once.
+
+  Each craft is flown by a cascaded PID per axis: position error times kp
+  gives a velocity setpoint, limited to maxSpeed, and a PID on the
+  velocity error gives the stick.  x drives aileron, y elevator and z
+  throttle, about a trim (hover throttle, or centred sticks); rudder is
+  left at its trim, since the camera can't see heading.  The D term acts
+  on the measured velocity rather than the error, so a new target doesn't
+  kick the sticks.
+
+  The integral stops growing while the stick is saturated in the
+  direction it would push (conditional integration, so it can't wind up),
+  and sticks move at most maxRate a second.  Sticks are in the 0..1000 of
+  CMD_STICKS and CX10::setAileron() and the rest.
+
+  State, gains and outputs are kept a field to an array, every craft side
+  by side, and step() runs down the arrays eight craft at a time with
+  AVX2 where there is one.  Both kernels do the same float operations in
+  the same order, so they give the same sticks to the bit.
+
+  step(dt) is for a variable loop; advance() runs fixed steps of fixedDt
+  as time goes by, which gives the same outputs for the same inputs
+  whatever the timing, for replay and simulation.
+
+  Gains per craft slot can be kept in a table, as tune writes it: a line
+  per slot and axis of
+
+    slot x|y|z kp maxSpeed vkp vki vkd trim maxRate
+
+  with # to end of line a comment.
+*/
+#ifndef Controller_h
+#define Controller_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+struct AxisGains {
+    float kp;       // position error to velocity setpoint, 1/s
+    float maxSpeed; // velocity setpoint limit
+    float vkp, vki, vkd; // velocity error to stick
+    float trim;     // stick with no correction
+    float maxRate;  // stick units per second
+};
+
+class FleetController {
+public:
+    enum Axis { X, Y, Z, AXES };
+    enum Channel { AILERON, ELEVATOR, THROTTLE, RUDDER, CHANNELS };
+    enum Kernel { SCALAR, AVX2 };
+
+    FleetController();
+
+    // Craft are numbered 0 to size() - 1; new ones are disarmed with
+    // default gains.
+    void resize(int craft);
+    int size() const { return _n; }
+
+    void setGains(int craft, Axis axis, const AxisGains& gains);
+    AxisGains gains(int craft, Axis axis) const;
+    // Sets the gains the table at path lists, growing the fleet to fit;
+    // slots it doesn't list are left as they were.
+    bool loadGains(const char* path);
+    bool saveGains(const char* path) const;
+    // One line of the table.
+    static void writeGains(FILE* f, int craft, Axis axis, const AxisGains& gains);
+    void setTarget(int craft, float x, float y, float z);
+    // The latest tracked position and velocity.
+    void setState(int craft, const float position[3], const float velocity[3]);
+    // A disarmed craft gets zero throttle and centred sticks, and its
+    // integrals are cleared.
+    void arm(int craft, bool on);
+    bool armed(int craft) const { return _armed[craft] != 0; }
+
+    // Runs every craft on by dt seconds.
+    void step(float dt);
+    // Runs as many steps of fixedDt as fit up to time (microseconds), at
+    // most maxSteps of them, and returns how many.  The first call only
+    // sets the clock going.
+    int advance(uint64_t time);
+    float fixedDt;
+    int maxSteps;
+
+    uint16_t stick(int craft, Channel c) const;
+
+    static Kernel best();
+    static const char* kernelName(Kernel k);
+    void setKernel(Kernel k) { _kernel = k; }
+    Kernel kernel() const { return _kernel; }
+
+    AxisGains defaults[AXES];
+
+    // One axis of every craft, padded to a multiple of eight.
+    struct Lanes {
+        std::vector<float> pos, vel, target;
+        std::vector<float> kp, maxSpeed, vkp, vki, vkd, trim, maxRate;
+        std::vector<float> integral, lastVel, out;
+        void resize(int n);
+    };
+
+private:
+    Kernel _kernel;
+    int _n;
+    Lanes _axes[AXES];
+    std::vector<float> _armed; // 1 or 0
+    std::vector<float> _rudder;
+    uint64_t _clock, _steps;
+    bool _started;
+};
+
+#endif
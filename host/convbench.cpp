@@ -0,0 +1,174 @@
+/*
+  convbench - times the native convnet on random frames, with each kernel
+  the CPU supports, and checks they agree with the scalar one.
+
+    convbench [-n frames] [-s WxH] [-j threads] [-p decode_ms] [convnet.weights]
+
+  -j runs that many independent networks at once, as several cameras
+  would.  -p feeds the network from a FrameRing whose decoder takes
+  decode_ms a frame, and compares that with decoding and inferring in turn.
+  vision/convbench.lua times the Torch forward pass for comparison.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "convnet.h"
+#include "framering.h"
+
+static int frames = 100, width = 640, height = 360;
+static std::vector<float> input;
+static const float* planes[ConvNet::MAX_PLANES];
+
+// Seconds per frame.
+static double run(ConvNet& net, std::vector<float>& out) {
+    out.resize((width - ConvNet::SHRINK) * (height - ConvNet::SHRINK));
+    net.forward(planes, width, width, height, &out[0], width - ConvNet::SHRINK); // warm up
+    uint64_t start = monotonicMicros();
+    for (int i = 0; i < frames; i++)
+        net.forward(planes, width, width, height, &out[0], width - ConvNet::SHRINK);
+    return (monotonicMicros() - start) * 1e-6 / frames;
+}
+
+// Stands in for a decoder: draws a square moving over the test input,
+// taking decode_ms about it.
+static bool decode(float* data, uint64_t* time_us, double decode_ms, int n) {
+    static int frame;
+    uint64_t start = monotonicMicros();
+    do {
+        memcpy(data, &input[0], n * width * height * sizeof(float));
+        int x0 = frame % (width - 16), y0 = frame % (height - 16);
+        for (int c = 0; c < n; c++)
+            for (int y = y0; y < y0 + 16; y++)
+                for (int x = x0; x < x0 + 16; x++)
+                    data[(c * height + y) * width + x] = 1;
+    } while (monotonicMicros() - start < decode_ms * 1000);
+    frame++;
+    *time_us = monotonicMicros();
+    return true;
+}
+
+static void pipeline(ConvNet& net, double decode_ms) {
+    int n = net.inputs() / 2; // planes per frame
+    size_t size = n * width * height;
+    int outWidth = width - ConvNet::SHRINK;
+    std::vector<float> out(outWidth * (height - ConvNet::SHRINK));
+    const float* planes[ConvNet::MAX_PLANES];
+    uint64_t t;
+
+    // Decode into alternate buffers, then infer, one after the other.
+    std::vector<float> buf(2 * size);
+    uint64_t start = monotonicMicros();
+    for (int i = 0; i <= frames; i++) {
+        float* cur = &buf[(i & 1) * size];
+        const float* prev = &buf[((i + 1) & 1) * size];
+        decode(cur, &t, decode_ms, n);
+        if (i == 0)
+            continue;
+        for (int c = 0; c < n; c++) {
+            planes[c] = cur + c * width * height;
+            planes[n + c] = prev + c * width * height;
+        }
+        net.forward(planes, width, width, height, &out[0], outWidth);
+    }
+    double serial = (monotonicMicros() - start) * 1e-6 / frames;
+
+    FrameRing ring(n, width, height);
+    start = monotonicMicros();
+    ring.start([decode_ms, n](float* data, uint64_t* time_us) { return decode(data, time_us, decode_ms, n); });
+    ring.next();
+    for (int i = 0; i < frames && ring.next(); i++) {
+        ring.planes(2, planes);
+        net.forward(planes, width, width, height, &out[0], outWidth);
+    }
+    double piped = (monotonicMicros() - start) * 1e-6 / frames;
+    ring.stop();
+    printf("decode %.1f ms: serial %8.1f fps, through FrameRing %8.1f fps\n", decode_ms, 1 / serial, 1 / piped);
+}
+
+int main(int argc, char** argv) {
+    int threads = 0;
+    double decode_ms = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:j:p:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+                width = 0;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'p':
+            decode_ms = atof(optarg);
+            break;
+        default:
+            width = 0;
+        }
+    }
+    if (frames <= 0 || width <= ConvNet::SHRINK || height <= ConvNet::SHRINK || optind + 1 < argc) {
+        fprintf(stderr, "usage: %s [-n frames] [-s WxH] [-j threads] [-p decode_ms] [convnet.weights]\n", argv[0]);
+        return 1;
+    }
+    ConvNet net;
+    if (optind < argc) {
+        if (!net.load(argv[optind])) {
+            fprintf(stderr, "%s: can't load weights\n", argv[optind]);
+            return 1;
+        }
+    } else {
+        net.randomize(1);
+    }
+
+    int n = net.inputs();
+    input.resize(n * width * height);
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = rand() / (float)RAND_MAX;
+    for (int i = 0; i < n; i++)
+        planes[i] = &input[i * width * height];
+
+    printf("%dx%d, %d-%d-%d-%d planes\n", width, height, net.layer(0).nIn, net.layer(0).nOut,
+           net.layer(1).nOut, net.layer(2).nOut);
+    std::vector<float> reference, out;
+    for (int k = ConvNet::SCALAR; k <= ConvNet::best(); k++) {
+        net.setKernel((ConvNet::Kernel)k);
+        double t = run(net, k == ConvNet::SCALAR ? reference : out);
+        printf("%-8s %8.2f ms/frame %8.1f fps", ConvNet::kernelName((ConvNet::Kernel)k), t * 1e3, 1 / t);
+        if (k != ConvNet::SCALAR) {
+            double diff = 0;
+            for (size_t i = 0; i < out.size(); i++)
+                diff = fmax(diff, fabs(out[i] - reference[i]));
+            printf("   max diff %.2g", diff);
+        }
+        printf("\n");
+    }
+
+    if (threads > 0) {
+        std::vector<std::thread> workers;
+        uint64_t start = monotonicMicros();
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(std::thread([&net]() {
+                ConvNet mine = net;
+                std::vector<float> result;
+                run(mine, result);
+            }));
+        }
+        for (int i = 0; i < threads; i++)
+            workers[i].join();
+        double elapsed = (monotonicMicros() - start) * 1e-6;
+        printf("%d threads %8.1f fps total\n", threads, threads * (frames + 1) / elapsed);
+    }
+    if (decode_ms >= 0) {
+        net.setKernel(ConvNet::best());
+        pipeline(net, decode_ms);
+    }
+    return 0;
+}
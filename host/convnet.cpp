@@ -0,0 +1,383 @@
+#include "convnet.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <random>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// The planes vision.lua's network has at each layer boundary.
+static const int defaultPlanes[ConvNet::LAYERS + 1] = { 6, 4, 3, 1 };
+
+static const float zeros[ConvNet::MAX_PLANES * 9] = {};
+
+// in[i * 3 + ky] is row ky of the three row window over input plane i.
+// Writes width raw (no ReLU) outputs to each out[o].
+typedef void (*ConvKernel)(const ConvLayer& l, const float* const* in, int width, float* const* out);
+// out[x] = max(0, in[x - 1], in[x], in[x + 1]): ReLU and the horizontal
+// half of the pooling.  in[-1] and in[width] must be readable and zero.
+typedef void (*ReluPoolKernel)(const float* in, int width, float* out);
+// out[x] = max(a[x], b[x], c[x]): the vertical half.
+typedef void (*MaxKernel)(const float* a, const float* b, const float* c, int width, float* out);
+
+static void convScalar(const ConvLayer& l, const float* const* in, int width, float* const* out) {
+    for (int o = 0; o < l.nOut; o++) {
+        const float* w = &l.weight[o * l.nIn * 9];
+        for (int x = 0; x < width; x++) {
+            float sum = l.bias[o];
+            for (int r = 0; r < l.nIn * 3; r++)
+                for (int kx = 0; kx < 3; kx++)
+                    sum += w[r * 3 + kx] * in[r][x + kx];
+            out[o][x] = sum;
+        }
+    }
+}
+
+static void reluPoolScalar(const float* in, int width, float* out) {
+    for (int x = 0; x < width; x++)
+        out[x] = fmaxf(fmaxf(0, in[x - 1]), fmaxf(in[x], in[x + 1]));
+}
+
+static void maxScalar(const float* a, const float* b, const float* c, int width, float* out) {
+    for (int x = 0; x < width; x++)
+        out[x] = fmaxf(a[x], fmaxf(b[x], c[x]));
+}
+
+#if defined(__x86_64__)
+
+// The vector kernels work out four output planes at once, so each input
+// load feeds four multiply-adds.  Layers with fewer planes multiply by
+// zeros for the rest.  Rows that aren't a whole number of vectors finish
+// with a vector overlapping the one before.
+
+static void weightGroup(const ConvLayer& l, int o0, const float** w, float* b) {
+    for (int k = 0; k < 4; k++) {
+        bool real = o0 + k < l.nOut;
+        w[k] = real ? &l.weight[(o0 + k) * l.nIn * 9] : zeros;
+        b[k] = real ? l.bias[o0 + k] : 0;
+    }
+}
+
+static void convSse(const ConvLayer& l, const float* const* in, int width, float* const* out) {
+    if (width < 4) {
+        convScalar(l, in, width, out);
+        return;
+    }
+    for (int o0 = 0; o0 < l.nOut; o0 += 4) {
+        const float* w[4];
+        float b[4];
+        weightGroup(l, o0, w, b);
+        for (int x = 0; x < width; x += 4) {
+            if (x + 4 > width)
+                x = width - 4;
+            __m128 a0 = _mm_set1_ps(b[0]), a1 = _mm_set1_ps(b[1]);
+            __m128 a2 = _mm_set1_ps(b[2]), a3 = _mm_set1_ps(b[3]);
+            for (int r = 0; r < l.nIn * 3; r++) {
+                const float* p = in[r] + x;
+                for (int kx = 0; kx < 3; kx++) {
+                    __m128 v = _mm_loadu_ps(p + kx);
+                    int t = r * 3 + kx;
+                    a0 = _mm_add_ps(a0, _mm_mul_ps(v, _mm_set1_ps(w[0][t])));
+                    a1 = _mm_add_ps(a1, _mm_mul_ps(v, _mm_set1_ps(w[1][t])));
+                    a2 = _mm_add_ps(a2, _mm_mul_ps(v, _mm_set1_ps(w[2][t])));
+                    a3 = _mm_add_ps(a3, _mm_mul_ps(v, _mm_set1_ps(w[3][t])));
+                }
+            }
+            _mm_storeu_ps(out[o0] + x, a0);
+            if (o0 + 1 < l.nOut)
+                _mm_storeu_ps(out[o0 + 1] + x, a1);
+            if (o0 + 2 < l.nOut)
+                _mm_storeu_ps(out[o0 + 2] + x, a2);
+            if (o0 + 3 < l.nOut)
+                _mm_storeu_ps(out[o0 + 3] + x, a3);
+        }
+    }
+}
+
+static void reluPoolSse(const float* in, int width, float* out) {
+    if (width < 4) {
+        reluPoolScalar(in, width, out);
+        return;
+    }
+    __m128 zero = _mm_setzero_ps();
+    for (int x = 0; x < width; x += 4) {
+        if (x + 4 > width)
+            x = width - 4;
+        __m128 m = _mm_max_ps(_mm_loadu_ps(in + x - 1), _mm_loadu_ps(in + x));
+        m = _mm_max_ps(m, _mm_loadu_ps(in + x + 1));
+        _mm_storeu_ps(out + x, _mm_max_ps(m, zero));
+    }
+}
+
+static void maxSse(const float* a, const float* b, const float* c, int width, float* out) {
+    if (width < 4) {
+        maxScalar(a, b, c, width, out);
+        return;
+    }
+    for (int x = 0; x < width; x += 4) {
+        if (x + 4 > width)
+            x = width - 4;
+        __m128 m = _mm_max_ps(_mm_loadu_ps(a + x), _mm_loadu_ps(b + x));
+        _mm_storeu_ps(out + x, _mm_max_ps(m, _mm_loadu_ps(c + x)));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void convAvx2(const ConvLayer& l, const float* const* in, int width, float* const* out) {
+    if (width < 8) {
+        convSse(l, in, width, out);
+        return;
+    }
+    for (int o0 = 0; o0 < l.nOut; o0 += 4) {
+        const float* w[4];
+        float b[4];
+        weightGroup(l, o0, w, b);
+        for (int x = 0; x < width; x += 8) {
+            if (x + 8 > width)
+                x = width - 8;
+            __m256 a0 = _mm256_set1_ps(b[0]), a1 = _mm256_set1_ps(b[1]);
+            __m256 a2 = _mm256_set1_ps(b[2]), a3 = _mm256_set1_ps(b[3]);
+            for (int r = 0; r < l.nIn * 3; r++) {
+                const float* p = in[r] + x;
+                for (int kx = 0; kx < 3; kx++) {
+                    __m256 v = _mm256_loadu_ps(p + kx);
+                    int t = r * 3 + kx;
+                    a0 = _mm256_fmadd_ps(v, _mm256_broadcast_ss(&w[0][t]), a0);
+                    a1 = _mm256_fmadd_ps(v, _mm256_broadcast_ss(&w[1][t]), a1);
+                    a2 = _mm256_fmadd_ps(v, _mm256_broadcast_ss(&w[2][t]), a2);
+                    a3 = _mm256_fmadd_ps(v, _mm256_broadcast_ss(&w[3][t]), a3);
+                }
+            }
+            _mm256_storeu_ps(out[o0] + x, a0);
+            if (o0 + 1 < l.nOut)
+                _mm256_storeu_ps(out[o0 + 1] + x, a1);
+            if (o0 + 2 < l.nOut)
+                _mm256_storeu_ps(out[o0 + 2] + x, a2);
+            if (o0 + 3 < l.nOut)
+                _mm256_storeu_ps(out[o0 + 3] + x, a3);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void reluPoolAvx2(const float* in, int width, float* out) {
+    if (width < 8) {
+        reluPoolSse(in, width, out);
+        return;
+    }
+    __m256 zero = _mm256_setzero_ps();
+    for (int x = 0; x < width; x += 8) {
+        if (x + 8 > width)
+            x = width - 8;
+        __m256 m = _mm256_max_ps(_mm256_loadu_ps(in + x - 1), _mm256_loadu_ps(in + x));
+        m = _mm256_max_ps(m, _mm256_loadu_ps(in + x + 1));
+        _mm256_storeu_ps(out + x, _mm256_max_ps(m, zero));
+    }
+}
+
+__attribute__((target("avx2")))
+static void maxAvx2(const float* a, const float* b, const float* c, int width, float* out) {
+    if (width < 8) {
+        maxSse(a, b, c, width, out);
+        return;
+    }
+    for (int x = 0; x < width; x += 8) {
+        if (x + 8 > width)
+            x = width - 8;
+        __m256 m = _mm256_max_ps(_mm256_loadu_ps(a + x), _mm256_loadu_ps(b + x));
+        _mm256_storeu_ps(out + x, _mm256_max_ps(m, _mm256_loadu_ps(c + x)));
+    }
+}
+
+#else
+#define convSse convScalar
+#define reluPoolSse reluPoolScalar
+#define maxSse maxScalar
+#define convAvx2 convScalar
+#define reluPoolAvx2 reluPoolScalar
+#define maxAvx2 maxScalar
+#endif
+
+static const struct {
+    ConvKernel conv;
+    ReluPoolKernel reluPool;
+    MaxKernel max;
+} kernels[] = {
+    { convScalar, reluPoolScalar, maxScalar },
+    { convSse, reluPoolSse, maxSse },
+    { convAvx2, reluPoolAvx2, maxAvx2 },
+};
+
+ConvNet::Kernel ConvNet::best() {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return AVX2;
+    return SSE;
+#else
+    return SCALAR;
+#endif
+}
+
+const char* ConvNet::kernelName(Kernel k) {
+    static const char* names[] = { "scalar", "sse", "avx2" };
+    return names[k];
+}
+
+ConvNet::ConvNet() : _kernel(best()) {
+    _shape(defaultPlanes);
+}
+
+void ConvNet::_shape(const int* planes) {
+    for (int i = 0; i < LAYERS; i++) {
+        ConvLayer& l = _layers[i];
+        l.nIn = planes[i];
+        l.nOut = planes[i + 1];
+        l.weight.assign(l.nOut * l.nIn * 9, 0);
+        l.bias.assign(l.nOut, 0);
+    }
+}
+
+// The file is what convnet.save() writes: "convnet <layers>", then for
+// each layer "<nOut> <nIn> <kH> <kW>" and its weights and biases, one
+// number per line.
+bool ConvNet::load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return false;
+    int layers;
+    bool ok = fscanf(f, "convnet %d", &layers) == 1 && layers == LAYERS;
+    int planes[LAYERS + 1];
+    std::vector<float> values[LAYERS];
+    for (int i = 0; ok && i < LAYERS; i++) {
+        int nOut, nIn, kH, kW;
+        ok = fscanf(f, "%d %d %d %d", &nOut, &nIn, &kH, &kW) == 4 && kH == 3 && kW == 3
+             && nIn > 0 && nIn <= MAX_PLANES && nOut > 0 && nOut <= MAX_PLANES
+             && (i == 0 || nIn == planes[i]) && (i < LAYERS - 1 || nOut == 1);
+        planes[i] = nIn;
+        planes[i + 1] = nOut;
+        values[i].resize(nOut * nIn * 9 + nOut);
+        for (size_t k = 0; ok && k < values[i].size(); k++)
+            ok = fscanf(f, "%f", &values[i][k]) == 1;
+    }
+    fclose(f);
+    if (!ok)
+        return false;
+    _shape(planes);
+    for (int i = 0; i < LAYERS; i++) {
+        ConvLayer& l = _layers[i];
+        l.weight.assign(values[i].begin(), values[i].begin() + l.weight.size());
+        l.bias.assign(values[i].begin() + l.weight.size(), values[i].end());
+    }
+    return true;
+}
+
+// Uniform in +-1/sqrt(fan in), as Torch initialises them.
+void ConvNet::randomize(unsigned seed) {
+    std::mt19937 rng(seed);
+    for (int i = 0; i < LAYERS; i++) {
+        ConvLayer& l = _layers[i];
+        float range = 1 / sqrtf(l.nIn * 9);
+        std::uniform_real_distribution<float> u(-range, range);
+        for (size_t k = 0; k < l.weight.size(); k++)
+            l.weight[k] = u(rng);
+        for (size_t k = 0; k < l.bias.size(); k++)
+            l.bias[k] = u(rng);
+    }
+}
+
+void ConvNet::Rows::resize(int c, int width) {
+    channels = c;
+    pitch = (width + 7) & ~7;
+    data.resize(4 * channels * pitch);
+}
+
+void ConvNet::_convPool(int layer, const float* const* in, int width, Rows& dst, int y) {
+    const ConvLayer& l = _layers[layer];
+    int pitch = width + 8;
+    float* raw[MAX_PLANES];
+    for (int o = 0; o < l.nOut; o++) {
+        raw[o] = &_scratch[o * pitch + 4];
+        raw[o][-1] = raw[o][width] = 0;
+    }
+    kernels[_kernel].conv(l, in, width, raw);
+    for (int o = 0; o < l.nOut; o++)
+        kernels[_kernel].reluPool(raw[o], width, dst.row(o, y));
+}
+
+// Vertical max over rows y - 1 to y + 1 of src, which is height rows tall.
+// Torch pads with -inf, so the edge rows just take the max of two.
+void ConvNet::_pool(Rows& src, int y, int height, int width, Rows& dst) {
+    int above = y > 0 ? y - 1 : y;
+    int below = y + 1 < height ? y + 1 : y;
+    for (int c = 0; c < src.channels; c++)
+        kernels[_kernel].max(src.row(c, above), src.row(c, y), src.row(c, below), width, dst.row(c, y));
+}
+
+void ConvNet::_hidden1(int y) {
+    while (_next[0] <= y) {
+        int r = _next[0]++;
+        const float* in[MAX_PLANES * 3];
+        for (int i = 0; i < _layers[0].nIn; i++)
+            for (int ky = 0; ky < 3; ky++)
+                in[i * 3 + ky] = _planes[i] + (r + ky) * _stride;
+        _convPool(0, in, _width - 2, _h1, r);
+    }
+}
+
+void ConvNet::_pooled1(int y) {
+    int height = _height - 2;
+    while (_next[1] <= y) {
+        int r = _next[1]++;
+        _hidden1(r + 1 < height ? r + 1 : r);
+        _pool(_h1, r, height, _width - 2, _p1);
+    }
+}
+
+void ConvNet::_hidden2(int y) {
+    while (_next[2] <= y) {
+        int r = _next[2]++;
+        _pooled1(r + 2);
+        const float* in[MAX_PLANES * 3];
+        for (int i = 0; i < _layers[1].nIn; i++)
+            for (int ky = 0; ky < 3; ky++)
+                in[i * 3 + ky] = _p1.row(i, r + ky);
+        _convPool(1, in, _width - 4, _h2, r);
+    }
+}
+
+void ConvNet::_pooled2(int y) {
+    int height = _height - 4;
+    while (_next[3] <= y) {
+        int r = _next[3]++;
+        _hidden2(r + 1 < height ? r + 1 : r);
+        _pool(_h2, r, height, _width - 4, _p2);
+    }
+}
+
+void ConvNet::forward(const float* const* planes, int stride, int width, int height, float* out, int outStride) {
+    if (width <= SHRINK || height <= SHRINK)
+        return;
+    _planes = planes;
+    _stride = stride;
+    _width = width;
+    _height = height;
+    _h1.resize(_layers[0].nOut, width - 2);
+    _p1.resize(_layers[0].nOut, width - 2);
+    _h2.resize(_layers[1].nOut, width - 4);
+    _p2.resize(_layers[1].nOut, width - 4);
+    _scratch.resize(MAX_PLANES * (width + 8));
+    memset(_next, 0, sizeof(_next));
+    const ConvLayer& last = _layers[LAYERS - 1];
+    for (int y = 0; y < height - SHRINK; y++) {
+        _pooled2(y + 2);
+        const float* in[MAX_PLANES * 3];
+        for (int i = 0; i < last.nIn; i++)
+            for (int ky = 0; ky < 3; ky++)
+                in[i * 3 + ky] = _p2.row(i, y + ky);
+        float* row = out + y * outStride;
+        kernels[_kernel].conv(last, in, width - SHRINK, &row);
+    }
+}
@@ -0,0 +1,81 @@
+/*
+  convnet.h - Native inference for the two-frame network in vision.lua.
+
+  The topology is the one get_net() in vision/convnet.lua builds: the
+  current and previous frames joined into one stack of planes, then three
+  3x3 convolutions, the first two followed by ReLU and 3x3 stride 1 max
+  pooling (Dropout is the identity at inference).  Weights are exported
+  from Lua with convnet.save().
+
+  Rows flow through all three layers as soon as their inputs exist, so the
+  intermediate maps are never held in full; a few rows of each stay in
+  cache instead.  Convolution, ReLU and the horizontal half of the pooling
+  are fused in one kernel, with AVX2 and SSE versions picked at run time.
+*/
+#ifndef ConvNet_h
+#define ConvNet_h
+
+#include <vector>
+
+struct ConvLayer {
+    int nIn, nOut;
+    std::vector<float> weight; // [nOut][nIn][3][3], as Torch stores it
+    std::vector<float> bias;
+};
+
+class ConvNet {
+public:
+    enum Kernel { SCALAR, SSE, AVX2 };
+    static const int LAYERS = 3;
+    static const int SHRINK = 2 * LAYERS; // each unpadded 3x3 loses two rows and columns
+    static const int MAX_PLANES = 16;
+
+    ConvNet();
+    // Reads weights written by convnet.save() in vision/convnet.lua.
+    bool load(const char* path);
+    // Random weights, for benchmarking without a trained model.
+    void randomize(unsigned seed);
+    int inputs() const { return _layers[0].nIn; }
+    const ConvLayer& layer(int i) const { return _layers[i]; }
+    ConvLayer& layer(int i) { return _layers[i]; } // keep the sizes as they are
+
+    // The fastest this CPU supports; set by default.
+    static Kernel best();
+    static const char* kernelName(Kernel k);
+    void setKernel(Kernel k) { _kernel = k; }
+    Kernel kernel() const { return _kernel; }
+
+    // planes[i] points at the top left of input plane i (current frame's
+    // channels, then the previous frame's), with rows stride floats apart.
+    // Writes height - SHRINK rows of width - SHRINK outputs, outStride
+    // apart.  Not reentrant: use one ConvNet per thread.
+    void forward(const float* const* planes, int stride, int width, int height, float* out, int outStride);
+
+private:
+    // A few consecutive rows of one layer's output, all channels.
+    struct Rows {
+        int channels, pitch;
+        std::vector<float> data;
+        void resize(int channels, int width);
+        float* row(int c, int y) { return &data[((y & 3) * channels + c) * pitch]; }
+    };
+    void _shape(const int* planes);
+    void _convPool(int layer, const float* const* in, int width, Rows& dst, int y);
+    void _pool(Rows& src, int y, int height, int width, Rows& dst);
+    void _hidden1(int y);
+    void _pooled1(int y);
+    void _hidden2(int y);
+    void _pooled2(int y);
+
+    ConvLayer _layers[LAYERS];
+    Kernel _kernel;
+
+    // Per forward() call
+    const float* const* _planes;
+    int _stride, _width, _height;
+    Rows _h1, _p1, _h2, _p2; // conv+ReLU+horizontal pool, then vertical pool
+    int _next[4];            // next row of each of those to compute
+    std::vector<float> _scratch; // raw convolution rows, with a zero either side
+};
+
+#endif
@@ -0,0 +1,527 @@
+/*
+  evaluate - replays labelled video through the detector and scores it.
+
+    evaluate [-n frames] [-s WxH] [-e float|int8|motion|roi|pyramid] [-k kernel]
+             [-H holdout] [-d 2,4,8,16] [-t threshold] [-c calibration]
+             [-j out.json] [-v video -l annotations] [convnet.weights]
+
+  Every frame goes through the whole pipeline: decode, inference, finding
+  the minima, tracking.  The labelled frames (with -H, only those whose
+  number is a multiple of holdout, the ones vision/train.lua -holdout left
+  out) are scored.  Without -v the scene is synthetic squares, which are
+  their own labels, and unless weights are given the network is made by
+  hand to find them.
+
+  The engine is the float network (-k picks its kernel: scalar, sse or
+  avx2), the 8 bit one calibrated on the first frames, the float one
+  behind MotionGate, RoiDetector fed by the tracker, or PyramidDetector.
+  The last two do the finding themselves.
+
+  Detections and confirmed tracks are each matched one to one with the
+  labels (Hungarian, on distance), then for each distance threshold
+  precision is the share of detections within it of a label and recall
+  the share of labels within it of a detection.  Labels marked unsure or
+  occluded may be matched but are not missed, and what matches them
+  counts neither way.  Localisation error is over matches within the
+  largest threshold.  Each stage gets a frame rate from its mean time and
+  latency percentiles.  -j writes all of it as JSON; "-" is stdout, and
+  the tables then go to stderr.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "annotations.h"
+#include "clock.h"
+#include "convnet.h"
+#include "hungarian.h"
+#include "motion.h"
+#include "pyramid.h"
+#include "quantnet.h"
+#include "roi.h"
+#include "tracker.h"
+
+#define SIZE 8        // of a synthetic craft, pixels
+#define FRAME_US 33333 // frames are taken to be 30/s apart
+// Output (x, y) is centred on input (x + OFFSET, y + OFFSET).
+#define OFFSET (ConvNet::SHRINK / 2)
+
+static int width = 640, height = 360;
+
+// Frames one after another, as planes of floats 0..1, with the labels for
+// each.  labels is false for frames nobody has looked at.
+class Source {
+public:
+    virtual ~Source() {}
+    virtual bool next(std::vector<float>& frame, std::vector<LabelPoint>& truth, bool& labelled) = 0;
+};
+
+class VideoSource : public Source {
+public:
+    VideoSource(const char* path, const Annotations& labels) : _labels(labels), _index(0) {
+        char cmd[1024];
+        snprintf(cmd, sizeof(cmd), "ffmpeg -loglevel error -i '%s' -f rawvideo -pix_fmt rgb24 -s %dx%d -", path,
+                 width, height);
+        _pipe = popen(cmd, "r");
+        _rgb.resize(width * height * 3);
+    }
+    ~VideoSource() {
+        if (_pipe)
+            pclose(_pipe);
+    }
+    bool next(std::vector<float>& frame, std::vector<LabelPoint>& truth, bool& labelled) {
+        if (!_pipe || fread(&_rgb[0], 1, _rgb.size(), _pipe) != _rgb.size())
+            return false;
+        int n = width * height;
+        frame.resize(3 * n);
+        for (int i = 0; i < n; i++)
+            for (int c = 0; c < 3; c++)
+                frame[c * n + i] = _rgb[i * 3 + c] / 255.0f;
+        const FrameLabels* l = _labels.frame(_index++);
+        labelled = l && (l->flags & FRAME_LABELLED) && !(l->flags & FRAME_SKIP);
+        truth.assign(l ? l->points : NULL, l ? l->points + l->count : NULL);
+        return true;
+    }
+
+private:
+    const Annotations& _labels;
+    uint32_t _index;
+    FILE* _pipe;
+    std::vector<uint8_t> _rgb;
+};
+
+class SyntheticSource : public Source {
+public:
+    SyntheticSource(int craft) : _rng(1) {
+        std::uniform_real_distribution<float> u(0, 1);
+        for (int k = 0; k < craft; k++) {
+            Craft c = { SIZE + u(_rng) * (width - 2 * SIZE), SIZE + u(_rng) * (height - 2 * SIZE), u(_rng) * 4 - 2,
+                        u(_rng) * 4 - 2 };
+            _craft.push_back(c);
+        }
+    }
+    bool next(std::vector<float>& frame, std::vector<LabelPoint>& truth, bool& labelled) {
+        std::uniform_real_distribution<float> noise(0, 0.3f);
+        frame.resize(3 * width * height);
+        for (size_t i = 0; i < frame.size(); i++)
+            frame[i] = noise(_rng);
+        truth.clear();
+        for (size_t k = 0; k < _craft.size(); k++) {
+            Craft& c = _craft[k];
+            c.x += c.vx;
+            c.y += c.vy;
+            if (c.x < SIZE || c.x > width - SIZE)
+                c.vx = -c.vx;
+            if (c.y < SIZE || c.y > height - SIZE)
+                c.vy = -c.vy;
+            int x0 = lroundf(c.x) - SIZE / 2, y0 = lroundf(c.y) - SIZE / 2;
+            for (int p = 0; p < 3; p++)
+                for (int y = y0; y < y0 + SIZE; y++)
+                    for (int x = x0; x < x0 + SIZE; x++)
+                        frame[(p * height + y) * width + x] = 1;
+            // The centre of the pixels drawn.
+            LabelPoint l = { x0 + (SIZE - 1) / 2.0f, y0 + (SIZE - 1) / 2.0f, (int16_t)k, 0 };
+            truth.push_back(l);
+        }
+        labelled = true;
+        return true;
+    }
+
+private:
+    struct Craft {
+        float x, y, vx, vy;
+    };
+    std::mt19937 _rng;
+    std::vector<Craft> _craft;
+};
+
+static void blobWeights(ConvNet& net) {
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        ConvLayer& l = net.layer(i);
+        l.weight.assign(l.weight.size(), 0);
+        l.bias.assign(l.bias.size(), 0);
+        l.weight[4] = i < ConvNet::LAYERS - 1 ? 1 : -1;
+    }
+    net.layer(ConvNet::LAYERS - 1).bias[0] = 0.5;
+}
+
+static double mean(const std::vector<double>& v) {
+    double sum = 0;
+    for (size_t i = 0; i < v.size(); i++)
+        sum += v[i];
+    return v.empty() ? 0 : sum / v.size();
+}
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty())
+        return 0;
+    size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+struct Stage {
+    const char* name;
+    std::vector<double> ms; // per frame
+};
+
+// Detections (or tracks) against labels, over all the scored frames.
+struct Score {
+    const char* name;
+    std::vector<int> hits;   // per threshold
+    int found, labels;       // not counting those matched to don't cares
+    std::vector<double> error;
+
+    void add(const std::vector<Detection>& found, const std::vector<LabelPoint>& truth,
+             const std::vector<float>& thresholds);
+};
+
+void Score::add(const std::vector<Detection>& det, const std::vector<LabelPoint>& truth,
+                const std::vector<float>& thresholds) {
+    float limit = thresholds.back();
+    int rows = det.size(), cols = truth.size();
+    std::vector<float> cost(rows * cols);
+    for (int i = 0; i < rows; i++) {
+        for (int k = 0; k < cols; k++) {
+            float d = hypotf(det[i].x - truth[k].x, det[i].y - truth[k].y);
+            cost[i * cols + k] = d <= limit ? d : HUNGARIAN_FORBIDDEN;
+        }
+    }
+    std::vector<int> match;
+    if (rows && cols)
+        hungarian(cost, rows, cols, match);
+    else
+        match.assign(rows, -1);
+    for (int i = 0; i < rows; i++) {
+        int k = match[i];
+        if (k >= 0) {
+            if (truth[k].flags & (POINT_OCCLUDED | POINT_UNSURE))
+                continue;
+            float d = cost[i * cols + k];
+            error.push_back(d);
+            for (size_t t = 0; t < thresholds.size(); t++)
+                hits[t] += d <= thresholds[t];
+        }
+        found++;
+    }
+    for (int k = 0; k < cols; k++)
+        labels += !(truth[k].flags & (POINT_OCCLUDED | POINT_UNSURE));
+}
+
+
+static void printScore(FILE* f, const Score& s, const std::vector<float>& thresholds) {
+    fprintf(f, "%-10s %6d %6d %7.2f %7.2f %7.2f", s.name, s.found, s.labels, mean(s.error),
+            percentile(s.error, 0.5), percentile(s.error, 0.9));
+    for (size_t t = 0; t < thresholds.size(); t++)
+        fprintf(f, "  %5.3f %5.3f", s.found ? (double)s.hits[t] / s.found : 0,
+                s.labels ? (double)s.hits[t] / s.labels : 0);
+    fprintf(f, "\n");
+}
+
+static void jsonString(FILE* f, const char* s) {
+    putc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            putc('\\', f);
+        if ((unsigned char)*s >= ' ')
+            putc(*s, f);
+    }
+    putc('"', f);
+}
+
+static void jsonScore(FILE* f, const Score& s, const std::vector<float>& thresholds) {
+    fprintf(f, "    \"%s\": {\"found\": %d, \"labels\": %d, ", s.name, s.found, s.labels);
+    fprintf(f, "\"error_px\": {\"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f}, \"thresholds\": [", mean(s.error),
+            percentile(s.error, 0.5), percentile(s.error, 0.9));
+    for (size_t t = 0; t < thresholds.size(); t++) {
+        double p = s.found ? (double)s.hits[t] / s.found : 0, r = s.labels ? (double)s.hits[t] / s.labels : 0;
+        fprintf(f, "%s{\"px\": %g, \"precision\": %.4f, \"recall\": %.4f, \"f1\": %.4f}", t ? ", " : "",
+                thresholds[t], p, r, p + r > 0 ? 2 * p * r / (p + r) : 0);
+    }
+    fprintf(f, "]}");
+}
+
+static void jsonStage(FILE* f, const Stage& s) {
+    double m = mean(s.ms);
+    fprintf(f, "    \"%s\": {\"fps\": %.2f, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, "
+               "\"max_ms\": %.4f}",
+            s.name, m > 0 ? 1000 / m : 0, m, percentile(s.ms, 0.5), percentile(s.ms, 0.9), percentile(s.ms, 0.99),
+            percentile(s.ms, 1));
+}
+
+enum Engine { FLOAT, INT8, MOTION, ROI, PYRAMID };
+static const char* engineNames[] = { "float", "int8", "motion", "roi", "pyramid" };
+
+int main(int argc, char** argv) {
+    int frames = 300, holdout = 0, calibration = 20;
+    float threshold = 0;
+    Engine engine = FLOAT;
+    const char* kernel = NULL;
+    const char* json = NULL;
+    const char* video = NULL;
+    const char* labelPath = NULL;
+    std::vector<float> thresholds;
+    bool ok = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:e:k:H:d:t:c:j:v:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 's':
+            ok = sscanf(optarg, "%dx%d", &width, &height) == 2;
+            break;
+        case 'e':
+            ok = false;
+            for (int i = FLOAT; i <= PYRAMID && !ok; i++)
+                if (strcmp(optarg, engineNames[i]) == 0)
+                    engine = (Engine)i, ok = true;
+            break;
+        case 'k':
+            kernel = optarg;
+            break;
+        case 'H':
+            holdout = atoi(optarg);
+            break;
+        case 'd':
+            for (char* s = strtok(optarg, ","); s; s = strtok(NULL, ","))
+                thresholds.push_back(atof(s));
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 'c':
+            calibration = atoi(optarg);
+            break;
+        case 'j':
+            json = optarg;
+            break;
+        case 'v':
+            video = optarg;
+            break;
+        case 'l':
+            labelPath = optarg;
+            break;
+        default:
+            ok = false;
+        }
+    }
+    if (thresholds.empty()) {
+        float d[] = { 2, 4, 8, 16 };
+        thresholds.assign(d, d + 4);
+    }
+    std::sort(thresholds.begin(), thresholds.end());
+    if (!ok || frames <= 0 || calibration <= 0 || holdout < 0 || thresholds[0] <= 0 || width < 8 * SIZE ||
+        height < 8 * SIZE || !video != !labelPath) {
+        fprintf(stderr, "usage: %s [-n frames] [-s WxH] [-e float|int8|motion|roi|pyramid] [-k kernel] [-H holdout] "
+                        "[-d 2,4,8,16] [-t threshold] [-c calibration] [-j out.json] [-v video -l annotations] "
+                        "[convnet.weights]\n", argv[0]);
+        return 1;
+    }
+    ConvNet net;
+    const char* weights = optind < argc ? argv[optind] : "synthetic";
+    if (optind < argc) {
+        if (!net.load(argv[optind])) {
+            fprintf(stderr, "%s: can't load weights\n", argv[optind]);
+            return 1;
+        }
+    } else {
+        blobWeights(net);
+    }
+    if (net.inputs() != 6) {
+        fprintf(stderr, "expected a network over two RGB frames\n");
+        return 1;
+    }
+    Annotations labels;
+    if (labelPath && !labels.open(labelPath))
+        return 1;
+
+    const float* planes[ConvNet::MAX_PLANES];
+    std::vector<float> cur, prev;
+    std::vector<LabelPoint> truth;
+    bool labelled;
+    QuantNet* quant = NULL;
+    if (engine == INT8) {
+        quant = new QuantNet(net);
+        Source* src = video ? (Source*)new VideoSource(video, labels) : new SyntheticSource(8);
+        for (int i = 0; i < calibration && src->next(cur, truth, labelled); i++, cur.swap(prev)) {
+            if (!i)
+                continue;
+            for (int c = 0; c < 3; c++) {
+                planes[c] = &cur[c * width * height];
+                planes[3 + c] = &prev[c * width * height];
+            }
+            quant->calibrate(planes, width, width, height);
+        }
+        delete src;
+    }
+    const char* kernelName = engine == INT8 ? QuantNet::kernelName(quant->kernel()) : ConvNet::kernelName(net.kernel());
+    if (kernel) {
+        bool found = false;
+        if (engine == INT8) {
+            for (int k = QuantNet::SCALAR; k <= QuantNet::best() && !found; k++)
+                if ((found = strcmp(kernel, QuantNet::kernelName((QuantNet::Kernel)k)) == 0))
+                    quant->setKernel((QuantNet::Kernel)k);
+        } else {
+            for (int k = ConvNet::SCALAR; k <= ConvNet::best() && !found; k++)
+                if ((found = strcmp(kernel, ConvNet::kernelName((ConvNet::Kernel)k)) == 0))
+                    net.setKernel((ConvNet::Kernel)k);
+        }
+        if (!found) {
+            fprintf(stderr, "%s: no such kernel here\n", kernel);
+            return 1;
+        }
+        kernelName = kernel;
+    }
+
+    MotionGate gate(net);
+    RoiDetector roi(net);
+    roi.threshold = threshold;
+    PyramidDetector pyramid(net);
+    pyramid.threshold = threshold;
+    Tracker tracker;
+    // RoiDetector and PyramidDetector find craft as they go, so there is no
+    // find stage.
+    bool finds = engine == ROI || engine == PYRAMID;
+    Stage stages[] = { { "decode", {} }, { finds ? engineNames[engine] : "infer", {} }, { "find", {} },
+                       { "track", {} }, { "total", {} } };
+    const int nstages = sizeof(stages) / sizeof(stages[0]);
+    Score scores[2] = { { "detections", {}, 0, 0, {} }, { "tracks", {}, 0, 0, {} } };
+    for (int i = 0; i < 2; i++)
+        scores[i].hits.assign(thresholds.size(), 0);
+
+    int ow = width - ConvNet::SHRINK, oh = height - ConvNet::SHRINK;
+    std::vector<float> map(ow * oh);
+    std::vector<Detection> found, predicted, tracked;
+    Source* src = video ? (Source*)new VideoSource(video, labels) : new SyntheticSource(8);
+    int n = 0, scored = 0;
+    uint64_t t0 = monotonicMicros();
+    if (!src->next(prev, truth, labelled)) {
+        fprintf(stderr, "no frames\n");
+        return 1;
+    }
+    for (uint32_t index = 1; n < frames; index++, n++, cur.swap(prev)) {
+        uint64_t t[6];
+        t[0] = monotonicMicros();
+        if (!src->next(cur, truth, labelled))
+            break;
+        for (int c = 0; c < 3; c++) {
+            planes[c] = &cur[c * width * height];
+            planes[3 + c] = &prev[c * width * height];
+        }
+        t[1] = monotonicMicros();
+        found.clear();
+        predicted.clear();
+        if (engine == ROI) {
+            tracker.predict(index * (uint64_t)FRAME_US, predicted);
+            roi.detect(planes, width, width, height, predicted, found);
+            t[2] = t[3] = monotonicMicros();
+        } else if (engine == PYRAMID) {
+            pyramid.detect(planes, width, width, height, found);
+            t[2] = t[3] = monotonicMicros();
+            tracker.predict(index * (uint64_t)FRAME_US, predicted);
+        } else {
+            const float* out = &map[0];
+            if (engine == FLOAT)
+                net.forward(planes, width, width, height, &map[0], ow);
+            else if (engine == INT8)
+                quant->forward(planes, width, width, height, &map[0], ow);
+            else
+                gate.forward(planes, width, width, height), out = gate.output();
+            t[2] = monotonicMicros();
+            findCraft(out, ow, ow, oh, threshold, 8, found);
+            for (size_t k = 0; k < found.size(); k++) {
+                found[k].x += OFFSET;
+                found[k].y += OFFSET;
+            }
+            t[3] = monotonicMicros();
+            tracker.predict(index * (uint64_t)FRAME_US, predicted);
+        }
+        tracker.update(found);
+        t[4] = monotonicMicros();
+        for (int s = 0; s < 4; s++)
+            stages[s].ms.push_back((t[s + 1] - t[s]) * 1e-3);
+        stages[4].ms.push_back((t[4] - t[0]) * 1e-3);
+
+        if (!labelled || (holdout && index % holdout))
+            continue;
+        tracked.clear();
+        for (size_t k = 0; k < tracker.tracks().size(); k++) {
+            const Track& tr = tracker.tracks()[k];
+            if (tr.confirmed) {
+                Detection d = { tr.x, tr.y, 0 };
+                tracked.push_back(d);
+            }
+        }
+        scores[0].add(found, truth, thresholds);
+        scores[1].add(tracked, truth, thresholds);
+        scored++;
+    }
+    double elapsed = (monotonicMicros() - t0) * 1e-6;
+    delete src;
+    delete quant;
+    if (!n) {
+        fprintf(stderr, "no frames\n");
+        return 1;
+    }
+
+    // With the JSON on stdout the tables go to stderr, out of its way.
+    FILE* out = json && strcmp(json, "-") == 0 ? stderr : stdout;
+    fprintf(out, "%s on %s at %dx%d: %s engine, %s kernel, %d frames, %d scored, %.1f s\n", weights,
+            video ? video : "synthetic", width, height, engineNames[engine], kernelName, n, scored, elapsed);
+    fprintf(out, "           found labels  err px     p50     p90");
+    for (size_t t = 0; t < thresholds.size(); t++)
+        fprintf(out, "   P@%-3g R@%-3g", thresholds[t], thresholds[t]);
+    fprintf(out, "\n");
+    for (int i = 0; i < 2; i++)
+        printScore(out, scores[i], thresholds);
+    fprintf(out, "stage        fps  mean ms   p50 ms   p90 ms   p99 ms   max ms\n");
+    for (int s = 0; s < nstages; s++) {
+        if (finds && s == 2)
+            continue;
+        const Stage& st = stages[s];
+        double m = mean(st.ms);
+        fprintf(out, "%-8s %7.1f %8.3f %8.3f %8.3f %8.3f %8.3f\n", st.name, m > 0 ? 1000 / m : 0, m,
+                percentile(st.ms, 0.5), percentile(st.ms, 0.9), percentile(st.ms, 0.99), percentile(st.ms, 1));
+    }
+
+    if (json) {
+        FILE* f = strcmp(json, "-") == 0 ? stdout : fopen(json, "w");
+        if (!f) {
+            perror(json);
+            return 1;
+        }
+        fprintf(f, "{\n  \"weights\": ");
+        jsonString(f, weights);
+        fprintf(f, ",\n  \"source\": ");
+        jsonString(f, video ? video : "synthetic");
+        fprintf(f, ",\n  \"width\": %d, \"height\": %d, \"engine\": \"%s\", \"kernel\": ", width, height,
+                engineNames[engine]);
+        jsonString(f, kernelName);
+        fprintf(f, ",\n  \"threshold\": %g, \"holdout\": %d, \"frames\": %d, \"scored\": %d,\n  \"accuracy\": {\n",
+                threshold, holdout, n, scored);
+        for (int i = 0; i < 2; i++) {
+            jsonScore(f, scores[i], thresholds);
+            fprintf(f, i ? "\n" : ",\n");
+        }
+        fprintf(f, "  },\n  \"stages\": {\n");
+        bool first = true;
+        for (int s = 0; s < nstages; s++) {
+            if (finds && s == 2)
+                continue;
+            fprintf(f, first ? "" : ",\n");
+            first = false;
+            jsonStage(f, stages[s]);
+        }
+        fprintf(f, "\n  }\n}\n");
+        if (f != stdout)
+            fclose(f);
+    }
+    return 0;
+}
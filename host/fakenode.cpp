@@ -0,0 +1,297 @@
+/*
+  fakenode - simulates arduino_proxy nodes on ptys, for trying out linkd
+  and the router without any hardware.
+
+    fakenode [-n nodes] [-s slots] [-k node:at[:for[:r]]] ...
+
+  Prints the pty of each node, then answers pings, binds (a craft answers
+  after a few hundred ms), restores, releases and stick updates much as the
+  sketch would.  Every couple of seconds it prints which craft each node is
+  flying and warns if two nodes share a hopping channel.  -k stalls a node
+  at time at (seconds) for a while, or for good; with :r it comes back
+  rebooted, having forgotten its craft.
+
+    ./fakenode -n 3 -k 1:10:5 &
+    ./linkd /dev/pts/5 /dev/pts/6 /dev/pts/7 < /tmp/quad
+*/
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+#include "clock.h"
+#include "link.h"
+
+struct FakeSlot {
+    bool active;
+    uint64_t bindDone; // non-zero while binding
+    uint8_t txid[4];
+    uint8_t aid[4];
+    uint16_t sticks[4];
+};
+
+struct FakeNode {
+    int index;
+    int master;
+    CommandParser parser;
+    std::vector<FakeSlot> slots;
+    int64_t offset; // this node's micros() runs from a different origin...
+    double drift;   // ...and at a slightly different rate
+    uint64_t dieAt, reviveAt;
+    bool reboot;
+};
+
+static std::vector<FakeNode*> nodes;
+static uint64_t start;
+
+static uint32_t micros(const FakeNode& n, uint64_t now) {
+    return (uint32_t)((int64_t)((now - start) * (1 + n.drift)) + n.offset);
+}
+
+static bool dead(const FakeNode& n, uint64_t now) {
+    return n.dieAt && now >= n.dieAt && (!n.reviveAt || now < n.reviveAt);
+}
+
+static void sendTelemetry(FakeNode& n, uint8_t type, const uint8_t* p, uint8_t len) {
+    uint8_t buf[PROTO_MAX_PAYLOAD + 4];
+    uint8_t csum = type ^ len;
+    buf[0] = TLM_SYNC;
+    buf[1] = type;
+    buf[2] = len;
+    for (int i = 0; i < len; i++) {
+        buf[3 + i] = p[i];
+        csum ^= p[i];
+    }
+    buf[3 + len] = csum;
+    if (write(n.master, buf, len + 4) < 0)
+        perror("write");
+}
+
+static void sendBound(FakeNode& n, int slot) {
+    const FakeSlot& s = n.slots[slot];
+    uint8_t p[TLM_BOUND_LEN];
+    p[0] = slot;
+    p[1] = n.slots.size();
+    p[2] = s.bindDone ? BOUND_BINDING : s.active ? BOUND_OK : BOUND_FREE;
+    memcpy(p + 3, s.txid, 4);
+    memcpy(p + 7, s.aid, 4);
+    sendTelemetry(n, TLM_BOUND, p, sizeof(p));
+}
+
+static void command(FakeNode& n, uint8_t cmd, const uint8_t* p, uint8_t len) {
+    uint64_t now = monotonicMicros();
+    int nslots = n.slots.size();
+    switch (cmd) {
+    case 0:
+        if (nslots)
+            for (int i = 0; i < 4; i++)
+                n.slots[0].sticks[i] = get16(p + 2 * i);
+        break;
+    case CMD_STICKS:
+        if (len == CMD_STICKS_LEN && p[0] < nslots)
+            for (int i = 0; i < 4; i++)
+                n.slots[p[0]].sticks[i] = get16(p + 1 + 2 * i);
+        break;
+    case CMD_TRACE_STICKS: {
+        if (len != CMD_TRACE_STICKS_LEN || p[0] >= nslots)
+            break;
+        for (int i = 0; i < 4; i++)
+            n.slots[p[0]].sticks[i] = get16(p + 3 + 2 * i);
+        uint8_t t[TLM_TRACE_LEN];
+        t[0] = p[0];
+        t[1] = p[1];
+        t[2] = p[2];
+        uint32_t rx = micros(n, now);
+        put32(t + 3, rx);
+        put32(t + 7, rx + rand() % 1500); // waiting for its time slice
+        sendTelemetry(n, TLM_TRACE, t, sizeof(t));
+        break;
+    }
+    case CMD_PING: {
+        if (len != CMD_PING_LEN)
+            break;
+        uint8_t t[TLM_PONG_LEN];
+        t[0] = p[0];
+        t[1] = p[1];
+        put32(t + 2, micros(n, now));
+        put32(t + 6, micros(n, now) + 20);
+        sendTelemetry(n, TLM_PONG, t, sizeof(t));
+        break;
+    }
+    case CMD_PROFILE: {
+        uint8_t end = PROF_END;
+        sendTelemetry(n, TLM_PROFILE, &end, 1);
+        break;
+    }
+    case CMD_BIND:
+        if (len != CMD_BIND_LEN || p[0] >= nslots)
+            break;
+        n.slots[p[0]].active = false;
+        memcpy(n.slots[p[0]].txid, p + 1, 4);
+        n.slots[p[0]].txid[1] %= 0x30;
+        n.slots[p[0]].bindDone = now + 200000 + rand() % 600000;
+        break;
+    case CMD_RESTORE:
+        if (len != CMD_RESTORE_LEN || p[0] >= nslots)
+            break;
+        n.slots[p[0]].active = true;
+        memcpy(n.slots[p[0]].txid, p + 1, 4);
+        memcpy(n.slots[p[0]].aid, p + 5, 4);
+        printf("node %d slot %d: restored aid %02x%02x%02x%02x\n", n.index, p[0], p[5], p[6], p[7], p[8]);
+        sendBound(n, p[0]);
+        break;
+    case CMD_RELEASE:
+        if (len != CMD_RELEASE_LEN || p[0] >= nslots)
+            break;
+        n.slots[p[0]].active = false;
+        printf("node %d slot %d: released\n", n.index, p[0]);
+        sendBound(n, p[0]);
+        break;
+    case CMD_STATUS:
+        for (int i = 0; i < nslots; i++)
+            sendBound(n, i);
+        break;
+    }
+}
+
+static void channels(const uint8_t* txid, int* freq) {
+    freq[0] = (txid[0] & 0x0F) + 0x03;
+    freq[1] = (txid[0] >> 4) + 0x16;
+    freq[2] = (txid[1] & 0x0F) + 0x2D;
+    freq[3] = (txid[1] >> 4) + 0x40;
+}
+
+static void report(uint64_t now) {
+    std::vector<int> used(128, -1); // channel -> node using it
+    for (size_t i = 0; i < nodes.size(); i++) {
+        FakeNode& n = *nodes[i];
+        printf("node %d%s:", n.index, dead(n, now) ? " (stalled)" : "");
+        for (size_t s = 0; s < n.slots.size(); s++) {
+            const FakeSlot& slot = n.slots[s];
+            if (!slot.active) {
+                printf(" -");
+                continue;
+            }
+            int freq[4];
+            channels(slot.txid, freq);
+            printf(" [%02x%02x%02x%02x thr %u ch %d/%d/%d/%d]", slot.aid[0], slot.aid[1],
+                   slot.aid[2], slot.aid[3], slot.sticks[2], freq[0], freq[1], freq[2], freq[3]);
+            if (dead(n, now))
+                continue;
+            for (int k = 0; k < 4; k++) {
+                if (used[freq[k]] >= 0 && used[freq[k]] != n.index)
+                    printf(" (shares ch %d with node %d)", freq[k], used[freq[k]]);
+                used[freq[k]] = n.index;
+            }
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    int count = 1, slots = 4;
+    std::vector<const char*> kills;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:k:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 's':
+            slots = atoi(optarg);
+            break;
+        case 'k':
+            kills.push_back(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n nodes] [-s slots] [-k node:at[:for[:r]]] ...\n", argv[0]);
+            return 1;
+        }
+    }
+    start = monotonicMicros();
+    srand(start);
+    for (int i = 0; i < count; i++) {
+        FakeNode* n = new FakeNode;
+        n->index = i;
+        n->master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (n->master < 0 || grantpt(n->master) || unlockpt(n->master)) {
+            perror("posix_openpt");
+            return 1;
+        }
+        // Hold the slave open so the master doesn't see EIO between opens.
+        int slave = open(ptsname(n->master), O_RDWR | O_NOCTTY);
+        struct termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        n->slots.resize(slots);
+        memset(&n->slots[0], 0, slots * sizeof(FakeSlot));
+        n->offset = rand();
+        n->drift = (rand() % 1000 - 500) * 1e-6;
+        n->dieAt = n->reviveAt = 0;
+        n->reboot = false;
+        n->parser.onCommand = [n](uint8_t cmd, const uint8_t* p, uint8_t len) { command(*n, cmd, p, len); };
+        nodes.push_back(n);
+        printf("node %d: %s\n", i, ptsname(n->master));
+    }
+    for (size_t i = 0; i < kills.size(); i++) {
+        int node;
+        double at, dur = 0;
+        if (sscanf(kills[i], "%d:%lf:%lf", &node, &at, &dur) < 2 || node < 0 || node >= count) {
+            fprintf(stderr, "bad -k %s\n", kills[i]);
+            return 1;
+        }
+        nodes[node]->dieAt = start + (uint64_t)(at * 1e6);
+        nodes[node]->reviveAt = dur > 0 ? nodes[node]->dieAt + (uint64_t)(dur * 1e6) : 0;
+        nodes[node]->reboot = strstr(kills[i], ":r") != NULL;
+    }
+    fflush(stdout);
+
+    uint64_t nextReport = start + 2000000;
+    for (;;) {
+        std::vector<struct pollfd> fds;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            struct pollfd p = { nodes[i]->master, POLLIN, 0 };
+            fds.push_back(p);
+        }
+        poll(&fds[0], fds.size(), 10);
+        uint64_t now = monotonicMicros();
+        for (size_t i = 0; i < nodes.size(); i++) {
+            FakeNode& n = *nodes[i];
+            if (n.reboot && n.reviveAt && now >= n.reviveAt) {
+                memset(&n.slots[0], 0, n.slots.size() * sizeof(FakeSlot));
+                n.reboot = false;
+                printf("node %d: rebooted\n", n.index);
+            }
+            uint8_t buf[256];
+            int r = 0;
+            if (fds[i].revents)
+                r = read(n.master, buf, sizeof(buf));
+            if (dead(n, now))
+                continue; // a stalled node hears nothing and says nothing
+            if (r > 0)
+                n.parser.feed(buf, r);
+            for (size_t s = 0; s < n.slots.size(); s++) {
+                FakeSlot& slot = n.slots[s];
+                if (!slot.bindDone || now < slot.bindDone)
+                    continue;
+                slot.bindDone = 0;
+                slot.active = true;
+                for (int k = 0; k < 4; k++)
+                    slot.aid[k] = rand();
+                printf("node %d slot %zu: bound aid %02x%02x%02x%02x\n", n.index, s,
+                       slot.aid[0], slot.aid[1], slot.aid[2], slot.aid[3]);
+                sendBound(n, s);
+            }
+        }
+        if (now >= nextReport) {
+            report(now);
+            nextReport = now + 2000000;
+        }
+    }
+}
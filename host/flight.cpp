@@ -0,0 +1,117 @@
+#include "flight.h"
+
+#include <math.h>
+#include <vector>
+
+#include "triangulate.h"
+
+#define PHYSICS_US 1000
+#define PACKET_US 6000
+#define FRAME_US 33333
+#define PIXEL_NOISE 0.5
+#define DROPOUT 0.05
+#define STRAY 5 // metres from the target counts as lost
+
+FlightPlan::FlightPlan() : seconds(0), settleFrom(0), settleTo(0), trackFrom(0), flipAt(-1) {
+}
+
+void flightGains(AxisGains gains[3]) {
+    // Sticks per metre and metre a second, for a CX10 tilting up to 0.3
+    // rad at full stick.
+    AxisGains flat = { 1.5f, 1, 250, 80, 10, 500, 4000 };
+    AxisGains lift = { 2, 1, 200, 150, 5, 500, 4000 };
+    gains[FleetController::X] = gains[FleetController::Y] = flat;
+    gains[FleetController::Z] = lift;
+}
+
+FlightResult fly(const QuadParams& airframe, const AxisGains gains[3], const FlightPlan& plan, unsigned seed) {
+    QuadSim quad(airframe, seed);
+    const uint8_t txid[4] = { 1, 2, 3, 4 }, aid[4] = { 5, 6, 7, 8 };
+    quad.setAid(aid);
+
+    std::vector<Camera> cams;
+    double centre[3] = { 0, 0, 1 };
+    double eyes[2][3] = { { 0, -4, 1.5 }, { 4, 0, 1.5 } };
+    for (int c = 0; c < 2; c++)
+        cams.push_back(Camera::lookAt(eyes[c], centre, 400, 320, 180));
+
+    FleetController control;
+    control.resize(1);
+    for (int a = 0; a < FleetController::AXES; a++)
+        control.setGains(0, (FleetController::Axis)a, gains[a]);
+    control.arm(0, true);
+
+    FlightResult r = { -1, 0, 0, false };
+    double sumSq = 0;
+    int tracked = 0;
+    bool airborne = false, flipped = plan.flipAt < 0;
+    float pos[3] = { 0, 0, 0 }, vel[3] = { 0, 0, 0 };
+    bool seen = false;
+    double target[3];
+    uint64_t end = (uint64_t)(plan.seconds * 1e6), nextPacket = 0, nextFrame = 0;
+    for (uint64_t t = 0; t < end && !r.crashed; t += PHYSICS_US) {
+        double now = t * 1e-6;
+        plan.target(now, target);
+        if (t >= nextFrame) {
+            nextFrame += FRAME_US;
+            Sighting s[2];
+            int n = 0;
+            for (int c = 0; c < 2; c++) {
+                Detection d;
+                if (quad.detect(cams[c], PIXEL_NOISE, DROPOUT, d)) {
+                    s[n].camera = c;
+                    s[n].x = d.x;
+                    s[n].y = d.y;
+                    n++;
+                }
+            }
+            double X[3];
+            if (n == 2 && triangulate(cams, s, n, X) >= 0) {
+                for (int k = 0; k < 3; k++) {
+                    float v = seen ? (X[k] - pos[k]) * 1e6f / FRAME_US : 0;
+                    vel[k] += 0.5f * (v - vel[k]);
+                    pos[k] = X[k];
+                }
+                seen = true;
+            }
+            control.setState(0, pos, vel);
+            control.setTarget(0, target[0], target[1], target[2]);
+            control.step(FRAME_US * 1e-6f);
+        }
+        if (t >= nextPacket) {
+            nextPacket += PACKET_US;
+            uint16_t sticks[4];
+            for (int ch = 0; ch < FleetController::CHANNELS; ch++)
+                sticks[ch] = control.stick(0, (FleetController::Channel)ch);
+            bool flipNow = !flipped && now >= plan.flipAt;
+            flipped = flipped || flipNow;
+            uint8_t packet[CX10_PACKET_LENGTH];
+            encodePacket(CX10_PACKET_DATA, txid, aid, sticks, 0, flipNow ? 1000 : 0, packet);
+            quad.packet(packet, sizeof(packet));
+        }
+        quad.step(PHYSICS_US * 1e-6);
+
+        const double* p = quad.position();
+        double err = 0, sq = 0;
+        for (int k = 0; k < 3; k++) {
+            double e = p[k] - target[k];
+            err = fmax(err, fabs(e));
+            sq += e * e;
+        }
+        airborne = airborne || p[2] > 0.3;
+        r.crashed = (airborne && p[2] <= 0) || err > STRAY;
+        if (now >= plan.settleFrom && now < plan.settleTo) {
+            if (err > FLIGHT_SETTLE)
+                r.settled = -1;
+            else if (r.settled < 0)
+                r.settled = now - plan.settleFrom;
+        }
+        if (now >= plan.trackFrom) {
+            sumSq += sq;
+            tracked++;
+        }
+        r.finalError = err;
+    }
+    r.rmsError = tracked ? sqrt(sumSq / tracked) : 0;
+    return r;
+}
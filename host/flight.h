@@ -0,0 +1,44 @@
+/*
+  flight.h - One simulated CX10 flown closed loop, as the real one is.
+
+  fly() puts a QuadSim on the ground, watches it with two cameras at 30
+  fps, triangulates their detections, and has a FleetController with the
+  given gains chase plan.target(), sending sticks as packets every 6 ms as
+  the proxy does.  The physics runs at 1 kHz.  It scores the flight by
+  the simulator's true position against the target.
+*/
+#ifndef Flight_h
+#define Flight_h
+
+#include <functional>
+
+#include "controller.h"
+#include "quadsim.h"
+
+#define FLIGHT_SETTLE 0.1 // metres from the target, on every axis, counts as there
+
+struct FlightPlan {
+    double seconds;
+    // Where it should be at time t.
+    std::function<void(double t, double target[3])> target;
+    // Settling is timed from settleFrom to settleTo, and the RMS error
+    // taken from trackFrom to the end.
+    double settleFrom, settleTo, trackFrom;
+    double flipAt; // negative for no flip
+
+    FlightPlan();
+};
+
+struct FlightResult {
+    double settled;    // seconds after settleFrom, or -1 if it never stayed
+    double rmsError;   // metres
+    double finalError; // metres, worst axis
+    bool crashed;      // came down once it had taken off, or strayed far
+};
+
+FlightResult fly(const QuadParams& airframe, const AxisGains gains[3], const FlightPlan& plan, unsigned seed);
+
+// Gains in metres that fly the default QuadParams, as a start for tuning.
+void flightGains(AxisGains gains[3]);
+
+#endif
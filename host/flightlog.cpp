@@ -0,0 +1,380 @@
+#include "flightlog.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "clock.h"
+
+#define FILE_MAGIC "QUADLOG1"
+#define CHUNK_MAGIC "CHNK"
+#define CHUNK_BYTES 65536
+#define FLUSH_US 250000
+#define IDLE_US 1000
+
+struct FileHeader {
+    char magic[8];
+    uint64_t started;
+};
+
+struct ChunkHeader {
+    char magic[4];
+    uint32_t bytes; // of records, after this header
+    uint32_t records;
+    uint32_t reserved;
+    uint64_t first, last;
+};
+
+struct RecordHeader {
+    uint64_t time_us;
+    uint16_t type, len;
+    uint32_t reserved;
+};
+
+struct IndexEntry {
+    uint64_t first, last, offset;
+};
+
+static const char* typeNames[LOG_TYPES] = { "", "frame", "detection", "track", "position", "state",
+                                            "target", "arm", "sticks", "command", "telemetry", "text", "gains" };
+
+const char* logTypeName(int type) {
+    return type > 0 && type < LOG_TYPES ? typeNames[type] : "?";
+}
+
+int logTypeFromName(const char* name) {
+    for (int t = 1; t < LOG_TYPES; t++)
+        if (!strcmp(name, typeNames[t]))
+            return t;
+    return -1;
+}
+
+static int padded(int len) {
+    return (len + 7) & ~7;
+}
+
+static bool writeAll(int fd, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+FlightRecorder::FlightRecorder(int capacity)
+    : _cells(capacity), _mask(capacity - 1), _head(0), _tail(0), _dropped(0), _written(0), _stop(false), _fd(-1),
+      _index(-1), _offset(0) {
+    for (int i = 0; i < capacity; i++)
+        _cells[i].seq = i;
+}
+
+FlightRecorder::~FlightRecorder() {
+    close();
+}
+
+bool FlightRecorder::open(const char* path) {
+    close();
+    std::string index = std::string(path) + ".idx";
+    _fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0) {
+        perror(path);
+        return false;
+    }
+    _index = ::open(index.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_index < 0) {
+        perror(index.c_str());
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+    FileHeader h;
+    memcpy(h.magic, FILE_MAGIC, sizeof(h.magic));
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    h.started = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (!writeAll(_fd, &h, sizeof(h))) {
+        perror(path);
+        return false;
+    }
+    _offset = sizeof(h);
+    _dropped = _written = 0;
+    _stop = false;
+    _thread = std::thread(&FlightRecorder::writer, this);
+    return true;
+}
+
+void FlightRecorder::close() {
+    if (_thread.joinable()) {
+        _stop = true;
+        _thread.join();
+    }
+    if (_fd >= 0)
+        ::close(_fd);
+    if (_index >= 0)
+        ::close(_index);
+    _fd = _index = -1;
+}
+
+bool FlightRecorder::record(LogType type, uint64_t time_us, const void* payload, int len) {
+    if (len < 0 || len > LOG_MAX_PAYLOAD) {
+        _dropped++;
+        return false;
+    }
+    uint64_t pos = _head.load(std::memory_order_relaxed);
+    Cell* c;
+    for (;;) {
+        c = &_cells[pos & _mask];
+        int64_t dif = (int64_t)(c->seq.load(std::memory_order_acquire) - pos);
+        if (dif == 0) {
+            if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            _dropped++; // full: the writer is behind
+            return false;
+        } else {
+            pos = _head.load(std::memory_order_relaxed);
+        }
+    }
+    c->time_us = time_us;
+    c->type = type;
+    c->len = len;
+    memcpy(c->payload, payload, len);
+    c->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool FlightRecorder::text(uint64_t time_us, int node, const std::string& line) {
+    LogText t;
+    t.node = node;
+    int len = std::min(line.size(), sizeof(t.text));
+    memcpy(t.text, line.data(), len);
+    return record(LOG_TEXT, time_us, &t, 1 + len);
+}
+
+void FlightRecorder::writer() {
+    std::vector<uint8_t> chunk;
+    int records = 0;
+    uint64_t first = 0, last = 0, opened = 0;
+    for (;;) {
+        bool stopping = _stop.load(std::memory_order_acquire);
+        int got = 0;
+        for (;;) {
+            Cell& c = _cells[_tail & _mask];
+            if (c.seq.load(std::memory_order_acquire) != _tail + 1)
+                break;
+            if (!records) {
+                first = last = c.time_us;
+                opened = monotonicMicros();
+            }
+            RecordHeader h = { c.time_us, c.type, c.len, 0 };
+            size_t at = chunk.size();
+            chunk.resize(at + sizeof(h) + padded(c.len), 0);
+            memcpy(&chunk[at], &h, sizeof(h));
+            memcpy(&chunk[at + sizeof(h)], c.payload, c.len);
+            first = std::min(first, c.time_us);
+            last = std::max(last, c.time_us);
+            records++;
+            got++;
+            c.seq.store(_tail + _mask + 1, std::memory_order_release);
+            _tail++;
+            if (chunk.size() >= CHUNK_BYTES) {
+                flush(chunk, records, first, last);
+                records = 0;
+            }
+        }
+        if (records && (stopping || monotonicMicros() - opened >= FLUSH_US)) {
+            flush(chunk, records, first, last);
+            records = 0;
+        }
+        if (stopping && !got)
+            break;
+        if (!got)
+            usleep(IDLE_US);
+    }
+}
+
+// Sorts the chunk's records by time, then appends it and its index entry.
+bool FlightRecorder::flush(std::vector<uint8_t>& chunk, int records, uint64_t first, uint64_t last) {
+    std::vector<std::pair<uint64_t, size_t> > order;
+    for (size_t at = 0; at < chunk.size();) {
+        RecordHeader h;
+        memcpy(&h, &chunk[at], sizeof(h));
+        order.push_back(std::make_pair(h.time_us, at));
+        at += sizeof(h) + padded(h.len);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+                         return a.first < b.first;
+                     });
+    std::vector<uint8_t> out(sizeof(ChunkHeader) + chunk.size());
+    ChunkHeader ch;
+    memcpy(ch.magic, CHUNK_MAGIC, sizeof(ch.magic));
+    ch.bytes = chunk.size();
+    ch.records = records;
+    ch.reserved = 0;
+    ch.first = first;
+    ch.last = last;
+    memcpy(&out[0], &ch, sizeof(ch));
+    size_t pos = sizeof(ch);
+    for (size_t i = 0; i < order.size(); i++) {
+        RecordHeader h;
+        memcpy(&h, &chunk[order[i].second], sizeof(h));
+        size_t size = sizeof(h) + padded(h.len);
+        memcpy(&out[pos], &chunk[order[i].second], size);
+        pos += size;
+    }
+    chunk.clear();
+    IndexEntry e = { first, last, _offset };
+    if (!writeAll(_fd, &out[0], out.size()) || !writeAll(_index, &e, sizeof(e))) {
+        perror("flight log");
+        return false;
+    }
+    _offset += out.size();
+    _written += records;
+    return true;
+}
+
+FlightLog::FlightLog() : _map(NULL), _size(0), _started(0), _chunk(0), _pos(0), _end(0) {
+}
+
+FlightLog::~FlightLog() {
+    close();
+}
+
+bool FlightLog::open(const char* path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(FileHeader)) {
+        fprintf(stderr, "%s: not a flight log\n", path);
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+    _map = (const uint8_t*)map;
+    _size = st.st_size;
+    FileHeader h;
+    memcpy(&h, _map, sizeof(h));
+    if (memcmp(h.magic, FILE_MAGIC, sizeof(h.magic))) {
+        fprintf(stderr, "%s: not a flight log\n", path);
+        close();
+        return false;
+    }
+    _started = h.started;
+
+    // The index as far as it agrees with the log, then whatever chunks
+    // made it to the log and not the index.
+    std::string index = std::string(path) + ".idx";
+    FILE* f = fopen(index.c_str(), "rb");
+    uint64_t from = sizeof(FileHeader);
+    IndexEntry e;
+    while (f && fread(&e, sizeof(e), 1, f) == 1) {
+        ChunkHeader ch;
+        if (e.offset != from || from + sizeof(ch) > _size)
+            break;
+        memcpy(&ch, _map + from, sizeof(ch));
+        if (memcmp(ch.magic, CHUNK_MAGIC, sizeof(ch.magic)) || from + sizeof(ch) + ch.bytes > _size)
+            break;
+        Chunk c = { e.first, e.last, e.offset, 0 };
+        _chunks.push_back(c);
+        from += sizeof(ch) + ch.bytes;
+    }
+    if (f)
+        fclose(f);
+    scan(from);
+    uint64_t latest = 0;
+    for (size_t i = 0; i < _chunks.size(); i++)
+        _chunks[i].latest = latest = std::max(latest, _chunks[i].last);
+    seek(0);
+    return true;
+}
+
+bool FlightLog::scan(uint64_t from) {
+    ChunkHeader ch;
+    while (from + sizeof(ch) <= _size) {
+        memcpy(&ch, _map + from, sizeof(ch));
+        if (memcmp(ch.magic, CHUNK_MAGIC, sizeof(ch.magic)) || from + sizeof(ch) + ch.bytes > _size)
+            return false;
+        Chunk c = { ch.first, ch.last, from, 0 };
+        _chunks.push_back(c);
+        from += sizeof(ch) + ch.bytes;
+    }
+    return true;
+}
+
+void FlightLog::close() {
+    if (_map)
+        munmap((void*)_map, _size);
+    _map = NULL;
+    _size = 0;
+    _chunks.clear();
+}
+
+uint64_t FlightLog::first() const {
+    uint64_t t = UINT64_MAX;
+    for (size_t i = 0; i < _chunks.size(); i++)
+        t = std::min(t, _chunks[i].first);
+    return _chunks.empty() ? 0 : t;
+}
+
+uint64_t FlightLog::last() const {
+    return _chunks.empty() ? 0 : _chunks.back().latest;
+}
+
+void FlightLog::seek(uint64_t time_us) {
+    _chunk = std::lower_bound(_chunks.begin(), _chunks.end(), time_us,
+                              [](const Chunk& c, uint64_t t) { return c.latest < t; }) -
+             _chunks.begin();
+    _pos = _end = 0;
+    if (_chunk >= _chunks.size())
+        return;
+    ChunkHeader ch;
+    memcpy(&ch, _map + _chunks[_chunk].offset, sizeof(ch));
+    _pos = _chunks[_chunk].offset + sizeof(ch);
+    _end = _pos + ch.bytes;
+    // Sorted within the chunk.
+    while (_pos < _end) {
+        RecordHeader h;
+        memcpy(&h, _map + _pos, sizeof(h));
+        if (h.time_us >= time_us)
+            break;
+        _pos += sizeof(h) + padded(h.len);
+    }
+}
+
+bool FlightLog::next(LogRecord& r) {
+    while (_pos >= _end) {
+        if (_chunk + 1 >= _chunks.size())
+            return false;
+        _chunk++;
+        ChunkHeader ch;
+        memcpy(&ch, _map + _chunks[_chunk].offset, sizeof(ch));
+        _pos = _chunks[_chunk].offset + sizeof(ch);
+        _end = _pos + ch.bytes;
+    }
+    RecordHeader h;
+    memcpy(&h, _map + _pos, sizeof(h));
+    r.time_us = h.time_us;
+    r.type = h.type;
+    r.len = h.len;
+    r.payload = _map + _pos + sizeof(h);
+    _pos += sizeof(h) + padded(h.len);
+    return true;
+}
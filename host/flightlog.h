@@ -0,0 +1,214 @@
+/*
+  flightlog.h - Recording a flying session, and reading it back.
+
+  FlightRecorder takes typed, timestamped records from any thread: frames,
+  detections, tracks, positions, the controller's gains, inputs and
+  sticks, serial commands, telemetry and text from the nodes.  record()
+  copies into a bounded lock-free queue (Vyukov's, a sequence number per
+  cell) and returns at once; if the queue is full the record is dropped and counted,
+  rather than the caller waiting.  A writer thread drains the queue into
+  chunks of about 64 KiB, sorts each by time, and appends it to the log,
+  with an entry for it (first and last time, offset) appended to path.idx.
+  A chunk is written when full or a quarter of a second old, so a crash
+  loses little.
+
+  The log is a 16 byte file header ("QUADLOG1", then the realtime clock
+  at opening, in microseconds) and chunks, each a 32 byte header ("CHNK",
+  payload bytes, records, reserved, first and last time) and its records:
+  time, type and length in 16 bytes, then the payload padded to 8 bytes.
+  Everything is in host byte order.  Payloads are the Log* structs below.
+
+  FlightLog maps a log and reads it back.  seek() finds the chunk by
+  binary search of the index (rebuilt by walking the chunk headers if
+  path.idx is missing or short) and the record within it by scanning.
+  Records are in time order within a chunk; across chunks nearly so, as a
+  record can be held up on its way to the queue.
+*/
+#ifndef FlightLog_h
+#define FlightLog_h
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../arduino_proxy/protocol.h"
+
+enum LogType {
+    LOG_FRAME = 1, // LogFrame
+    LOG_DETECTION, // LogDetection
+    LOG_TRACK,     // LogTrack
+    LOG_POSITION,  // LogPosition, fused 3D
+    LOG_STATE,     // LogState, a controller input
+    LOG_TARGET,    // LogTarget
+    LOG_ARM,       // LogArm
+    LOG_STICKS,    // LogSticks, a controller output
+    LOG_COMMAND,   // LogCommand, host to node
+    LOG_TELEMETRY, // LogTelemetry, node to host
+    LOG_TEXT,      // LogText
+    LOG_GAINS,     // LogGains
+    LOG_TYPES
+};
+
+const char* logTypeName(int type);
+int logTypeFromName(const char* name);
+
+struct LogFrame {
+    uint32_t index; // frame number in its source
+    uint16_t camera;
+    uint16_t reserved;
+};
+
+struct LogDetection {
+    uint16_t camera;
+    uint16_t reserved;
+    float x, y, score;
+};
+
+struct LogTrack {
+    uint16_t camera;
+    int16_t craft; // -1 if not yet known
+    int32_t id;
+    float x, y, vx, vy;
+};
+
+struct LogPosition {
+    int32_t craft;
+    float x, y, z, error;
+};
+
+struct LogState {
+    int32_t craft;
+    float position[3], velocity[3];
+};
+
+struct LogTarget {
+    int32_t craft;
+    float x, y, z;
+};
+
+struct LogArm {
+    int32_t craft;
+    int32_t on;
+};
+
+struct LogSticks {
+    int32_t craft;
+    uint16_t stick[4]; // aileron, elevator, throttle, rudder
+};
+
+struct LogCommand {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t payload[PROTO_MAX_PAYLOAD];
+};
+
+struct LogTelemetry {
+    uint8_t node;
+    uint8_t type;
+    uint8_t len;
+    uint8_t payload[PROTO_MAX_PAYLOAD];
+};
+
+// AxisGains (controller.h) for one axis of one craft.
+struct LogGains {
+    int32_t craft;
+    int32_t axis;
+    float kp, maxSpeed, vkp, vki, vkd, trim, maxRate;
+};
+
+#define LOG_MAX_PAYLOAD 64
+
+struct LogText {
+    uint8_t node;
+    char text[LOG_MAX_PAYLOAD - 1]; // not terminated if full
+};
+
+class FlightRecorder {
+public:
+    // capacity records in flight, a power of two.
+    FlightRecorder(int capacity = 1 << 16);
+    ~FlightRecorder();
+    bool open(const char* path);
+    // Writes out everything queued and closes the files.
+    void close();
+
+    // From any thread, never waiting.  False if dropped.
+    bool record(LogType type, uint64_t time_us, const void* payload, int len);
+    template <class T> bool record(LogType type, uint64_t time_us, const T& payload) {
+        return record(type, time_us, &payload, sizeof(payload));
+    }
+    bool text(uint64_t time_us, int node, const std::string& line);
+
+    uint64_t dropped() const { return _dropped; }
+    uint64_t written() const { return _written; }
+
+private:
+    struct Cell {
+        std::atomic<uint64_t> seq;
+        uint64_t time_us;
+        uint16_t type, len;
+        uint8_t payload[LOG_MAX_PAYLOAD];
+    };
+
+    void writer();
+    bool flush(std::vector<uint8_t>& chunk, int records, uint64_t first, uint64_t last);
+
+    std::vector<Cell> _cells;
+    uint64_t _mask;
+    std::atomic<uint64_t> _head; // next to enqueue
+    uint64_t _tail;              // next to dequeue, the writer's alone
+    std::atomic<uint64_t> _dropped, _written;
+    std::atomic<bool> _stop;
+    int _fd, _index;
+    uint64_t _offset;
+    std::thread _thread;
+};
+
+struct LogRecord {
+    uint64_t time_us;
+    int type;
+    int len;
+    const uint8_t* payload;
+
+    template <class T> const T* as() const {
+        return len >= (int)sizeof(T) ? (const T*)payload : NULL;
+    }
+};
+
+class FlightLog {
+public:
+    FlightLog();
+    ~FlightLog();
+    bool open(const char* path);
+    void close();
+
+    int chunks() const { return (int)_chunks.size(); }
+    uint64_t first() const;
+    uint64_t last() const;
+    // realtime clock when recording began, microseconds
+    uint64_t started() const { return _started; }
+
+    // next() reads the first record at or after time_us, then on in the
+    // order of the log.
+    void seek(uint64_t time_us);
+    bool next(LogRecord& r);
+
+private:
+    struct Chunk {
+        uint64_t first, last, offset;
+        uint64_t latest; // the latest last of this and every chunk before
+    };
+    bool scan(uint64_t from);
+
+    const uint8_t* _map;
+    size_t _size;
+    uint64_t _started;
+    std::vector<Chunk> _chunks;
+    size_t _chunk;  // reading this one
+    uint64_t _pos;  // at this offset in the file
+    uint64_t _end;  // of the chunk
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "formation.h"
+
+#include <algorithm>
+
+#include "hungarian.h"
+
+// Peak speed of a minimum jerk move over distance d in time T is 1.875 d/T.
+#define PEAK_SPEED 1.875f
+#define SEPARATION_PASSES 3
+
+static float distSq(const float* a, const float* b) {
+    float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+uint32_t SpatialHash::bucket(int x, int y, int z) const {
+    return ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u) & _mask;
+}
+
+void SpatialHash::build(const float* points, int n, float cell) {
+    _cell = cell;
+    uint32_t buckets = 64;
+    while (buckets < 2 * (uint32_t)n)
+        buckets *= 2;
+    _mask = buckets - 1;
+    _start.assign(buckets + 1, 0);
+    _entries.resize(n);
+    _of.resize(n);
+    for (int i = 0; i < n; i++) {
+        const float* p = points + 3 * i;
+        _of[i] = bucket((int)floorf(p[0] / cell), (int)floorf(p[1] / cell), (int)floorf(p[2] / cell));
+        _start[_of[i]]++;
+    }
+    // Counting sort: each bucket's end, then fill each from its end, which
+    // leaves _start[b] at bucket b's first entry.
+    for (uint32_t b = 1; b < buckets; b++)
+        _start[b] += _start[b - 1];
+    _start[buckets] = n;
+    for (int i = n - 1; i >= 0; i--) {
+        const float* p = points + 3 * i;
+        Entry& e = _entries[--_start[_of[i]]];
+        e.x = (int)floorf(p[0] / cell);
+        e.y = (int)floorf(p[1] / cell);
+        e.z = (int)floorf(p[2] / cell);
+        e.point = i;
+    }
+}
+
+FormationPlanner::FormationPlanner()
+    : separation(0.3f), maxSpeed(0.5f), tolerance(0.15f), _arrival(0), _conflicts(0) {
+}
+
+float FormationPlanner::lineTime(const float* from, const float* to) const {
+    return PEAK_SPEED * sqrtf(distSq(from, to)) / maxSpeed;
+}
+
+void FormationPlanner::plan(int craft, const float* from, double now, double end) {
+    Line& l = _lines[craft];
+    const float* to = &_shape[3 * _goal[craft]];
+    for (int k = 0; k < 3; k++) {
+        l.from[k] = from[k];
+        l.to[k] = to[k];
+    }
+    l.start = now;
+    l.end = std::max(end, now + lineTime(from, to));
+}
+
+void FormationPlanner::along(const Line& l, double now, float* p) const {
+    double t = l.end > l.start ? (now - l.start) / (l.end - l.start) : 1;
+    t = std::min(std::max(t, 0.0), 1.0);
+    float s = (float)(t * t * t * (10 - 15 * t + 6 * t * t));
+    for (int k = 0; k < 3; k++)
+        p[k] = l.from[k] + (l.to[k] - l.from[k]) * s;
+}
+
+float FormationPlanner::offLine(const Line& l, const float* p) const {
+    float d[3], a[3], len = 0, dot = 0;
+    for (int k = 0; k < 3; k++) {
+        d[k] = l.to[k] - l.from[k];
+        a[k] = p[k] - l.from[k];
+        len += d[k] * d[k];
+        dot += a[k] * d[k];
+    }
+    float u = len > 0 ? std::min(std::max(dot / len, 0.0f), 1.0f) : 0;
+    float closest[3] = { l.from[0] + u * d[0], l.from[1] + u * d[1], l.from[2] + u * d[2] };
+    return distSq(p, closest);
+}
+
+bool FormationPlanner::setFormation(const std::vector<float>& shape, const std::vector<float>& positions,
+                                    double now) {
+    int n = (int)positions.size() / 3, m = (int)shape.size() / 3;
+    if (m < n)
+        return false;
+    std::vector<float> cost(n * m);
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < m; j++)
+            cost[i * m + j] = distSq(&positions[3 * i], &shape[3 * j]);
+    std::vector<int> assignment;
+    hungarian(cost, n, m, assignment);
+    _shape = shape;
+    _goal = assignment;
+    _lines.resize(n);
+    float longest = 0;
+    for (int i = 0; i < n; i++)
+        longest = std::max(longest, lineTime(&positions[3 * i], &shape[3 * _goal[i]]));
+    // All on the same profile, arriving together.
+    _arrival = now + longest;
+    for (int i = 0; i < n; i++)
+        plan(i, &positions[3 * i], now, _arrival);
+    return true;
+}
+
+double FormationPlanner::arrival() const {
+    double last = _arrival;
+    for (size_t i = 0; i < _lines.size(); i++)
+        last = std::max(last, _lines[i].end);
+    return last;
+}
+
+int FormationPlanner::update(const std::vector<float>& positions, double now) {
+    int n = size();
+    _hash.build(&positions[0], n, separation);
+    int replanned = 0;
+    for (int i = 0; i < n; i++) {
+        const float* at = &positions[3 * i];
+        // Off to the side, not just behind: starting a lagging craft's
+        // line again from rest would only leave it further behind.
+        if (offLine(_lines[i], at) <= tolerance * tolerance)
+            continue;
+        // Would a neighbour's goal be the better for both?
+        const float* gi = &_shape[3 * _goal[i]];
+        int swap = -1;
+        float best = 0;
+        _hash.near(at, [&](int j) {
+            if (j == i)
+                return;
+            const float* pj = &positions[3 * j];
+            const float* gj = &_shape[3 * _goal[j]];
+            float gain = distSq(at, gi) + distSq(pj, gj) - distSq(at, gj) - distSq(pj, gi);
+            if (gain > best) {
+                best = gain;
+                swap = j;
+            }
+        });
+        if (swap >= 0) {
+            std::swap(_goal[i], _goal[swap]);
+            plan(swap, &positions[3 * swap], now, _lines[swap].end);
+            replanned++;
+        }
+        plan(i, at, now, _lines[i].end);
+        replanned++;
+    }
+    return replanned;
+}
+
+void FormationPlanner::setpoints(double now, std::vector<float>& out) {
+    int n = size();
+    out.resize(3 * n);
+    for (int i = 0; i < n; i++)
+        along(_lines[i], now, &out[3 * i]);
+    _conflicts = 0;
+    float sepSq = separation * separation;
+    for (int pass = 0; pass < SEPARATION_PASSES; pass++) {
+        _hash.build(&out[0], n, separation);
+        int pushed = 0;
+        for (int i = 0; i < n; i++) {
+            float* a = &out[3 * i];
+            _hash.near(a, [&](int j) {
+                if (j <= i)
+                    return;
+                float* b = &out[3 * j];
+                float d2 = distSq(a, b);
+                if (d2 >= sepSq)
+                    return;
+                // Half the shortfall each, straight apart (along x if they
+                // coincide).
+                float d = sqrtf(d2), dir[3] = { 1, 0, 0 };
+                if (d > 1e-6f)
+                    for (int k = 0; k < 3; k++)
+                        dir[k] = (b[k] - a[k]) / d;
+                float push = (separation - d) / 2;
+                for (int k = 0; k < 3; k++) {
+                    a[k] -= dir[k] * push;
+                    b[k] += dir[k] * push;
+                }
+                pushed++;
+            });
+        }
+        if (pass == 0)
+            _conflicts = pushed;
+        if (!pushed)
+            break;
+    }
+}
+
+void FormationPlanner::feed(FleetController& control, double now) {
+    setpoints(now, _planned);
+    if (control.size() < size())
+        control.resize(size());
+    for (int i = 0; i < size(); i++)
+        control.setTarget(i, _planned[3 * i], _planned[3 * i + 1], _planned[3 * i + 2]);
+}
@@ -0,0 +1,121 @@
+/*
+  formation.h - From a formation's shape to where each craft should be.
+
+  setFormation() assigns craft to the points of a shape by the Hungarian
+  method on squared distance, and sends them all along straight lines on
+  the same minimum jerk profile, to arrive together.  Minimising the sum
+  of squared distances this way keeps the lines apart, so long as the
+  craft start and finish well enough separated (Turpin, Michael and
+  Kumar's CAPT); the arrival time is set by the furthest craft and
+  maxSpeed.
+
+  Craft don't follow their lines exactly.  update() replans any craft
+  that has drifted more than tolerance off its line: a new line from
+  where it is, due no sooner than the old one, trading goals with a near
+  neighbour first if that makes the two paths shorter.  Each is a few lookups, so a drifting craft costs
+  microseconds however many there are.  setpoints() then pushes apart any
+  two setpoints closer than separation, a few times over.  Both find
+  neighbours through a SpatialHash of cells separation wide, so a tick is
+  linear in the number of craft rather than quadratic.
+
+  Positions are in metres, three floats a craft; craft i is the
+  controller's slot i.
+*/
+#ifndef Formation_h
+#define Formation_h
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#include "controller.h"
+
+// Points hashed into cubic cells, for finding those within a cell of a
+// place without looking at all of them.
+class SpatialHash {
+public:
+    SpatialHash() : _cell(1) {}
+    // points is three floats each.  Rebuilds from scratch.
+    void build(const float* points, int n, float cell);
+    // Calls f(i) for each point i in the 27 cells round p, so every point
+    // within a cell of p, and some further.
+    template <class F> void near(const float* p, F f) const;
+
+private:
+    struct Entry {
+        int x, y, z; // cell
+        int point;
+    };
+    uint32_t bucket(int x, int y, int z) const;
+
+    float _cell;
+    uint32_t _mask;
+    std::vector<int> _start; // per bucket, into _entries
+    std::vector<Entry> _entries;
+    std::vector<uint32_t> _of;
+};
+
+class FormationPlanner {
+public:
+    FormationPlanner();
+
+    float separation; // m, closest two setpoints may come
+    float maxSpeed;   // m/s, peak speed along a line
+    float tolerance;  // m off its line before a craft is replanned
+
+    // Plans craft at positions to the points of shape, starting at now
+    // (seconds).  False if there are fewer points than craft.
+    bool setFormation(const std::vector<float>& shape, const std::vector<float>& positions, double now);
+    int size() const { return (int)_goal.size(); }
+    // The point of the shape craft is headed for.
+    int goal(int craft) const { return _goal[craft]; }
+    // When the last craft is due.
+    double arrival() const;
+
+    // Replans craft that have drifted.  Returns how many.
+    int update(const std::vector<float>& positions, double now);
+    // Where each craft should be at now.
+    void setpoints(double now, std::vector<float>& out);
+    // Pairs setpoints() had to push apart, the last time.
+    int conflicts() const { return _conflicts; }
+    // setpoints() as targets for slots 0 to size() - 1.
+    void feed(FleetController& control, double now);
+
+private:
+    struct Line {
+        float from[3], to[3];
+        double start, end;
+    };
+    void plan(int craft, const float* from, double now, double end);
+    void along(const Line& l, double now, float* p) const;
+    float lineTime(const float* from, const float* to) const;
+    // Squared distance from p to the nearest point of l.
+    float offLine(const Line& l, const float* p) const;
+
+    std::vector<float> _shape;
+    std::vector<int> _goal;
+    std::vector<Line> _lines;
+    double _arrival;
+    int _conflicts;
+    SpatialHash _hash;
+    std::vector<float> _planned;
+};
+
+template <class F> void SpatialHash::near(const float* p, F f) const {
+    if (_entries.empty())
+        return;
+    int cx = (int)floorf(p[0] / _cell), cy = (int)floorf(p[1] / _cell), cz = (int)floorf(p[2] / _cell);
+    for (int x = cx - 1; x <= cx + 1; x++)
+        for (int y = cy - 1; y <= cy + 1; y++)
+            for (int z = cz - 1; z <= cz + 1; z++) {
+                uint32_t b = bucket(x, y, z);
+                // Other cells can share the bucket.
+                for (int k = _start[b]; k < _start[b + 1]; k++) {
+                    const Entry& e = _entries[k];
+                    if (e.x == x && e.y == y && e.z == z)
+                        f(e.point);
+                }
+            }
+}
+
+#endif
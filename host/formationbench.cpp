@@ -0,0 +1,142 @@
+/*
+  formationbench - times FormationPlanner and checks it keeps craft apart.
+
+    formationbench [-t seconds] [-s separation] [-k kick]
+
+  For fleets of 16 to 1024 craft, starting on a grid on the floor, plans
+  them into a wall of the same number of points three metres off, then
+  flies point masses that follow their setpoints with a lag, at 30 fps,
+  knocking one craft in fifty a frame up to kick metres off course, for
+  seconds, then leaves them to finish undisturbed.  Reports how long the
+  assignment took, the time per frame of update() and setpoints()
+  together, the time for update() when a single craft has drifted, how
+  many craft were replanned, how close setpoints and craft came (the
+  craft, knocked about, can come closer than their setpoints), and how
+  far from their places they ended.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+
+#include "clock.h"
+#include "formation.h"
+
+#define FPS 30
+#define LAG 0.3 // s, point masses' time constant
+#define SPACING 0.5
+
+// Closest two of the n points come, looking only within limit.
+static float closest(const std::vector<float>& p, float limit) {
+    int n = (int)p.size() / 3;
+    SpatialHash hash;
+    hash.build(&p[0], n, limit);
+    float best = limit;
+    for (int i = 0; i < n; i++)
+        hash.near(&p[3 * i], [&](int j) {
+            if (j <= i)
+                return;
+            float d = 0;
+            for (int k = 0; k < 3; k++)
+                d += (p[3 * i + k] - p[3 * j + k]) * (p[3 * i + k] - p[3 * j + k]);
+            best = fminf(best, sqrtf(d));
+        });
+    return best;
+}
+
+// n points in a square grid, side on, rows along x and the other way
+// along y (floor) or z (wall).
+static void grid(int n, bool wall, std::vector<float>& p) {
+    int side = (int)ceil(sqrt(n));
+    p.clear();
+    for (int i = 0; i < n; i++) {
+        float a = (i % side - side / 2) * SPACING, b = (i / side) * SPACING;
+        p.push_back(a);
+        p.push_back(wall ? 3 : b);
+        p.push_back(wall ? 0.5f + b : 0);
+    }
+}
+
+int main(int argc, char** argv) {
+    double seconds = 30;
+    float separation = 0.3f, kick = 0.3f;
+    bool ok = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:k:")) != -1) {
+        if (opt == 't')
+            seconds = atof(optarg);
+        else if (opt == 's')
+            separation = atof(optarg);
+        else if (opt == 'k')
+            kick = atof(optarg);
+        else
+            ok = false;
+    }
+    if (!ok || seconds <= 0 || separation <= 0 || separation > SPACING) {
+        fprintf(stderr, "usage: %s [-t seconds] [-s separation (up to %g)] [-k kick]\n", argv[0], SPACING);
+        return 1;
+    }
+
+    printf("craft  assign ms  frame us  drift us  replanned  setpoints m  craft m  error m\n");
+    int sizes[] = { 16, 64, 256, 1024 };
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        std::vector<float> pos, shape, vel(3 * n, 0), sp;
+        grid(n, false, pos);
+        grid(n, true, shape);
+        FormationPlanner planner;
+        planner.separation = separation;
+        uint64_t start = monotonicMicros();
+        planner.setFormation(shape, pos, 0);
+        double assign = (monotonicMicros() - start) * 1e-3;
+
+        std::mt19937 rng(n);
+        std::uniform_int_distribution<int> pick(0, 49);
+        std::uniform_real_distribution<float> u(-1, 1);
+        uint64_t frameUs = 0;
+        int frames = 0, replanned = 0;
+        float closeSp = separation, closeCraft = separation;
+        double dt = 1.0 / FPS;
+        for (double t = 0; t < seconds; t += dt) {
+            for (int i = 0; i < n; i++)
+                if (pick(rng) == 0)
+                    for (int k = 0; k < 3; k++)
+                        pos[3 * i + k] += kick * u(rng);
+            uint64_t t0 = monotonicMicros();
+            replanned += planner.update(pos, t);
+            planner.setpoints(t, sp);
+            frameUs += monotonicMicros() - t0;
+            frames++;
+            closeSp = fminf(closeSp, closest(sp, separation));
+            for (int i = 0; i < 3 * n; i++)
+                pos[i] += (sp[i] - pos[i]) * (float)(dt / LAG);
+            closeCraft = fminf(closeCraft, closest(pos, separation));
+        }
+        // Settle undisturbed until well after they should have arrived,
+        // then knock one craft and time the replan.
+        double end = fmax(seconds, planner.arrival()) + 5;
+        for (double t = seconds; t < end; t += dt) {
+            planner.update(pos, t);
+            planner.setpoints(t, sp);
+            for (int i = 0; i < 3 * n; i++)
+                pos[i] += (sp[i] - pos[i]) * (float)(dt / LAG);
+        }
+        double error = 0;
+        for (int i = 0; i < n; i++) {
+            const float* g = &shape[3 * planner.goal(i)];
+            float d = 0;
+            for (int k = 0; k < 3; k++)
+                d += (pos[3 * i + k] - g[k]) * (pos[3 * i + k] - g[k]);
+            error = fmax(error, sqrt(d));
+        }
+        pos[0] += 1;
+        uint64_t t0 = monotonicMicros();
+        int one = planner.update(pos, end);
+        double driftUs = (double)(monotonicMicros() - t0);
+        printf("%5d %10.2f %9.1f %9.1f %10d %12.3f %8.3f %8.3f%s\n", n, assign, (double)frameUs / frames, driftUs,
+               replanned, closeSp, closeCraft, error, one ? "" : " (drift missed)");
+    }
+    return 0;
+}
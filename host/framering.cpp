@@ -0,0 +1,77 @@
+#include "framering.h"
+
+FrameRing::FrameRing(int channels, int width, int height, int history, int ahead)
+    : dropped(0), _channels(channels), _width(width), _height(height), _history(history),
+      _ahead(ahead), _slots(history + ahead), _frameSize((size_t)channels * width * height),
+      _data(_slots * _frameSize), _times(_slots), _produced(0), _consumed(0),
+      _ended(false), _stopping(false) {
+}
+
+FrameRing::~FrameRing() {
+    stop();
+}
+
+void FrameRing::start(const Decoder& decode) {
+    stop();
+    _produced = _consumed = 0;
+    _ended = _stopping = false;
+    dropped = 0;
+    _thread = std::thread(&FrameRing::_run, this, decode);
+}
+
+void FrameRing::stop() {
+    if (!_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _space.notify_all();
+    _thread.join();
+}
+
+void FrameRing::_run(Decoder decode) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        // The consumer holds the history frames up to _consumed; everything
+        // beyond is free.
+        _space.wait(lock, [this]() { return _stopping || _produced < _consumed + _ahead; });
+        if (_stopping)
+            break;
+        uint64_t n = _produced;
+        lock.unlock();
+        uint64_t t = 0;
+        bool ok = decode(&_data[(n % _slots) * _frameSize], &t);
+        lock.lock();
+        if (!ok)
+            break;
+        _times[n % _slots] = t;
+        _produced++;
+        _ready.notify_one();
+    }
+    _ended = true;
+    _ready.notify_one();
+}
+
+bool FrameRing::next(bool newest) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _ready.wait(lock, [this]() { return _produced > _consumed || _ended; });
+    if (_produced == _consumed)
+        return false;
+    uint64_t target = newest ? _produced : _consumed + 1;
+    dropped += target - _consumed - 1;
+    _consumed = target;
+    lock.unlock();
+    _space.notify_one();
+    return true;
+}
+
+void FrameRing::planes(int count, const float** out) const {
+    for (int age = 0; age < count; age++)
+        for (int c = 0; c < _channels; c++)
+            *out++ = plane(age, c);
+}
+
+int FrameRing::held() const {
+    return _consumed < (uint64_t)_history ? _consumed : _history;
+}
@@ -0,0 +1,69 @@
+/*
+  framering.h - Decoded frames in preallocated storage, with history.
+
+  A producer thread decodes into the ring while the consumer works on the
+  frames it already has, so decoding overlaps inference.  The consumer sees
+  the current frame and up to history - 1 before it in place, with nothing
+  copied or allocated per frame; frame(0) and frame(1) are the pair the
+  convnet wants.  The producer runs up to ahead frames in front and then
+  waits for the consumer to move on.
+*/
+#ifndef FrameRing_h
+#define FrameRing_h
+
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FrameRing {
+public:
+    // Decodes the next frame into data (channels planes of width x height
+    // floats) and stamps it.  Returns false at the end of the stream.
+    typedef std::function<bool(float* data, uint64_t* time_us)> Decoder;
+
+    FrameRing(int channels, int width, int height, int history = 2, int ahead = 2);
+    ~FrameRing();
+    void start(const Decoder& decode);
+    void stop();
+
+    // Moves on to the next frame, or with newest to the latest decoded one,
+    // skipping any in between.  Waits for one if need be; false once the
+    // stream has ended.
+    bool next(bool newest = false);
+
+    // age 0 is the current frame, 1 the one before and so on.  Valid until
+    // the next call to next().
+    const float* frame(int age) const { return &_data[_slot(age) * _frameSize]; }
+    const float* plane(int age, int channel) const { return frame(age) + channel * _width * _height; }
+    uint64_t time(int age) const { return _times[_slot(age)]; }
+    // Fills in the planes of the newest count frames, newest first: the
+    // order vision.lua joins them in.
+    void planes(int count, const float** out) const;
+    // How many frames of history there are so far, up to history.
+    int held() const;
+    uint64_t index() const { return _consumed - 1; } // of the current frame
+    int channels() const { return _channels; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    uint64_t dropped; // frames skipped by next(true)
+
+private:
+    int _slot(int age) const { return (_consumed - 1 - age) % _slots; }
+    void _run(Decoder decode);
+
+    int _channels, _width, _height, _history, _ahead, _slots;
+    size_t _frameSize;
+    std::vector<float> _data;
+    std::vector<uint64_t> _times;
+    uint64_t _produced, _consumed; // frames decoded, and moved on to
+    bool _ended, _stopping;
+    std::mutex _mutex;
+    std::condition_variable _ready, _space;
+    std::thread _thread;
+};
+
+#endif
@@ -0,0 +1,398 @@
+#include "framesource.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+
+#include "clock.h"
+
+#define BUFFERS 4
+#define TIMEOUT_MS 2000
+
+FrameSource* FrameSource::open(const char* name, int width, int height, int fps, bool pace) {
+    if (strncmp(name, "/dev/", 5) == 0) {
+        V4l2Source* src = new V4l2Source;
+        if (src->open(name, width, height, fps))
+            return src;
+        delete src;
+    } else {
+        FileSource* src = new FileSource;
+        if (src->open(name, width, height, pace))
+            return src;
+        delete src;
+    }
+    return NULL;
+}
+
+static int xioctl(int fd, unsigned long request, void* arg) {
+    int r;
+    do
+        r = ioctl(fd, request, arg);
+    while (r < 0 && errno == EINTR);
+    return r;
+}
+
+V4l2Source::V4l2Source()
+    : _fd(-1), _width(0), _height(0), _stride(0), _format(0), _held(-1), _streaming(false), _sequence(0) {
+}
+
+V4l2Source::~V4l2Source() {
+    close();
+}
+
+bool V4l2Source::open(const char* device, int width, int height, int fps) {
+    close();
+    _fd = ::open(device, O_RDWR);
+    if (_fd < 0) {
+        perror(device);
+        return false;
+    }
+    v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (xioctl(_fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        perror(device);
+        close();
+        return false;
+    }
+    uint32_t caps = cap.capabilities & V4L2_CAP_DEVICE_CAPS ? cap.device_caps : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+        fprintf(stderr, "%s: can't stream video\n", device);
+        close();
+        return false;
+    }
+
+    // The formats whose luma we can use, best first.
+    static const uint32_t wanted[] = { V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12,
+                                       V4L2_PIX_FMT_YUYV };
+    const int nwanted = sizeof(wanted) / sizeof(wanted[0]);
+    int best = nwanted;
+    v4l2_fmtdesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (; xioctl(_fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++)
+        for (int i = 0; i < best; i++)
+            if (desc.pixelformat == wanted[i])
+                best = i;
+    if (best == nwanted) {
+        fprintf(stderr, "%s: no grayscale or YUV format\n", device);
+        close();
+        return false;
+    }
+    v4l2_format f;
+    memset(&f, 0, sizeof(f));
+    f.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    f.fmt.pix.width = width > 0 ? width : 640;
+    f.fmt.pix.height = height > 0 ? height : 480;
+    f.fmt.pix.pixelformat = wanted[best];
+    f.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(_fd, VIDIOC_S_FMT, &f) < 0 || f.fmt.pix.pixelformat != wanted[best]) {
+        perror("VIDIOC_S_FMT");
+        close();
+        return false;
+    }
+    _format = f.fmt.pix.pixelformat;
+    _width = f.fmt.pix.width;
+    _height = f.fmt.pix.height;
+    _stride = f.fmt.pix.bytesperline ? f.fmt.pix.bytesperline : _width * (_format == V4L2_PIX_FMT_YUYV ? 2 : 1);
+    if (_format == V4L2_PIX_FMT_YUYV)
+        _luma.resize(_width * _height);
+
+    if (fps > 0) {
+        v4l2_streamparm parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        parm.parm.capture.timeperframe.numerator = 1;
+        parm.parm.capture.timeperframe.denominator = fps;
+        xioctl(_fd, VIDIOC_S_PARM, &parm); // not every driver can
+    }
+
+    v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(_fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+        fprintf(stderr, "%s: can't get capture buffers\n", device);
+        close();
+        return false;
+    }
+    for (uint32_t i = 0; i < req.count; i++) {
+        v4l2_buffer b;
+        memset(&b, 0, sizeof(b));
+        b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        b.memory = V4L2_MEMORY_MMAP;
+        b.index = i;
+        if (xioctl(_fd, VIDIOC_QUERYBUF, &b) < 0) {
+            perror("VIDIOC_QUERYBUF");
+            close();
+            return false;
+        }
+        Buffer buf = { mmap(NULL, b.length, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, b.m.offset), b.length };
+        if (buf.start == MAP_FAILED) {
+            perror("mmap");
+            close();
+            return false;
+        }
+        _buffers.push_back(buf);
+        if (xioctl(_fd, VIDIOC_QBUF, &b) < 0) {
+            perror("VIDIOC_QBUF");
+            close();
+            return false;
+        }
+    }
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(_fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("VIDIOC_STREAMON");
+        close();
+        return false;
+    }
+    _streaming = true;
+    _sequence = 0;
+    dropped = 0;
+    return true;
+}
+
+void V4l2Source::close() {
+    if (_fd < 0)
+        return;
+    if (_streaming) {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(_fd, VIDIOC_STREAMOFF, &type);
+    }
+    for (size_t i = 0; i < _buffers.size(); i++)
+        munmap(_buffers[i].start, _buffers[i].length);
+    _buffers.clear();
+    ::close(_fd);
+    _fd = -1;
+    _held = -1;
+    _streaming = false;
+}
+
+bool V4l2Source::_requeue() {
+    if (_held < 0)
+        return true;
+    v4l2_buffer b;
+    memset(&b, 0, sizeof(b));
+    b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    b.memory = V4L2_MEMORY_MMAP;
+    b.index = _held;
+    _held = -1;
+    if (xioctl(_fd, VIDIOC_QBUF, &b) < 0) {
+        perror("VIDIOC_QBUF");
+        return false;
+    }
+    return true;
+}
+
+bool V4l2Source::next(Frame& frame) {
+    if (!_streaming || !_requeue())
+        return false;
+    v4l2_buffer b;
+    for (;;) {
+        pollfd p = { _fd, POLLIN, 0 };
+        int r = poll(&p, 1, TIMEOUT_MS);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            fprintf(stderr, "capture %s\n", r ? strerror(errno) : "timed out");
+            return false;
+        }
+        memset(&b, 0, sizeof(b));
+        b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        b.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(_fd, VIDIOC_DQBUF, &b) < 0) {
+            if (errno == EAGAIN)
+                continue;
+            perror("VIDIOC_DQBUF");
+            return false;
+        }
+        if (b.sequence > _sequence)
+            dropped += b.sequence - _sequence;
+        _sequence = b.sequence + 1;
+        if (!(b.flags & V4L2_BUF_FLAG_ERROR))
+            break;
+        // A damaged frame is as good as lost.
+        dropped++;
+        _held = b.index;
+        if (!_requeue())
+            return false;
+    }
+
+    if ((b.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        frame.time_us = (uint64_t)b.timestamp.tv_sec * 1000000 + b.timestamp.tv_usec;
+    else
+        frame.time_us = monotonicMicros();
+    frame.index = b.sequence;
+    frame.width = _width;
+    frame.height = _height;
+    const uint8_t* data = (const uint8_t*)_buffers[b.index].start;
+    if (_format == V4L2_PIX_FMT_YUYV) {
+        for (int y = 0; y < _height; y++) {
+            const uint8_t* src = data + y * _stride;
+            uint8_t* dst = &_luma[y * _width];
+            for (int x = 0; x < _width; x++)
+                dst[x] = src[2 * x];
+        }
+        frame.luma = &_luma[0];
+        frame.stride = _width;
+        _held = b.index;
+        return _requeue();
+    }
+    frame.luma = data;
+    frame.stride = _stride;
+    _held = b.index;
+    return true;
+}
+
+FileSource::FileSource()
+    : _file(NULL), _pipe(false), _pace(false), _width(0), _height(0), _chroma(0), _rateNum(30), _rateDen(1),
+      _frames(0), _start(0) {
+}
+
+FileSource::~FileSource() {
+    close();
+}
+
+static bool isY4m(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return false;
+    char magic[10];
+    bool y4m = fread(magic, 1, 10, f) == 10 && memcmp(magic, "YUV4MPEG2 ", 10) == 0;
+    fclose(f);
+    return y4m;
+}
+
+bool FileSource::open(const char* path, int width, int height, bool pace) {
+    close();
+    _pace = pace;
+    if (isY4m(path) && width <= 0 && height <= 0) {
+        _file = fopen(path, "rb");
+        _pipe = false;
+    } else {
+        if (access(path, R_OK) < 0) {
+            perror(path);
+            return false;
+        }
+        char scale[64] = "";
+        if (width > 0 && height > 0)
+            snprintf(scale, sizeof(scale), "-s %dx%d ", width, height);
+        char cmd[1024];
+        snprintf(cmd, sizeof(cmd), "ffmpeg -loglevel error -i '%s' %s-f yuv4mpegpipe -pix_fmt gray -", path, scale);
+        _file = popen(cmd, "r");
+        _pipe = true;
+    }
+    if (!_file) {
+        perror(path);
+        return false;
+    }
+    if (!_header()) {
+        fprintf(stderr, "%s: not YUV4MPEG2 that we can read\n", path);
+        close();
+        return false;
+    }
+    _luma.resize((size_t)_width * _height);
+    _skip.resize(_chroma);
+    _frames = 0;
+    dropped = 0;
+    return true;
+}
+
+void FileSource::close() {
+    if (!_file)
+        return;
+    if (_pipe)
+        pclose(_file);
+    else
+        fclose(_file);
+    _file = NULL;
+}
+
+// Reads a line of up to size - 1 characters, without the newline.
+static bool readLine(FILE* f, char* line, size_t size) {
+    size_t n = 0;
+    int c;
+    while ((c = getc(f)) != EOF && c != '\n')
+        if (n + 1 < size)
+            line[n++] = c;
+    line[n] = 0;
+    return c == '\n';
+}
+
+bool FileSource::_header() {
+    char line[1024];
+    if (!readLine(_file, line, sizeof(line)) || strncmp(line, "YUV4MPEG2 ", 10) != 0)
+        return false;
+    const char* colour = "420";
+    for (char* tok = strtok(line + 10, " "); tok; tok = strtok(NULL, " ")) {
+        switch (tok[0]) {
+        case 'W':
+            _width = atoi(tok + 1);
+            break;
+        case 'H':
+            _height = atoi(tok + 1);
+            break;
+        case 'F':
+            if (sscanf(tok + 1, "%u:%u", &_rateNum, &_rateDen) != 2 || !_rateNum || !_rateDen)
+                _rateNum = 30, _rateDen = 1;
+            break;
+        case 'C':
+            colour = tok + 1;
+            break;
+        }
+    }
+    if (_width <= 0 || _height <= 0)
+        return false;
+    size_t cw = (_width + 1) / 2, ch = (_height + 1) / 2;
+    if (strcmp(colour, "mono") == 0)
+        _chroma = 0;
+    else if (strncmp(colour, "420", 3) == 0)
+        _chroma = 2 * cw * ch;
+    else if (strcmp(colour, "422") == 0)
+        _chroma = 2 * cw * _height;
+    else if (strcmp(colour, "444") == 0)
+        _chroma = 2 * (size_t)_width * _height;
+    else if (strcmp(colour, "444alpha") == 0)
+        _chroma = 3 * (size_t)_width * _height;
+    else
+        return false;
+    return true;
+}
+
+bool FileSource::next(Frame& frame) {
+    char line[256];
+    if (!_file || !readLine(_file, line, sizeof(line)) || strncmp(line, "FRAME", 5) != 0)
+        return false;
+    if (fread(&_luma[0], 1, _luma.size(), _file) != _luma.size() ||
+        (_chroma && fread(&_skip[0], 1, _chroma, _file) != _chroma))
+        return false;
+    if (!_frames)
+        _start = monotonicMicros();
+    frame.time_us = _start + _frames * 1000000 * _rateDen / _rateNum;
+    if (_pace) {
+        uint64_t now = monotonicMicros();
+        if (frame.time_us > now)
+            usleep(frame.time_us - now);
+    }
+    frame.index = _frames++;
+    frame.luma = &_luma[0];
+    frame.stride = _width;
+    frame.width = _width;
+    frame.height = _height;
+    return true;
+}
+
+void lumaToPlane(const Frame& frame, float* plane, int stride) {
+    for (int y = 0; y < frame.height; y++) {
+        const uint8_t* src = frame.luma + y * frame.stride;
+        float* dst = plane + y * stride;
+        for (int x = 0; x < frame.width; x++)
+            dst[x] = src[x] * (1 / 255.0f);
+    }
+}
@@ -0,0 +1,106 @@
+/*
+  framesource.h - Grayscale frames from a camera or a file, timestamped.
+
+  V4l2Source captures into buffers the driver fills by DMA and memory maps
+  for us, and hands out the luma plane in place: for GREY, YUV420 and NV12
+  it is the start of the buffer, so nothing is copied.  YUYV, which most
+  webcams offer, interleaves luma and chroma, so its luma is picked out
+  into a buffer of our own.  The buffer is given back to the driver when
+  the next frame is asked for.  Frames are stamped by the driver when
+  capture finished, on the same clock as monotonicMicros().
+
+  FileSource reads YUV4MPEG2, directly if the file is one and otherwise
+  streamed from ffmpeg converting to gray, and keeps only the luma.  Its
+  frames are stamped from the frame rate, counting from when the first was
+  read; with pace it waits until then, as a camera would.
+*/
+#ifndef FrameSource_h
+#define FrameSource_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+struct Frame {
+    const uint8_t* luma; // valid until the next call to next()
+    int stride;          // bytes between rows
+    int width, height;
+    uint64_t time_us;    // capture time, monotonic
+    uint64_t index;      // of the frame in the stream, counting any lost
+};
+
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+    // Waits for the next frame; false at the end of the stream or on error.
+    virtual bool next(Frame& frame) = 0;
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+
+    uint64_t dropped; // frames the driver or decoder lost
+
+    // A V4l2Source for /dev/ paths, otherwise a FileSource; NULL if it
+    // won't open.  width, height and fps are what to ask a camera for, or
+    // to scale a video to if not 0.
+    static FrameSource* open(const char* name, int width = 0, int height = 0, int fps = 0, bool pace = false);
+
+protected:
+    FrameSource() : dropped(0) {}
+};
+
+class V4l2Source : public FrameSource {
+public:
+    V4l2Source();
+    ~V4l2Source();
+    // The size and rate are requests; the driver may pick others.
+    bool open(const char* device, int width, int height, int fps);
+    void close();
+    bool next(Frame& frame);
+    int width() const { return _width; }
+    int height() const { return _height; }
+    uint32_t format() const { return _format; } // V4L2_PIX_FMT_*
+
+private:
+    struct Buffer {
+        void* start;
+        size_t length;
+    };
+    bool _requeue();
+
+    int _fd;
+    int _width, _height, _stride;
+    uint32_t _format;
+    std::vector<Buffer> _buffers;
+    int _held;                  // buffer handed out, or -1
+    bool _streaming;
+    uint32_t _sequence;         // expected next
+    std::vector<uint8_t> _luma; // for YUYV
+};
+
+class FileSource : public FrameSource {
+public:
+    FileSource();
+    ~FileSource();
+    bool open(const char* path, int width = 0, int height = 0, bool pace = false);
+    void close();
+    bool next(Frame& frame);
+    int width() const { return _width; }
+    int height() const { return _height; }
+    double fps() const { return (double)_rateNum / _rateDen; }
+
+private:
+    bool _header();
+
+    FILE* _file;
+    bool _pipe, _pace;
+    int _width, _height;
+    size_t _chroma;              // bytes after the luma in each frame
+    uint32_t _rateNum, _rateDen;
+    uint64_t _frames, _start;
+    std::vector<uint8_t> _luma, _skip;
+};
+
+// Converts luma to floats 0..1, the convnet's input.
+void lumaToPlane(const Frame& frame, float* plane, int stride);
+
+#endif
@@ -0,0 +1,66 @@
+#include "hungarian.h"
+
+#include <limits>
+
+// Pads to square, then adds rows one at a time, each by the cheapest
+// augmenting path under the current potentials u and v.
+float hungarian(const std::vector<float>& cost, int rows, int cols, std::vector<int>& assignment) {
+    int n = rows > cols ? rows : cols;
+    const double inf = std::numeric_limits<double>::infinity();
+    // 1 based, with column 0 standing for the row being added.
+    std::vector<double> u(n + 1), v(n + 1), minv(n + 1);
+    std::vector<int> p(n + 1), way(n + 1);
+    std::vector<bool> used(n + 1);
+    for (int i = 1; i <= n; i++) {
+        p[0] = i;
+        int j0 = 0;
+        minv.assign(n + 1, inf);
+        used.assign(n + 1, false);
+        do {
+            used[j0] = true;
+            int i0 = p[j0], j1 = 0;
+            double delta = inf;
+            for (int j = 1; j <= n; j++) {
+                if (used[j])
+                    continue;
+                double c = i0 <= rows && j <= cols ? cost[(i0 - 1) * cols + j - 1] : HUNGARIAN_FORBIDDEN;
+                double cur = c - u[i0] - v[j];
+                if (cur < minv[j]) {
+                    minv[j] = cur;
+                    way[j] = j0;
+                }
+                if (minv[j] < delta) {
+                    delta = minv[j];
+                    j1 = j;
+                }
+            }
+            for (int j = 0; j <= n; j++) {
+                if (used[j]) {
+                    u[p[j]] += delta;
+                    v[j] -= delta;
+                } else {
+                    minv[j] -= delta;
+                }
+            }
+            j0 = j1;
+        } while (p[j0] != 0);
+        do {
+            int j1 = way[j0];
+            p[j0] = p[j1];
+            j0 = j1;
+        } while (j0);
+    }
+    assignment.assign(rows, -1);
+    float total = 0;
+    for (int j = 1; j <= cols; j++) {
+        int i = p[j];
+        if (i < 1 || i > rows)
+            continue;
+        float c = cost[(i - 1) * cols + j - 1];
+        if (c >= HUNGARIAN_FORBIDDEN)
+            continue;
+        assignment[i - 1] = j - 1;
+        total += c;
+    }
+    return total;
+}
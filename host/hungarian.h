@@ -0,0 +1,18 @@
+/*
+  hungarian.h - Minimum cost assignment (the Hungarian method, in the
+  O(n^3) shortest augmenting path form).
+*/
+#ifndef Hungarian_h
+#define Hungarian_h
+
+#include <vector>
+
+// Cost of a pairing that mustn't be made.  Anything this size or more is
+// left unassigned, after as many allowed pairings as possible are made.
+#define HUNGARIAN_FORBIDDEN 1e9f
+
+// cost is rows x cols, row major.  Sets assignment[row] to its column, or
+// -1 if it has none.
+float hungarian(const std::vector<float>& cost, int rows, int cols, std::vector<int>& assignment);
+
+#endif
@@ -0,0 +1,224 @@
+#include "link.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "clock.h"
+
+#define MAX_TEXT 120 // node text longer than this is passed on as a line anyway
+
+CommandParser::CommandParser() : dropped(0), _len(0), _inFrame(false) {}
+
+void CommandParser::feed(const uint8_t* data, int len) {
+    for (int i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        if (!_inFrame) {
+            if (c == PROTO_SYNC) {
+                _inFrame = true;
+                _len = 0;
+            } else {
+                dropped++;
+            }
+            continue;
+        }
+        _frame[_len++] = c;
+        if (_frame[0] < PROTO_CMD_MIN) {
+            if (_len == PROTO_LEGACY_LEN) {
+                _inFrame = false;
+                if (onCommand)
+                    onCommand(0, _frame, PROTO_LEGACY_LEN);
+            }
+            continue;
+        }
+        if (_len < 2)
+            continue;
+        if (_frame[1] > PROTO_MAX_PAYLOAD) {
+            _inFrame = false;
+            dropped += _len + 1;
+            continue;
+        }
+        if (_len < _frame[1] + 3)
+            continue;
+        _inFrame = false;
+        uint8_t csum = 0;
+        for (int j = 0; j < _len - 1; j++)
+            csum ^= _frame[j];
+        if (csum != _frame[_len - 1])
+            dropped += _len + 1;
+        else if (onCommand)
+            onCommand(_frame[0], _frame + 2, _frame[1]);
+    }
+}
+
+int encodeCommand(uint8_t* buf, uint8_t cmd, const uint8_t* payload, uint8_t len) {
+    uint8_t csum = cmd ^ len;
+    buf[0] = PROTO_SYNC;
+    buf[1] = cmd;
+    buf[2] = len;
+    for (int i = 0; i < len; i++) {
+        buf[3 + i] = payload[i];
+        csum ^= payload[i];
+    }
+    buf[3 + len] = csum;
+    return len + 4;
+}
+
+Link::Link() : badFrames(0), _fd(-1), _tlmPos(0), _csum(0), _pingSeq(0) {
+    memset(_pingSent, 0, sizeof(_pingSent));
+}
+
+Link::~Link() {
+    close();
+}
+
+bool Link::open(const char* path) {
+    _fd = ::open(path, O_RDWR | O_NOCTTY);
+    if (_fd < 0)
+        return false;
+    struct termios tio;
+    if (tcgetattr(_fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tio.c_cflag &= ~HUPCL; // don't reset the Arduino every time we reopen
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(_fd, TCSANOW, &tio);
+    }
+    return true;
+}
+
+void Link::close() {
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+}
+
+bool Link::sendRaw(const uint8_t* data, int len) {
+    while (len > 0) {
+        int n = write(_fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool Link::send(uint8_t cmd, const uint8_t* payload, uint8_t len) {
+    uint8_t buf[PROTO_MAX_PAYLOAD + 4];
+    return sendRaw(buf, encodeCommand(buf, cmd, payload, len));
+}
+
+bool Link::sendSticks(uint16_t ail, uint16_t ele, uint16_t thr, uint16_t rud) {
+    uint8_t buf[1 + PROTO_LEGACY_LEN];
+    buf[0] = PROTO_SYNC;
+    put16(buf + 1, ail);
+    put16(buf + 3, ele);
+    put16(buf + 5, thr);
+    put16(buf + 7, rud);
+    return sendRaw(buf, sizeof(buf));
+}
+
+bool Link::sendTraceSticks(uint8_t slot, uint16_t seq, uint16_t ail, uint16_t ele, uint16_t thr, uint16_t rud) {
+    uint8_t p[CMD_TRACE_STICKS_LEN];
+    p[0] = slot;
+    put16(p + 1, seq);
+    put16(p + 3, ail);
+    put16(p + 5, ele);
+    put16(p + 7, thr);
+    put16(p + 9, rud);
+    return send(CMD_TRACE_STICKS, p, sizeof(p));
+}
+
+bool Link::ping() {
+    uint8_t p[CMD_PING_LEN];
+    _pingSeq++;
+    put16(p, _pingSeq);
+    _pingSent[_pingSeq & 7] = monotonicMicros();
+    return send(CMD_PING, p, sizeof(p));
+}
+
+bool Link::poll(int timeout_ms) {
+    struct pollfd pfd = { _fd, POLLIN, 0 };
+    int r = ::poll(&pfd, 1, timeout_ms);
+    if (r < 0)
+        return errno == EINTR;
+    if (r == 0)
+        return true;
+    uint8_t buf[256];
+    int n = read(_fd, buf, sizeof(buf));
+    if (n <= 0)
+        return false;
+    receive(buf, n, monotonicMicros());
+    return true;
+}
+
+void Link::receive(const uint8_t* data, int len, uint64_t now) {
+    for (int i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        switch (_tlmPos) {
+        case 0:
+            if (c == TLM_SYNC) {
+                _tlmPos = 1;
+            } else if (c == '\n') {
+                if (onText)
+                    onText(_text);
+                _text.clear();
+            } else if (c != '\r' && !(c & 0x80)) {
+                _text += (char)c;
+                // Legacy stick frames are echoed with no newline at all.
+                if (_text.size() >= MAX_TEXT) {
+                    if (onText)
+                        onText(_text);
+                    _text.clear();
+                }
+            }
+            break;
+        case 1:
+            _tlm.type = c;
+            _csum = c;
+            _tlmPos = 2;
+            break;
+        case 2:
+            if (c > PROTO_MAX_PAYLOAD) {
+                badFrames++;
+                _tlmPos = 0;
+                break;
+            }
+            _tlm.len = c;
+            _csum ^= c;
+            _tlmPos = 3;
+            break;
+        default:
+            if (_tlmPos - 3 < _tlm.len) {
+                _tlm.payload[_tlmPos - 3] = c;
+                _csum ^= c;
+                _tlmPos++;
+                break;
+            }
+            _tlmPos = 0;
+            if (c != _csum) {
+                badFrames++;
+                break;
+            }
+            _tlm.host_us = now;
+            if (_tlm.type == TLM_PONG && _tlm.len == TLM_PONG_LEN) {
+                uint16_t seq = get16(_tlm.payload);
+                // Anything more than a few pings old has been overwritten.
+                if ((uint16_t)(_pingSeq - seq) < 8 && _pingSent[seq & 7]) {
+                    clock.addSample(_pingSent[seq & 7], get32(_tlm.payload + 2),
+                                    get32(_tlm.payload + 6), now);
+                    _pingSent[seq & 7] = 0;
+                }
+            }
+            if (onTelemetry)
+                onTelemetry(_tlm);
+        }
+    }
+}
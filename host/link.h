@@ -0,0 +1,84 @@
+/*
+  link.h - Host side of the arduino_proxy serial protocol.
+
+  See arduino_proxy/protocol.h for the wire format.
+*/
+#ifndef Link_h
+#define Link_h
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+
+#include "../arduino_proxy/protocol.h"
+#include "clocksync.h"
+
+inline uint16_t get16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+inline uint32_t get32(const uint8_t* p) { return ((uint32_t)get16(p) << 16) | get16(p + 2); }
+inline void put16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+inline void put32(uint8_t* p, uint32_t v) { put16(p, v >> 16); put16(p + 2, v); }
+
+// A telemetry frame from the Arduino.
+struct Telemetry {
+    uint8_t type;
+    uint8_t len;
+    uint8_t payload[PROTO_MAX_PAYLOAD];
+    uint64_t host_us; // host monotonic time the last byte arrived
+};
+
+// Splits a host -> Arduino byte stream back into frames, exactly as the
+// sketch does.  Legacy stick frames are reported with cmd 0.
+class CommandParser {
+public:
+    CommandParser();
+    void feed(const uint8_t* data, int len);
+    std::function<void(uint8_t cmd, const uint8_t* payload, uint8_t len)> onCommand;
+    unsigned dropped; // bytes thrown away hunting for PROTO_SYNC or with a bad checksum
+private:
+    uint8_t _frame[PROTO_MAX_PAYLOAD + 3];
+    int _len;
+    bool _inFrame;
+};
+
+// Encodes a host -> Arduino frame into buf (at least PROTO_MAX_PAYLOAD + 4
+// bytes), returning its length.
+int encodeCommand(uint8_t* buf, uint8_t cmd, const uint8_t* payload, uint8_t len);
+
+class Link {
+public:
+    Link();
+    ~Link();
+    // Opens a tty at 115200 raw, or anything else (a pty, a pipe) as is.
+    bool open(const char* path);
+    void close();
+    int fd() const { return _fd; }
+
+    bool send(uint8_t cmd, const uint8_t* payload, uint8_t len);
+    bool sendRaw(const uint8_t* data, int len);
+    bool sendSticks(uint16_t ail, uint16_t ele, uint16_t thr, uint16_t rud);
+    bool sendTraceSticks(uint8_t slot, uint16_t seq, uint16_t ail, uint16_t ele, uint16_t thr, uint16_t rud);
+    // Sends a clock sync ping; the pong is fed to clock when it comes back.
+    bool ping();
+
+    // Waits up to timeout_ms for input and dispatches everything that has
+    // arrived.  Returns false once the port has gone away.
+    bool poll(int timeout_ms);
+    // Feeds bytes already read from fd().
+    void receive(const uint8_t* data, int len, uint64_t now);
+
+    std::function<void(const Telemetry&)> onTelemetry;
+    std::function<void(const std::string&)> onText;
+    unsigned badFrames;
+    ClockSync clock;
+
+private:
+    int _fd;
+    Telemetry _tlm;
+    int _tlmPos; // bytes of the current telemetry frame seen, 0 when idle
+    uint8_t _csum;
+    std::string _text;
+    uint16_t _pingSeq;
+    uint64_t _pingSent[8]; // host send time, indexed by low bits of seq
+};
+
+#endif
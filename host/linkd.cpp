@@ -0,0 +1,252 @@
+/*
+  linkd - owns the serial ports to one or more arduino_proxy nodes.
+
+  Reads host -> Arduino frames (protocol.h) on stdin, so the Lua side can
+  simply write to a pipe, and routes them to whichever node carries the
+  craft.  The slot byte of CMD_STICKS and CMD_TRACE_STICKS is a global
+  craft ID here, legacy stick frames go to craft 0, and CMD_HOST_BIND binds
+  a new craft.  See router.h for how craft are spread over nodes.
+
+  Host-only frames (CMD_TRACE_MARK) are consumed here.  With -t the whole
+  path is stamped into a trace log for tracereport.  Each node's clock is
+  kept in sync with a ping every -p milliseconds (default 1000) so its
+  stamps land on the host timeline.  SIGUSR1 snapshots the nodes' profile
+  counters to stderr.  With -r every command, telemetry frame and line of
+  node text is also recorded to a flight log (flightlog.h) for logdump.
+  With -m, per craft and per node statistics (linkstats.h) are served on
+  http://127.0.0.1:port/metrics for Prometheus, and as a snapshot for
+  linkstat, and the nodes' profile counters are gathered every ten
+  seconds for them, printed only on SIGUSR1.
+
+    mkfifo /tmp/quad
+    linkd -t trace.log /dev/ttyUSB0 /dev/ttyUSB1 < /tmp/quad &
+    QUAD_LINK=/tmp/quad qlua vision.lua
+*/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "flightlog.h"
+#include "link.h"
+#include "linkstats.h"
+#include "profile.h"
+#include "router.h"
+#include "trace.h"
+
+#define PROFILE_INTERVAL 10000000 // us, between snapshots gathered for -m
+
+static Router router;
+static TraceLog trace;
+static FlightRecorder recorder;
+static bool recording;
+static LinkStats stats;
+static bool serving;
+static std::vector<ProfileSnapshot> profiles;
+static volatile sig_atomic_t profileRequested;
+static bool printProfile;
+// The vision side's marks carry no craft, but come just before the sticks
+// they go with, so they wait here for them.
+static bool markPending;
+static uint16_t markSeq;
+static uint64_t markTime[TRACE_ENQUEUE];
+
+static void requestProfile(int) {
+    profileRequested = 1;
+}
+
+// Until the first pong comes back, assume the echo left the Arduino
+// straight after the packet aired and took its own serial time to arrive.
+static uint64_t arduinoToHost(int node, uint32_t arduino_us, uint32_t anchor_us, const Telemetry& t) {
+    const ClockSync& clock = router.node(node).link.clock;
+    if (clock.synced())
+        return clock.toHost(arduino_us);
+    uint64_t serial_us = (t.len + 4) * 10 * 1000000 / 115200;
+    return t.host_us - serial_us - (uint32_t)(anchor_us - arduino_us);
+}
+
+static void command(uint8_t cmd, const uint8_t* p, uint8_t len) {
+    uint64_t now = monotonicMicros();
+    if (recording) {
+        LogCommand c = { cmd, len, {} };
+        memcpy(c.payload, p, len < sizeof(c.payload) ? len : sizeof(c.payload));
+        recorder.record(LOG_COMMAND, now, c);
+    }
+    switch (cmd) {
+    case 0:
+        stats.sticks(0, router.sendSticks(0, get16(p), get16(p + 2), get16(p + 4), get16(p + 6)));
+        break;
+    case CMD_TRACE_MARK: {
+        if (len != CMD_TRACE_MARK_LEN)
+            break;
+        uint32_t age[TRACE_ENQUEUE];
+        for (int stage = TRACE_CAPTURE; stage <= TRACE_CONTROLLER; stage++) {
+            age[stage] = get32(p + 2 + 4 * stage);
+            markTime[stage] = age[stage] != 0xFFFFFFFF ? now - age[stage] : 0;
+        }
+        markSeq = get16(p);
+        markPending = true;
+        stats.marked(age);
+        break;
+    }
+    case CMD_TRACE_STICKS:
+        if (len != CMD_TRACE_STICKS_LEN)
+            break;
+        if (markPending && markSeq == get16(p + 1))
+            for (int stage = TRACE_CAPTURE; stage <= TRACE_CONTROLLER; stage++)
+                if (markTime[stage])
+                    trace.stamp(markSeq, p[0], (TraceStage)stage, markTime[stage]);
+        markPending = false;
+        trace.stamp(get16(p + 1), p[0], TRACE_ENQUEUE, now);
+        stats.enqueued(p[0], get16(p + 1), now);
+        stats.sticks(p[0], router.sendTraceSticks(p[0], get16(p + 1), get16(p + 3), get16(p + 5), get16(p + 7),
+                                                  get16(p + 9)));
+        break;
+    case CMD_STICKS:
+        if (len == CMD_STICKS_LEN)
+            stats.sticks(p[0], router.sendSticks(p[0], get16(p + 1), get16(p + 3), get16(p + 5), get16(p + 7)));
+        break;
+    case CMD_HOST_BIND:
+        if (len != CMD_HOST_BIND_LEN)
+            break;
+        if (router.bind(p[0]))
+            stats.binding(p[0]);
+        else
+            fprintf(stderr, "craft %d: already bound\n", p[0]);
+        break;
+    case CMD_PROFILE:
+    case CMD_STATUS:
+        router.broadcast(cmd, p, len);
+        break;
+    default:
+        // Slot addressed commands can't be routed; use the host-level ones.
+        fprintf(stderr, "dropping command 0x%02x\n", cmd);
+    }
+}
+
+static void telemetry(int node, const Telemetry& t) {
+    if (recording) {
+        LogTelemetry r = { (uint8_t)node, t.type, t.len, {} };
+        memcpy(r.payload, t.payload, t.len < sizeof(r.payload) ? t.len : sizeof(r.payload));
+        recorder.record(LOG_TELEMETRY, t.host_us, r);
+    }
+    stats.telemetry(node);
+    switch (t.type) {
+    case TLM_TRACE: {
+        if (t.len != TLM_TRACE_LEN)
+            break;
+        uint16_t seq = get16(t.payload + 1);
+        uint32_t rx = get32(t.payload + 3);
+        uint32_t air = get32(t.payload + 7);
+        int id = router.craftAt(node, t.payload[0]);
+        trace.stamp(seq, id, TRACE_RECEIPT, arduinoToHost(node, rx, air, t));
+        trace.stamp(seq, id, TRACE_AIR, arduinoToHost(node, air, air, t));
+        if (id >= 0)
+            stats.aired(id, seq, arduinoToHost(node, air, air, t));
+        break;
+    }
+    case TLM_PROFILE:
+        if (profiles[node].add(t)) {
+            stats.profile(node, profiles[node]);
+            if (printProfile) {
+                fprintf(stderr, "node %d (%s):\n", node, router.node(node).path.c_str());
+                profiles[node].print(stderr);
+            }
+            profiles[node].clear();
+        }
+        break;
+    }
+}
+
+static void text(int node, const std::string& line) {
+    fprintf(stderr, "node %d: %s\n", node, line.c_str());
+    if (recording)
+        recorder.text(monotonicMicros(), node, line);
+}
+
+static void craft(int id, const CraftBinding& b) {
+    stats.bound(id, b);
+    if (router.queued(id))
+        stats.binding(id);
+    if (b.node < 0) {
+        fprintf(stderr, "craft %d: %s\n", id,
+                b.bound ? "no node available" : router.queued(id) ? "waiting to bind again" : "bind failed");
+        return;
+    }
+    fprintf(stderr, "craft %d: node %d slot %d txid %02x%02x%02x%02x aid %02x%02x%02x%02x\n",
+            id, b.node, b.slot, b.txid[0], b.txid[1], b.txid[2], b.txid[3],
+            b.aid[0], b.aid[1], b.aid[2], b.aid[3]);
+}
+
+static int usage(const char* name) {
+    fprintf(stderr, "usage: %s [-t trace.log] [-r session.log] [-m port] [-p ping_ms] [-f fail_ms] /dev/ttyUSB0 ...\n", name);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:m:p:f:")) != -1) {
+        switch (opt) {
+        case 'p':
+            router.pingInterval = atoi(optarg);
+            break;
+        case 'f':
+            router.failTimeout = atoi(optarg);
+            break;
+        case 't':
+            if (!trace.open(optarg)) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            if (!recorder.open(optarg))
+                return 1;
+            recording = true;
+            break;
+        case 'm':
+            if (!stats.metrics.serve(atoi(optarg)))
+                return 1;
+            serving = true;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind >= argc || router.pingInterval <= 0)
+        return usage(argv[0]);
+    router.onTelemetry = telemetry;
+    router.onText = text;
+    router.onCraft = craft;
+    profiles.resize(argc - optind);
+    for (int i = optind; i < argc; i++)
+        if (!router.addNode(argv[i]))
+            perror(argv[i]); // keeps retrying
+    signal(SIGUSR1, requestProfile);
+
+    CommandParser commands;
+    commands.onCommand = command;
+    bool input = true;
+    uint64_t nextProfile = monotonicMicros() + PROFILE_INTERVAL;
+    for (;;) {
+        uint64_t now = monotonicMicros();
+        if (profileRequested || (serving && now >= nextProfile)) {
+            printProfile = profileRequested;
+            profileRequested = 0;
+            nextProfile = now + PROFILE_INTERVAL;
+            router.broadcast(CMD_PROFILE, NULL, 0);
+        }
+        bool ready = router.poll(-1, input ? 0 : -1);
+        stats.poll(router, commands);
+        if (!ready)
+            continue;
+        uint8_t buf[256];
+        int n = read(0, buf, sizeof(buf));
+        if (n <= 0)
+            input = false; // keep the craft flying on their last values
+        else
+            commands.feed(buf, n);
+    }
+}
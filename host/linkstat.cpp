@@ -0,0 +1,135 @@
+/*
+  linkstat - a terminal dashboard of linkd's statistics.
+
+    linkstat [-i seconds] [-n count] port
+
+  Fetches the binary snapshot from linkd -m port every -i seconds
+  (default 1) and redraws: counters with their rate since the last
+  snapshot, gauges, and histograms with their rate and median and 99th
+  percentile.  -n stops after count snapshots, without clearing the
+  screen, for a log.
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+
+static bool fetch(int port, std::vector<uint8_t>& body) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return false;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    const char request[] = "GET /snapshot HTTP/1.0\r\n\r\n";
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        write(fd, request, sizeof(request) - 1) != (ssize_t)sizeof(request) - 1) {
+        perror("linkd");
+        close(fd);
+        return false;
+    }
+    std::string reply;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        reply.append(buf, n);
+    close(fd);
+    size_t head = reply.find("\r\n\r\n");
+    if (reply.compare(0, 12, "HTTP/1.0 200") || head == std::string::npos) {
+        fprintf(stderr, "linkd: bad reply\n");
+        return false;
+    }
+    body.assign(reply.begin() + head + 4, reply.end());
+    return true;
+}
+
+static void show(const std::vector<MetricSample>& now, const std::map<std::string, MetricSample>& before,
+                 double seconds) {
+    for (size_t i = 0; i < now.size(); i++) {
+        const MetricSample& s = now[i];
+        std::map<std::string, MetricSample>::const_iterator was = before.find(s.name);
+        double rate = was != before.end() && seconds > 0 ? (s.count - was->second.count) / seconds : 0;
+        switch (s.kind) {
+        case METRIC_COUNTER:
+            printf("%-60s %12llu %10.1f/s\n", s.name.c_str(), (unsigned long long)s.count, rate);
+            break;
+        case METRIC_GAUGE:
+            printf("%-60s %12g\n", s.name.c_str(), s.value);
+            break;
+        case METRIC_HISTOGRAM: {
+            // Quantiles over the interval where there is one.
+            uint64_t b[METRIC_BUCKETS];
+            for (int k = 0; k < METRIC_BUCKETS; k++)
+                b[k] = s.buckets[k] - (was != before.end() ? was->second.buckets[k] : 0);
+            printf("%-60s %12llu %10.1f/s  p50 %8.2f ms  p99 %8.2f ms\n", s.name.c_str(), (unsigned long long)s.count,
+                   rate, histogramQuantile(b, 0.5) * 1e-3, histogramQuantile(b, 0.99) * 1e-3);
+            break;
+        }
+        }
+    }
+}
+
+static int usage(const char* name) {
+    fprintf(stderr, "usage: %s [-i seconds] [-n count] port\n", name);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    double interval = 1;
+    int count = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval = atof(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || interval <= 0)
+        return usage(argv[0]);
+    int port = atoi(argv[optind]);
+
+    std::map<std::string, MetricSample> before;
+    uint64_t last = 0;
+    for (int n = 0; !count || n < count; n++) {
+        if (n)
+            usleep((useconds_t)(interval * 1e6));
+        std::vector<uint8_t> body;
+        std::vector<MetricSample> samples;
+        uint64_t time_us;
+        if (!fetch(port, body))
+            return 1;
+        if (!decodeSnapshot(body.empty() ? NULL : &body[0], body.size(), time_us, samples)) {
+            fprintf(stderr, "linkd: bad snapshot\n");
+            return 1;
+        }
+        if (!count)
+            printf("\033[H\033[J");
+        show(samples, before, last ? (time_us - last) * 1e-6 : 0);
+        if (count)
+            printf("\n");
+        fflush(stdout);
+        before.clear();
+        for (size_t i = 0; i < samples.size(); i++)
+            before[samples[i].name] = samples[i];
+        last = time_us;
+    }
+    return 0;
+}
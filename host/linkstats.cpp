@@ -0,0 +1,125 @@
+#include "linkstats.h"
+
+#include <string>
+
+LinkStats::LinkStats() : _lastInputDropped(0) {
+    _dropped = metrics.counter("linkd_sticks_dropped_total", "Stick updates for craft with no node");
+    _inputDropped = metrics.counter("linkd_input_dropped_bytes_total",
+                                    "Bytes on stdin thrown away hunting for sync or with a bad checksum");
+    _frames = metrics.counter("vision_updates_total", "Traced stick updates, one per camera frame");
+    for (int stage = TRACE_CAPTURE; stage < TRACE_ENQUEUE; stage++)
+        _age[stage] = metrics.histogram(std::string("vision_age_seconds{stage=\"") + traceStageName(stage) + "\"}",
+                                        "Age of each stage's stamp when the sticks were enqueued");
+    for (int i = 0; i < 256; i++) {
+        _enqueued[i] = 0;
+        _enqueuedCraft[i] = -1;
+    }
+}
+
+LinkStats::Craft& LinkStats::craft(int id) {
+    while ((int)_craft.size() <= id) {
+        std::string label = "{craft=\"" + std::to_string(_craft.size()) + "\"}";
+        Craft c;
+        c.sticks = metrics.counter("linkd_sticks_total" + label, "Stick updates sent to the craft's node");
+        c.state = metrics.gauge("linkd_craft_state" + label, "0 no node, 1 binding, 2 bound");
+        c.node = metrics.gauge("linkd_craft_node" + label, "Node carrying the craft, -1 for none");
+        c.air = metrics.histogram("linkd_air_latency_seconds" + label,
+                                  "Serial enqueue to packet on air, traced sticks only");
+        metrics.set(c.node, -1);
+        _craft.push_back(c);
+    }
+    return _craft[id];
+}
+
+LinkStats::NodeStats& LinkStats::node(int id) {
+    while ((int)_nodes.size() <= id) {
+        std::string label = "{node=\"" + std::to_string(_nodes.size()) + "\"}";
+        NodeStats n;
+        n.healthy = metrics.gauge("linkd_node_healthy" + label, "1 while the node answers pings");
+        n.telemetry = metrics.counter("linkd_telemetry_frames_total" + label, "Telemetry frames from the node");
+        n.badFrames = metrics.counter("linkd_serial_bad_frames_total" + label,
+                                      "Telemetry frames from the node dropped for a bad length or checksum");
+        n.resync = metrics.counter("linkd_node_resync_bytes_total" + label,
+                                   "Bytes the node dropped hunting for sync, from profile snapshots");
+        n.badCsum = metrics.counter("linkd_node_bad_checksums_total" + label,
+                                    "Frames the node dropped for a bad checksum, from profile snapshots");
+        n.rxFrames = metrics.counter("linkd_node_radio_frames_total" + label,
+                                     "Radio frames the node drained while binding, from profile snapshots");
+        n.rxBadCrc = metrics.counter("linkd_node_radio_bad_crc_total" + label,
+                                     "Radio frames failing the emulated XN297 CRC, from profile snapshots");
+        n.rxJunk = metrics.counter("linkd_node_radio_junk_total" + label,
+                                   "Radio frames with a good CRC that were no bind reply, from profile snapshots");
+        n.late = metrics.histogram("linkd_node_packet_late_seconds" + label,
+                                   "How late packets went on air, from profile snapshots");
+        n.lastBad = 0;
+        _nodes.push_back(n);
+    }
+    return _nodes[id];
+}
+
+void LinkStats::sticks(int id, bool sent) {
+    if (sent)
+        metrics.add(craft(id).sticks);
+    else
+        metrics.add(_dropped);
+}
+
+void LinkStats::binding(int id) {
+    metrics.set(craft(id).state, 1);
+}
+
+void LinkStats::bound(int id, const CraftBinding& b) {
+    Craft& c = craft(id);
+    metrics.set(c.state, b.node < 0 ? 0 : b.bound ? 2 : 1);
+    metrics.set(c.node, b.node);
+}
+
+void LinkStats::enqueued(int id, uint16_t seq, uint64_t host_us) {
+    _enqueued[seq & 255] = host_us;
+    _enqueuedCraft[seq & 255] = id;
+}
+
+void LinkStats::aired(int id, uint16_t seq, uint64_t host_us) {
+    if (_enqueuedCraft[seq & 255] != id || host_us < _enqueued[seq & 255])
+        return;
+    metrics.observe(craft(id).air, host_us - _enqueued[seq & 255]);
+    _enqueuedCraft[seq & 255] = -1;
+}
+
+void LinkStats::marked(const uint32_t age[TRACE_ENQUEUE]) {
+    metrics.add(_frames);
+    for (int stage = TRACE_CAPTURE; stage < TRACE_ENQUEUE; stage++)
+        if (age[stage] != 0xFFFFFFFF)
+            metrics.observe(_age[stage], age[stage]);
+}
+
+void LinkStats::telemetry(int id) {
+    metrics.add(node(id).telemetry);
+}
+
+// The sketch's bucket i counts values below 16 << i us, which all fall
+// in bucket 4 + i or below here.
+void LinkStats::profile(int id, const ProfileSnapshot& p) {
+    NodeStats& n = node(id);
+    metrics.add(n.resync, p.counters[PROF_RESYNC].sum);
+    metrics.add(n.badCsum, p.counters[PROF_BAD_CSUM].count);
+    metrics.add(n.rxFrames, p.counters[PROF_RX_BURST].sum);
+    metrics.add(n.rxBadCrc, p.counters[PROF_RX_BAD_CRC].count);
+    metrics.add(n.rxJunk, p.counters[PROF_RX_JUNK].count);
+    const ProfileCounter& late = p.counters[PROF_LATE];
+    for (int b = 0; b < PROF_BUCKETS; b++)
+        metrics.addBucket(n.late, b < PROF_BUCKETS - 1 ? 4 + b : METRIC_BUCKETS - 1, late.buckets[b],
+                          b ? 0 : late.sum);
+}
+
+void LinkStats::poll(Router& router, const CommandParser& input) {
+    for (int i = 0; i < router.nodes(); i++) {
+        NodeStats& n = node(i);
+        const Node& r = router.node(i);
+        metrics.set(n.healthy, r.healthy);
+        metrics.add(n.badFrames, r.link.badFrames - n.lastBad);
+        n.lastBad = r.link.badFrames;
+    }
+    metrics.add(_inputDropped, input.dropped - _lastInputDropped);
+    _lastInputDropped = input.dropped;
+}
@@ -0,0 +1,67 @@
+/*
+  linkstats.h - linkd's live statistics, as Metrics series.
+
+  Per craft: stick updates routed and dropped, bind state (0 no node, 1
+  binding, 2 bound) and node, and for traced sticks the time from serial
+  enqueue to the packet going on air.  Per node: health, telemetry frames,
+  frames the host threw away, and from each profile snapshot the bytes
+  the sketch dropped resyncing, its bad checksums, the radio frames it
+  read while binding and how many were corrupt or junk, and how late
+  packets went out.  From the vision side's trace marks: updates (one a camera
+  frame, so their rate is the detector's) and how old each stage's stamp
+  was when the sticks were enqueued, capture being the whole loop.
+
+  Everything is published from linkd's thread; Metrics serves it.
+*/
+#ifndef LinkStats_h
+#define LinkStats_h
+
+#include <stdint.h>
+#include <vector>
+
+#include "metrics.h"
+#include "profile.h"
+#include "router.h"
+#include "trace.h"
+
+class LinkStats {
+public:
+    LinkStats();
+
+    void sticks(int craft, bool sent);
+    void binding(int craft);
+    void bound(int craft, const CraftBinding& b);
+    void enqueued(int craft, uint16_t seq, uint64_t host_us);
+    void aired(int craft, uint16_t seq, uint64_t host_us);
+    // Ages of TRACE_CAPTURE to TRACE_CONTROLLER before enqueue, 0xFFFFFFFF
+    // if not stamped.
+    void marked(const uint32_t age[TRACE_ENQUEUE]);
+    void telemetry(int node);
+    void profile(int node, const ProfileSnapshot& p);
+    // Picks up the counters Link and CommandParser keep themselves.
+    void poll(Router& router, const CommandParser& input);
+
+    Metrics metrics;
+
+private:
+    struct Craft {
+        int sticks, state, node, air;
+    };
+    struct NodeStats {
+        int healthy, telemetry, badFrames, resync, badCsum, rxFrames, rxBadCrc, rxJunk, late;
+        unsigned lastBad;
+    };
+    Craft& craft(int id);
+    NodeStats& node(int id);
+
+    std::vector<Craft> _craft;
+    std::vector<NodeStats> _nodes;
+    int _dropped, _inputDropped, _frames, _age[TRACE_ENQUEUE];
+    unsigned _lastInputDropped;
+    // Enqueue time and craft of the last traced sticks with each low byte
+    // of sequence number.
+    uint64_t _enqueued[256];
+    int _enqueuedCraft[256];
+};
+
+#endif
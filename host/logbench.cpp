@@ -0,0 +1,234 @@
+/*
+  logbench - times FlightRecorder and FlightLog, and checks replay.
+
+    logbench [-n craft] [-t seconds] [-d dir]
+
+  First times record() from one to four threads at once, as fast as they
+  can go, counting what the queue drops.  Then records a synthetic
+  session: craft point masses (as in controlbench) flown by
+  FleetController at 30 frames a second, with two cameras' frames,
+  detections and tracks, positions, the controller's inputs and sticks,
+  and the CMD_STICKS that would go to linkd.  It reads that back, checks
+  every record came through in order, times seeks, rebuilds the index
+  from the log alone, and replays the controller, which should give the
+  same sticks to the bit.  Logs go in dir (default /tmp) and are removed.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "link.h"
+#include "logreplay.h"
+
+#define FPS 30
+#define BURST 1000000 // records per thread in the throughput test
+
+// Records, waiting for room rather than dropping: the session should be
+// complete to check it.
+template <class T> static void keep(FlightRecorder& rec, LogType type, uint64_t t, const T& payload) {
+    while (!rec.record(type, t, payload))
+        std::this_thread::yield();
+}
+
+static void throughput(const std::string& path) {
+    printf("threads  ns/record  dropped  written\n");
+    for (int threads = 1; threads <= 4; threads *= 2) {
+        FlightRecorder rec;
+        if (!rec.open(path.c_str()))
+            exit(1);
+        uint64_t start = monotonicMicros();
+        std::vector<std::thread> pool;
+        for (int i = 0; i < threads; i++)
+            pool.push_back(std::thread([&rec, i]() {
+                LogState s = { i, { 1, 2, 3 }, { 0, 0, 0 } };
+                for (int n = 0; n < BURST; n++)
+                    rec.record(LOG_STATE, monotonicMicros(), s);
+            }));
+        for (size_t i = 0; i < pool.size(); i++)
+            pool[i].join();
+        double ns = (monotonicMicros() - start) * 1e3 / ((double)threads * BURST);
+        rec.close();
+        printf("%7d %10.1f %8llu %8llu\n", threads, ns, (unsigned long long)rec.dropped(),
+               (unsigned long long)rec.written());
+    }
+    unlink(path.c_str());
+    unlink((path + ".idx").c_str());
+}
+
+// Flies craft point masses between two targets, recording everything.
+// Returns the records written.
+static uint64_t session(const std::string& path, int craft, double seconds) {
+    FlightRecorder rec;
+    if (!rec.open(path.c_str()))
+        exit(1);
+    FleetController c;
+    c.resize(craft);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> u(0.8f, 1.2f), noise(-1, 1);
+    std::vector<float> pos(3 * craft, 0), vel(3 * craft, 0), hover(craft), gain(craft);
+    uint64_t t = 1000000;
+    for (int i = 0; i < craft; i++) {
+        hover[i] = 450 * u(rng);
+        gain[i] = 2 * u(rng);
+        for (int a = 0; a < FleetController::AXES; a++) {
+            AxisGains g = c.gains(i, (FleetController::Axis)a);
+            LogGains lg = { i, a, g.kp, g.maxSpeed, g.vkp, g.vki, g.vkd, g.trim, g.maxRate };
+            keep(rec, LOG_GAINS, t, lg);
+        }
+        c.arm(i, true);
+        LogArm arm = { i, 1 };
+        keep(rec, LOG_ARM, t, arm);
+    }
+    uint64_t frameUs = 1000000 / FPS;
+    int frames = (int)(seconds * FPS);
+    for (int f = 0; f < frames; f++, t += frameUs) {
+        // A new target every five seconds.
+        if (f % (5 * FPS) == 0)
+            for (int i = 0; i < craft; i++) {
+                float side = (f / (5 * FPS)) % 2 ? -100.0f : 100.0f;
+                c.setTarget(i, side, -side, 100);
+                LogTarget lt = { i, side, -side, 100 };
+                keep(rec, LOG_TARGET, t, lt);
+            }
+        for (int cam = 0; cam < 2; cam++) {
+            LogFrame lf = { (uint32_t)f, (uint16_t)cam, 0 };
+            keep(rec, LOG_FRAME, t, lf);
+        }
+        for (int i = 0; i < craft; i++) {
+            float* p = &pos[3 * i];
+            float* v = &vel[3 * i];
+            for (int cam = 0; cam < 2; cam++) {
+                float x = p[cam] + noise(rng), y = p[2] + noise(rng);
+                LogDetection ld = { (uint16_t)cam, 0, x, y, 0.9f };
+                keep(rec, LOG_DETECTION, t, ld);
+                LogTrack lk = { (uint16_t)cam, (int16_t)i, i, x, y, v[cam], v[2] };
+                keep(rec, LOG_TRACK, t, lk);
+            }
+            LogPosition lp = { i, p[0], p[1], p[2], 0.5f };
+            keep(rec, LOG_POSITION, t, lp);
+            c.setState(i, p, v);
+            LogState ls = { i, { p[0], p[1], p[2] }, { v[0], v[1], v[2] } };
+            keep(rec, LOG_STATE, t, ls);
+        }
+        c.advance(t);
+        for (int i = 0; i < craft; i++) {
+            LogSticks ls = { i, { 0, 0, 0, 0 } };
+            for (int ch = 0; ch < FleetController::CHANNELS; ch++)
+                ls.stick[ch] = c.stick(i, (FleetController::Channel)ch);
+            keep(rec, LOG_STICKS, t, ls);
+            LogCommand cmd = { CMD_STICKS, CMD_STICKS_LEN, { (uint8_t)i } };
+            for (int ch = 0; ch < FleetController::CHANNELS; ch++)
+                put16(cmd.payload + 1 + 2 * ch, ls.stick[ch]);
+            keep(rec, LOG_COMMAND, t, cmd);
+        }
+        // The craft fly on until the next frame.
+        for (double s = 0; s < 1.0 / FPS; s += c.fixedDt)
+            for (int i = 0; i < craft; i++) {
+                float a[3] = { gain[i] * (c.stick(i, FleetController::AILERON) - 500.0f),
+                               gain[i] * (c.stick(i, FleetController::ELEVATOR) - 500.0f),
+                               gain[i] * (c.stick(i, FleetController::THROTTLE) - hover[i]) };
+                for (int k = 0; k < 3; k++) {
+                    vel[3 * i + k] += a[k] * c.fixedDt;
+                    pos[3 * i + k] += vel[3 * i + k] * c.fixedDt;
+                }
+            }
+    }
+    rec.close();
+    return rec.written();
+}
+
+static int usage(const char* name) {
+    fprintf(stderr, "usage: %s [-n craft] [-t seconds] [-d dir]\n", name);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    int craft = 16;
+    double seconds = 60;
+    std::string dir = "/tmp";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            craft = atoi(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (craft <= 0 || seconds <= 0)
+        return usage(argv[0]);
+    std::string path = dir + "/logbench." + std::to_string(getpid()) + ".log";
+    throughput(path);
+
+    uint64_t start = monotonicMicros();
+    uint64_t written = session(path, craft, seconds);
+    double recordMs = (monotonicMicros() - start) * 1e-3;
+    FlightLog log;
+    if (!log.open(path.c_str()))
+        return 1;
+    bool ok = true;
+    uint64_t count = 0, previous = 0, disorder = 0;
+    LogRecord r;
+    start = monotonicMicros();
+    while (log.next(r)) {
+        disorder += r.time_us < previous;
+        previous = r.time_us;
+        count++;
+    }
+    double readMs = (monotonicMicros() - start) * 1e-3;
+    printf("\n%d craft for %g s: %llu records in %d chunks, recorded in %.0f ms, read in %.1f ms, "
+           "%llu out of order\n",
+           craft, seconds, (unsigned long long)count, log.chunks(), recordMs, readMs,
+           (unsigned long long)disorder);
+    if (count != written) {
+        printf("wrote %llu records, read %llu\n", (unsigned long long)written, (unsigned long long)count);
+        ok = false;
+    }
+
+    // Seek to random times; the record found must not be before it.
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<uint64_t> when(log.first(), log.last());
+    int seeks = 1000, wrong = 0;
+    uint64_t seekUs = 0;
+    for (int i = 0; i < seeks; i++) {
+        uint64_t at = when(rng);
+        uint64_t t0 = monotonicMicros();
+        log.seek(at);
+        bool found = log.next(r);
+        seekUs += monotonicMicros() - t0;
+        wrong += !found || r.time_us < at;
+    }
+    printf("seek: %.2f us, %d wrong\n", (double)seekUs / seeks, wrong);
+    ok = ok && !wrong;
+
+    int chunks = log.chunks();
+    log.close();
+    unlink((path + ".idx").c_str());
+    if (!log.open(path.c_str()))
+        return 1;
+    printf("without the index: %d chunks of %d\n", log.chunks(), chunks);
+    ok = ok && log.chunks() == chunks;
+
+    FleetController c;
+    start = monotonicMicros();
+    ReplayResult result = replayLog(log, c, log.first(), UINT64_MAX);
+    printf("replay: %d sticks records in %.1f ms, %d differ, worst by %d\n", result.sticks,
+           (monotonicMicros() - start) * 1e-3, result.differ, result.worst);
+    ok = ok && result.sticks == craft * (int)(seconds * FPS) && !result.differ;
+    log.close();
+    unlink(path.c_str());
+    return ok ? 0 : 1;
+}
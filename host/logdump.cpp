@@ -0,0 +1,137 @@
+/*
+  logdump - prints a flight log as text.
+
+    logdump [-s seconds] [-e seconds] [-t type,...] session.log
+
+  One line per record: seconds since the first record, type, and fields.
+  -s and -e bound the time (seconds from the first record), seeking
+  rather than reading from the start; -t keeps only the types named
+  (frame, detection, track, position, state, target, arm, sticks,
+  command, telemetry, text, gains).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flightlog.h"
+
+static void bytes(const uint8_t* p, int len) {
+    for (int i = 0; i < len; i++)
+        printf(" %02x", p[i]);
+}
+
+static void print(const LogRecord& r, uint64_t origin) {
+    printf("%12.6f %-9s", (double)(r.time_us - origin) * 1e-6, logTypeName(r.type));
+    switch (r.type) {
+    case LOG_FRAME:
+        if (const LogFrame* f = r.as<LogFrame>())
+            printf(" camera %d frame %u", f->camera, f->index);
+        break;
+    case LOG_DETECTION:
+        if (const LogDetection* d = r.as<LogDetection>())
+            printf(" camera %d %.1f %.1f score %.3f", d->camera, d->x, d->y, d->score);
+        break;
+    case LOG_TRACK:
+        if (const LogTrack* t = r.as<LogTrack>())
+            printf(" camera %d track %d craft %d %.1f %.1f v %.1f %.1f", t->camera, t->id, t->craft,
+                   t->x, t->y, t->vx, t->vy);
+        break;
+    case LOG_POSITION:
+        if (const LogPosition* p = r.as<LogPosition>())
+            printf(" craft %d %.3f %.3f %.3f error %.3f", p->craft, p->x, p->y, p->z, p->error);
+        break;
+    case LOG_STATE:
+        if (const LogState* s = r.as<LogState>())
+            printf(" craft %d %.3f %.3f %.3f v %.3f %.3f %.3f", s->craft, s->position[0], s->position[1],
+                   s->position[2], s->velocity[0], s->velocity[1], s->velocity[2]);
+        break;
+    case LOG_TARGET:
+        if (const LogTarget* t = r.as<LogTarget>())
+            printf(" craft %d %.3f %.3f %.3f", t->craft, t->x, t->y, t->z);
+        break;
+    case LOG_ARM:
+        if (const LogArm* a = r.as<LogArm>())
+            printf(" craft %d %s", a->craft, a->on ? "on" : "off");
+        break;
+    case LOG_STICKS:
+        if (const LogSticks* s = r.as<LogSticks>())
+            printf(" craft %d %d %d %d %d", s->craft, s->stick[0], s->stick[1], s->stick[2], s->stick[3]);
+        break;
+    case LOG_COMMAND:
+        if (const LogCommand* c = r.as<LogCommand>()) {
+            printf(" 0x%02x", c->cmd);
+            bytes(c->payload, c->len < PROTO_MAX_PAYLOAD ? c->len : PROTO_MAX_PAYLOAD);
+        }
+        break;
+    case LOG_TELEMETRY:
+        if (const LogTelemetry* t = r.as<LogTelemetry>()) {
+            printf(" node %d 0x%02x", t->node, t->type);
+            bytes(t->payload, t->len < PROTO_MAX_PAYLOAD ? t->len : PROTO_MAX_PAYLOAD);
+        }
+        break;
+    case LOG_TEXT:
+        if (r.len >= 1)
+            printf(" node %d %.*s", r.payload[0], r.len - 1, (const char*)r.payload + 1);
+        break;
+    case LOG_GAINS:
+        if (const LogGains* g = r.as<LogGains>())
+            printf(" craft %d %c %g %g %g %g %g %g %g", g->craft, "xyz?"[g->axis >= 0 && g->axis < 3 ? g->axis : 3],
+                   g->kp, g->maxSpeed, g->vkp, g->vki, g->vkd, g->trim, g->maxRate);
+        break;
+    default:
+        printf(" %d", r.type);
+        bytes(r.payload, r.len);
+    }
+    printf("\n");
+}
+
+static int usage(const char* name) {
+    fprintf(stderr, "usage: %s [-s seconds] [-e seconds] [-t type,...] session.log\n", name);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    double start = 0, end = -1;
+    bool wanted[LOG_TYPES + 1] = { false };
+    bool filter = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:e:t:")) != -1) {
+        switch (opt) {
+        case 's':
+            start = atof(optarg);
+            break;
+        case 'e':
+            end = atof(optarg);
+            break;
+        case 't':
+            for (char* name = strtok(optarg, ","); name; name = strtok(NULL, ",")) {
+                int type = logTypeFromName(name);
+                if (type < 0) {
+                    fprintf(stderr, "unknown type %s\n", name);
+                    return 1;
+                }
+                wanted[type] = filter = true;
+            }
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        return usage(argv[0]);
+
+    FlightLog log;
+    if (!log.open(argv[optind]))
+        return 1;
+    uint64_t origin = log.first();
+    log.seek(origin + (uint64_t)(start * 1e6));
+    LogRecord r;
+    while (log.next(r)) {
+        if (end >= 0 && r.time_us > origin + (uint64_t)(end * 1e6))
+            break;
+        if (!filter || (r.type > 0 && r.type < LOG_TYPES && wanted[r.type]))
+            print(r, origin);
+    }
+    return 0;
+}
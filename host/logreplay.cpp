@@ -0,0 +1,71 @@
+#include "logreplay.h"
+
+#include <stdlib.h>
+
+ReplayResult replayLog(FlightLog& log, FleetController& control, uint64_t from, uint64_t to,
+                       const std::function<void(const LogRecord& r, const uint16_t sticks[4])>& onSticks) {
+    ReplayResult result = { 0, 0, 0 };
+    log.seek(from);
+    LogRecord r;
+    uint64_t advanced = 0;
+    bool started = false;
+    while (log.next(r) && r.time_us <= to) {
+        switch (r.type) {
+        case LOG_GAINS:
+            if (const LogGains* g = r.as<LogGains>()) {
+                if (g->axis < 0 || g->axis >= FleetController::AXES)
+                    break;
+                if (g->craft >= control.size())
+                    control.resize(g->craft + 1);
+                AxisGains a = { g->kp, g->maxSpeed, g->vkp, g->vki, g->vkd, g->trim, g->maxRate };
+                control.setGains(g->craft, (FleetController::Axis)g->axis, a);
+            }
+            break;
+        case LOG_ARM:
+            if (const LogArm* a = r.as<LogArm>()) {
+                if (a->craft >= control.size())
+                    control.resize(a->craft + 1);
+                control.arm(a->craft, a->on != 0);
+            }
+            break;
+        case LOG_TARGET:
+            if (const LogTarget* t = r.as<LogTarget>()) {
+                if (t->craft >= control.size())
+                    control.resize(t->craft + 1);
+                control.setTarget(t->craft, t->x, t->y, t->z);
+            }
+            break;
+        case LOG_STATE:
+            if (const LogState* s = r.as<LogState>()) {
+                if (s->craft >= control.size())
+                    control.resize(s->craft + 1);
+                control.setState(s->craft, s->position, s->velocity);
+            }
+            break;
+        case LOG_STICKS:
+            if (const LogSticks* s = r.as<LogSticks>()) {
+                if (s->craft < 0 || s->craft >= control.size())
+                    break;
+                if (!started || r.time_us != advanced) {
+                    control.advance(r.time_us);
+                    advanced = r.time_us;
+                    started = true;
+                }
+                uint16_t sticks[4];
+                bool same = true;
+                for (int ch = 0; ch < FleetController::CHANNELS; ch++) {
+                    sticks[ch] = control.stick(s->craft, (FleetController::Channel)ch);
+                    int d = abs((int)sticks[ch] - s->stick[ch]);
+                    result.worst = d > result.worst ? d : result.worst;
+                    same = same && !d;
+                }
+                result.sticks++;
+                result.differ += !same;
+                if (onSticks)
+                    onSticks(r, sticks);
+            }
+            break;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,31 @@
+/*
+  logreplay.h - Flying a FleetController again from a flight log.
+
+  The controller is fed the gains, arm, target and state records in the
+  order they were logged, and at each sticks record is advanced to its
+  time with advance(), as the live loop did before logging them.  Played
+  from the start of the session, fixed steps give the same sticks to the
+  bit, so any difference is a change in the controller (or gains not in
+  the log).  Played from part way, the integrals start empty and the
+  sticks take a moment to agree.
+*/
+#ifndef LogReplay_h
+#define LogReplay_h
+
+#include <functional>
+
+#include "controller.h"
+#include "flightlog.h"
+
+struct ReplayResult {
+    int sticks;   // compared
+    int differ;   // of those, not the same as logged
+    int worst;    // largest difference on any channel
+};
+
+// Replays records from time from up to to.  onSticks, if set, is given
+// each logged sticks record and what the controller made of it.
+ReplayResult replayLog(FlightLog& log, FleetController& control, uint64_t from, uint64_t to,
+                       const std::function<void(const LogRecord& r, const uint16_t sticks[4])>& onSticks = nullptr);
+
+#endif
@@ -0,0 +1,386 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <math.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "clock.h"
+
+static const char SNAPSHOT_MAGIC[4] = { 'Q', 'M', 'E', 'T' };
+static std::atomic<uint64_t> serials(1);
+
+// The block this thread last published into, and whose it was.
+static thread_local uint64_t cachedSerial;
+static thread_local std::atomic<uint64_t>* cachedBlock;
+
+static int bucketOf(uint64_t us) {
+    int k = us > 1 ? 64 - __builtin_clzll(us - 1) : 0;
+    return k < METRIC_BUCKETS - 1 ? k : METRIC_BUCKETS - 1;
+}
+
+Metrics::Metrics(int capacity)
+    : _serial(serials++), _capacity(capacity), _slots(0), _gauges(new std::atomic<double>[capacity]),
+      _gaugeCount(0), _blocks(NULL), _stop(false), _listen(-1) {
+    for (int i = 0; i < capacity; i++)
+        _gauges[i] = 0;
+    // Never reallocated, so publishing can index it without the lock.
+    _series.reserve(2 * capacity);
+}
+
+Metrics::~Metrics() {
+    _stop = true;
+    if (_thread.joinable())
+        _thread.join();
+    if (_listen >= 0)
+        close(_listen);
+    for (Block* b = _blocks; b;) {
+        Block* next = b->next;
+        delete b;
+        b = next;
+    }
+}
+
+int Metrics::enrol(const std::string& name, MetricKind kind, const char* help) {
+    std::lock_guard<std::mutex> hold(_lock);
+    std::map<std::string, int>::const_iterator found = _byName.find(name);
+    if (found != _byName.end())
+        return _series[found->second].kind == kind ? found->second : -1;
+    std::string family = name.substr(0, name.find('{'));
+    size_t f = 0;
+    while (f < _families.size() && _families[f].name != family)
+        f++;
+    if (f == _families.size()) {
+        Family fam = { family, "", kind, std::vector<int>() };
+        _families.push_back(fam);
+    } else if (_families[f].kind != kind) {
+        return -1;
+    }
+    Series s = { name, kind, 0 };
+    if (kind == METRIC_GAUGE) {
+        if (_gaugeCount >= _capacity)
+            return -1;
+        s.slot = _gaugeCount++;
+    } else {
+        int need = kind == METRIC_HISTOGRAM ? METRIC_BUCKETS + 1 : 1;
+        if (_slots + need > _capacity)
+            return -1;
+        s.slot = _slots;
+        _slots += need;
+    }
+    if (help && _families[f].help.empty())
+        _families[f].help = help;
+    int id = (int)_series.size();
+    _series.push_back(s);
+    _families[f].series.push_back(id);
+    _byName[name] = id;
+    return id;
+}
+
+int Metrics::counter(const std::string& name, const char* help) {
+    return enrol(name, METRIC_COUNTER, help);
+}
+
+int Metrics::gauge(const std::string& name, const char* help) {
+    return enrol(name, METRIC_GAUGE, help);
+}
+
+int Metrics::histogram(const std::string& name, const char* help) {
+    return enrol(name, METRIC_HISTOGRAM, help);
+}
+
+// This thread's slots, made and pushed onto the list the first time.
+std::atomic<uint64_t>* Metrics::block() {
+    if (cachedSerial == _serial)
+        return cachedBlock;
+    std::thread::id me = std::this_thread::get_id();
+    Block* b = _blocks.load(std::memory_order_acquire);
+    while (b && b->owner != me)
+        b = b->next;
+    if (!b) {
+        b = new Block;
+        b->owner = me;
+        b->slots.reset(new std::atomic<uint64_t>[_capacity]);
+        for (int i = 0; i < _capacity; i++)
+            b->slots[i].store(0, std::memory_order_relaxed);
+        b->next = _blocks.load(std::memory_order_relaxed);
+        while (!_blocks.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+    cachedSerial = _serial;
+    cachedBlock = b->slots.get();
+    return cachedBlock;
+}
+
+void Metrics::add(int id, uint64_t n) {
+    if (id < 0)
+        return;
+    bump(block()[_series[id].slot], n);
+}
+
+void Metrics::set(int id, double value) {
+    if (id < 0)
+        return;
+    _gauges[_series[id].slot].store(value, std::memory_order_relaxed);
+}
+
+void Metrics::observe(int id, uint64_t us) {
+    if (id < 0)
+        return;
+    std::atomic<uint64_t>* slots = block() + _series[id].slot;
+    bump(slots[bucketOf(us)], 1);
+    bump(slots[METRIC_BUCKETS], us);
+}
+
+void Metrics::addBucket(int id, int bucket, uint64_t n, uint64_t sum) {
+    if (id < 0 || bucket < 0 || bucket >= METRIC_BUCKETS)
+        return;
+    std::atomic<uint64_t>* slots = block() + _series[id].slot;
+    bump(slots[bucket], n);
+    bump(slots[METRIC_BUCKETS], sum);
+}
+
+uint64_t Metrics::sum(int slot) const {
+    uint64_t total = 0;
+    for (Block* b = _blocks.load(std::memory_order_acquire); b; b = b->next)
+        total += b->slots[slot].load(std::memory_order_relaxed);
+    return total;
+}
+
+static void appendf(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string& out, const char* format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+// name{labels} with suffix on the name and extra added to the labels.
+static std::string seriesName(const std::string& name, const char* suffix, const std::string& extra) {
+    size_t brace = name.find('{');
+    std::string base = name.substr(0, brace), labels;
+    if (brace != std::string::npos)
+        labels = name.substr(brace + 1, name.size() - brace - 2);
+    if (!extra.empty())
+        labels += (labels.empty() ? "" : ",") + extra;
+    return base + suffix + (labels.empty() ? "" : "{" + labels + "}");
+}
+
+void Metrics::prometheus(std::string& out) const {
+    static const char* const types[] = { "counter", "gauge", "histogram" };
+    std::lock_guard<std::mutex> hold(_lock);
+    for (size_t f = 0; f < _families.size(); f++) {
+        const Family& fam = _families[f];
+        if (!fam.help.empty())
+            out += "# HELP " + fam.name + " " + fam.help + "\n";
+        out += "# TYPE " + fam.name + " " + types[fam.kind] + "\n";
+        for (size_t i = 0; i < fam.series.size(); i++) {
+            const Series& s = _series[fam.series[i]];
+            switch (s.kind) {
+            case METRIC_COUNTER:
+                appendf(out, "%s %llu\n", s.name.c_str(), (unsigned long long)sum(s.slot));
+                break;
+            case METRIC_GAUGE:
+                appendf(out, "%s %.9g\n", s.name.c_str(), _gauges[s.slot].load(std::memory_order_relaxed));
+                break;
+            case METRIC_HISTOGRAM: {
+                uint64_t cumulative = 0;
+                for (int k = 0; k < METRIC_BUCKETS; k++) {
+                    cumulative += sum(s.slot + k);
+                    char le[32];
+                    if (k < METRIC_BUCKETS - 1)
+                        snprintf(le, sizeof(le), "le=\"%.9g\"", ldexp(1e-6, k));
+                    else
+                        snprintf(le, sizeof(le), "le=\"+Inf\"");
+                    appendf(out, "%s %llu\n", seriesName(s.name, "_bucket", le).c_str(),
+                            (unsigned long long)cumulative);
+                }
+                appendf(out, "%s %.9g\n", seriesName(s.name, "_sum", "").c_str(), sum(s.slot + METRIC_BUCKETS) * 1e-6);
+                appendf(out, "%s %llu\n", seriesName(s.name, "_count", "").c_str(), (unsigned long long)cumulative);
+                break;
+            }
+            }
+        }
+    }
+}
+
+template <class T> static void put(std::vector<uint8_t>& out, const T& v) {
+    const uint8_t* p = (const uint8_t*)&v;
+    out.insert(out.end(), p, p + sizeof(v));
+}
+
+void Metrics::snapshot(std::vector<uint8_t>& out) const {
+    std::lock_guard<std::mutex> hold(_lock);
+    out.assign(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + sizeof(SNAPSHOT_MAGIC));
+    put(out, (uint32_t)_series.size());
+    put(out, monotonicMicros());
+    for (size_t f = 0; f < _families.size(); f++)
+        for (size_t i = 0; i < _families[f].series.size(); i++) {
+            const Series& s = _series[_families[f].series[i]];
+            size_t len = s.name.size() < 255 ? s.name.size() : 255;
+            out.push_back(s.kind);
+            out.push_back(len);
+            out.insert(out.end(), s.name.begin(), s.name.begin() + len);
+            if (s.kind == METRIC_COUNTER)
+                put(out, sum(s.slot));
+            else if (s.kind == METRIC_GAUGE)
+                put(out, _gauges[s.slot].load(std::memory_order_relaxed));
+            else
+                for (int k = 0; k <= METRIC_BUCKETS; k++)
+                    put(out, sum(s.slot + k));
+        }
+}
+
+bool Metrics::serve(int port) {
+    _listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (_listen < 0) {
+        perror("metrics socket");
+        return false;
+    }
+    int on = 1;
+    setsockopt(_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(_listen, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listen, 4) < 0) {
+        perror("metrics port");
+        close(_listen);
+        _listen = -1;
+        return false;
+    }
+    _thread = std::thread(&Metrics::server, this);
+    return true;
+}
+
+static bool writeAll(int fd, const char* data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// One request per connection, each answered in turn: scrapes are rare
+// and small.
+void Metrics::server() {
+    while (!_stop) {
+        struct pollfd p = { _listen, POLLIN, 0 };
+        if (poll(&p, 1, 200) <= 0)
+            continue;
+        int fd = accept(_listen, NULL, NULL);
+        if (fd < 0)
+            continue;
+        struct timeval timeout = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char buf[1024];
+        while (request.size() < 8192 && request.find("\r\n\r\n") == std::string::npos) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                break;
+            request.append(buf, n);
+        }
+        std::string body, type = "text/plain; version=0.0.4", status = "200 OK";
+        if (request.compare(0, 13, "GET /metrics ") == 0) {
+            prometheus(body);
+        } else if (request.compare(0, 14, "GET /snapshot ") == 0) {
+            std::vector<uint8_t> snap;
+            snapshot(snap);
+            body.assign(snap.begin(), snap.end());
+            type = "application/octet-stream";
+        } else {
+            status = "404 Not Found";
+            body = "try /metrics or /snapshot\n";
+        }
+        std::string head = "HTTP/1.0 " + status + "\r\nContent-Type: " + type +
+                           "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+        if (writeAll(fd, head.data(), head.size()))
+            writeAll(fd, body.data(), body.size());
+        close(fd);
+    }
+}
+
+template <class T> static bool get(const uint8_t*& p, const uint8_t* end, T& v) {
+    if (end - p < (ptrdiff_t)sizeof(v))
+        return false;
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return true;
+}
+
+bool decodeSnapshot(const uint8_t* data, size_t len, uint64_t& time_us, std::vector<MetricSample>& samples) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    uint32_t count;
+    samples.clear();
+    if (len < sizeof(SNAPSHOT_MAGIC) || memcmp(p, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)))
+        return false;
+    p += sizeof(SNAPSHOT_MAGIC);
+    if (!get(p, end, count) || !get(p, end, time_us))
+        return false;
+    for (uint32_t i = 0; i < count; i++) {
+        MetricSample s;
+        memset(s.buckets, 0, sizeof(s.buckets));
+        s.count = 0;
+        s.value = 0;
+        uint8_t kind, n;
+        if (!get(p, end, kind) || !get(p, end, n) || kind > METRIC_HISTOGRAM || end - p < n)
+            return false;
+        s.kind = (MetricKind)kind;
+        s.name.assign((const char*)p, n);
+        p += n;
+        if (s.kind == METRIC_COUNTER) {
+            if (!get(p, end, s.count))
+                return false;
+        } else if (s.kind == METRIC_GAUGE) {
+            if (!get(p, end, s.value))
+                return false;
+        } else {
+            uint64_t total;
+            for (int k = 0; k < METRIC_BUCKETS; k++) {
+                if (!get(p, end, s.buckets[k]))
+                    return false;
+                s.count += s.buckets[k];
+            }
+            if (!get(p, end, total))
+                return false;
+            s.value = total * 1e-6;
+        }
+        samples.push_back(s);
+    }
+    return true;
+}
+
+double histogramQuantile(const uint64_t buckets[METRIC_BUCKETS], double q) {
+    uint64_t total = 0;
+    for (int k = 0; k < METRIC_BUCKETS; k++)
+        total += buckets[k];
+    if (!total)
+        return 0;
+    double want = q * total, seen = 0;
+    for (int k = 0; k < METRIC_BUCKETS; k++) {
+        double lo = k ? ldexp(1, k - 1) : 0;
+        if (k == METRIC_BUCKETS - 1 || seen + buckets[k] >= want) {
+            if (k == METRIC_BUCKETS - 1 || !buckets[k])
+                return lo;
+            return lo + (ldexp(1, k) - lo) * (want - seen) / buckets[k];
+        }
+        seen += buckets[k];
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+  metrics.h - Live counters, gauges and histograms, served over HTTP.
+
+  Series are registered by name (Prometheus style, labels and all, as in
+  link_sticks_total{craft="3"}) and published by the id they are given.
+  Registering takes a lock; publishing never does.  Counters and
+  histograms are kept per thread: each thread that publishes gets its own
+  block of slots on first use, which only it writes, so add() is a load
+  and a store with no bus lock, and a scrape sums the blocks.  Gauges are
+  one atomic per series, the last set() winning.
+
+  Histograms count microseconds in powers of two: bucket k holds values
+  up to 2^k us, to 2^(METRIC_BUCKETS - 2), and the last everything above.
+  They are exported in seconds.
+
+  serve() answers on 127.0.0.1 only, from a thread of its own:
+
+    GET /metrics   Prometheus text format
+    GET /snapshot  the same as a compact binary snapshot
+
+  A snapshot is, in host byte order, "QMET", the number of series (u32)
+  and the monotonic time it was taken (u64 us), then for each series its
+  kind (u8), the length of its name (u8) and the name, and its value: a
+  u64 for a counter, a double for a gauge, and for a histogram
+  METRIC_BUCKETS u64 counts then the u64 sum.  decodeSnapshot() reads one
+  back.
+*/
+#ifndef Metrics_h
+#define Metrics_h
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define METRIC_BUCKETS 24
+
+enum MetricKind { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+
+class Metrics {
+public:
+    // capacity slots per thread: one a counter, METRIC_BUCKETS + 1 a
+    // histogram.
+    Metrics(int capacity = 1 << 14);
+    ~Metrics();
+
+    // Each returns the id to publish with, the same one if the name is
+    // already registered, or -1 if full.  help goes on the # HELP line
+    // for the name without its labels, from the first to give one.
+    int counter(const std::string& name, const char* help = NULL);
+    int gauge(const std::string& name, const char* help = NULL);
+    int histogram(const std::string& name, const char* help = NULL);
+
+    // From any thread; ids of -1 are ignored.
+    void add(int id, uint64_t n = 1);
+    void set(int id, double value);
+    void observe(int id, uint64_t us);
+    // Adds counts already bucketed, into bucket of id's histogram.
+    void addBucket(int id, int bucket, uint64_t n, uint64_t sum);
+
+    void prometheus(std::string& out) const;
+    void snapshot(std::vector<uint8_t>& out) const;
+
+    bool serve(int port);
+
+private:
+    struct Series {
+        std::string name;
+        MetricKind kind;
+        int slot; // first per thread slot, or gauge index
+    };
+    // Series that share a name but for their labels, exported together.
+    struct Family {
+        std::string name, help;
+        MetricKind kind;
+        std::vector<int> series;
+    };
+    struct Block {
+        std::thread::id owner;
+        std::unique_ptr<std::atomic<uint64_t>[]> slots;
+        Block* next;
+    };
+
+    int enrol(const std::string& name, MetricKind kind, const char* help);
+    std::atomic<uint64_t>* block();
+    void bump(std::atomic<uint64_t>& slot, uint64_t n) {
+        slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    uint64_t sum(int slot) const;
+    void server();
+
+    uint64_t _serial; // tells this from an earlier one at the same address
+    int _capacity;
+    mutable std::mutex _lock; // the series table, not the values
+    std::vector<Series> _series;
+    std::vector<Family> _families;
+    std::map<std::string, int> _byName;
+    int _slots;
+    std::unique_ptr<std::atomic<double>[]> _gauges;
+    int _gaugeCount;
+    std::atomic<Block*> _blocks;
+    std::atomic<bool> _stop;
+    int _listen;
+    std::thread _thread;
+};
+
+struct MetricSample {
+    MetricKind kind;
+    std::string name;
+    uint64_t count; // a counter's value, a histogram's observations
+    double value;   // a gauge's value, a histogram's sum
+    uint64_t buckets[METRIC_BUCKETS];
+};
+
+bool decodeSnapshot(const uint8_t* data, size_t len, uint64_t& time_us, std::vector<MetricSample>& samples);
+
+// An estimate of the q quantile of a histogram, in microseconds.
+double histogramQuantile(const uint64_t buckets[METRIC_BUCKETS], double q);
+
+#endif
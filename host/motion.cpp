@@ -0,0 +1,172 @@
+#include "motion.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Outputs this far in from a tile's edge match a full frame pass, as in
+// roi.cpp.
+#define HALO (ConvNet::LAYERS - 1)
+
+// Adds to counts[c] the pixels in cell c of a row where a and b differ by
+// more than threshold.  Cells already over limit are skipped.
+typedef void (*CountKernel)(const float* a, const float* b, int width, int cell, float threshold, int limit,
+                            uint16_t* counts);
+
+static void countScalar(const float* a, const float* b, int width, int cell, float threshold, int limit,
+                        uint16_t* counts) {
+    for (int c = 0, x0 = 0; x0 < width; c++, x0 += cell) {
+        if (counts[c] > limit)
+            continue;
+        int x1 = std::min(width, x0 + cell), n = 0;
+        for (int x = x0; x < x1; x++)
+            n += fabsf(a[x] - b[x]) > threshold;
+        counts[c] += n;
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2,popcnt")))
+static void countAvx2(const float* a, const float* b, int width, int cell, float threshold, int limit,
+                      uint16_t* counts) {
+    __m256 t = _mm256_set1_ps(threshold);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    for (int c = 0, x0 = 0; x0 < width; c++, x0 += cell) {
+        if (counts[c] > limit)
+            continue;
+        int x1 = std::min(width, x0 + cell), n = 0, x = x0;
+        for (; x + 8 <= x1; x += 8) {
+            __m256 d = _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_loadu_ps(a + x), _mm256_loadu_ps(b + x)));
+            n += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(d, t, _CMP_GT_OQ)));
+        }
+        for (; x < x1; x++)
+            n += fabsf(a[x] - b[x]) > threshold;
+        counts[c] += n;
+    }
+}
+
+static CountKernel countKernel() {
+    return __builtin_cpu_supports("avx2") ? countAvx2 : countScalar;
+}
+#else
+static CountKernel countKernel() {
+    return countScalar;
+}
+#endif
+
+MotionGate::MotionGate(ConvNet& net)
+    : cell(16), threshold(0.08f), minPixels(2), refreshEvery(300), cells(0), active(0), computed(0), _net(net),
+      _reset(true), _frame(0), _width(0), _height(0), _outWidth(0), _outHeight(0), _cols(0), _rows(0) {
+}
+
+void MotionGate::_compare(const float* const* planes, int stride) {
+    static const CountKernel count = countKernel();
+    _changed.assign(_cols * _rows, 0);
+    for (int p = 0; p < _net.inputs(); p++) {
+        for (int y = 0; y < _height; y++) {
+            const float* ref = &_ref[((size_t)p * _height + y) * _width];
+            count(planes[p] + y * stride, ref, _width, cell, threshold, minPixels, &_changed[(y / cell) * _cols]);
+        }
+    }
+}
+
+void MotionGate::_run(const float* const* planes, int stride, const Rect& t) {
+    Rect g = { std::max(0, t.x0 - HALO), std::max(0, t.y0 - HALO), std::min(_outWidth - 1, t.x1 + HALO),
+               std::min(_outHeight - 1, t.y1 + HALO) };
+    int w = g.x1 - g.x0 + 1, h = g.y1 - g.y0 + 1;
+    _tile.resize(w * h);
+    const float* p[ConvNet::MAX_PLANES];
+    for (int k = 0; k < _net.inputs(); k++)
+        p[k] = planes[k] + g.y0 * stride + g.x0;
+    _net.forward(p, stride, w + ConvNet::SHRINK, h + ConvNet::SHRINK, &_tile[0], w);
+    computed += w * h;
+    for (int y = t.y0; y <= t.y1; y++)
+        memcpy(&_out[y * _outWidth + t.x0], &_tile[(y - g.y0) * w + t.x0 - g.x0], (t.x1 - t.x0 + 1) * sizeof(float));
+}
+
+void MotionGate::forward(const float* const* planes, int stride, int width, int height) {
+    tiles.clear();
+    computed = 0;
+    if (width <= ConvNet::SHRINK || height <= ConvNet::SHRINK)
+        return;
+    if (width != _width || height != _height) {
+        _width = width;
+        _height = height;
+        _outWidth = width - ConvNet::SHRINK;
+        _outHeight = height - ConvNet::SHRINK;
+        _out.assign(_outWidth * _outHeight, 0);
+        _ref.assign((size_t)_net.inputs() * width * height, 0);
+        _reset = true;
+    }
+    // Output x needs inputs x - 2 to x + 8, so with cells of at least 8 an
+    // output block depends on the input cells next to it and no further.
+    cell = std::max(cell, 8);
+    _cols = (width + cell - 1) / cell;
+    _rows = (height + cell - 1) / cell;
+    cells = _cols * _rows;
+    int bcols = (_outWidth + cell - 1) / cell, brows = (_outHeight + cell - 1) / cell;
+    bool full = _reset || (refreshEvery > 0 && _frame % refreshEvery == 0);
+    _reset = false;
+    _frame++;
+
+    if (full) {
+        active = cells;
+        for (int p = 0; p < _net.inputs(); p++)
+            for (int y = 0; y < height; y++)
+                memcpy(&_ref[((size_t)p * height + y) * width], planes[p] + y * stride, width * sizeof(float));
+        Rect all = { 0, 0, _outWidth - 1, _outHeight - 1 };
+        tiles.push_back(all);
+        _run(planes, stride, all);
+        return;
+    }
+
+    _compare(planes, stride);
+    active = 0;
+    _dirty.assign(bcols * brows, false);
+    for (int cy = 0; cy < _rows; cy++) {
+        for (int cx = 0; cx < _cols; cx++) {
+            if (_changed[cy * _cols + cx] <= minPixels)
+                continue;
+            active++;
+            for (int by = std::max(0, cy - 1); by <= std::min(brows - 1, cy + 1); by++)
+                for (int bx = std::max(0, cx - 1); bx <= std::min(bcols - 1, cx + 1); bx++)
+                    _dirty[by * bcols + bx] = true;
+            // Every output depending on this cell is about to be computed
+            // from it as it is now.
+            int x0 = cx * cell, n = std::min(width - x0, cell) * sizeof(float);
+            for (int p = 0; p < _net.inputs(); p++)
+                for (int y = cy * cell; y < std::min(height, (cy + 1) * cell); y++)
+                    memcpy(&_ref[((size_t)p * height + y) * width + x0], planes[p] + y * stride + x0, n);
+        }
+    }
+
+    // Runs of dirty blocks along each row, merged with the run below when
+    // they line up.
+    for (int by = 0; by < brows; by++) {
+        for (int bx = 0; bx < bcols; bx++) {
+            if (!_dirty[by * bcols + bx])
+                continue;
+            int end = bx;
+            while (end + 1 < bcols && _dirty[by * bcols + end + 1])
+                end++;
+            Rect r = { bx * cell, by * cell, std::min(_outWidth, (end + 1) * cell) - 1,
+                       std::min(_outHeight, (by + 1) * cell) - 1 };
+            bool merged = false;
+            for (size_t i = 0; i < tiles.size() && !merged; i++) {
+                if (tiles[i].x0 == r.x0 && tiles[i].x1 == r.x1 && tiles[i].y1 + 1 == r.y0) {
+                    tiles[i].y1 = r.y1;
+                    merged = true;
+                }
+            }
+            if (!merged)
+                tiles.push_back(r);
+            bx = end;
+        }
+    }
+    for (size_t i = 0; i < tiles.size(); i++)
+        _run(planes, stride, tiles[i]);
+}
@@ -0,0 +1,62 @@
+/*
+  motion.h - Runs the convnet only where the picture has changed.
+
+  The input is divided into square cells, and each frame every cell is
+  compared, pixel by pixel across all planes, with a reference copy taken
+  when the outputs depending on it were last computed.  A cell with more
+  than minPixels pixels changed by more than threshold is active.  Only the
+  output blocks whose receptive field touches an active cell are computed
+  again; the rest keep their cached values.  Comparing with the reference
+  rather than the last frame means slow drift is still caught.
+
+  Recomputed blocks are run as tiles with the pooling halo, as in roi.h, so
+  they match a full frame pass exactly; the saving is exact for a static
+  scene and approximate for one changing by less than threshold.
+*/
+#ifndef Motion_h
+#define Motion_h
+
+#include <stdint.h>
+#include <vector>
+
+#include "convnet.h"
+#include "roi.h"
+
+class MotionGate {
+public:
+    MotionGate(ConvNet& net);
+
+    // As ConvNet::forward(), but into a map kept here (output(), rows
+    // outputStride() apart) that only changes where the input has.  A
+    // change of size starts again with a full frame.
+    void forward(const float* const* planes, int stride, int width, int height);
+    const float* output() const { return &_out[0]; }
+    int outputStride() const { return _outWidth; }
+    // Compute everything next frame.
+    void reset() { _reset = true; }
+
+    int cell;          // input (and output) pixels per side of a cell
+    float threshold;   // change in a pixel that counts
+    int minPixels;     // changed pixels that make a cell active
+    int refreshEvery;  // frames between full recomputes, or 0 for never
+
+    // About the last forward()
+    int cells, active;       // input cells, and how many changed
+    uint64_t computed;       // outputs evaluated
+    std::vector<Rect> tiles; // in output pixels
+
+private:
+    void _compare(const float* const* planes, int stride);
+    void _run(const float* const* planes, int stride, const Rect& r);
+
+    ConvNet& _net;
+    bool _reset;
+    uint64_t _frame;
+    int _width, _height, _outWidth, _outHeight, _cols, _rows;
+    std::vector<float> _out, _tile;
+    std::vector<float> _ref;        // the inputs as of the cached outputs
+    std::vector<uint16_t> _changed; // per cell
+    std::vector<bool> _dirty;       // per output block
+};
+
+#endif
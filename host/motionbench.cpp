@@ -0,0 +1,210 @@
+/*
+  motionbench - compares motion gated inference with full frames.
+
+    motionbench [-n frames] [-s WxH] [-c cell] [-t threshold] [-k craft]
+                [-v video] [convnet.weights]
+
+  The synthetic scene is a still, textured arena with a little sensor noise
+  and craft (bright squares) flying over it; -v decodes a video with
+  ffmpeg instead.  Without weights the network is made by hand to find the
+  squares, as in roibench.  Prints the time per frame both ways, the share
+  of cells active and outputs computed, how far the gated output strayed
+  from the full one, and how many full frame detections it kept.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+
+#include "clock.h"
+#include "convnet.h"
+#include "motion.h"
+#include "roi.h"
+
+#define SIZE 8 // of a craft, pixels
+
+static int width = 640, height = 360;
+
+// Frames one after another, as three planes of floats 0..1.
+class Scene {
+public:
+    Scene(int craft, const char* video) : _rng(1), _pipe(NULL) {
+        if (video) {
+            char cmd[1024];
+            snprintf(cmd, sizeof(cmd), "ffmpeg -loglevel error -i '%s' -f rawvideo -pix_fmt rgb24 -s %dx%d -", video,
+                     width, height);
+            _pipe = popen(cmd, "r");
+            _rgb.resize(width * height * 3);
+            return;
+        }
+        std::uniform_real_distribution<float> u(0, 1);
+        _arena.resize(3 * width * height);
+        for (size_t i = 0; i < _arena.size(); i++) {
+            int x = i % width, y = i / width % height;
+            _arena[i] = 0.3f + 0.1f * sinf(x * 0.05f) * cosf(y * 0.07f) + 0.05f * u(_rng);
+        }
+        for (int k = 0; k < craft; k++) {
+            Craft c = { SIZE + u(_rng) * (width - 2 * SIZE), SIZE + u(_rng) * (height - 2 * SIZE), u(_rng) * 4 - 2,
+                        u(_rng) * 4 - 2 };
+            _craft.push_back(c);
+        }
+    }
+    ~Scene() {
+        if (_pipe)
+            pclose(_pipe);
+    }
+    bool next(std::vector<float>& frame) {
+        int n = width * height;
+        frame.resize(3 * n);
+        if (!_rgb.empty()) {
+            if (!_pipe || fread(&_rgb[0], 1, _rgb.size(), _pipe) != _rgb.size())
+                return false;
+            for (int i = 0; i < n; i++)
+                for (int c = 0; c < 3; c++)
+                    frame[c * n + i] = _rgb[i * 3 + c] / 255.0f;
+            return true;
+        }
+        std::uniform_real_distribution<float> noise(-0.02f, 0.02f);
+        for (int i = 0; i < 3 * n; i++)
+            frame[i] = _arena[i] + noise(_rng);
+        for (size_t k = 0; k < _craft.size(); k++) {
+            Craft& c = _craft[k];
+            c.x += c.vx;
+            c.y += c.vy;
+            if (c.x < SIZE || c.x > width - SIZE)
+                c.vx = -c.vx;
+            if (c.y < SIZE || c.y > height - SIZE)
+                c.vy = -c.vy;
+            int x0 = lroundf(c.x) - SIZE / 2, y0 = lroundf(c.y) - SIZE / 2;
+            for (int p = 0; p < 3; p++)
+                for (int y = y0; y < y0 + SIZE; y++)
+                    for (int x = x0; x < x0 + SIZE; x++)
+                        frame[p * n + y * width + x] = 1;
+        }
+        return true;
+    }
+
+private:
+    struct Craft {
+        float x, y, vx, vy;
+    };
+    std::mt19937 _rng;
+    std::vector<float> _arena;
+    std::vector<Craft> _craft;
+    FILE* _pipe;
+    std::vector<uint8_t> _rgb;
+};
+
+static void blobWeights(ConvNet& net) {
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        ConvLayer& l = net.layer(i);
+        l.weight.assign(l.weight.size(), 0);
+        l.bias.assign(l.bias.size(), 0);
+        l.weight[4] = i < ConvNet::LAYERS - 1 ? 1 : -1;
+    }
+    net.layer(ConvNet::LAYERS - 1).bias[0] = 0.5;
+}
+
+int main(int argc, char** argv) {
+    int frames = 300, craft = 4;
+    const char* video = NULL;
+    ConvNet net;
+    MotionGate gate(net);
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:c:t:k:v:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+                frames = 0;
+            break;
+        case 'c':
+            gate.cell = atoi(optarg);
+            break;
+        case 't':
+            gate.threshold = atof(optarg);
+            break;
+        case 'k':
+            craft = atoi(optarg);
+            break;
+        case 'v':
+            video = optarg;
+            break;
+        default:
+            frames = 0;
+        }
+    }
+    if (frames <= 0 || width < 8 * SIZE || height < 8 * SIZE) {
+        fprintf(stderr, "usage: %s [-n frames] [-s WxH] [-c cell] [-t threshold] [-k craft] [-v video] "
+                        "[convnet.weights]\n", argv[0]);
+        return 1;
+    }
+    if (optind < argc) {
+        if (!net.load(argv[optind]) || net.inputs() != 6) {
+            fprintf(stderr, "%s: can't load weights for two RGB frames\n", argv[optind]);
+            return 1;
+        }
+    } else {
+        blobWeights(net);
+    }
+
+    Scene scene(craft, video);
+    int ow = width - ConvNet::SHRINK, oh = height - ConvNet::SHRINK;
+    std::vector<float> cur, prev, full(ow * oh);
+    const float* planes[ConvNet::MAX_PLANES];
+    uint64_t fullTime = 0, gateTime = 0, computed = 0, active = 0;
+    double maxErr = 0, sumErr = 0;
+    int found = 0, kept = 0, n = 0;
+    scene.next(prev);
+    while (n < frames && scene.next(cur)) {
+        for (int c = 0; c < 3; c++) {
+            planes[c] = &cur[c * width * height];
+            planes[3 + c] = &prev[c * width * height];
+        }
+        uint64_t start = monotonicMicros();
+        net.forward(planes, width, width, height, &full[0], ow);
+        uint64_t mid = monotonicMicros();
+        gate.forward(planes, width, width, height);
+        gateTime += monotonicMicros() - mid;
+        fullTime += mid - start;
+        computed += gate.computed;
+        active += gate.active;
+        const float* out = gate.output();
+        for (int i = 0; i < ow * oh; i++) {
+            double d = fabs(out[i] - full[i]);
+            maxErr = fmax(maxErr, d);
+            sumErr += d;
+        }
+        std::vector<Detection> a, b;
+        findCraft(&full[0], ow, ow, oh, 0, 8, a);
+        findCraft(out, ow, ow, oh, 0, 8, b);
+        found += a.size();
+        for (size_t i = 0; i < a.size(); i++) {
+            for (size_t k = 0; k < b.size(); k++) {
+                if (hypotf(a[i].x - b[k].x, a[i].y - b[k].y) <= 2) {
+                    kept++;
+                    break;
+                }
+            }
+        }
+        cur.swap(prev);
+        n++;
+    }
+    if (!n) {
+        fprintf(stderr, "no frames\n");
+        return 1;
+    }
+    printf("%dx%d, %s, %d frames, cells of %d, threshold %g, full recompute every %d\n", width, height,
+           video ? video : "synthetic", n, gate.cell, gate.threshold, gate.refreshEvery);
+    printf("full   %8.2f ms/frame\n", fullTime * 1e-3 / n);
+    printf("gated  %8.2f ms/frame  %.1fx  cells active %.1f%%  outputs computed %.1f%%\n", gateTime * 1e-3 / n,
+           (double)fullTime / gateTime, 100.0 * active / ((double)gate.cells * n),
+           100.0 * computed / ((double)ow * oh * n));
+    printf("error  max %.4f  mean %.6f  detections kept %d of %d\n", maxErr, sumErr / ((double)ow * oh * n), kept,
+           found);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include "multicam.h"
+
+#include <math.h>
+#include <algorithm>
+
+#include "clock.h"
+#include "hungarian.h"
+
+CameraPipeline::CameraPipeline(const ConvNet& net, int width, int height)
+    : _net(net), _width(width), _height(height), _detector(_net), _stopping(false), _running(false) {
+    _view.time_us = 0;
+    _view.frames = 0;
+    _view.detectMs = 0;
+}
+
+CameraPipeline::~CameraPipeline() {
+    stop();
+}
+
+void CameraPipeline::start(const Grabber& grab) {
+    stop();
+    _stopping = false;
+    _running = true;
+    _thread = std::thread(&CameraPipeline::_run, this, grab);
+}
+
+void CameraPipeline::stop() {
+    if (!_thread.joinable())
+        return;
+    _stopping = true;
+    _thread.join();
+}
+
+bool CameraPipeline::latest(CameraView& view) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_view.frames)
+        return false;
+    view = _view;
+    return true;
+}
+
+void CameraPipeline::_run(Grabber grab) {
+    // A gray frame stands in for all three colour planes, the current
+    // frame's then the previous one's.
+    std::vector<float> cur(_width * _height), prev(_width * _height);
+    std::vector<Detection> found, predicted;
+    std::vector<Track> confirmed;
+    uint64_t t, frames = 0, busy = 0;
+    bool first = true;
+    while (!_stopping && grab(&cur[0], &t)) {
+        if (first) {
+            prev = cur;
+            first = false;
+        }
+        const float* planes[ConvNet::MAX_PLANES];
+        int half = _net.inputs() / 2;
+        for (int k = 0; k < half; k++) {
+            planes[k] = &cur[0];
+            planes[half + k] = &prev[0];
+        }
+        uint64_t start = monotonicMicros();
+        _detector.detect(planes, _width, _width, _height, found);
+        predicted.clear();
+        _tracker.predict(t, predicted);
+        _tracker.update(found);
+        busy += monotonicMicros() - start;
+        frames++;
+
+        confirmed.clear();
+        for (size_t i = 0; i < _tracker.tracks().size(); i++)
+            if (_tracker.tracks()[i].confirmed)
+                confirmed.push_back(_tracker.tracks()[i]);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _view.time_us = t;
+            _view.frames = frames;
+            _view.detectMs = busy * 1e-3 / frames;
+            _view.tracks.swap(confirmed);
+        }
+        cur.swap(prev);
+    }
+    _running = false;
+}
+
+Fusion::Fusion(const std::vector<Camera>& cameras) : gate(3), minViews(2), _cameras(cameras) {
+}
+
+// RMS reprojection error of g with s added, or FORBIDDEN.
+double Fusion::_error(const Group& g, const Sighting& s) {
+    std::vector<Sighting> all(g.sightings);
+    all.push_back(s);
+    double X[3];
+    double e = triangulate(_cameras, &all[0], all.size(), X);
+    return e < 0 || e > gate ? HUNGARIAN_FORBIDDEN : e;
+}
+
+void Fusion::fuse(const std::vector<CameraView>& views, uint64_t time, std::vector<Position>& out) {
+    out.clear();
+    _groups.clear();
+    std::vector<Sighting> loose;
+    std::vector<float> cost;
+    std::vector<int> assignment;
+    for (size_t c = 0; c < views.size() && c < _cameras.size(); c++) {
+        const CameraView& v = views[c];
+        double dt = ((int64_t)(time - v.time_us)) * 1e-6;
+        loose.clear();
+        for (size_t i = 0; i < v.tracks.size(); i++) {
+            const Track& t = v.tracks[i];
+            Sighting s = { (int)c, t.x + t.vx * dt, t.y + t.vy * dt };
+            if (t.craft < 0) {
+                loose.push_back(s);
+                continue;
+            }
+            size_t g = 0;
+            while (g < _groups.size() && _groups[g].craft != t.craft)
+                g++;
+            if (g == _groups.size()) {
+                Group n = { t.craft, std::vector<Sighting>() };
+                _groups.push_back(n);
+            } else if (_error(_groups[g], s) == HUNGARIAN_FORBIDDEN) {
+                // The ID says it's the same craft but the rays don't meet:
+                // one of them is wrong, so keep it apart rather than
+                // spoil the position.
+                Group n = { -1, std::vector<Sighting>(1, s) };
+                _groups.push_back(n);
+                continue;
+            }
+            _groups[g].sightings.push_back(s);
+        }
+        if (loose.empty())
+            continue;
+        // Groups this camera hasn't added to yet.
+        std::vector<int> open;
+        for (size_t g = 0; g < _groups.size(); g++)
+            if (_groups[g].sightings.back().camera != (int)c)
+                open.push_back(g);
+        int rows = loose.size(), cols = open.size();
+        assignment.assign(rows, -1);
+        if (cols) {
+            cost.resize(rows * cols);
+            for (int i = 0; i < rows; i++)
+                for (int k = 0; k < cols; k++)
+                    cost[i * cols + k] = _error(_groups[open[k]], loose[i]);
+            hungarian(cost, rows, cols, assignment);
+        }
+        for (int i = 0; i < rows; i++) {
+            if (assignment[i] >= 0) {
+                _groups[open[assignment[i]]].sightings.push_back(loose[i]);
+            } else {
+                Group n = { -1, std::vector<Sighting>(1, loose[i]) };
+                _groups.push_back(n);
+            }
+        }
+    }
+
+    for (size_t g = 0; g < _groups.size(); g++) {
+        const Group& gr = _groups[g];
+        if ((int)gr.sightings.size() < std::max(2, minViews))
+            continue;
+        double X[3];
+        double e = triangulate(_cameras, &gr.sightings[0], gr.sightings.size(), X);
+        if (e < 0)
+            continue;
+        Position p = { gr.craft, X[0], X[1], X[2], e, (int)gr.sightings.size() };
+        out.push_back(p);
+    }
+}
@@ -0,0 +1,100 @@
+/*
+  multicam.h - Craft positions in 3D from several cameras.
+
+  Each camera has a CameraPipeline: a thread of its own grabbing frames,
+  finding craft (PyramidDetector, on a copy of the network, since a ConvNet
+  is not reentrant) and tracking them, so cameras run on separate cores.
+  The latest tracks are published under a lock with the capture time of
+  the frame they came from.
+
+  Fusion takes a snapshot of every camera and brings them to one time by
+  moving each track along its velocity, since the cameras aren't in step.
+  Tracks are then grouped across cameras: by craft ID where the trackers
+  know it, and otherwise camera by camera, each track joining the group it
+  triangulates best with (Hungarian) or starting its own.  Either way a
+  group only takes a track that keeps it within gate pixels RMS; a track
+  whose ID group it doesn't fit starts a group of its own, without the ID.
+  Every group seen by minViews or more cameras becomes a position.
+*/
+#ifndef MultiCam_h
+#define MultiCam_h
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "convnet.h"
+#include "pyramid.h"
+#include "tracker.h"
+#include "triangulate.h"
+
+// What one camera saw last.
+struct CameraView {
+    uint64_t time_us;         // capture time of the frame
+    uint64_t frames;          // seen so far
+    double detectMs;          // mean per frame, detection and tracking
+    std::vector<Track> tracks; // confirmed only
+};
+
+class CameraPipeline {
+public:
+    // Grabs the next frame as a width x height plane of floats 0..1 and
+    // stamps it with monotonicMicros() time.  False at the end.
+    typedef std::function<bool(float* plane, uint64_t* time_us)> Grabber;
+
+    CameraPipeline(const ConvNet& net, int width, int height);
+    ~CameraPipeline();
+    // Set detector and tracker up before start().
+    PyramidDetector& detector() { return _detector; }
+    Tracker& tracker() { return _tracker; }
+    void start(const Grabber& grab);
+    void stop();
+    bool running() const { return _running; }
+    // False until the first frame is through.
+    bool latest(CameraView& view) const;
+
+private:
+    void _run(Grabber grab);
+
+    ConvNet _net;
+    int _width, _height;
+    PyramidDetector _detector;
+    Tracker _tracker;
+    std::thread _thread;
+    std::atomic<bool> _stopping, _running;
+    mutable std::mutex _mutex;
+    CameraView _view;
+};
+
+struct Position {
+    int craft;       // router ID, or -1
+    double x, y, z;  // metres
+    double error;    // RMS reprojection error, pixels
+    int views;
+};
+
+class Fusion {
+public:
+    Fusion(const std::vector<Camera>& cameras);
+
+    // views[i] is from cameras[i]; time is when to place the craft.
+    void fuse(const std::vector<CameraView>& views, uint64_t time, std::vector<Position>& out);
+
+    float gate;   // RMS reprojection error, pixels
+    int minViews;
+
+private:
+    struct Group {
+        int craft;
+        std::vector<Sighting> sightings;
+    };
+    double _error(const Group& g, const Sighting& s);
+
+    std::vector<Camera> _cameras;
+    std::vector<Group> _groups;
+};
+
+#endif
@@ -0,0 +1,294 @@
+/*
+  multicambench - craft positions in 3D from several cameras.
+
+    multicambench [-n fuses] [-k cameras] [-m craft] [-r fps] [-g gate]
+                  [-w weights]
+    multicambench -c cameras.txt [-n fuses] [-g gate] [-w weights] source...
+
+  The first form makes up a scene: craft flying smooth loops in a room
+  with cameras round it, each camera rendering what it sees on its own
+  thread, paced at fps and out of step with the others.  The cameras are
+  calibrated from noisy sightings of random points, then run through the
+  whole pipeline.  It prints each camera's frame rate and detection time,
+  how far apart the cameras' latest frames were, and how far the fused
+  positions were from the truth.
+
+  The second runs one pipeline per source (see framesource.h), with the
+  projection matrices in cameras.txt, and prints the positions.
+
+  Without -w the network is made by hand to find bright squares.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "clock.h"
+#include "framesource.h"
+#include "hungarian.h"
+#include "multicam.h"
+
+#define SIZE 8       // of a craft in the image, pixels
+#define WIDTH 640
+#define HEIGHT 360
+#define FOCAL 400    // pixels
+#define CALIBRATION_POINTS 30
+
+static void blobWeights(ConvNet& net) {
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        ConvLayer& l = net.layer(i);
+        l.weight.assign(l.weight.size(), 0);
+        l.bias.assign(l.bias.size(), 0);
+        l.weight[4] = i < ConvNet::LAYERS - 1 ? 1 : -1;
+    }
+    net.layer(ConvNet::LAYERS - 1).bias[0] = 0.5;
+}
+
+// Where craft k is s seconds in, metres.
+static void craftAt(int k, double s, double X[3]) {
+    X[0] = 3 * sin(0.5 * s * (1 + 0.1 * k) + k);
+    X[1] = 3 * cos(0.4 * s * (1 + 0.07 * k) + 2 * k);
+    X[2] = 1.5 + sin(0.3 * s + k);
+}
+
+struct Scene {
+    std::vector<Camera> cameras;
+    int craft;
+    uint64_t start;
+    double period; // microseconds between frames
+};
+
+// Draws what camera c sees at each frame time, waiting until then.
+static CameraPipeline::Grabber renderer(const Scene& scene, int c) {
+    std::shared_ptr<std::mt19937> rng(new std::mt19937(c + 1));
+    std::shared_ptr<uint64_t> frame(new uint64_t(0));
+    // Out of step: each camera starts a different part of a frame late.
+    double offset = scene.period * c / scene.cameras.size();
+    return [&scene, c, rng, frame, offset](float* plane, uint64_t* time_us) {
+        uint64_t t = scene.start + (uint64_t)(offset + scene.period * (*frame)++);
+        uint64_t now = monotonicMicros();
+        if (t > now)
+            usleep(t - now);
+        std::uniform_real_distribution<float> noise(0, 0.3f);
+        for (int i = 0; i < WIDTH * HEIGHT; i++)
+            plane[i] = noise(*rng);
+        for (int k = 0; k < scene.craft; k++) {
+            double X[3], x, y;
+            craftAt(k, (t - scene.start) * 1e-6, X);
+            if (!scene.cameras[c].project(X, x, y))
+                continue;
+            int x0 = lround(x) - SIZE / 2, y0 = lround(y) - SIZE / 2;
+            for (int py = std::max(0, y0); py < std::min(HEIGHT, y0 + SIZE); py++)
+                for (int px = std::max(0, x0); px < std::min(WIDTH, x0 + SIZE); px++)
+                    plane[py * WIDTH + px] = 1;
+        }
+        *time_us = t;
+        return true;
+    };
+}
+
+int main(int argc, char** argv) {
+    int fuses = 300, ncameras = 4, ncraft = 4, fps = 30;
+    float gate = 3;
+    const char* calibration = NULL;
+    const char* weights = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:k:m:r:g:w:c:")) != -1) {
+        switch (opt) {
+        case 'n':
+            fuses = atoi(optarg);
+            break;
+        case 'k':
+            ncameras = atoi(optarg);
+            break;
+        case 'm':
+            ncraft = atoi(optarg);
+            break;
+        case 'r':
+            fps = atoi(optarg);
+            break;
+        case 'g':
+            gate = atof(optarg);
+            break;
+        case 'w':
+            weights = optarg;
+            break;
+        case 'c':
+            calibration = optarg;
+            break;
+        default:
+            fuses = 0;
+        }
+    }
+    bool synthetic = !calibration;
+    if (fuses <= 0 || ncameras < 2 || ncraft < 1 || fps <= 0 || (synthetic ? optind != argc : optind >= argc)) {
+        fprintf(stderr, "usage: %s [-n fuses] [-k cameras] [-m craft] [-r fps] [-g gate] [-w weights]\n"
+                        "       %s -c cameras.txt [-n fuses] [-g gate] [-w weights] source...\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+    ConvNet net;
+    if (weights) {
+        if (!net.load(weights) || net.inputs() != 6) {
+            fprintf(stderr, "%s: can't load weights for two RGB frames\n", weights);
+            return 1;
+        }
+    } else {
+        blobWeights(net);
+    }
+
+    Scene scene;
+    std::vector<Camera> calibrated;
+    std::vector<FrameSource*> sources;
+    std::vector<CameraPipeline*> pipes;
+    if (synthetic) {
+        scene.craft = ncraft;
+        scene.period = 1e6 / fps;
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<double> u(-3, 3);
+        std::normal_distribution<double> blur(0, 0.5);
+        double rms = 0;
+        for (int c = 0; c < ncameras; c++) {
+            double a = 2 * M_PI * c / ncameras;
+            double eye[3] = { 7 * cos(a), 7 * sin(a), 3 }, target[3] = { 0, 0, 1.2 };
+            Camera truth = Camera::lookAt(eye, target, FOCAL, WIDTH / 2.0, HEIGHT / 2.0);
+            scene.cameras.push_back(truth);
+            std::vector<double> world, image;
+            for (int i = 0; i < CALIBRATION_POINTS; i++) {
+                double X[3] = { u(rng), u(rng), 1.5 + u(rng) / 3 }, x, y;
+                truth.project(X, x, y);
+                world.insert(world.end(), X, X + 3);
+                image.push_back(x + blur(rng));
+                image.push_back(y + blur(rng));
+            }
+            Camera cam;
+            if (!calibrate(&world[0], &image[0], CALIBRATION_POINTS, cam)) {
+                fprintf(stderr, "camera %d won't calibrate\n", c);
+                return 1;
+            }
+            calibrated.push_back(cam);
+            for (int i = 0; i < CALIBRATION_POINTS; i++) {
+                double x, y;
+                cam.project(&world[i * 3], x, y);
+                rms += pow(x - image[i * 2], 2) + pow(y - image[i * 2 + 1], 2);
+            }
+        }
+        printf("%d cameras calibrated from %d points each, %.2f px RMS\n", ncameras, CALIBRATION_POINTS,
+               sqrt(rms / (ncameras * CALIBRATION_POINTS)));
+        scene.start = monotonicMicros() + 100000;
+        for (int c = 0; c < ncameras; c++) {
+            pipes.push_back(new CameraPipeline(net, WIDTH, HEIGHT));
+            pipes.back()->start(renderer(scene, c));
+        }
+    } else {
+        if (!loadCameras(calibration, calibrated))
+            return 1;
+        if ((int)calibrated.size() != argc - optind) {
+            fprintf(stderr, "%s has %d cameras for %d sources\n", calibration, (int)calibrated.size(),
+                    argc - optind);
+            return 1;
+        }
+        for (int i = optind; i < argc; i++) {
+            FrameSource* src = FrameSource::open(argv[i], 0, 0, 0, true);
+            if (!src)
+                return 1;
+            sources.push_back(src);
+            pipes.push_back(new CameraPipeline(net, src->width(), src->height()));
+            pipes.back()->start([src](float* plane, uint64_t* time_us) {
+                Frame f;
+                if (!src->next(f))
+                    return false;
+                lumaToPlane(f, plane, f.width);
+                *time_us = f.time_us;
+                return true;
+            });
+        }
+        fps = 30;
+    }
+
+    Fusion fusion(calibrated);
+    fusion.gate = gate;
+    std::vector<CameraView> views(pipes.size());
+    std::vector<Position> positions;
+    double sumSq = 0, sumReproj = 0, sumSkew = 0, fuseMs = 0;
+    int fused = 0, placed = 0, matched = 0, expected = 0;
+    while (fused < fuses) {
+        usleep(1000000 / fps);
+        bool ready = true, running = false;
+        for (size_t c = 0; c < pipes.size(); c++) {
+            ready = pipes[c]->latest(views[c]) && ready;
+            running = running || pipes[c]->running();
+        }
+        if (!running)
+            break;
+        if (!ready)
+            continue;
+        // Place the craft at the oldest of the latest frames, so no camera is
+        // taken beyond what it has seen.
+        uint64_t time = views[0].time_us, newest = views[0].time_us;
+        for (size_t c = 1; c < views.size(); c++) {
+            time = std::min(time, views[c].time_us);
+            newest = std::max(newest, views[c].time_us);
+        }
+        uint64_t start = monotonicMicros();
+        fusion.fuse(views, time, positions);
+        fuseMs += (monotonicMicros() - start) * 1e-3;
+        fused++;
+        sumSkew += (newest - time) * 1e-3;
+        placed += positions.size();
+        for (size_t i = 0; i < positions.size(); i++)
+            sumReproj += positions[i].error;
+        if (!synthetic) {
+            for (size_t i = 0; i < positions.size(); i++) {
+                const Position& p = positions[i];
+                printf("%llu %d %.3f %.3f %.3f %.2f %d\n", (unsigned long long)time, p.craft, p.x, p.y, p.z, p.error,
+                       p.views);
+            }
+            continue;
+        }
+        // Against the truth, one to one within half a metre.
+        int rows = positions.size(), cols = scene.craft;
+        expected += cols;
+        if (!rows)
+            continue;
+        std::vector<float> cost(rows * cols);
+        for (int i = 0; i < rows; i++) {
+            for (int k = 0; k < cols; k++) {
+                double X[3];
+                craftAt(k, (time - scene.start) * 1e-6, X);
+                double d = sqrt(pow(X[0] - positions[i].x, 2) + pow(X[1] - positions[i].y, 2) +
+                                pow(X[2] - positions[i].z, 2));
+                cost[i * cols + k] = d < 0.5 ? d : HUNGARIAN_FORBIDDEN;
+            }
+        }
+        std::vector<int> assignment;
+        hungarian(cost, rows, cols, assignment);
+        for (int i = 0; i < rows; i++) {
+            if (assignment[i] >= 0) {
+                matched++;
+                sumSq += pow(cost[i * cols + assignment[i]], 2);
+            }
+        }
+    }
+    for (size_t c = 0; c < pipes.size(); c++)
+        pipes[c]->stop();
+
+    printf("%d fuses of %d cameras: %.2f positions each, %.3f ms to fuse, cameras %.1f ms apart\n", fused,
+           (int)pipes.size(), fused ? (double)placed / fused : 0, fused ? fuseMs / fused : 0,
+           fused ? sumSkew / fused : 0);
+    for (size_t c = 0; c < pipes.size(); c++)
+        printf("camera %d: %llu frames, %.2f ms detecting each\n", (int)c, (unsigned long long)views[c].frames,
+               views[c].detectMs);
+    printf("reprojection %.2f px RMS mean\n", placed ? sumReproj / placed : 0);
+    if (synthetic)
+        printf("%d of %d craft placed within 0.5 m, %.1f cm RMS; %d false\n", matched, expected,
+               matched ? 100 * sqrt(sumSq / matched) : 0, placed - matched);
+    for (size_t c = 0; c < pipes.size(); c++)
+        delete pipes[c];
+    for (size_t i = 0; i < sources.size(); i++)
+        delete sources[i];
+    return 0;
+}
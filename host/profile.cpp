@@ -0,0 +1,77 @@
+#include "profile.h"
+
+#include <string.h>
+
+static const char* const names[PROF_COUNTERS] = {
+    "late", "write_packet", "loop", "resync", "bad_csum", "rx_burst", "rx_bad_crc", "rx_junk",
+};
+
+static const char* const units[PROF_COUNTERS] = {
+    "us", "us", "us", "bytes", "bytes", "frames", "bits", "flag",
+};
+
+const char* profileCounterName(int id) {
+    return id >= 0 && id < PROF_COUNTERS ? names[id] : "?";
+}
+
+ProfileSnapshot::ProfileSnapshot() {
+    clear();
+}
+
+void ProfileSnapshot::clear() {
+    memset(counters, 0, sizeof(counters));
+    _received = 0;
+}
+
+bool ProfileSnapshot::add(const Telemetry& t) {
+    if (t.type != TLM_PROFILE || t.len < 1)
+        return false;
+    if (t.payload[0] == PROF_END)
+        return true;
+    if (t.len != TLM_PROFILE_LEN || t.payload[0] >= PROF_COUNTERS)
+        return false;
+    ProfileCounter& c = counters[t.payload[0]];
+    const uint8_t* p = t.payload + 1;
+    c.count = get32(p);
+    c.min = get16(p + 4);
+    c.max = get16(p + 6);
+    c.sum = get32(p + 8);
+    for (int b = 0; b < PROF_BUCKETS; b++)
+        c.buckets[b] = get16(p + 12 + 2 * b);
+    _received++;
+    return false;
+}
+
+void ProfileSnapshot::print(FILE* out) const {
+    if (!enabled()) {
+        fprintf(out, "arduino_proxy was built without PROXY_PROFILE\n");
+        return;
+    }
+    for (int id = 0; id < PROF_COUNTERS; id++) {
+        const ProfileCounter& c = counters[id];
+        fprintf(out, "%-13s", names[id]);
+        if (!c.count) {
+            fprintf(out, " -\n");
+            continue;
+        }
+        uint16_t most = 0;
+        for (int b = 0; b < PROF_BUCKETS; b++)
+            if (c.buckets[b] > most)
+                most = c.buckets[b];
+        fprintf(out, " n=%u%s min=%u max=%u%s mean=%u %s%s%s\n", c.count,
+                c.count == 0xFFFFFFFF ? "+" : "", c.min, c.max, c.max == 0xFFFF ? "+" : "",
+                c.sum / c.count, units[id], c.sum == 0xFFFFFFFF ? " (sum saturated)" : "",
+                most == 0xFFFF ? " (histogram saturated)" : "");
+        for (int b = 0; b < PROF_BUCKETS; b++) {
+            if (!c.buckets[b])
+                continue;
+            if (b < PROF_BUCKETS - 1)
+                fprintf(out, "    < %5u %6u ", 16 << b, c.buckets[b]);
+            else
+                fprintf(out, "   >= %5u %6u ", 16 << (b - 1), c.buckets[b]);
+            for (int i = 0; i < c.buckets[b] * 40 / most; i++)
+                fputc('#', out);
+            fputc('\n', out);
+        }
+    }
+}
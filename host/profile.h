@@ -0,0 +1,39 @@
+/*
+  profile.h - Decodes and prints the arduino_proxy profile counters (see
+  arduino_proxy/profile.h).
+*/
+#ifndef Profile_h
+#define Profile_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "link.h"
+
+// Any field at its maximum has saturated.
+struct ProfileCounter {
+    uint32_t count;
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint16_t buckets[PROF_BUCKETS];
+};
+
+const char* profileCounterName(int id);
+
+// Gathers the TLM_PROFILE frames of one snapshot.
+class ProfileSnapshot {
+public:
+    ProfileSnapshot();
+    void clear();
+    // Returns true once the PROF_END marker has arrived.
+    bool add(const Telemetry& t);
+    // False if the sketch was built without PROXY_PROFILE.
+    bool enabled() const { return _received > 0; }
+    void print(FILE* out) const;
+    ProfileCounter counters[PROF_COUNTERS];
+private:
+    int _received;
+};
+
+#endif
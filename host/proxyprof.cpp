@@ -0,0 +1,68 @@
+/*
+  proxyprof - snapshots and resets the arduino_proxy profile counters and
+  pretty-prints them.
+
+    proxyprof [-i seconds] /dev/ttyUSB0
+
+  With -i it keeps taking snapshots, each covering the interval since the
+  last.  While linkd owns the port, send it SIGUSR1 instead.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "link.h"
+#include "profile.h"
+
+static ProfileSnapshot snapshot;
+static bool done;
+
+static void telemetry(const Telemetry& t) {
+    if (snapshot.add(t))
+        done = true;
+}
+
+int main(int argc, char** argv) {
+    int interval = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i seconds] /dev/ttyUSB0\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-i seconds] /dev/ttyUSB0\n", argv[0]);
+        return 1;
+    }
+    Link link;
+    if (!link.open(argv[optind])) {
+        perror(argv[optind]);
+        return 1;
+    }
+    link.onTelemetry = telemetry;
+    for (;;) {
+        snapshot.clear();
+        done = false;
+        link.send(CMD_PROFILE, NULL, 0);
+        uint64_t deadline = monotonicMicros() + 2000000;
+        while (!done && monotonicMicros() < deadline)
+            if (!link.poll(100))
+                return 1;
+        if (!done) {
+            fprintf(stderr, "%s: no reply\n", argv[optind]);
+            return 1;
+        }
+        snapshot.print(stdout);
+        if (!interval)
+            return 0;
+        printf("\n");
+        fflush(stdout);
+        sleep(interval);
+    }
+}
@@ -0,0 +1,117 @@
+#include "pyramid.h"
+
+#include <math.h>
+#include <algorithm>
+
+PyramidDetector::PyramidDetector(ConvNet& net)
+    : levels(2), coarseThreshold(0.25f), threshold(0), radius(8), margin(8), candidates(0), computed(0), _net(net),
+      _width(0), _height(0) {
+}
+
+// Averages each 2x2 block of the first inputs() / 2 planes of src.
+void PyramidDetector::_halve(const float* const* src, int stride, int width, int height, std::vector<float>& dst) {
+    int w = width / 2, h = height / 2, half = _net.inputs() / 2;
+    dst.resize((size_t)half * w * h);
+    for (int p = 0; p < half; p++) {
+        for (int y = 0; y < h; y++) {
+            const float* a = src[p] + 2 * y * stride;
+            const float* b = a + stride;
+            float* d = &dst[((size_t)p * h + y) * w];
+            for (int x = 0; x < w; x++)
+                d[x] = 0.25f * (a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1]);
+        }
+    }
+}
+
+int PyramidDetector::_planes(int l, const float* const* full, int stride, const float** planes, int& width,
+                             int& height) {
+    if (l == 0) {
+        for (int k = 0; k < _net.inputs(); k++)
+            planes[k] = full[k];
+        width = _width;
+        height = _height;
+        return stride;
+    }
+    Level& L = _levels[l - 1];
+    int half = _net.inputs() / 2;
+    for (int k = 0; k < half; k++) {
+        planes[k] = &L.cur[(size_t)k * L.width * L.height];
+        planes[half + k] = &L.prev[(size_t)k * L.width * L.height];
+    }
+    width = L.width;
+    height = L.height;
+    return L.width;
+}
+
+void PyramidDetector::detect(const float* const* planes, int stride, int width, int height,
+                             std::vector<Detection>& found) {
+    found.clear();
+    tiles.clear();
+    computed = 0;
+    candidates = 0;
+    if (width <= ConvNet::SHRINK || height <= ConvNet::SHRINK)
+        return;
+    // Levels whose output is still more than a few pixels across.
+    int n = 0;
+    while (n < levels && (width >> (n + 1)) > 2 * ConvNet::SHRINK && (height >> (n + 1)) > 2 * ConvNet::SHRINK)
+        n++;
+    bool fresh = width != _width || height != _height || (int)_levels.size() != n;
+    if (fresh) {
+        _width = width;
+        _height = height;
+        _levels.assign(n, Level());
+    }
+
+    // Each level is made from the one above it.  Only this frame's are new;
+    // the previous frame's were this frame's last time.
+    int half = _net.inputs() / 2;
+    const float* p[ConvNet::MAX_PLANES];
+    for (int l = 1; l <= n; l++) {
+        int w, h, s = _planes(l - 1, planes, stride, p, w, h);
+        Level& L = _levels[l - 1];
+        L.width = w / 2;
+        L.height = h / 2;
+        if (fresh)
+            _halve(p + half, s, w, h, L.prev);
+        else
+            L.prev.swap(L.cur);
+        _halve(p, s, w, h, L.cur);
+    }
+
+    // The whole of the smallest level, then round the candidates at each
+    // level below.
+    std::vector<Detection> cand, next;
+    for (int l = n; l >= 0; l--) {
+        int w, h, s = _planes(l, planes, stride, p, w, h);
+        std::vector<Rect>& t = l ? _tiles : tiles;
+        t.clear();
+        if (l == n) {
+            Rect all = { 0, 0, w - ConvNet::SHRINK - 1, h - ConvNet::SHRINK - 1 };
+            t.push_back(all);
+        } else {
+            for (size_t i = 0; i < cand.size(); i++) {
+                cand[i].x = 2 * cand[i].x + 0.5f;
+                cand[i].y = 2 * cand[i].y + 0.5f;
+            }
+            tilesAround(cand, margin, w - ConvNet::SHRINK, h - ConvNet::SHRINK, t);
+        }
+        int r = std::max(2, radius >> l);
+        next.clear();
+        computed += detectInTiles(_net, p, s, w, h, t, l ? coarseThreshold : threshold, r, next, _scratch);
+        if (l == n)
+            candidates = next.size();
+        for (size_t i = 0; i < cand.size(); i++) {
+            if (cand[i].score >= threshold)
+                continue;
+            bool confirmed = false;
+            for (size_t k = 0; k < next.size() && !confirmed; k++)
+                confirmed = fabsf(next[k].x - cand[i].x) <= margin && fabsf(next[k].y - cand[i].y) <= margin;
+            if (!confirmed)
+                next.push_back(cand[i]);
+        }
+        cand.swap(next);
+    }
+    found.swap(cand);
+    std::stable_sort(found.begin(), found.end(),
+                     [](const Detection& a, const Detection& b) { return a.score < b.score; });
+}
@@ -0,0 +1,72 @@
+/*
+  pyramid.h - Finds craft coarse to fine.
+
+  Each frame is halved levels times by averaging, and the network run over
+  the whole of the smallest level, which costs a quarter as much per level.
+  Minima there under coarseThreshold are candidates, and each finer level
+  is run only in tiles around the candidates from the one above, down to
+  full resolution.  A candidate already under threshold at a coarser level
+  is kept even if nothing finer confirms it: a craft near the camera can be
+  too big for the network to see at full size.
+
+  The network takes the previous frame as well as this one, so each
+  frame's levels are kept and reused as the previous frame's next time
+  rather than made again.  detect() therefore expects consecutive frames;
+  reset() after a jump.
+
+  Only the inputs are shared between levels.  The network's activations
+  are deliberately computed afresh at each level: the layers are stride 1
+  convolutions with ReLU and max pooling, which don't commute with the
+  averaging that makes a level, so halving the first layer's output at
+  one level is not the first layer's output at the next.  They can't be
+  kept from the previous frame either, as the first layer mixes its planes
+  with this frame's.  The saving is in how little each level runs: the
+  coarse ones are small and the fine ones only run in tiles.
+*/
+#ifndef Pyramid_h
+#define Pyramid_h
+
+#include <stdint.h>
+#include <vector>
+
+#include "convnet.h"
+#include "roi.h"
+
+class PyramidDetector {
+public:
+    PyramidDetector(ConvNet& net);
+
+    // planes as for ConvNet::forward(); found in input pixels, strongest
+    // first.
+    void detect(const float* const* planes, int stride, int width, int height, std::vector<Detection>& found);
+    void reset() { _width = 0; }
+
+    int levels;           // below full resolution, as many as fit
+    float coarseThreshold; // for candidates, above the levels below
+    float threshold;
+    int radius;           // minimum distance between craft, full size output pixels
+    int margin;           // output pixels searched round a candidate, at each level
+
+    // About the last detect()
+    int candidates;          // at the smallest level
+    uint64_t computed;       // outputs evaluated, at all levels
+    std::vector<Rect> tiles; // at full resolution, in output pixels
+
+private:
+    // A frame, and the one before, at one level.
+    struct Level {
+        int width, height;
+        std::vector<float> cur, prev; // planes of width x height
+    };
+    void _halve(const float* const* src, int stride, int width, int height, std::vector<float>& dst);
+    // Points planes at level l (0 is full size) and returns their stride.
+    int _planes(int l, const float* const* full, int stride, const float** planes, int& width, int& height);
+
+    ConvNet& _net;
+    int _width, _height;
+    std::vector<Level> _levels;
+    std::vector<float> _scratch;
+    std::vector<Rect> _tiles;
+};
+
+#endif
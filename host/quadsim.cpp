@@ -0,0 +1,216 @@
+#include "quadsim.h"
+
+#include <math.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#define GRAVITY 9.81
+#define FLIP_RATE (6 * M_PI) // rad/s
+#define NORMALS 4096
+
+// Drawing from std::normal_distribution costs more than the rest of a step
+// put together, so noise comes from a table of draws instead, picked by a
+// xorshift.
+static const float* normals() {
+    static std::vector<float> table = []() {
+        std::mt19937 rng(1);
+        std::normal_distribution<float> n(0, 1);
+        std::vector<float> t(NORMALS);
+        for (int i = 0; i < NORMALS; i++)
+            t[i] = n(rng);
+        return t;
+    }();
+    return &table[0];
+}
+
+uint32_t QuadSim::random() {
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng;
+}
+
+double QuadSim::normal() {
+    return _normals[random() & (NORMALS - 1)];
+}
+
+void encodePacket(uint8_t type, const uint8_t txid[4], const uint8_t aid[4], const uint16_t sticks[4],
+                  uint16_t chan5, uint16_t chan6, uint8_t* packet) {
+    uint16_t servo[4];
+    for (int i = 0; i < 4; i++)
+        servo[i] = sticks[i] + 1000;
+    if (chan6 + 1000 > 1500)
+        servo[3] |= 1 << 12; // flip
+    packet[0] = type;
+    memcpy(packet + 1, txid, 4);
+    memcpy(packet + 5, aid, 4);
+    for (int i = 0; i < 4; i++) {
+        packet[9 + 2 * i] = servo[i] & 0xff;
+        packet[10 + 2 * i] = servo[i] >> 8;
+    }
+    packet[17] = chan5 + 1000 > 1800 ? 0x02 : chan5 + 1000 > 1300 ? 0x01 : 0x00;
+    packet[18] = 0;
+}
+
+QuadParams::QuadParams()
+    : mass(0.019), arm(0.03), maxThrust(0.095), yawTorque(0.01), drag(0.01), motorLag(0.03), motorNoise(0.02),
+      maxYawRate(3), attitudeGain(400), rateGain(40), yawGain(20), failsafe(1) {
+    inertia[0] = inertia[1] = 2.5e-6;
+    inertia[2] = 4.5e-6;
+    maxTilt[0] = 0.3;
+    maxTilt[1] = 0.45;
+    maxTilt[2] = 0.6;
+}
+
+QuadSim::QuadSim(const QuadParams& params, unsigned seed)
+    : _p(params), _rng(seed ? seed : 1), _normals(normals()), _mode(0), _flipRequested(false), _flipping(false), _flipTurned(0),
+      _lastPacket(-1e9), _time(0) {
+    memset(_aid, 0, sizeof(_aid));
+    for (int i = 0; i < 4; i++)
+        _sticks[i] = 500;
+    _sticks[2] = 0;
+    place(0, 0);
+}
+
+void QuadSim::setAid(const uint8_t aid[4]) {
+    memcpy(_aid, aid, 4);
+}
+
+bool QuadSim::packet(const uint8_t* data, int len) {
+    if (len != CX10_PACKET_LENGTH || data[0] != CX10_PACKET_DATA || memcmp(data + 5, _aid, 4) != 0)
+        return false;
+    for (int i = 0; i < 4; i++) {
+        int v = (data[9 + 2 * i] | data[10 + 2 * i] << 8);
+        if (i == 3) {
+            _flipRequested = _flipRequested || (v & (1 << 12));
+            v &= 0x0fff;
+        }
+        v -= 1000;
+        _sticks[i] = v < 0 ? 0 : v > 1000 ? 1000 : v;
+    }
+    _mode = data[17] > 2 ? 2 : data[17];
+    _lastPacket = _time;
+    return true;
+}
+
+void QuadSim::place(double x, double y) {
+    _pos[0] = x;
+    _pos[1] = y;
+    _pos[2] = 0;
+    memset(_vel, 0, sizeof(_vel));
+    memset(_rate, 0, sizeof(_rate));
+    memset(_motor, 0, sizeof(_motor));
+    _q[0] = 1;
+    _q[1] = _q[2] = _q[3] = 0;
+    _flipping = _flipRequested = false;
+}
+
+void QuadSim::attitude(double a[3]) const {
+    const double* q = _q;
+    a[0] = atan2(2 * (q[0] * q[1] + q[2] * q[3]), 1 - 2 * (q[1] * q[1] + q[2] * q[2]));
+    double s = 2 * (q[0] * q[2] - q[3] * q[1]);
+    a[1] = asin(s > 1 ? 1 : s < -1 ? -1 : s);
+    a[2] = atan2(2 * (q[0] * q[3] + q[1] * q[2]), 1 - 2 * (q[2] * q[2] + q[3] * q[3]));
+}
+
+void QuadSim::step(double dt) {
+    _time += dt;
+    bool live = _time - _lastPacket < _p.failsafe;
+
+    // The flight controller: an angular acceleration per body axis, then
+    // the thrust per motor that gives it.
+    double* q = _q;
+    double roll = atan2(2 * (q[0] * q[1] + q[2] * q[3]), 1 - 2 * (q[1] * q[1] + q[2] * q[2]));
+    double sp = 2 * (q[0] * q[2] - q[3] * q[1]);
+    double pitch = asin(sp > 1 ? 1 : sp < -1 ? -1 : sp);
+    double ail = (_sticks[0] - 500) / 500.0, ele = (_sticks[1] - 500) / 500.0;
+    double rud = (_sticks[3] - 500) / 500.0, thr = live ? _sticks[2] / 1000.0 : 0;
+    double tilt = _p.maxTilt[_mode];
+    double alpha[3];
+    alpha[0] = _p.attitudeGain * (-ele * tilt - roll) - _p.rateGain * _rate[0];
+    alpha[1] = _p.attitudeGain * (ail * tilt - pitch) - _p.rateGain * _rate[1];
+    alpha[2] = _p.yawGain * (rud * _p.maxYawRate - _rate[2]);
+    if (_flipRequested && !_flipping && _pos[2] > 0.3) {
+        _flipping = true;
+        _flipTurned = 0;
+    }
+    _flipRequested = false;
+    if (_flipping) {
+        alpha[0] = _p.rateGain * (FLIP_RATE - _rate[0]);
+        _flipTurned += _rate[0] * dt;
+        if (_flipTurned >= 2 * M_PI)
+            _flipping = false;
+    }
+
+    // X mixer.  Motors at (+d, +d), (-d, +d), (-d, -d), (+d, -d), spinning
+    // alternately, so the cross terms cancel.
+    static const int sx[4] = { 1, -1, -1, 1 }, sy[4] = { 1, 1, -1, -1 }, spin[4] = { 1, -1, 1, -1 };
+    double d = _p.arm / M_SQRT2;
+    double total = thr * 4 * _p.maxThrust;
+    double torque[3] = { _p.inertia[0] * alpha[0], _p.inertia[1] * alpha[1], _p.inertia[2] * alpha[2] };
+    for (int m = 0; m < 4; m++) {
+        double cmd = total / 4 + torque[0] * sy[m] / (4 * d) - torque[1] * sx[m] / (4 * d) +
+                     torque[2] * spin[m] / (4 * _p.yawTorque);
+        if (thr <= 0)
+            cmd = 0;
+        cmd = cmd < 0 ? 0 : cmd > _p.maxThrust ? _p.maxThrust : cmd;
+        _motor[m] += (cmd - _motor[m]) * (dt / (_p.motorLag + dt));
+    }
+
+    // What the motors actually do.
+    double T = 0, tau[3] = { 0, 0, 0 };
+    for (int m = 0; m < 4; m++) {
+        double f = _motor[m] * (1 + _p.motorNoise * normal());
+        T += f;
+        tau[0] += f * sy[m] * d;
+        tau[1] -= f * sx[m] * d;
+        tau[2] += f * spin[m] * _p.yawTorque;
+    }
+    const double* I = _p.inertia;
+    double* w = _rate;
+    double wdot[3] = { (tau[0] - (I[2] - I[1]) * w[1] * w[2]) / I[0], (tau[1] - (I[0] - I[2]) * w[2] * w[0]) / I[1],
+                       (tau[2] - (I[1] - I[0]) * w[0] * w[1]) / I[2] };
+    for (int k = 0; k < 3; k++)
+        w[k] += wdot[k] * dt;
+    double dq[4] = { -0.5 * (q[1] * w[0] + q[2] * w[1] + q[3] * w[2]), 0.5 * (q[0] * w[0] + q[2] * w[2] - q[3] * w[1]),
+                     0.5 * (q[0] * w[1] + q[3] * w[0] - q[1] * w[2]), 0.5 * (q[0] * w[2] + q[1] * w[1] - q[2] * w[0]) };
+    double n = 0;
+    for (int k = 0; k < 4; k++) {
+        q[k] += dq[k] * dt;
+        n += q[k] * q[k];
+    }
+    n = 1 / sqrt(n);
+    for (int k = 0; k < 4; k++)
+        q[k] *= n;
+
+    // Thrust along body z, in the world.
+    double up[3] = { 2 * (q[1] * q[3] + q[0] * q[2]), 2 * (q[2] * q[3] - q[0] * q[1]),
+                     1 - 2 * (q[1] * q[1] + q[2] * q[2]) };
+    for (int k = 0; k < 3; k++) {
+        double a = (T * up[k] - _p.drag * _vel[k]) / _p.mass - (k == 2 ? GRAVITY : 0);
+        _vel[k] += a * dt;
+        _pos[k] += _vel[k] * dt;
+    }
+    if (_pos[2] <= 0) {
+        // On the ground: it stays there, level, until it lifts off.
+        _pos[2] = 0;
+        memset(_vel, 0, sizeof(_vel));
+        memset(_rate, 0, sizeof(_rate));
+        double yaw = atan2(2 * (q[0] * q[3] + q[1] * q[2]), 1 - 2 * (q[2] * q[2] + q[3] * q[3]));
+        _q[0] = cos(yaw / 2);
+        _q[1] = _q[2] = 0;
+        _q[3] = sin(yaw / 2);
+        _flipping = false;
+    }
+}
+
+bool QuadSim::detect(const Camera& camera, double noise, double dropout, Detection& d) {
+    double x, y;
+    if ((random() >> 8) * (1.0 / (1 << 24)) < dropout || !camera.project(_pos, x, y))
+        return false;
+    d.x = x + noise * normal();
+    d.y = y + noise * normal();
+    d.score = -1;
+    return true;
+}
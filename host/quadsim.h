@@ -0,0 +1,101 @@
+/*
+  quadsim.h - A CX10 in software, for flying the whole stack on a desk.
+
+  QuadSim takes the 19 byte packets CX10::Write_Packet() sends (a type
+  byte, txid and aid, then the sticks, mode and flags) and flies a rigid
+  body with them.  Its flight controller is modelled on the CX10's own:
+  aileron and elevator set a tilt, up to an angle that grows with the
+  mode, rudder a yaw rate and throttle the total thrust, with a PD loop on
+  attitude mixed to four motors in an X.  Motors follow their commands
+  with a first order lag and some noise.  The flip flag rolls it through
+  a full turn.  With yaw 0, aileron moves it along +x, elevator along +y,
+  and z is up, in metres.
+
+  detect() sees it through a camera (triangulate.h) with pixel noise and
+  now and then not at all, as the detector would.
+
+  Each step takes under 200 nanoseconds, so a second of flight at 1 kHz
+  takes well under a millisecond.  flight.h flies one closed loop.
+*/
+#ifndef QuadSim_h
+#define QuadSim_h
+
+#include <stdint.h>
+
+#include "roi.h"
+#include "triangulate.h"
+
+#define CX10_PACKET_LENGTH 19
+#define CX10_PACKET_DATA 0x55
+#define CX10_PACKET_BIND 0xaa
+
+// Builds the packet CX10::Write_Packet() would for sticks of 0..1000,
+// as the sketch holds them in Servo_data less 1000: chan5 picks the mode
+// and chan6 above 500 sets the flip flag.
+void encodePacket(uint8_t type, const uint8_t txid[4], const uint8_t aid[4], const uint16_t sticks[4],
+                  uint16_t chan5, uint16_t chan6, uint8_t* packet);
+
+struct QuadParams {
+    double mass;       // kg
+    double arm;        // motor to centre, m
+    double maxThrust;  // per motor, N
+    double inertia[3]; // kg m^2, about body x, y, z
+    double yawTorque;  // N m per N of thrust
+    double drag;       // N per m/s
+    double motorLag;   // time constant, s
+    double motorNoise; // standard deviation, fraction of thrust
+    double maxTilt[3]; // rad at full stick, per mode
+    double maxYawRate; // rad/s at full stick
+    double attitudeGain, rateGain, yawGain;
+    double failsafe;   // s without a packet before cutting the motors
+
+    QuadParams(); // a CX10, near enough
+};
+
+class QuadSim {
+public:
+    QuadSim(const QuadParams& params = QuadParams(), unsigned seed = 1);
+
+    // Only data packets for aid are flown; others (and bind packets) are
+    // ignored and return false.
+    void setAid(const uint8_t aid[4]);
+    bool packet(const uint8_t* data, int len);
+
+    void step(double dt);
+    double time() const { return _time; }
+
+    // Sits it on the ground at (x, y), level.
+    void place(double x, double y);
+    const double* position() const { return _pos; }
+    const double* velocity() const { return _vel; }
+    // roll, pitch, yaw
+    void attitude(double angles[3]) const;
+    bool flying() const { return _pos[2] > 0 || _vel[2] > 0; }
+    uint16_t stick(int channel) const { return _sticks[channel]; }
+    int mode() const { return _mode; }
+
+    // Where camera sees it, false if dropped (probability dropout) or
+    // behind the camera.
+    bool detect(const Camera& camera, double noise, double dropout, Detection& d);
+
+private:
+    uint32_t random();
+    double normal();
+
+    QuadParams _p;
+    uint32_t _rng;
+    const float* _normals;
+    uint8_t _aid[4];
+    uint16_t _sticks[4];
+    int _mode;
+    bool _flipRequested, _flipping;
+    double _flipTurned;
+    double _lastPacket;
+    double _time;
+    double _pos[3], _vel[3];
+    double _q[4];     // attitude, body to world, w x y z
+    double _rate[3];  // body rates
+    double _motor[4]; // thrust, N
+};
+
+#endif
@@ -0,0 +1,318 @@
+/*
+  quantbench - compares 8 bit inference with the float network, for speed
+  and for how much it changes the output.
+
+    quantbench [-n frames] [-s WxH] [-c calibration_frames]
+               [-v video [-l annotations]] [convnet.weights]
+
+  With -v, frames are decoded by ffmpeg.  If annotations are given the
+  labelled frames are used, alternately for calibration and evaluation;
+  otherwise the first calibration_frames are for calibration and the next
+  frames for evaluation.  Without -v the scene is synthetic: squares moving
+  over noise, and unless weights are given, hand made weights that find
+  them with some noise added so that rounding matters.
+
+  For each engine it prints the time per frame and how many 30 frame/s
+  streams one core could keep up with, then against the float output: the
+  largest and RMS difference, and how many craft found (findCraft() below
+  zero) match within 2 pixels and how far they moved.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+
+#include "annotations.h"
+#include "clock.h"
+#include "convnet.h"
+#include "quantnet.h"
+#include "roi.h"
+
+#define SIZE 8 // of a synthetic craft, pixels
+
+static int width = 640, height = 360;
+
+// Frames one after another, as planes of floats 0..1.
+class Source {
+public:
+    virtual ~Source() {}
+    virtual bool next(std::vector<float>& frame) = 0;
+};
+
+class VideoSource : public Source {
+public:
+    VideoSource(const char* path) {
+        char cmd[1024];
+        snprintf(cmd, sizeof(cmd), "ffmpeg -loglevel error -i '%s' -f rawvideo -pix_fmt rgb24 -s %dx%d -", path,
+                 width, height);
+        _pipe = popen(cmd, "r");
+        _rgb.resize(width * height * 3);
+    }
+    ~VideoSource() {
+        if (_pipe)
+            pclose(_pipe);
+    }
+    bool next(std::vector<float>& frame) {
+        if (!_pipe || fread(&_rgb[0], 1, _rgb.size(), _pipe) != _rgb.size())
+            return false;
+        int n = width * height;
+        frame.resize(3 * n);
+        for (int i = 0; i < n; i++)
+            for (int c = 0; c < 3; c++)
+                frame[c * n + i] = _rgb[i * 3 + c] / 255.0f;
+        return true;
+    }
+
+private:
+    FILE* _pipe;
+    std::vector<uint8_t> _rgb;
+};
+
+class SyntheticSource : public Source {
+public:
+    SyntheticSource(int craft) : _rng(1) {
+        std::uniform_real_distribution<float> u(0, 1);
+        for (int k = 0; k < craft; k++) {
+            float c[4] = { SIZE + u(_rng) * (width - 2 * SIZE), SIZE + u(_rng) * (height - 2 * SIZE),
+                           u(_rng) * 4 - 2, u(_rng) * 4 - 2 };
+            _craft.push_back(std::vector<float>(c, c + 4));
+        }
+    }
+    bool next(std::vector<float>& frame) {
+        std::uniform_real_distribution<float> noise(0, 0.3f);
+        frame.resize(3 * width * height);
+        for (size_t i = 0; i < frame.size(); i++)
+            frame[i] = noise(_rng);
+        for (size_t k = 0; k < _craft.size(); k++) {
+            std::vector<float>& c = _craft[k];
+            c[0] += c[2];
+            c[1] += c[3];
+            if (c[0] < SIZE || c[0] > width - SIZE)
+                c[2] = -c[2];
+            if (c[1] < SIZE || c[1] > height - SIZE)
+                c[3] = -c[3];
+            int x0 = lroundf(c[0]) - SIZE / 2, y0 = lroundf(c[1]) - SIZE / 2;
+            for (int p = 0; p < 3; p++)
+                for (int y = y0; y < y0 + SIZE; y++)
+                    for (int x = x0; x < x0 + SIZE; x++)
+                        frame[(p * height + y) * width + x] = 1;
+        }
+        return true;
+    }
+
+private:
+    std::mt19937 _rng;
+    std::vector<std::vector<float> > _craft;
+};
+
+// As roibench's, finding bright squares, then jittered.
+static void blobWeights(ConvNet& net) {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        ConvLayer& l = net.layer(i);
+        for (size_t k = 0; k < l.weight.size(); k++)
+            l.weight[k] = jitter(rng);
+        for (size_t k = 0; k < l.bias.size(); k++)
+            l.bias[k] = jitter(rng);
+        l.weight[4] = i < ConvNet::LAYERS - 1 ? 1 : -1;
+    }
+    net.layer(ConvNet::LAYERS - 1).bias[0] = 0.5;
+}
+
+// Feeds each frame and the one before it to use(), which returns false to
+// stop.  Only frames wanted(index) are used, if there is a filter.
+template <class F>
+static void pairs(Source& src, const Annotations* labels, int parity, F use) {
+    std::vector<float> cur, prev;
+    const float* planes[ConvNet::MAX_PLANES];
+    int used = 0;
+    for (uint32_t i = 0; src.next(cur); i++, cur.swap(prev)) {
+        if (i == 0)
+            continue;
+        if (labels) {
+            const FrameLabels* l = labels->frame(i);
+            if (!l || !(l->flags & FRAME_LABELLED) || (l->flags & FRAME_SKIP) || used++ % 2 != parity)
+                continue;
+        }
+        for (int c = 0; c < 3; c++) {
+            planes[c] = &cur[c * width * height];
+            planes[3 + c] = &prev[c * width * height];
+        }
+        if (!use(planes))
+            break;
+    }
+}
+
+struct Engine {
+    const char* name;
+    ConvNet* net;
+    QuantNet* quant;
+    double seconds;
+    double maxErr, sumSq, samples;
+    int found, matched;
+    double shift;
+};
+
+static void compare(const std::vector<float>& ref, const std::vector<float>& out, int w, int h, Engine& e) {
+    for (size_t i = 0; i < out.size(); i++) {
+        double d = fabs(out[i] - ref[i]);
+        e.maxErr = fmax(e.maxErr, d);
+        e.sumSq += d * d;
+    }
+    e.samples += out.size();
+    std::vector<Detection> a, b;
+    findCraft(&ref[0], w, w, h, 0, 8, a);
+    findCraft(&out[0], w, w, h, 0, 8, b);
+    e.found += a.size();
+    for (size_t i = 0; i < a.size(); i++) {
+        for (size_t k = 0; k < b.size(); k++) {
+            float d = hypotf(a[i].x - b[k].x, a[i].y - b[k].y);
+            if (d <= 2) {
+                e.matched++;
+                e.shift += d;
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int frames = 100, calibration = 20;
+    const char* video = NULL;
+    const char* labelPath = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:c:v:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+                frames = 0;
+            break;
+        case 'c':
+            calibration = atoi(optarg);
+            break;
+        case 'v':
+            video = optarg;
+            break;
+        case 'l':
+            labelPath = optarg;
+            break;
+        default:
+            frames = 0;
+        }
+    }
+    if (frames <= 0 || calibration <= 0 || width < 8 * SIZE || height < 8 * SIZE || (labelPath && !video)) {
+        fprintf(stderr, "usage: %s [-n frames] [-s WxH] [-c calibration_frames] [-v video [-l annotations]] "
+                        "[convnet.weights]\n", argv[0]);
+        return 1;
+    }
+    ConvNet net;
+    if (optind < argc) {
+        if (!net.load(argv[optind])) {
+            fprintf(stderr, "%s: can't load weights\n", argv[optind]);
+            return 1;
+        }
+    } else {
+        blobWeights(net);
+    }
+    if (net.inputs() != 6) {
+        fprintf(stderr, "expected a network over two RGB frames\n");
+        return 1;
+    }
+    Annotations labels;
+    if (labelPath && !labels.open(labelPath))
+        return 1;
+    const Annotations* filter = labelPath ? &labels : NULL;
+
+    QuantNet quant(net);
+    Source* src = video ? (Source*)new VideoSource(video) : new SyntheticSource(8);
+    int calibrated = 0;
+    pairs(*src, filter, 0, [&](const float* const* planes) {
+        quant.calibrate(planes, width, width, height);
+        return ++calibrated < calibration;
+    });
+    if (!video || filter) {
+        delete src;
+        src = video ? (Source*)new VideoSource(video) : new SyntheticSource(8);
+    }
+
+    std::vector<Engine> engines;
+    Engine base = { "float", &net, NULL, 0, 0, 0, 0, 0, 0, 0 };
+    engines.push_back(base);
+    QuantNet::Kernel best = QuantNet::best();
+    static QuantNet scalar(quant), avx2(quant), vnni(quant);
+    scalar.setKernel(QuantNet::SCALAR);
+    avx2.setKernel(QuantNet::AVX2);
+    vnni.setKernel(QuantNet::VNNI);
+    Engine q = base;
+    q.net = NULL;
+    q.name = "int8 scalar";
+    q.quant = &scalar;
+    engines.push_back(q);
+    if (best >= QuantNet::AVX2) {
+        q.name = "int8 avx2";
+        q.quant = &avx2;
+        engines.push_back(q);
+    }
+    if (best >= QuantNet::VNNI) {
+        q.name = "int8 vnni";
+        q.quant = &vnni;
+        engines.push_back(q);
+    }
+
+    int ow = width - ConvNet::SHRINK, oh = height - ConvNet::SHRINK;
+    std::vector<float> ref(ow * oh), out(ow * oh), first(ow * oh);
+    int evaluated = 0;
+    bool agree = true;
+    pairs(*src, filter, 1, [&](const float* const* planes) {
+        for (size_t i = 0; i < engines.size(); i++) {
+            Engine& e = engines[i];
+            std::vector<float>& dst = i ? out : ref;
+            uint64_t start = monotonicMicros();
+            if (e.net)
+                e.net->forward(planes, width, width, height, &dst[0], ow);
+            else
+                e.quant->forward(planes, width, width, height, &dst[0], ow);
+            e.seconds += (monotonicMicros() - start) * 1e-6;
+            if (!i)
+                continue;
+            // The integer kernels should agree exactly.
+            if (i == 1)
+                first = out;
+            else if (memcmp(&first[0], &out[0], out.size() * sizeof(float)) != 0)
+                agree = false;
+            compare(ref, out, ow, oh, e);
+        }
+        return ++evaluated < frames;
+    });
+    delete src;
+    if (!evaluated) {
+        fprintf(stderr, "no frames to evaluate\n");
+        return 1;
+    }
+
+    printf("%dx%d, %s, calibrated on %d frames, evaluated on %d\n", width, height,
+           video ? video : "synthetic", calibrated, evaluated);
+    printf("ranges in:");
+    for (int i = 0; i < ConvNet::LAYERS; i++)
+        printf(" %.3g", quant.range(i));
+    printf("\nengine       ms/frame  streams@30  speedup   max err   rms err  craft  matched  shift px\n");
+    for (size_t i = 0; i < engines.size(); i++) {
+        const Engine& e = engines[i];
+        double ms = e.seconds * 1e3 / evaluated;
+        printf("%-12s %8.2f %11.1f %8.2f", e.name, ms, 1000 / (30 * ms), engines[0].seconds / e.seconds);
+        if (i)
+            printf(" %9.4f %9.4f %6d %8d %9.3f", e.maxErr, sqrt(e.sumSq / e.samples), e.found, e.matched,
+                   e.matched ? e.shift / e.matched : 0);
+        printf("\n");
+    }
+    if (!agree)
+        printf("integer kernels disagree\n");
+    return agree ? 0 : 1;
+}
@@ -0,0 +1,449 @@
+#include "quantnet.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define QMAX 127 // activations are 7 bits, see quantnet.h
+
+// p[c] is input plane c of a group of four.  out[x * 4 + c] is it scaled by
+// mul and rounded.
+typedef void (*QuantKernel)(const float* const* p, int width, float mul, uint8_t* out);
+// in[ky * groups + g] is row ky of the three row window over group g.
+// Writes width outputs: requantised to each group out[o / 4] for a hidden
+// layer, or as floats to last for the final one.
+typedef void (*QConvKernel)(const QuantNet::Layer& l, const uint8_t* const* in, int width, uint8_t* const* out,
+                            float* last);
+// 3x3 max of rows a, b and c, four planes interleaved.  Each row must have
+// a zero pixel either side.
+typedef void (*QPoolKernel)(const uint8_t* a, const uint8_t* b, const uint8_t* c, int width, uint8_t* out);
+
+static inline int clampQ(int q) {
+    return q < 0 ? 0 : q > QMAX ? QMAX : q;
+}
+
+static void quantScalar(const float* const* p, int width, float mul, uint8_t* out) {
+    for (int x = 0; x < width; x++)
+        for (int c = 0; c < 4; c++)
+            out[x * 4 + c] = clampQ(lrintf(p[c][x] * mul));
+}
+
+static void qconvScalar(const QuantNet::Layer& l, const uint8_t* const* in, int width, uint8_t* const* out,
+                        float* last) {
+    int outs = last ? 1 : (l.nOut + 3) & ~3;
+    for (int o = 0; o < outs; o++) {
+        const int32_t* w = &l.weight[o * 9 * l.groups];
+        for (int x = 0; x < width; x++) {
+            int32_t acc = 0;
+            for (int t = 0; t < 9; t++) {
+                for (int g = 0; g < l.groups; g++) {
+                    const uint8_t* a = in[(t / 3) * l.groups + g] + (x + t % 3) * 4;
+                    uint32_t packed = w[t * l.groups + g];
+                    for (int c = 0; c < 4; c++)
+                        acc += a[c] * (int8_t)(packed >> (8 * c));
+                }
+            }
+            float v = fmaf((float)acc, l.scale[o], l.offset[o]);
+            if (last)
+                last[x] = v;
+            else
+                out[o / 4][x * 4 + o % 4] = clampQ(lrintf(v));
+        }
+    }
+}
+
+static void qpoolScalar(const uint8_t* a, const uint8_t* b, const uint8_t* c, int width, uint8_t* out) {
+    for (int i = 0; i < width * 4; i++) {
+        uint8_t m = 0;
+        for (int d = -4; d <= 4; d += 4)
+            m = std::max(m, std::max(a[i + d], std::max(b[i + d], c[i + d])));
+        out[i] = m;
+    }
+}
+
+#if defined(__x86_64__)
+
+// Eight pixels at a time; rows that aren't a whole number of vectors finish
+// with a vector overlapping the one before, as in convnet.cpp.
+
+__attribute__((target("avx2")))
+static inline __m256i packQ(__m256 v0, __m256 v1, __m256 v2, __m256 v3) {
+    __m256i zero = _mm256_setzero_si256(), top = _mm256_set1_epi32(QMAX);
+    __m256i q0 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(v0), zero), top);
+    __m256i q1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(v1), zero), top);
+    __m256i q2 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(v2), zero), top);
+    __m256i q3 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(v3), zero), top);
+    q0 = _mm256_or_si256(q0, _mm256_slli_epi32(q1, 8));
+    q2 = _mm256_or_si256(_mm256_slli_epi32(q2, 16), _mm256_slli_epi32(q3, 24));
+    return _mm256_or_si256(q0, q2);
+}
+
+__attribute__((target("avx2")))
+static void quantAvx2(const float* const* p, int width, float mul, uint8_t* out) {
+    if (width < 8) {
+        quantScalar(p, width, mul, out);
+        return;
+    }
+    __m256 m = _mm256_set1_ps(mul);
+    for (int x = 0; x < width; x += 8) {
+        if (x + 8 > width)
+            x = width - 8;
+        __m256i q = packQ(_mm256_mul_ps(_mm256_loadu_ps(p[0] + x), m), _mm256_mul_ps(_mm256_loadu_ps(p[1] + x), m),
+                          _mm256_mul_ps(_mm256_loadu_ps(p[2] + x), m), _mm256_mul_ps(_mm256_loadu_ps(p[3] + x), m));
+        _mm256_storeu_si256((__m256i*)(out + x * 4), q);
+    }
+}
+
+__attribute__((target("avx2")))
+static void qpoolAvx2(const uint8_t* a, const uint8_t* b, const uint8_t* c, int width, uint8_t* out) {
+    if (width < 8) {
+        qpoolScalar(a, b, c, width, out);
+        return;
+    }
+    for (int x = 0; x < width; x += 8) {
+        if (x + 8 > width)
+            x = width - 8;
+        int i = x * 4;
+        __m256i m = _mm256_max_epu8(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                    _mm256_loadu_si256((const __m256i*)(b + i)));
+        m = _mm256_max_epu8(m, _mm256_loadu_si256((const __m256i*)(c + i)));
+        for (int d = -4; d <= 4; d += 8) {
+            m = _mm256_max_epu8(m, _mm256_loadu_si256((const __m256i*)(a + i + d)));
+            m = _mm256_max_epu8(m, _mm256_loadu_si256((const __m256i*)(b + i + d)));
+            m = _mm256_max_epu8(m, _mm256_loadu_si256((const __m256i*)(c + i + d)));
+        }
+        _mm256_storeu_si256((__m256i*)(out + i), m);
+    }
+}
+
+// The convolution is the same for every instruction set but for the 8 bit
+// dot product, and GCC won't inline intrinsics across target attributes,
+// so the body is stamped out once per DOT(acc, activations, weights).
+// Hidden layers work out four output planes for sixteen pixels at a time,
+// and the last layer's single plane thirty two at a time, so each weight
+// broadcast feeds several dot products and enough of them are independent
+// to keep the multiplier busy.
+#define QCONV_BODY(DOT)                                                                                    \
+    if (width < 32) {                                                                                      \
+        qconvScalar(l, in, width, out, last);                                                              \
+        return;                                                                                            \
+    }                                                                                                      \
+    int G = l.groups;                                                                                      \
+    if (last) {                                                                                            \
+        const int32_t* w = &l.weight[0];                                                                   \
+        __m256 scale = _mm256_set1_ps(l.scale[0]), offset = _mm256_set1_ps(l.offset[0]);                   \
+        for (int x = 0; x < width; x += 32) {                                                              \
+            if (x + 32 > width)                                                                            \
+                x = width - 32;                                                                            \
+            __m256i a0 = _mm256_setzero_si256(), a1 = a0, a2 = a0, a3 = a0;                                \
+            for (int ky = 0; ky < 3; ky++) {                                                               \
+                for (int g = 0; g < G; g++) {                                                              \
+                    const uint8_t* r = in[ky * G + g] + x * 4;                                             \
+                    for (int kx = 0; kx < 3; kx++, r += 4) {                                               \
+                        __m256i wv = _mm256_set1_epi32(w[(ky * 3 + kx) * G + g]);                          \
+                        a0 = DOT(a0, _mm256_loadu_si256((const __m256i*)r), wv);                           \
+                        a1 = DOT(a1, _mm256_loadu_si256((const __m256i*)(r + 32)), wv);                    \
+                        a2 = DOT(a2, _mm256_loadu_si256((const __m256i*)(r + 64)), wv);                    \
+                        a3 = DOT(a3, _mm256_loadu_si256((const __m256i*)(r + 96)), wv);                    \
+                    }                                                                                      \
+                }                                                                                          \
+            }                                                                                              \
+            _mm256_storeu_ps(last + x, _mm256_fmadd_ps(_mm256_cvtepi32_ps(a0), scale, offset));            \
+            _mm256_storeu_ps(last + x + 8, _mm256_fmadd_ps(_mm256_cvtepi32_ps(a1), scale, offset));        \
+            _mm256_storeu_ps(last + x + 16, _mm256_fmadd_ps(_mm256_cvtepi32_ps(a2), scale, offset));       \
+            _mm256_storeu_ps(last + x + 24, _mm256_fmadd_ps(_mm256_cvtepi32_ps(a3), scale, offset));       \
+        }                                                                                                  \
+        return;                                                                                            \
+    }                                                                                                      \
+    for (int o0 = 0; o0 < l.nOut; o0 += 4) {                                                               \
+        const int32_t* w = &l.weight[o0 * 9 * G];                                                          \
+        int step = 9 * G; /* between output planes */                                                      \
+        __m256 s[4], c[4];                                                                                 \
+        for (int k = 0; k < 4; k++) {                                                                      \
+            s[k] = _mm256_set1_ps(l.scale[o0 + k]);                                                        \
+            c[k] = _mm256_set1_ps(l.offset[o0 + k]);                                                       \
+        }                                                                                                  \
+        for (int x = 0; x < width; x += 16) {                                                              \
+            if (x + 16 > width)                                                                            \
+                x = width - 16;                                                                            \
+            __m256i a0 = _mm256_setzero_si256(), a1 = a0, a2 = a0, a3 = a0;                                \
+            __m256i b0 = a0, b1 = a0, b2 = a0, b3 = a0;                                                    \
+            for (int ky = 0; ky < 3; ky++) {                                                               \
+                for (int g = 0; g < G; g++) {                                                              \
+                    const uint8_t* r = in[ky * G + g] + x * 4;                                             \
+                    for (int kx = 0; kx < 3; kx++, r += 4) {                                               \
+                        const int32_t* wk = w + (ky * 3 + kx) * G + g;                                     \
+                        __m256i va = _mm256_loadu_si256((const __m256i*)r);                                \
+                        __m256i vb = _mm256_loadu_si256((const __m256i*)(r + 32));                         \
+                        __m256i wv = _mm256_set1_epi32(wk[0]);                                             \
+                        a0 = DOT(a0, va, wv);                                                              \
+                        b0 = DOT(b0, vb, wv);                                                              \
+                        wv = _mm256_set1_epi32(wk[step]);                                                  \
+                        a1 = DOT(a1, va, wv);                                                              \
+                        b1 = DOT(b1, vb, wv);                                                              \
+                        wv = _mm256_set1_epi32(wk[2 * step]);                                              \
+                        a2 = DOT(a2, va, wv);                                                              \
+                        b2 = DOT(b2, vb, wv);                                                              \
+                        wv = _mm256_set1_epi32(wk[3 * step]);                                              \
+                        a3 = DOT(a3, va, wv);                                                              \
+                        b3 = DOT(b3, vb, wv);                                                              \
+                    }                                                                                      \
+                }                                                                                          \
+            }                                                                                              \
+            uint8_t* dst = out[o0 / 4] + x * 4;                                                            \
+            _mm256_storeu_si256((__m256i*)dst,                                                             \
+                                packQ(_mm256_fmadd_ps(_mm256_cvtepi32_ps(a0), s[0], c[0]),                 \
+                                      _mm256_fmadd_ps(_mm256_cvtepi32_ps(a1), s[1], c[1]),                 \
+                                      _mm256_fmadd_ps(_mm256_cvtepi32_ps(a2), s[2], c[2]),                 \
+                                      _mm256_fmadd_ps(_mm256_cvtepi32_ps(a3), s[3], c[3])));               \
+            _mm256_storeu_si256((__m256i*)(dst + 32),                                                      \
+                                packQ(_mm256_fmadd_ps(_mm256_cvtepi32_ps(b0), s[0], c[0]),                 \
+                                      _mm256_fmadd_ps(_mm256_cvtepi32_ps(b1), s[1], c[1]),                 \
+                                      _mm256_fmadd_ps(_mm256_cvtepi32_ps(b2), s[2], c[2]),                 \
+                                      _mm256_fmadd_ps(_mm256_cvtepi32_ps(b3), s[3], c[3])));               \
+        }                                                                                                  \
+    }
+
+// Pairs of u8 x s8 products summed to s16, then pairs of those to s32.
+#define DOT_AVX2(acc, v, w) _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(v, w), ones))
+
+__attribute__((target("avx2,fma")))
+static void qconvAvx2(const QuantNet::Layer& l, const uint8_t* const* in, int width, uint8_t* const* out,
+                      float* last) {
+    __m256i ones = _mm256_set1_epi16(1);
+    QCONV_BODY(DOT_AVX2)
+}
+
+__attribute__((target("avx2,fma,avxvnni")))
+static void qconvAvxVnni(const QuantNet::Layer& l, const uint8_t* const* in, int width, uint8_t* const* out,
+                         float* last) {
+    QCONV_BODY(_mm256_dpbusd_avx_epi32)
+}
+
+__attribute__((target("avx2,fma,avx512vnni,avx512vl")))
+static void qconvAvx512Vnni(const QuantNet::Layer& l, const uint8_t* const* in, int width, uint8_t* const* out,
+                            float* last) {
+    QCONV_BODY(_mm256_dpbusd_epi32)
+}
+
+static bool haveAvxVnni() {
+    return __builtin_cpu_supports("avxvnni");
+}
+
+#else
+#define quantAvx2 quantScalar
+#define qpoolAvx2 qpoolScalar
+#define qconvAvx2 qconvScalar
+#define qconvAvxVnni qconvScalar
+#define qconvAvx512Vnni qconvScalar
+static bool haveAvxVnni() {
+    return false;
+}
+#endif
+
+static struct QKernels {
+    QuantKernel quant;
+    QConvKernel conv;
+    QPoolKernel pool;
+} kernels[] = {
+    { quantScalar, qconvScalar, qpoolScalar },
+    { quantAvx2, qconvAvx2, qpoolAvx2 },
+    // VNNI comes in a 256 bit AVX form and an AVX-512 one; see best().
+    { quantAvx2, qconvAvxVnni, qpoolAvx2 },
+};
+
+QuantNet::Kernel QuantNet::best() {
+#if defined(__x86_64__)
+    if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma"))
+        return SCALAR;
+    if (haveAvxVnni())
+        return VNNI;
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl")) {
+        kernels[VNNI].conv = qconvAvx512Vnni;
+        return VNNI;
+    }
+    return AVX2;
+#else
+    return SCALAR;
+#endif
+}
+
+const char* QuantNet::kernelName(Kernel k) {
+    static const char* names[] = { "scalar", "avx2", "vnni" };
+    return names[k];
+}
+
+void QuantNet::Map::resize(int planes, int w, int h) {
+    int g = (planes + 3) / 4, p = (w + 2) * 4;
+    if (g == groups && w == width && h == height)
+        return;
+    groups = g;
+    width = w;
+    height = h;
+    pitch = p;
+    data.assign((size_t)groups * height * pitch, 0); // the edge pixels stay zero
+}
+
+QuantNet::QuantNet(const ConvNet& net) : _float(net), _calibrated(false), _kernel(best()) {
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        const ConvLayer& f = net.layer(i);
+        Layer& l = _layers[i];
+        l.nIn = f.nIn;
+        l.nOut = f.nOut;
+        l.groups = (f.nIn + 3) / 4;
+        int outs = (f.nOut + 3) & ~3;
+        l.weight.assign(outs * 9 * l.groups, 0);
+        l.scale.assign(outs, 0);
+        l.offset.assign(outs, 0);
+        _weightScale[i].assign(f.nOut, 1);
+        for (int o = 0; o < f.nOut; o++) {
+            const float* w = &f.weight[o * f.nIn * 9];
+            float big = 0;
+            for (int k = 0; k < f.nIn * 9; k++)
+                big = std::max(big, fabsf(w[k]));
+            float s = big > 0 ? big / 127 : 1;
+            _weightScale[i][o] = s;
+            for (int p = 0; p < f.nIn; p++) {
+                for (int t = 0; t < 9; t++) {
+                    int q = std::max(-127, std::min(127, (int)lrintf(w[p * 9 + t] / s)));
+                    uint32_t& packed = (uint32_t&)l.weight[(o * 9 + t) * l.groups + p / 4];
+                    packed |= (uint32_t)(uint8_t)q << (8 * (p % 4));
+                }
+            }
+        }
+        _range[i] = i == 0 ? 1 : 4;
+    }
+    _scales();
+}
+
+// What an accumulator is in each layer's output units: the next layer's
+// activation steps, or floats for the last.
+void QuantNet::_scales() {
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        Layer& l = _layers[i];
+        float in = _range[i] / QMAX;
+        float out = i < ConvNet::LAYERS - 1 ? _range[i + 1] / QMAX : 1;
+        for (int o = 0; o < l.nOut; o++) {
+            l.scale[o] = in * _weightScale[i][o] / out;
+            l.offset[o] = _float.layer(i).bias[o] / out;
+        }
+    }
+}
+
+// The float network a layer at a time, keeping the largest input to each.
+void QuantNet::calibrate(const float* const* planes, int stride, int width, int height) {
+    if (width <= ConvNet::SHRINK || height <= ConvNet::SHRINK)
+        return;
+    float range[ConvNet::LAYERS] = {};
+    const ConvLayer& first = _float.layer(0);
+    for (int p = 0; p < first.nIn; p++)
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                range[0] = std::max(range[0], planes[p][y * stride + x]);
+
+    const float* in[ConvNet::MAX_PLANES];
+    for (int p = 0; p < first.nIn; p++)
+        in[p] = planes[p];
+    int inStride = stride, w = width, h = height;
+    for (int i = 0; i < ConvNet::LAYERS - 1; i++) {
+        const ConvLayer& l = _float.layer(i);
+        w -= 2;
+        h -= 2;
+        std::vector<float>& conv = _scratch[0];
+        std::vector<float>& pooled = _scratch[1];
+        conv.assign((size_t)l.nOut * w * h, 0);
+        for (int o = 0; o < l.nOut; o++) {
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    float sum = l.bias[o];
+                    for (int p = 0; p < l.nIn; p++)
+                        for (int t = 0; t < 9; t++)
+                            sum += l.weight[(o * l.nIn + p) * 9 + t] * in[p][(y + t / 3) * inStride + x + t % 3];
+                    conv[(o * h + y) * w + x] = std::max(0.0f, sum);
+                    range[i + 1] = std::max(range[i + 1], sum);
+                }
+            }
+        }
+        // Pooling doesn't change the largest value, but the next layer
+        // needs it.
+        std::vector<float> next((size_t)l.nOut * w * h);
+        for (int o = 0; o < l.nOut; o++) {
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    float m = 0;
+                    for (int dy = std::max(0, y - 1); dy <= std::min(h - 1, y + 1); dy++)
+                        for (int dx = std::max(0, x - 1); dx <= std::min(w - 1, x + 1); dx++)
+                            m = std::max(m, conv[(o * h + dy) * w + dx]);
+                    next[(o * h + y) * w + x] = m;
+                }
+            }
+        }
+        pooled.swap(next);
+        for (int o = 0; o < l.nOut; o++)
+            in[o] = &pooled[o * w * h];
+        inStride = w;
+    }
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        if (!_calibrated || range[i] > _range[i])
+            _range[i] = range[i] > 0 ? range[i] : 1;
+    }
+    _calibrated = true;
+    _scales();
+}
+
+void QuantNet::forward(const float* const* planes, int stride, int width, int height, float* out, int outStride) {
+    if (width <= ConvNet::SHRINK || height <= ConvNet::SHRINK)
+        return;
+    const QKernels& k = kernels[_kernel];
+    const Layer& first = _layers[0];
+    _in.resize(first.nIn, width, height);
+    _zeros.assign(width, 0);
+    float mul = QMAX / _range[0];
+    for (int g = 0; g < _in.groups; g++) {
+        for (int y = 0; y < height; y++) {
+            const float* p[4];
+            for (int c = 0; c < 4; c++)
+                p[c] = g * 4 + c < first.nIn ? planes[g * 4 + c] + y * stride : &_zeros[0];
+            k.quant(p, width, mul, _in.row(g, y));
+        }
+    }
+
+    Map* cur = &_in;
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        const Layer& l = _layers[i];
+        int w = cur->width - 2, h = cur->height - 2;
+        bool last = i == ConvNet::LAYERS - 1;
+        if (!last)
+            _hidden[i].resize(l.nOut, w, h);
+        for (int y = 0; y < h; y++) {
+            const uint8_t* in[3 * ConvNet::MAX_PLANES / 4];
+            for (int ky = 0; ky < 3; ky++)
+                for (int g = 0; g < l.groups; g++)
+                    in[ky * l.groups + g] = cur->row(g, y + ky);
+            if (last) {
+                k.conv(l, in, w, NULL, out + y * outStride);
+                continue;
+            }
+            uint8_t* o[ConvNet::MAX_PLANES / 4];
+            for (int g = 0; g < _hidden[i].groups; g++)
+                o[g] = _hidden[i].row(g, y);
+            k.conv(l, in, w, o, NULL);
+        }
+        if (last)
+            break;
+        // Torch pads the pooling with -inf, so the edge rows take the max
+        // of two.
+        Map& src = _hidden[i];
+        Map& dst = _pooled[i];
+        dst.resize(l.nOut, w, h);
+        for (int g = 0; g < src.groups; g++)
+            for (int y = 0; y < h; y++)
+                k.pool(src.row(g, y > 0 ? y - 1 : y), src.row(g, y), src.row(g, y + 1 < h ? y + 1 : y), w,
+                       dst.row(g, y));
+        cur = &dst;
+    }
+}
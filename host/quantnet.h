@@ -0,0 +1,80 @@
+/*
+  quantnet.h - 8 bit integer inference for the ConvNet topology.
+
+  Weights are quantised per output plane to signed 8 bits, and activations
+  (the input frames and each pooled hidden layer) to 0..127, with ranges
+  calibrated by running the float network over sample frames.  Each 3x3
+  convolution then sums 8 bit products into 32 bits: four input planes
+  at a time with VPDPBUSD where the CPU has AVX-VNNI, or VPMADDUBSW and
+  VPMADDWD with plain AVX2.  Keeping activations to 7 bits is what stops
+  VPMADDUBSW's 16 bit pair sums saturating, so both give the same answer.
+  ReLU and pooling happen on the 8 bit values, which doesn't change them:
+  both commute with rounding.
+
+  Activations are stored with four planes interleaved per pixel, so one
+  32 byte load is eight pixels' worth of four planes.  Layers are run a
+  whole frame at a time.
+*/
+#ifndef QuantNet_h
+#define QuantNet_h
+
+#include <stdint.h>
+#include <vector>
+
+#include "convnet.h"
+
+class QuantNet {
+public:
+    enum Kernel { SCALAR, AVX2, VNNI };
+
+    // Quantises net's weights as they are now.
+    QuantNet(const ConvNet& net);
+
+    // Widens the activation ranges to cover this frame pair, as the float
+    // network sees it.  Until the first call inputs are taken to be 0..1
+    // and hidden layers 0..4.
+    void calibrate(const float* const* planes, int stride, int width, int height);
+    // Largest value seen going into layer i.
+    float range(int i) const { return _range[i]; }
+
+    static Kernel best();
+    static const char* kernelName(Kernel k);
+    void setKernel(Kernel k) { _kernel = k; }
+    Kernel kernel() const { return _kernel; }
+
+    // As ConvNet::forward().  Not reentrant: one QuantNet per thread.
+    void forward(const float* const* planes, int stride, int width, int height, float* out, int outStride);
+
+    // An activation map: groups of four planes interleaved, with a zero
+    // pixel either side of each row.
+    struct Map {
+        int groups, width, height, pitch;
+        std::vector<uint8_t> data;
+        Map() : groups(0), width(0), height(0), pitch(0) {}
+        void resize(int planes, int width, int height);
+        uint8_t* row(int g, int y) { return &data[(g * height + y) * pitch + 4]; }
+    };
+
+    struct Layer {
+        int nIn, nOut, groups;       // groups of four input planes
+        std::vector<int32_t> weight; // four s8 per [nOut rounded to 4][9][groups]
+        std::vector<float> scale;    // per output: to the next layer's units,
+        std::vector<float> offset;   // or to floats for the last
+    };
+
+private:
+    void _scales();
+
+    ConvNet _float;
+    std::vector<float> _weightScale[ConvNet::LAYERS];
+    float _range[ConvNet::LAYERS];
+    bool _calibrated;
+    Layer _layers[ConvNet::LAYERS];
+    Kernel _kernel;
+
+    Map _in, _hidden[ConvNet::LAYERS - 1], _pooled[ConvNet::LAYERS - 1];
+    std::vector<float> _zeros;      // stands in for missing input planes
+    std::vector<float> _scratch[2]; // float network, for calibrate()
+};
+
+#endif
@@ -0,0 +1,70 @@
+/*
+  replay - flies the controller again from a flight log.
+
+    replay [-g gains.txt] [-s seconds] [-e seconds] [-v] session.log
+
+  Feeds FleetController the gains, arm, target and state records in the
+  log and compares the sticks it gives with those logged (see
+  logreplay.h).  -g loads a gain table first, for what the log does not
+  set, or to see what different gains would have done; -s and -e bound
+  the time, in seconds from the first record.  -v prints every sticks
+  record that differs.  Exits 0 if every one matched.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "logreplay.h"
+
+static int usage(const char* name) {
+    fprintf(stderr, "usage: %s [-g gains.txt] [-s seconds] [-e seconds] [-v] session.log\n", name);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    const char* gains = NULL;
+    double start = 0, end = -1;
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "g:s:e:v")) != -1) {
+        switch (opt) {
+        case 'g':
+            gains = optarg;
+            break;
+        case 's':
+            start = atof(optarg);
+            break;
+        case 'e':
+            end = atof(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        return usage(argv[0]);
+
+    FlightLog log;
+    if (!log.open(argv[optind]))
+        return 1;
+    FleetController control;
+    if (gains && !control.loadGains(gains))
+        return 1;
+    uint64_t origin = log.first();
+    uint64_t to = end < 0 ? UINT64_MAX : origin + (uint64_t)(end * 1e6);
+    ReplayResult result = replayLog(log, control, origin + (uint64_t)(start * 1e6), to,
+                                    [&](const LogRecord& r, const uint16_t sticks[4]) {
+        const LogSticks* s = r.as<LogSticks>();
+        if (!verbose || (s->stick[0] == sticks[0] && s->stick[1] == sticks[1] &&
+                         s->stick[2] == sticks[2] && s->stick[3] == sticks[3]))
+            return;
+        printf("%12.6f craft %d logged %d %d %d %d replayed %d %d %d %d\n", (double)(r.time_us - origin) * 1e-6,
+               s->craft, s->stick[0], s->stick[1], s->stick[2], s->stick[3],
+               sticks[0], sticks[1], sticks[2], sticks[3]);
+    });
+    printf("%d sticks records, %d differ, worst by %d\n", result.sticks, result.differ, result.worst);
+    return result.differ ? 2 : 0;
+}
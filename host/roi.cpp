@@ -0,0 +1,242 @@
+#include "roi.h"
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Output (x, y) is centred on input (x + OFFSET, y + OFFSET).
+#define OFFSET (ConvNet::SHRINK / 2)
+// Outputs this far in from a tile's edge match a full frame pass: each of
+// the two poolings reaches one output further out.
+#define HALO (ConvNet::LAYERS - 1)
+
+static bool near(const std::vector<Detection>& v, size_t first, const Detection& d, float r2) {
+    for (size_t k = first; k < v.size(); k++) {
+        float dx = d.x - v[k].x, dy = d.y - v[k].y;
+        if (dx * dx + dy * dy < r2)
+            return true;
+    }
+    return false;
+}
+
+// A candidate is a pixel under threshold that is no higher than any of
+// its neighbours, so slopes are skipped but every pixel of a flat bottom
+// is kept: two craft touching can share one, and the spread of candidates
+// is what lets the suppression below split it.  a, c and b are the rows
+// above, at and below; missing rows and columns count as infinitely high.
+static void minimaScalar(const float* a, const float* c, const float* b, int x0, int x1, int width,
+                         float threshold, int y, std::vector<Detection>& candidates) {
+    const float inf = std::numeric_limits<float>::infinity();
+    for (int x = x0; x < x1; x++) {
+        float v = c[x];
+        if (!(v < threshold))
+            continue;
+        float al = x > 0 ? a[x - 1] : inf, cl = x > 0 ? c[x - 1] : inf, bl = x > 0 ? b[x - 1] : inf;
+        float ar = x < width - 1 ? a[x + 1] : inf, cr = x < width - 1 ? c[x + 1] : inf;
+        float br = x < width - 1 ? b[x + 1] : inf;
+        if (v <= al && v <= a[x] && v <= ar && v <= cl && v <= cr && v <= bl && v <= b[x] && v <= br) {
+            Detection d = { (float)x, (float)y, v };
+            candidates.push_back(d);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+// Interior columns eight at a time; the edges go through minimaScalar.
+__attribute__((target("avx2")))
+static void minimaAvx2(const float* a, const float* c, const float* b, int width, float threshold, int y,
+                       std::vector<Detection>& candidates) {
+    if (width < 10) {
+        minimaScalar(a, c, b, 0, width, width, threshold, y, candidates);
+        return;
+    }
+    minimaScalar(a, c, b, 0, 1, width, threshold, y, candidates);
+    __m256 t = _mm256_set1_ps(threshold);
+    for (int x = 1, done = 1; done < width - 1; x += 8) {
+        if (x + 8 > width - 1)
+            x = width - 9;
+        __m256 v = _mm256_loadu_ps(c + x);
+        __m256 m = _mm256_cmp_ps(v, t, _CMP_LT_OQ);
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(a + x - 1), _CMP_LE_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(a + x), _CMP_LE_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(a + x + 1), _CMP_LE_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(c + x - 1), _CMP_LE_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(c + x + 1), _CMP_LE_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(b + x - 1), _CMP_LE_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(b + x), _CMP_LE_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(b + x + 1), _CMP_LE_OQ));
+        // The last block overlaps the one before; skip what it already did.
+        unsigned bits = _mm256_movemask_ps(m) & (0xffu << (done - x));
+        done = x + 8;
+        while (bits) {
+            int i = x + __builtin_ctz(bits);
+            Detection d = { (float)i, (float)y, c[i] };
+            candidates.push_back(d);
+            bits &= bits - 1;
+        }
+    }
+    minimaScalar(a, c, b, width - 1, width, width, threshold, y, candidates);
+}
+
+static bool haveAvx2() {
+    static bool have = __builtin_cpu_supports("avx2");
+    return have;
+}
+#endif
+
+void findCraft(const float* map, int stride, int width, int height, float threshold, int radius,
+               std::vector<Detection>& found) {
+    std::vector<Detection> candidates;
+    std::vector<float> edge(width, std::numeric_limits<float>::infinity());
+    for (int y = 0; y < height; y++) {
+        const float* a = y > 0 ? map + (y - 1) * stride : &edge[0];
+        const float* c = map + y * stride;
+        const float* b = y < height - 1 ? map + (y + 1) * stride : &edge[0];
+#if defined(__x86_64__)
+        if (haveAvx2()) {
+            minimaAvx2(a, c, b, width, threshold, y, candidates);
+            continue;
+        }
+#endif
+        minimaScalar(a, c, b, 0, width, width, threshold, y, candidates);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Detection& a, const Detection& b) { return a.score < b.score; });
+    // A flat bottomed minimum has no single lowest pixel, and its corners
+    // can be further apart than radius.  So each peak is moved to the
+    // centroid of what's under threshold around it (recentring the window a
+    // few times), and any that land on one already found are dropped.
+    size_t first = found.size();
+    float r2 = radius * radius;
+    std::vector<Detection> peaks;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const Detection& c = candidates[i];
+        if (near(peaks, 0, c, r2))
+            continue;
+        peaks.push_back(c);
+        float cx = c.x, cy = c.y;
+        for (int pass = 0; pass < 3; pass++) {
+            int x0 = std::max(0, (int)cx - radius), x1 = std::min(width - 1, (int)cx + radius);
+            int y0 = std::max(0, (int)cy - radius), y1 = std::min(height - 1, (int)cy + radius);
+            double sum = 0, sx = 0, sy = 0;
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    float w = threshold - map[y * stride + x];
+                    if (w > 0) {
+                        sum += w;
+                        sx += w * x;
+                        sy += w * y;
+                    }
+                }
+            }
+            cx = sx / sum;
+            cy = sy / sum;
+        }
+        Detection d = { cx, cy, c.score };
+        if (!near(found, first, d, r2))
+            found.push_back(d);
+    }
+}
+
+RoiDetector::RoiDetector(ConvNet& net)
+    : margin(24), sweepEvery(30), threshold(0), radius(8), swept(false), computed(0),
+      _net(net), _sweep(true), _frame(0) {
+}
+
+static bool overlap(const Rect& a, const Rect& b) {
+    return a.x0 <= b.x1 + 2 * HALO && b.x0 <= a.x1 + 2 * HALO
+        && a.y0 <= b.y1 + 2 * HALO && b.y0 <= a.y1 + 2 * HALO;
+}
+
+void tilesAround(const std::vector<Detection>& points, int margin, int width, int height,
+                 std::vector<Rect>& tiles) {
+    size_t first = tiles.size();
+    for (size_t i = 0; i < points.size(); i++) {
+        int cx = lroundf(points[i].x) - OFFSET, cy = lroundf(points[i].y) - OFFSET;
+        Rect r = { std::max(0, cx - margin), std::max(0, cy - margin),
+                   std::min(width - 1, cx + margin), std::min(height - 1, cy + margin) };
+        if (r.x0 <= r.x1 && r.y0 <= r.y1)
+            tiles.push_back(r);
+    }
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = first; i < tiles.size(); i++) {
+            for (size_t j = i + 1; j < tiles.size(); j++) {
+                if (!overlap(tiles[i], tiles[j]))
+                    continue;
+                tiles[i].x0 = std::min(tiles[i].x0, tiles[j].x0);
+                tiles[i].y0 = std::min(tiles[i].y0, tiles[j].y0);
+                tiles[i].x1 = std::max(tiles[i].x1, tiles[j].x1);
+                tiles[i].y1 = std::max(tiles[i].y1, tiles[j].y1);
+                tiles.erase(tiles.begin() + j--);
+                merged = true;
+            }
+        }
+    }
+}
+
+uint64_t detectInTiles(ConvNet& net, const float* const* planes, int stride, int width, int height,
+                       const std::vector<Rect>& tiles, float threshold, int radius, std::vector<Detection>& found,
+                       std::vector<float>& scratch) {
+    int outWidth = width - ConvNet::SHRINK, outHeight = height - ConvNet::SHRINK;
+    uint64_t computed = 0;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const Rect& t = tiles[i];
+        Rect g = { std::max(0, t.x0 - HALO), std::max(0, t.y0 - HALO),
+                   std::min(outWidth - 1, t.x1 + HALO), std::min(outHeight - 1, t.y1 + HALO) };
+        int w = g.x1 - g.x0 + 1, h = g.y1 - g.y0 + 1;
+        scratch.resize(w * h);
+        const float* p[ConvNet::MAX_PLANES];
+        for (int k = 0; k < net.inputs(); k++)
+            p[k] = planes[k] + g.y0 * stride + g.x0;
+        net.forward(p, stride, w + ConvNet::SHRINK, h + ConvNet::SHRINK, &scratch[0], w);
+        computed += w * h;
+        size_t first = found.size();
+        findCraft(&scratch[(t.y0 - g.y0) * w + t.x0 - g.x0], w, t.x1 - t.x0 + 1, t.y1 - t.y0 + 1,
+                  threshold, radius, found);
+        for (size_t k = first; k < found.size(); k++) {
+            found[k].x += t.x0 + OFFSET;
+            found[k].y += t.y0 + OFFSET;
+        }
+    }
+    return computed;
+}
+
+void RoiDetector::detect(const float* const* planes, int stride, int width, int height,
+                         const std::vector<Detection>& predicted, std::vector<Detection>& found) {
+    found.clear();
+    tiles.clear();
+    computed = 0;
+    int outWidth = width - ConvNet::SHRINK, outHeight = height - ConvNet::SHRINK;
+    if (outWidth <= 0 || outHeight <= 0)
+        return;
+    swept = _sweep || predicted.empty() || sweepEvery <= 1 || _frame % sweepEvery == 0;
+    _sweep = false;
+    _frame++;
+    if (swept) {
+        Rect all = { 0, 0, outWidth - 1, outHeight - 1 };
+        tiles.push_back(all);
+    } else {
+        tilesAround(predicted, margin, outWidth, outHeight, tiles);
+    }
+
+    computed = detectInTiles(_net, planes, stride, width, height, tiles, threshold, radius, found, _out);
+    std::stable_sort(found.begin(), found.end(),
+                     [](const Detection& a, const Detection& b) { return a.score < b.score; });
+
+    if (swept)
+        return;
+    // Nothing where a craft was expected: it has gone or was never there,
+    // so look everywhere next time.
+    for (size_t i = 0; i < predicted.size() && !_sweep; i++) {
+        bool near = false;
+        for (size_t k = 0; k < found.size() && !near; k++)
+            near = fabsf(found[k].x - predicted[i].x) <= margin && fabsf(found[k].y - predicted[i].y) <= margin;
+        _sweep = !near;
+    }
+}
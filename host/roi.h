@@ -0,0 +1,79 @@
+/*
+  roi.h - Runs the convnet only where craft are expected.
+
+  The network is trained towards 0.5 less a unit gaussian at each craft,
+  so craft show up as minima below zero.  Given where the tracker expects
+  craft this frame, only a tile around each prediction is evaluated, so
+  the work goes with the number of craft rather than the frame size.  The
+  whole frame is still swept every sweepEvery frames, or straight after a
+  prediction comes up empty, to catch craft arriving or lost.
+
+  Tiles carry enough halo for the pooling that their outputs match a full
+  frame pass exactly.
+*/
+#ifndef Roi_h
+#define Roi_h
+
+#include <stdint.h>
+#include <vector>
+
+#include "convnet.h"
+
+struct Detection {
+    float x, y;  // input pixels
+    float score; // network output at the peak; lower is surer
+};
+
+struct Rect {
+    int x0, y0, x1, y1; // inclusive
+};
+
+// Minima below threshold at least radius apart in a map of width x
+// height, rows stride apart, strongest first.  Candidates are local minima
+// (found eight pixels at a time with AVX2 where there is one), and their
+// positions are refined to the centroid of the nearby pixels under
+// threshold.
+void findCraft(const float* map, int stride, int width, int height, float threshold, int radius,
+               std::vector<Detection>& found);
+
+// Appends a tile of an output map width x height within margin of each
+// point (in input pixels), merged where they or their halos overlap.
+void tilesAround(const std::vector<Detection>& points, int margin, int width, int height,
+                 std::vector<Rect>& tiles);
+
+// Runs net over each tile of the output of a width x height input, with
+// halo enough to match a full frame pass, and appends the craft found in
+// input pixels.  scratch holds a tile's output.  Returns the outputs
+// computed.
+uint64_t detectInTiles(ConvNet& net, const float* const* planes, int stride, int width, int height,
+                       const std::vector<Rect>& tiles, float threshold, int radius, std::vector<Detection>& found,
+                       std::vector<float>& scratch);
+
+class RoiDetector {
+public:
+    RoiDetector(ConvNet& net);
+
+    // predicted are where craft should be this frame, in input pixels.
+    void detect(const float* const* planes, int stride, int width, int height,
+                const std::vector<Detection>& predicted, std::vector<Detection>& found);
+    // Make the next detect() sweep the whole frame.
+    void sweep() { _sweep = true; }
+
+    int margin;      // output pixels searched either side of a prediction
+    int sweepEvery;  // frames between full sweeps
+    float threshold;
+    int radius;      // minimum distance between craft, output pixels
+
+    // About the last detect()
+    bool swept;
+    uint64_t computed;        // outputs evaluated
+    std::vector<Rect> tiles;  // in output pixels
+
+private:
+    ConvNet& _net;
+    bool _sweep;
+    uint64_t _frame;
+    std::vector<float> _out;
+};
+
+#endif
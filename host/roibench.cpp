@@ -0,0 +1,197 @@
+/*
+  roibench - compares full frame and tracked region inference on a
+  synthetic scene of bright squares flying about over noise.
+
+    roibench [-n frames] [-s WxH] [-m margin] [-e sweep_every] [craft ...]
+
+  The network's weights are made by hand to find the squares, so no trained
+  model is needed.  For each number of craft (default 1 4 16) it prints the
+  time and outputs evaluated per frame both ways, how far detections were
+  from the truth, and how many craft were missed or seen that weren't there.
+  Predictions come from the tracker, whose time per frame and number of
+  times a craft changed track are shown too.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "clock.h"
+#include "convnet.h"
+#include "roi.h"
+#include "tracker.h"
+
+#define SIZE 8 // of a craft, pixels
+#define FRAME_US 33333
+
+struct Craft {
+    float x, y, vx, vy;
+};
+
+static int width = 640, height = 360;
+
+// Passes the red channel of the current frame through both poolings and
+// turns it upside down, so a bright square becomes a flat minimum of -0.5.
+static void blobWeights(ConvNet& net) {
+    for (int i = 0; i < ConvNet::LAYERS; i++) {
+        ConvLayer& l = net.layer(i);
+        l.weight.assign(l.weight.size(), 0);
+        l.bias.assign(l.bias.size(), 0);
+        l.weight[4] = i < ConvNet::LAYERS - 1 ? 1 : -1; // centre tap, plane 0 to plane 0
+    }
+    net.layer(ConvNet::LAYERS - 1).bias[0] = 0.5;
+}
+
+static void render(float* frame, int planes, const std::vector<Craft>& craft) {
+    for (int i = 0; i < planes * width * height; i++)
+        frame[i] = rand() % 300 / 1000.0f;
+    for (size_t k = 0; k < craft.size(); k++) {
+        int x0 = lroundf(craft[k].x) - SIZE / 2, y0 = lroundf(craft[k].y) - SIZE / 2;
+        for (int c = 0; c < planes; c++)
+            for (int y = y0; y < y0 + SIZE; y++)
+                for (int x = x0; x < x0 + SIZE; x++)
+                    frame[(c * height + y) * width + x] = 1;
+    }
+}
+
+static void move(std::vector<Craft>& craft) {
+    for (size_t k = 0; k < craft.size(); k++) {
+        Craft& c = craft[k];
+        c.x += c.vx;
+        c.y += c.vy;
+        if (c.x < SIZE || c.x > width - SIZE)
+            c.vx = -c.vx;
+        if (c.y < SIZE || c.y > height - SIZE)
+            c.vy = -c.vy;
+    }
+}
+
+struct Result {
+    double ms, outputs, error, trackMs;
+    int missed, spurious, switches;
+};
+
+static Result run(ConvNet& net, int count, int frames, bool roi, int margin, int sweepEvery) {
+    srand(count);
+    std::vector<Craft> craft(count);
+    for (int k = 0; k < count; k++) {
+        Craft c = { (float)(SIZE + rand() % (width - 2 * SIZE)), (float)(SIZE + rand() % (height - 2 * SIZE)),
+                    (rand() % 9 - 4) * 0.5f, (rand() % 9 - 4) * 0.5f };
+        craft[k] = c;
+    }
+    int planes = net.inputs() / 2;
+    size_t size = planes * width * height;
+    std::vector<float> buf(2 * size);
+    RoiDetector detector(net);
+    detector.margin = margin;
+    detector.sweepEvery = roi ? sweepEvery : 1;
+    Tracker tracker;
+    for (int k = 0; k < count; k++)
+        tracker.addCraft(k);
+    std::vector<Detection> found;
+    std::vector<int> on(count);
+    Result r = { 0, 0, 0, 0, 0, 0, 0 };
+    uint64_t busy = 0, tracking = 0;
+    for (int f = 0; f < frames; f++) {
+        move(craft);
+        float* cur = &buf[(f & 1) * size];
+        const float* prev = &buf[((f + 1) & 1) * size];
+        render(cur, planes, craft);
+        const float* p[ConvNet::MAX_PLANES];
+        for (int c = 0; c < planes; c++) {
+            p[c] = cur + c * width * height;
+            p[planes + c] = prev + c * width * height;
+        }
+        std::vector<Detection> predicted;
+        tracker.predict(f * FRAME_US, predicted);
+        uint64_t start = monotonicMicros();
+        detector.detect(p, width, width, height, predicted, found);
+        uint64_t detected = monotonicMicros();
+        tracker.update(found);
+        busy += detected - start;
+        tracking += monotonicMicros() - detected;
+        r.outputs += detector.computed;
+        // Which track is on each craft; a change is an ID switch.
+        for (int k = 0; k < count; k++) {
+            const std::vector<Track>& tracks = tracker.tracks();
+            for (size_t i = 0; i < tracks.size(); i++) {
+                if (tracks[i].confirmed && hypotf(tracks[i].x - craft[k].x, tracks[i].y - craft[k].y) <= SIZE / 2) {
+                    r.switches += on[k] && on[k] != tracks[i].id;
+                    on[k] = tracks[i].id;
+                    break;
+                }
+            }
+        }
+        for (int k = 0; k < count; k++) {
+            float best = 1e9;
+            for (size_t i = 0; i < found.size(); i++)
+                best = fminf(best, hypotf(found[i].x - craft[k].x, found[i].y - craft[k].y));
+            if (best > SIZE)
+                r.missed++;
+            else
+                r.error += best;
+        }
+        for (size_t i = 0; i < found.size(); i++) {
+            float best = 1e9;
+            for (int k = 0; k < count; k++)
+                best = fminf(best, hypotf(found[i].x - craft[k].x, found[i].y - craft[k].y));
+            r.spurious += best > SIZE;
+        }
+    }
+    r.ms = busy * 1e-3 / frames;
+    r.trackMs = tracking * 1e-3 / frames;
+    r.outputs /= frames;
+    r.error /= frames * count - r.missed;
+    return r;
+}
+
+int main(int argc, char** argv) {
+    int frames = 300, margin = 16, sweepEvery = 30;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:m:e:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+                frames = 0;
+            break;
+        case 'm':
+            margin = atoi(optarg);
+            break;
+        case 'e':
+            sweepEvery = atoi(optarg);
+            break;
+        default:
+            frames = 0;
+        }
+    }
+    if (frames <= 0 || width < 8 * SIZE || height < 8 * SIZE) {
+        fprintf(stderr, "usage: %s [-n frames] [-s WxH] [-m margin] [-e sweep_every] [craft ...]\n", argv[0]);
+        return 1;
+    }
+    std::vector<int> counts;
+    for (int i = optind; i < argc; i++)
+        counts.push_back(atoi(argv[i]));
+    if (counts.empty()) {
+        counts.push_back(1);
+        counts.push_back(4);
+        counts.push_back(16);
+    }
+
+    ConvNet net;
+    blobWeights(net);
+    printf("%dx%d, %s, margin %d, full sweep every %d frames\n", width, height,
+           ConvNet::kernelName(net.kernel()), margin, sweepEvery);
+    printf("craft          ms/frame  outputs/frame  error px  missed  spurious  track ms  switches\n");
+    for (size_t i = 0; i < counts.size(); i++) {
+        for (int roi = 0; roi < 2; roi++) {
+            Result r = run(net, counts[i], frames, roi, margin, sweepEvery);
+            printf("%5d %-6s %10.2f %14.0f %9.2f %7d %9d %9.3f %9d\n", counts[i], roi ? "roi" : "full", r.ms,
+                   r.outputs, r.error, r.missed, r.spurious, r.trackMs, r.switches);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,395 @@
+#include "router.h"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock.h"
+
+#define REOPEN_INTERVAL 2000000 // us between attempts to reopen a vanished port
+// A slot reported free this soon after CMD_BIND was answering an earlier
+// CMD_STATUS, not giving up on the bind.
+#define BIND_MIN 1000000
+
+Router::Router() : pingInterval(1000), failTimeout(3000) {
+    srand(monotonicMicros());
+}
+
+Router::~Router() {
+    for (size_t i = 0; i < _nodes.size(); i++)
+        delete _nodes[i];
+}
+
+bool Router::addNode(const char* path) {
+    int index = _nodes.size();
+    Node* n = new Node;
+    n->path = path;
+    n->healthy = false;
+    n->lastHeard = 0;
+    n->nextPing = 0;
+    n->nextReopen = 0;
+    n->link.onTelemetry = [this, index](const Telemetry& t) { _telemetry(index, t); };
+    n->link.onText = [this, index](const std::string& s) {
+        if (onText)
+            onText(index, s);
+    };
+    _nodes.push_back(n);
+    if (!n->link.open(path)) {
+        n->nextReopen = monotonicMicros() + REOPEN_INTERVAL;
+        return false;
+    }
+    n->link.send(CMD_STATUS, NULL, 0);
+    return true;
+}
+
+const CraftBinding* Router::craft(int id) const {
+    std::map<int, CraftBinding>::const_iterator it = _craft.find(id);
+    return it == _craft.end() ? NULL : &it->second;
+}
+
+int Router::craftAt(int node, int slot) const {
+    const Node& n = *_nodes[node];
+    if (slot < 0 || slot >= (int)n.craft.size())
+        return -1;
+    return n.craft[slot];
+}
+
+// Slots in use or waiting to be released.
+int Router::_used(int node) const {
+    const Node& n = *_nodes[node];
+    int used = 0;
+    for (size_t s = 0; s < n.craft.size(); s++)
+        used += n.craft[s] >= 0 || n.stale[s];
+    return used;
+}
+
+bool Router::_hasRoom(int node) const {
+    const Node& n = *_nodes[node];
+    return !n.craft.empty() && _used(node) < (int)n.craft.size();
+}
+
+// Least loaded healthy node with a free slot, other than exclude.
+int Router::_place(int exclude) {
+    int best = -1;
+    double bestLoad = 0;
+    for (int i = 0; i < (int)_nodes.size(); i++) {
+        const Node& n = *_nodes[i];
+        if (i == exclude || !n.healthy || !_hasRoom(i))
+            continue;
+        double load = (double)_used(i) / n.craft.size();
+        if (best < 0 || load < bestLoad) {
+            best = i;
+            bestLoad = load;
+        }
+    }
+    return best;
+}
+
+// The four hopping channels are (txid[0] & 0xF) + 3, (txid[0] >> 4) + 0x16,
+// (txid[1] & 0xF) + 0x2D and (txid[1] >> 4) + 0x40 with txid[1] < 0x30.
+// The ranges don't overlap, so each nibble can be chosen independently to
+// dodge whatever the other nodes are using.
+void Router::_pickTxid(int node, uint8_t* txid) {
+    static const int choices[4] = { 16, 16, 16, 3 };
+    int used[4][16];
+    memset(used, 0, sizeof(used));
+    for (std::map<int, CraftBinding>::const_iterator it = _craft.begin(); it != _craft.end(); ++it) {
+        const CraftBinding& b = it->second;
+        if (b.node < 0 || b.node == node)
+            continue;
+        used[0][b.txid[0] & 0xF]++;
+        used[1][b.txid[0] >> 4]++;
+        used[2][b.txid[1] & 0xF]++;
+        used[3][(b.txid[1] % 0x30) >> 4]++;
+    }
+    int nibble[4];
+    for (int k = 0; k < 4; k++) {
+        int start = rand() % choices[k];
+        nibble[k] = start;
+        for (int i = 0; i < choices[k]; i++) {
+            int v = (start + i) % choices[k];
+            if (used[k][v] < used[k][nibble[k]])
+                nibble[k] = v;
+        }
+    }
+    txid[0] = nibble[0] | (nibble[1] << 4);
+    txid[1] = nibble[2] | (nibble[3] << 4);
+    txid[2] = rand();
+    txid[3] = rand();
+}
+
+bool Router::bind(int id, int timeout_s) {
+    std::map<int, CraftBinding>::iterator it = _craft.find(id);
+    if (it != _craft.end() && it->second.node >= 0)
+        return false;
+    _queued[id] = timeout_s;
+    _bindQueued();
+    return true;
+}
+
+// The node with a bind in progress, or -1.
+int Router::_bindingNode() const {
+    for (std::map<int, CraftBinding>::const_iterator it = _craft.begin(); it != _craft.end(); ++it)
+        if (it->second.node >= 0 && !it->second.bound)
+            return it->second.node;
+    return -1;
+}
+
+// Starts as many queued binds as there are free slots for.  Binding craft
+// all answer on the same channel, so only one node binds at a time: the
+// sketch binds every slot it was asked for in one pass, and takes aids it
+// has heard once each, but two nodes would both hear each reply.  Further
+// binds go to the node already binding while it has room, and otherwise
+// wait for it to finish.
+void Router::_bindQueued() {
+    while (!_queued.empty()) {
+        int node = _bindingNode();
+        if (node < 0)
+            node = _place(-1);
+        else if (!_nodes[node]->healthy || !_hasRoom(node))
+            return;
+        if (node < 0)
+            return;
+        int id = _queued.begin()->first;
+        int timeout_s = _queued.begin()->second;
+        _queued.erase(_queued.begin());
+        Node& n = *_nodes[node];
+        int slot = 0;
+        while (n.craft[slot] >= 0 || n.stale[slot])
+            slot++;
+        CraftBinding& b = _craft[id];
+        b.node = node;
+        b.slot = slot;
+        b.bound = false;
+        _pickTxid(node, b.txid);
+        memset(b.aid, 0xFF, 4);
+        b.bindSent = monotonicMicros();
+        b.timeout_s = timeout_s;
+        n.craft[slot] = id;
+        uint8_t p[CMD_BIND_LEN];
+        p[0] = slot;
+        memcpy(p + 1, b.txid, 4);
+        p[5] = timeout_s;
+        n.link.send(CMD_BIND, p, sizeof(p));
+    }
+}
+
+// Moves a bound craft onto node, which must have a free slot.
+bool Router::_restore(int id, int node) {
+    Node& n = *_nodes[node];
+    int slot = 0;
+    while (n.craft[slot] >= 0 || n.stale[slot])
+        slot++;
+    CraftBinding& b = _craft[id];
+    b.node = node;
+    b.slot = slot;
+    n.craft[slot] = id;
+    uint8_t p[CMD_RESTORE_LEN];
+    p[0] = slot;
+    memcpy(p + 1, b.txid, 4);
+    memcpy(p + 5, b.aid, 4);
+    bool ok = n.link.send(CMD_RESTORE, p, sizeof(p));
+    if (onCraft)
+        onCraft(id, b);
+    return ok;
+}
+
+bool Router::sendSticks(int id, uint16_t ail, uint16_t ele, uint16_t thr, uint16_t rud) {
+    const CraftBinding* b = craft(id);
+    if (!b || b->node < 0)
+        return false;
+    uint8_t p[CMD_STICKS_LEN];
+    p[0] = b->slot;
+    put16(p + 1, ail);
+    put16(p + 3, ele);
+    put16(p + 5, thr);
+    put16(p + 7, rud);
+    return _nodes[b->node]->link.send(CMD_STICKS, p, sizeof(p));
+}
+
+bool Router::sendTraceSticks(int id, uint16_t seq, uint16_t ail, uint16_t ele, uint16_t thr, uint16_t rud) {
+    const CraftBinding* b = craft(id);
+    if (!b || b->node < 0)
+        return false;
+    return _nodes[b->node]->link.sendTraceSticks(b->slot, seq, ail, ele, thr, rud);
+}
+
+void Router::broadcast(uint8_t cmd, const uint8_t* payload, uint8_t len) {
+    for (size_t i = 0; i < _nodes.size(); i++)
+        if (_nodes[i]->healthy)
+            _nodes[i]->link.send(cmd, payload, len);
+}
+
+void Router::_bound(int node, const uint8_t* p) {
+    Node& n = *_nodes[node];
+    int slot = p[0];
+    bool bound = p[2] == BOUND_OK;
+    if ((int)n.craft.size() < p[1]) {
+        n.craft.resize(p[1], -1);
+        n.stale.resize(p[1], false);
+    }
+    if (slot >= (int)n.craft.size())
+        return;
+    if (n.stale[slot]) {
+        // Still binding counts too: it must stop, as its bind has moved.
+        if (p[2] != BOUND_FREE)
+            n.link.send(CMD_RELEASE, p, CMD_RELEASE_LEN);
+        else
+            n.stale[slot] = false;
+        return;
+    }
+    if (p[2] == BOUND_BINDING)
+        return;
+    int id = n.craft[slot];
+    if (id < 0) {
+        if (!bound)
+            return;
+        // Bound before we got here, by the sketch's own bind at boot say.
+        for (id = 0; _craft.count(id); id++) {
+        }
+        n.craft[slot] = id;
+    }
+    CraftBinding& b = _craft[id];
+    if (bound) {
+        b.node = node;
+        b.slot = slot;
+        memcpy(b.txid, p + 3, 4);
+        memcpy(b.aid, p + 7, 4);
+        b.bound = true;
+    } else if (b.bound) {
+        // The node has forgotten it, most likely by rebooting, which
+        // restarted its clock too.
+        n.link.clock.reset();
+        n.craft[slot] = -1;
+        _restore(id, node);
+        return;
+    } else if (monotonicMicros() - b.bindSent < BIND_MIN) {
+        return;
+    } else {
+        // Nothing answered the bind in time.
+        n.craft[slot] = -1;
+        b.node = -1;
+    }
+    if (onCraft)
+        onCraft(id, b);
+}
+
+void Router::_telemetry(int node, const Telemetry& t) {
+    Node& n = *_nodes[node];
+    n.lastHeard = t.host_us;
+    if (!n.healthy)
+        _recover(node);
+    if (t.type == TLM_BOUND && t.len == TLM_BOUND_LEN)
+        _bound(node, t.payload);
+    if (onTelemetry)
+        onTelemetry(node, t);
+}
+
+void Router::_fail(int node) {
+    Node& n = *_nodes[node];
+    n.healthy = false;
+    for (size_t slot = 0; slot < n.craft.size(); slot++) {
+        int id = n.craft[slot];
+        if (id < 0)
+            continue;
+        n.craft[slot] = -1;
+        n.stale[slot] = true;
+        CraftBinding& b = _craft[id];
+        int target = b.bound ? _place(node) : -1;
+        if (target >= 0) {
+            _restore(id, target);
+        } else {
+            // Binds start again from the queue, so they go to whichever
+            // node is binding and get a txid picked for it.
+            if (!b.bound)
+                _queued[id] = b.timeout_s;
+            b.node = -1;
+            if (onCraft)
+                onCraft(id, b);
+        }
+    }
+    _bindQueued();
+}
+
+void Router::_recover(int node) {
+    _nodes[node]->healthy = true;
+    // The replies tell us what it is still sending, so stale slots can be released.
+    _nodes[node]->link.send(CMD_STATUS, NULL, 0);
+}
+
+void Router::_tick(uint64_t now) {
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        Node& n = *_nodes[i];
+        if (n.link.fd() < 0) {
+            if (now < n.nextReopen)
+                continue;
+            n.nextReopen = now + REOPEN_INTERVAL;
+            if (!n.link.open(n.path.c_str()))
+                continue;
+            // Opening the port resets most Arduinos.
+            n.link.clock.reset();
+            n.link.send(CMD_STATUS, NULL, 0);
+        }
+        if (now >= n.nextPing) {
+            n.link.ping();
+            n.nextPing = now + pingInterval * 1000;
+        }
+        if (n.healthy && now - n.lastHeard > (uint64_t)failTimeout * 1000)
+            _fail(i);
+    }
+    // Anything left without a node gets one as soon as there's room.
+    _bindQueued();
+    for (std::map<int, CraftBinding>::iterator it = _craft.begin(); it != _craft.end(); ++it) {
+        if (it->second.node >= 0 || !it->second.bound)
+            continue;
+        int target = _place(-1);
+        if (target < 0)
+            break;
+        _restore(it->first, target);
+    }
+}
+
+bool Router::poll(int timeout_ms, int extraFd) {
+    uint64_t now = monotonicMicros();
+    _tick(now);
+    std::vector<struct pollfd> fds;
+    std::vector<int> which;
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        if (_nodes[i]->link.fd() < 0) {
+            if (timeout_ms < 0 || timeout_ms > REOPEN_INTERVAL / 1000)
+                timeout_ms = REOPEN_INTERVAL / 1000;
+            continue;
+        }
+        struct pollfd p = { _nodes[i]->link.fd(), POLLIN, 0 };
+        fds.push_back(p);
+        which.push_back(i);
+        uint64_t wait = _nodes[i]->nextPing > now ? (_nodes[i]->nextPing - now) / 1000 + 1 : 0;
+        if (timeout_ms < 0 || wait < (uint64_t)timeout_ms)
+            timeout_ms = wait;
+    }
+    if (extraFd >= 0) {
+        struct pollfd p = { extraFd, POLLIN, 0 };
+        fds.push_back(p);
+    }
+    if (::poll(fds.empty() ? NULL : &fds[0], fds.size(), timeout_ms) <= 0)
+        return false;
+    now = monotonicMicros();
+    for (size_t i = 0; i < which.size(); i++) {
+        if (!fds[i].revents)
+            continue;
+        Node& n = *_nodes[which[i]];
+        uint8_t buf[256];
+        int r = read(n.link.fd(), buf, sizeof(buf));
+        if (r <= 0) {
+            n.link.close();
+            n.nextReopen = now + REOPEN_INTERVAL;
+            if (n.healthy)
+                _fail(which[i]);
+            continue;
+        }
+        n.lastHeard = now;
+        n.link.receive(buf, r, now);
+    }
+    return extraFd >= 0 && fds.back().revents;
+}
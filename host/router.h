@@ -0,0 +1,98 @@
+/*
+  router.h - Spreads a fleet of craft over several arduino_proxy nodes.
+
+  Controllers address craft by a global ID; the router decides which node
+  and slot carries each one.  New craft go to the least loaded healthy node,
+  with a transmitter ID chosen so its hopping channels don't collide with
+  the craft on other nodes (craft on the same node share the air by time
+  slicing, so they may overlap).  A node that stops answering pings has its
+  craft restored on the others from their txid/aid, and is told to release
+  them if it comes back.
+*/
+#ifndef Router_h
+#define Router_h
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "link.h"
+
+struct CraftBinding {
+    int node;  // -1 if it has nowhere to go
+    int slot;
+    uint8_t txid[4];
+    uint8_t aid[4];
+    bool bound; // aid is valid
+    uint64_t bindSent; // host time of the last CMD_BIND
+    int timeout_s; // of the bind, to start it again elsewhere
+};
+
+struct Node {
+    std::string path;
+    Link link;
+    bool healthy;
+    uint64_t lastHeard;    // host time anything last arrived
+    uint64_t nextPing;
+    uint64_t nextReopen;
+    std::vector<int> craft; // global ID per slot, -1 if free
+    std::vector<bool> stale; // slots handed elsewhere while it was down
+};
+
+class Router {
+public:
+    Router();
+    ~Router();
+    bool addNode(const char* path);
+    int nodes() const { return _nodes.size(); }
+    Node& node(int i) { return *_nodes[i]; }
+
+    // Binds a new craft as id on the least loaded node, or on the first to
+    // have room if none does yet.  Only one node binds at a time, so while
+    // one is binding further craft go to it or wait.  False if id is
+    // already flying.
+    bool bind(int id, int timeout_s = 30);
+    bool sendSticks(int id, uint16_t ail, uint16_t ele, uint16_t thr, uint16_t rud);
+    bool sendTraceSticks(int id, uint16_t seq, uint16_t ail, uint16_t ele, uint16_t thr, uint16_t rud);
+    // Sends cmd to every healthy node.
+    void broadcast(uint8_t cmd, const uint8_t* payload, uint8_t len);
+    const CraftBinding* craft(int id) const;
+    // Waiting for a node to bind it on.
+    bool queued(int id) const { return _queued.count(id) != 0; }
+    // Global ID of whatever is in a node's slot, or -1.
+    int craftAt(int node, int slot) const;
+
+    // Services every node for up to timeout_ms, pinging and failing over as
+    // needed.  Returns true if extraFd (if any) became readable.
+    bool poll(int timeout_ms, int extraFd = -1);
+
+    std::function<void(int node, const Telemetry&)> onTelemetry;
+    std::function<void(int node, const std::string&)> onText;
+    // A craft was bound, moved, or lost its node.
+    std::function<void(int id, const CraftBinding&)> onCraft;
+
+    int pingInterval;  // ms
+    int failTimeout;   // ms without hearing from a node before failing it
+
+private:
+    void _telemetry(int node, const Telemetry& t);
+    void _bound(int node, const uint8_t* p);
+    void _tick(uint64_t now);
+    void _fail(int node);
+    void _recover(int node);
+    int _used(int node) const;
+    bool _hasRoom(int node) const;
+    int _place(int exclude);
+    bool _restore(int id, int node);
+    void _pickTxid(int node, uint8_t* txid);
+    int _bindingNode() const;
+    void _bindQueued();
+
+    std::vector<Node*> _nodes;
+    std::map<int, CraftBinding> _craft;
+    std::map<int, int> _queued; // binds waiting for a slot: id -> timeout_s
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*
+  simbench - flies simulated CX10s closed loop, faster than real time.
+
+    simbench [-n sims] [-t seconds] [-j threads] [-f]
+
+  Each simulation is one QuadSim, a little heavier or weaker than the
+  next, seen by two cameras at 30 fps.  Its detections are triangulated,
+  FleetController turns the positions into sticks, and the sticks go to
+  the simulator as packets every 6 ms, as the proxy sends them.  It takes
+  off to a metre up, then is sent 1 m along x, 0.5 m back along y and half
+  a metre higher; -f has it flip on the way.  Reports how long it took to
+  settle there, how far off it ended, and how many times faster than real
+  time the simulations ran.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+
+#include "clock.h"
+#include "flight.h"
+#include "workpool.h"
+
+static const double moveTo[3] = { 1, -0.5, 1.5 };
+
+static FlightResult flyOne(int sim, double seconds, bool flip) {
+    std::mt19937 rng(sim);
+    std::uniform_real_distribution<double> u(0.9, 1.1);
+    QuadParams params;
+    params.mass *= u(rng);
+    params.maxThrust *= u(rng);
+    AxisGains gains[3];
+    flightGains(gains);
+    FlightPlan plan;
+    plan.seconds = seconds;
+    double moveAt = seconds / 2;
+    plan.target = [moveAt](double t, double target[3]) {
+        target[0] = t < moveAt ? 0 : moveTo[0];
+        target[1] = t < moveAt ? 0 : moveTo[1];
+        target[2] = t < moveAt ? 1 : moveTo[2];
+    };
+    plan.settleFrom = plan.trackFrom = moveAt;
+    plan.settleTo = seconds;
+    if (flip)
+        plan.flipAt = moveAt + 1;
+    return fly(params, gains, plan, sim + 1);
+}
+
+int main(int argc, char** argv) {
+    int sims = 64, threads = 0;
+    double seconds = 20;
+    bool flip = false, ok = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:j:f")) != -1) {
+        if (opt == 'n')
+            sims = atoi(optarg);
+        else if (opt == 't')
+            seconds = atof(optarg);
+        else if (opt == 'j')
+            threads = atoi(optarg);
+        else if (opt == 'f')
+            flip = true;
+        else
+            ok = false;
+    }
+    if (!ok || sims <= 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s [-n sims] [-t seconds] [-j threads] [-f]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<FlightResult> results(sims);
+    WorkPool pool(threads);
+    uint64_t start = monotonicMicros();
+    pool.run(sims, [&](int i) { results[i] = flyOne(i, seconds, flip); });
+    double wall = (monotonicMicros() - start) * 1e-6;
+
+    double sumSettle = 0, worstSettle = 0, sumError = 0, worstError = 0;
+    int unsettled = 0;
+    for (int i = 0; i < sims; i++) {
+        sumError += results[i].finalError;
+        worstError = fmax(worstError, results[i].finalError);
+        if (results[i].settled < 0 || results[i].crashed) {
+            unsettled++;
+            continue;
+        }
+        sumSettle += results[i].settled;
+        worstSettle = fmax(worstSettle, results[i].settled);
+    }
+    int settled = sims - unsettled;
+    printf("%d sims of %.0f s on %d threads in %.2f s: %.0fx real time\n", sims, seconds, pool.threads(), wall,
+           sims * seconds / wall);
+    printf("settled in %.2f s (worst %.2f), ended %.3f m off (worst %.3f), %d unsettled\n",
+           settled ? sumSettle / settled : 0, worstSettle, sumError / sims, worstError, unsettled);
+    return unsettled ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+#include "trace.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <map>
+
+static const char* const stageNames[TRACE_STAGES] = {
+    "capture", "inference", "controller", "enqueue", "receipt", "air",
+};
+
+const char* traceStageName(int stage) {
+    if (stage < 0 || stage >= TRACE_STAGES)
+        return "?";
+    return stageNames[stage];
+}
+
+int traceStageFromName(const char* name) {
+    for (int i = 0; i < TRACE_STAGES; i++)
+        if (strcmp(name, stageNames[i]) == 0)
+            return i;
+    return -1;
+}
+
+TraceLog::TraceLog() : _f(NULL) {}
+
+TraceLog::~TraceLog() {
+    if (_f)
+        fclose(_f);
+}
+
+bool TraceLog::open(const char* path) {
+    _f = fopen(path, "a");
+    return _f != NULL;
+}
+
+void TraceLog::stamp(uint16_t seq, int craft, TraceStage stage, uint64_t host_us) {
+    if (!_f)
+        return;
+    fprintf(_f, "%u %d %s %" PRIu64 "\n", seq, craft, stageNames[stage], host_us);
+    fflush(_f);
+}
+
+bool readTraceLog(const char* path, std::vector<TraceRecord>& records) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return false;
+    typedef std::pair<int, uint16_t> Key; // craft, seq
+    std::map<Key, size_t> open; // index of each one's current record
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned seq;
+        int craft = 0;
+        char name[32];
+        uint64_t t;
+        if (sscanf(line, "%u %d %31s %" SCNu64, &seq, &craft, name, &t) != 4 &&
+            sscanf(line, "%u %31s %" SCNu64, &seq, name, &t) != 3)
+            continue;
+        int stage = traceStageFromName(name);
+        if (stage < 0)
+            continue;
+        Key key(craft, seq);
+        std::map<Key, size_t>::iterator it = open.find(key);
+        if (it == open.end() || records[it->second].t[stage]) {
+            TraceRecord r;
+            memset(&r, 0, sizeof(r));
+            r.seq = seq;
+            r.craft = craft;
+            records.push_back(r);
+            open[key] = records.size() - 1;
+            it = open.find(key);
+        }
+        records[it->second].t[stage] = t;
+    }
+    fclose(f);
+    return true;
+}
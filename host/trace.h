@@ -0,0 +1,53 @@
+/*
+  trace.h - End-to-end latency trace, camera frame to packet on air.
+
+  Every stick update carries a 16 bit sequence number, and each stage it
+  passes through stamps that number with a host monotonic time.  The vision
+  side gives every craft's sticks in a frame the same number, so stamps are
+  kept per craft.  The log is plain text, one "seq craft stage time_us" line
+  per stamp; lines from older logs without the craft read as craft 0.
+*/
+#ifndef Trace_h
+#define Trace_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+enum TraceStage {
+    TRACE_CAPTURE,    // frame out of the camera
+    TRACE_INFERENCE,  // convnet output ready
+    TRACE_CONTROLLER, // stick values decided
+    TRACE_ENQUEUE,    // written to the serial port
+    TRACE_RECEIPT,    // parsed by the Arduino
+    TRACE_AIR,        // packet handed to the radio
+    TRACE_STAGES
+};
+
+const char* traceStageName(int stage);
+int traceStageFromName(const char* name);
+
+class TraceLog {
+public:
+    TraceLog();
+    ~TraceLog();
+    bool open(const char* path);
+    // craft is the router's global ID, -1 if unknown.
+    void stamp(uint16_t seq, int craft, TraceStage stage, uint64_t host_us);
+private:
+    FILE* _f;
+};
+
+// All the stamps one sequence number collected for one craft.  Missing
+// stages are 0.
+struct TraceRecord {
+    uint16_t seq;
+    int craft;
+    uint64_t t[TRACE_STAGES];
+};
+
+// Reads a trace log back.  Sequence numbers wrap, so a repeated stamp for a
+// craft and sequence number starts a new record.
+bool readTraceLog(const char* path, std::vector<TraceRecord>& records);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+  tracereport - per-stage latency histograms and critical path report from
+  a linkd trace log.
+
+    tracereport trace.log
+*/
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "trace.h"
+
+#define BUCKETS 24 // power of two buckets, 1us .. 8s
+
+struct Latency {
+    std::vector<uint64_t> samples;
+    unsigned buckets[BUCKETS];
+    Latency() { memset(buckets, 0, sizeof(buckets)); }
+
+    void add(uint64_t us) {
+        samples.push_back(us);
+        int b = 0;
+        while (b < BUCKETS - 1 && us >= (2ull << b))
+            b++;
+        buckets[b]++;
+    }
+
+    uint64_t percentile(double p) {
+        size_t i = (size_t)(p * (samples.size() - 1));
+        std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+        return samples[i];
+    }
+
+    void print(const char* name) {
+        if (samples.empty())
+            return;
+        uint64_t sum = 0;
+        for (size_t i = 0; i < samples.size(); i++)
+            sum += samples[i];
+        printf("%s: n=%zu mean=%" PRIu64 "us p50=%" PRIu64 "us p90=%" PRIu64 "us p99=%" PRIu64 "us max=%" PRIu64 "us\n",
+               name, samples.size(), sum / samples.size(), percentile(0.5),
+               percentile(0.9), percentile(0.99), percentile(1.0));
+        unsigned most = *std::max_element(buckets, buckets + BUCKETS);
+        for (int b = 0; b < BUCKETS; b++) {
+            if (!buckets[b])
+                continue;
+            printf("  %8" PRIu64 "us+ %6u ", b ? (uint64_t)1 << b : 0, buckets[b]);
+            for (unsigned i = 0; i < buckets[b] * 50 / most; i++)
+                putchar('#');
+            putchar('\n');
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace.log\n", argv[0]);
+        return 1;
+    }
+    std::vector<TraceRecord> records;
+    if (!readTraceLog(argv[1], records)) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // Latency of each stage is measured from the previous stage that was
+    // stamped, so a trace without camera stages still reports the link.
+    Latency stage[TRACE_STAGES], total;
+    unsigned critical[TRACE_STAGES] = { 0 };
+    uint64_t criticalTime[TRACE_STAGES] = { 0 };
+    std::vector<std::pair<uint64_t, size_t> > slowest;
+    for (size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& r = records[i];
+        int first = -1, prev = -1, worst = -1;
+        uint64_t worstGap = 0;
+        for (int s = 0; s < TRACE_STAGES; s++) {
+            if (!r.t[s])
+                continue;
+            if (first < 0)
+                first = s;
+            if (prev >= 0) {
+                uint64_t gap = r.t[s] > r.t[prev] ? r.t[s] - r.t[prev] : 0;
+                stage[s].add(gap);
+                if (worst < 0 || gap > worstGap) {
+                    worst = s;
+                    worstGap = gap;
+                }
+            }
+            prev = s;
+        }
+        // Only records that made it on air count towards the end to end path.
+        if (worst < 0 || !r.t[TRACE_AIR])
+            continue;
+        uint64_t e2e = r.t[TRACE_AIR] - r.t[first];
+        total.add(e2e);
+        critical[worst]++;
+        criticalTime[worst] += worstGap;
+        slowest.push_back(std::make_pair(e2e, i));
+    }
+
+    printf("%zu records, %zu reached the air\n\n", records.size(), total.samples.size());
+    for (int s = 1; s < TRACE_STAGES; s++) {
+        char name[64];
+        snprintf(name, sizeof(name), "-> %s", traceStageName(s));
+        stage[s].print(name);
+    }
+    printf("\n");
+    total.print("end to end");
+
+    if (slowest.empty())
+        return 0;
+    printf("\ncritical path (stage that dominated each update):\n");
+    for (int s = 1; s < TRACE_STAGES; s++) {
+        if (!critical[s])
+            continue;
+        printf("  %-12s %5.1f%% of updates, mean %" PRIu64 "us when critical\n",
+               traceStageName(s), 100.0 * critical[s] / slowest.size(),
+               criticalTime[s] / critical[s]);
+    }
+
+    std::sort(slowest.rbegin(), slowest.rend());
+    printf("\nslowest updates:\n");
+    for (size_t i = 0; i < slowest.size() && i < 10; i++) {
+        const TraceRecord& r = records[slowest[i].second];
+        printf("  craft %3d seq %5u %8" PRIu64 "us:", r.craft, r.seq, slowest[i].first);
+        int prev = -1;
+        for (int s = 0; s < TRACE_STAGES; s++) {
+            if (!r.t[s])
+                continue;
+            if (prev >= 0)
+                printf(" %s %+" PRId64, traceStageName(s), (int64_t)(r.t[s] - r.t[prev]));
+            prev = s;
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "tracker.h"
+
+#include <math.h>
+
+#include "hungarian.h"
+
+Tracker::Tracker()
+    : gate(13.8f), accelNoise(2000), measurementNoise(1.5f), initialSpeed(300), reacquire(64),
+      confirmHits(3), maxMisses(15), matched(0), _nextId(1), _time(0), _started(false) {
+}
+
+// Constant velocity over dt, with white noise acceleration of variance q.
+static void predictAxis(float& p, float& v, float* c, float dt, float q) {
+    p += v * dt;
+    float dt2 = dt * dt;
+    c[0] += dt * (2 * c[1] + dt * c[2]) + q * dt2 * dt2 / 4;
+    c[1] += dt * c[2] + q * dt2 * dt / 2;
+    c[2] += q * dt2;
+}
+
+static void correctAxis(float& p, float& v, float* c, float z, float r) {
+    float s = c[0] + r;
+    float k0 = c[0] / s, k1 = c[1] / s;
+    float e = z - p;
+    p += k0 * e;
+    v += k1 * e;
+    c[2] -= k1 * c[1];
+    c[1] -= k0 * c[1];
+    c[0] -= k0 * c[0];
+}
+
+void Tracker::predict(uint64_t time, std::vector<Detection>& predicted) {
+    float dt = _started && time > _time ? (time - _time) * 1e-6f : 0;
+    _time = time;
+    _started = true;
+    float q = accelNoise * accelNoise;
+    for (size_t i = 0; i < _tracks.size(); i++) {
+        Track& t = _tracks[i];
+        predictAxis(t.x, t.vx, t.cx, dt, q);
+        predictAxis(t.y, t.vy, t.cy, dt, q);
+        Detection d = { t.x, t.y, 0 };
+        predicted.push_back(d);
+    }
+}
+
+void Tracker::update(const std::vector<Detection>& found) {
+    int rows = _tracks.size(), cols = found.size();
+    float r = measurementNoise * measurementNoise;
+    _cost.resize(rows * cols);
+    for (int i = 0; i < rows; i++) {
+        const Track& t = _tracks[i];
+        float sx = t.cx[0] + r, sy = t.cy[0] + r;
+        for (int j = 0; j < cols; j++) {
+            float dx = found[j].x - t.x, dy = found[j].y - t.y;
+            float d2 = dx * dx / sx + dy * dy / sy;
+            _cost[i * cols + j] = d2 <= gate ? d2 : HUNGARIAN_FORBIDDEN;
+        }
+    }
+    hungarian(_cost, rows, cols, _assignment);
+
+    matched = 0;
+    _used.assign(cols, false);
+    std::vector<Track> kept;
+    kept.reserve(rows + cols);
+    for (int i = 0; i < rows; i++) {
+        Track& t = _tracks[i];
+        int j = _assignment[i];
+        if (j >= 0) {
+            correctAxis(t.x, t.vx, t.cx, found[j].x, r);
+            correctAxis(t.y, t.vy, t.cy, found[j].y, r);
+            t.hits++;
+            t.misses = 0;
+            _used[j] = true;
+            matched++;
+            if (!t.confirmed && t.hits >= confirmHits) {
+                t.confirmed = true;
+                _claim(t);
+            }
+        } else if (++t.misses > (t.confirmed ? maxMisses : 0)) {
+            _lose(t);
+            continue;
+        }
+        kept.push_back(t);
+    }
+    float v = initialSpeed * initialSpeed;
+    for (int j = 0; j < cols; j++) {
+        if (_used[j])
+            continue;
+        Track t = { _nextId++, -1, found[j].x, found[j].y, 0, 0, 1, 0, false,
+                    { r, 0, v }, { r, 0, v } };
+        if (t.hits >= confirmHits) {
+            t.confirmed = true;
+            _claim(t);
+        }
+        kept.push_back(t);
+    }
+    _tracks.swap(kept);
+}
+
+// A lost craft close by if there is one, else the longest waiting new
+// one, else the nearest lost one.
+void Tracker::_claim(Track& t) {
+    if (t.craft >= 0 || _waiting.empty())
+        return;
+    int best = -1, fresh = -1;
+    float bestD = INFINITY;
+    for (size_t i = 0; i < _waiting.size(); i++) {
+        const Waiting& w = _waiting[i];
+        if (!w.lost) {
+            if (fresh < 0)
+                fresh = i;
+            continue;
+        }
+        float d = hypotf(w.x - t.x, w.y - t.y);
+        if (d < bestD) {
+            bestD = d;
+            best = i;
+        }
+    }
+    int pick = best >= 0 && (bestD <= reacquire || fresh < 0) ? best : fresh;
+    t.craft = _waiting[pick].craft;
+    _waiting.erase(_waiting.begin() + pick);
+}
+
+void Tracker::_lose(const Track& t) {
+    if (t.craft < 0)
+        return;
+    Waiting w = { t.craft, true, t.x, t.y };
+    _waiting.push_back(w);
+}
+
+const Track* Tracker::find(int craft) const {
+    for (size_t i = 0; i < _tracks.size(); i++)
+        if (_tracks[i].craft == craft)
+            return &_tracks[i];
+    return 0;
+}
+
+void Tracker::addCraft(int craft) {
+    if (find(craft))
+        return;
+    for (size_t i = 0; i < _waiting.size(); i++)
+        if (_waiting[i].craft == craft)
+            return;
+    Waiting w = { craft, false, 0, 0 };
+    _waiting.push_back(w);
+    // A track may already be flying with no craft to give it.
+    for (size_t i = 0; i < _tracks.size() && !_waiting.empty(); i++)
+        if (_tracks[i].confirmed)
+            _claim(_tracks[i]);
+}
+
+void Tracker::removeCraft(int craft) {
+    for (size_t i = 0; i < _tracks.size(); i++)
+        if (_tracks[i].craft == craft)
+            _tracks[i].craft = -1;
+    for (size_t i = 0; i < _waiting.size(); i++) {
+        if (_waiting[i].craft == craft) {
+            _waiting.erase(_waiting.begin() + i);
+            return;
+        }
+    }
+}
+
+bool Tracker::identify(int track, int craft) {
+    Track* t = 0;
+    for (size_t i = 0; i < _tracks.size(); i++)
+        if (_tracks[i].id == track)
+            t = &_tracks[i];
+    if (!t)
+        return false;
+    if (t->craft == craft)
+        return true;
+    bool swapped = false;
+    for (size_t i = 0; i < _tracks.size(); i++) {
+        if (_tracks[i].craft == craft) {
+            _tracks[i].craft = t->craft;
+            swapped = true;
+        }
+    }
+    for (size_t i = 0; i < _waiting.size(); i++) {
+        if (_waiting[i].craft == craft) {
+            _waiting.erase(_waiting.begin() + i);
+            break;
+        }
+    }
+    if (!swapped && t->craft >= 0) {
+        Waiting w = { t->craft, false, 0, 0 };
+        _waiting.push_front(w);
+    }
+    t->craft = craft;
+    return true;
+}
@@ -0,0 +1,93 @@
+/*
+  tracker.h - Turns per frame detections into persistent craft.
+
+  Each track runs a constant velocity Kalman filter per axis.  Every frame
+  the tracks are predicted forward to the frame's time, detections are
+  matched to them as a whole by the Hungarian method on Mahalanobis
+  distance, and the matched tracks corrected.  Detections left over start
+  tentative tracks, which are confirmed after confirmHits matches; tracks
+  unmatched for maxMisses frames in a row are dropped.
+
+  Confirmed tracks are given a craft ID, the one the router knows the craft
+  by.  The camera can't tell craft apart, so this goes on history: a track
+  appearing near where a craft's track was lost takes that craft back, and
+  otherwise it takes the craft that has waited longest since it was bound.
+  Bind craft one at a time, letting each take off before the next, and
+  they line up.  identify() corrects the guess.
+*/
+#ifndef Tracker_h
+#define Tracker_h
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include "roi.h"
+
+struct Track {
+    int id;        // unique to this tracker
+    int craft;     // router ID, or -1 if not known yet
+    float x, y;    // input pixels
+    float vx, vy;  // pixels per second
+    int hits;      // matches in all
+    int misses;    // frames unmatched in a row
+    bool confirmed;
+
+    // Per axis covariance of position and velocity: pp, pv, vv.
+    float cx[3], cy[3];
+};
+
+class Tracker {
+public:
+    Tracker();
+
+    // Moves every track on to time (microseconds) and appends where it
+    // should be, for RoiDetector::detect().
+    void predict(uint64_t time, std::vector<Detection>& predicted);
+    // Matches this frame's detections, found at the time last predicted.
+    void update(const std::vector<Detection>& found);
+
+    const std::vector<Track>& tracks() const { return _tracks; }
+    // The confirmed track flying craft, or 0.
+    const Track* find(int craft) const;
+
+    // A craft has been bound (or released) and should be looked for.
+    void addCraft(int craft);
+    void removeCraft(int craft);
+    // Says which craft a track really is, swapping with any track that
+    // had it.
+    bool identify(int track, int craft);
+
+    float gate;              // squared Mahalanobis distance to match within
+    float accelNoise;        // pixels per second^2, standard deviation
+    float measurementNoise;  // pixels, standard deviation
+    float initialSpeed;      // pixels per second, standard deviation
+    float reacquire;         // pixels from where a craft was lost
+    int confirmHits;
+    int maxMisses;
+
+    // About the last update()
+    int matched;
+
+private:
+    struct Waiting {
+        int craft;
+        bool lost;  // else newly bound
+        float x, y;
+    };
+
+    void _claim(Track& t);
+    void _lose(const Track& t);
+
+    std::vector<Track> _tracks;
+    std::deque<Waiting> _waiting;
+    int _nextId;
+    uint64_t _time;
+    bool _started;
+
+    std::vector<float> _cost;
+    std::vector<int> _assignment;
+    std::vector<bool> _used;
+};
+
+#endif
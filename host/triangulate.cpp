@@ -0,0 +1,244 @@
+#include "triangulate.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define REFINE_STEPS 3
+
+// Solves the n x n system A x = b in place, b becoming x, by elimination
+// with partial pivoting.  False if A is singular.
+static bool solve(double* A, double* b, int n) {
+    for (int c = 0; c < n; c++) {
+        int pivot = c;
+        for (int r = c + 1; r < n; r++)
+            if (fabs(A[r * n + c]) > fabs(A[pivot * n + c]))
+                pivot = r;
+        if (fabs(A[pivot * n + c]) < 1e-12)
+            return false;
+        if (pivot != c) {
+            for (int k = 0; k < n; k++) {
+                double t = A[c * n + k];
+                A[c * n + k] = A[pivot * n + k];
+                A[pivot * n + k] = t;
+            }
+            double t = b[c];
+            b[c] = b[pivot];
+            b[pivot] = t;
+        }
+        for (int r = c + 1; r < n; r++) {
+            double f = A[r * n + c] / A[c * n + c];
+            for (int k = c; k < n; k++)
+                A[r * n + k] -= f * A[c * n + k];
+            b[r] -= f * b[c];
+        }
+    }
+    for (int c = n - 1; c >= 0; c--) {
+        for (int k = c + 1; k < n; k++)
+            b[c] -= A[c * n + k] * b[k];
+        b[c] /= A[c * n + c];
+    }
+    return true;
+}
+
+// Adds w * row^T row to the normal equations AtA and w * row * rhs to Atb.
+static void accumulate(double* AtA, double* Atb, const double* row, double rhs, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < n; k++)
+            AtA[i * n + k] += row[i] * row[k];
+        Atb[i] += row[i] * rhs;
+    }
+}
+
+bool Camera::project(const double X[3], double& x, double& y) const {
+    double w = P[8] * X[0] + P[9] * X[1] + P[10] * X[2] + P[11];
+    if (w <= 0)
+        return false;
+    x = (P[0] * X[0] + P[1] * X[1] + P[2] * X[2] + P[3]) / w;
+    y = (P[4] * X[0] + P[5] * X[1] + P[6] * X[2] + P[7]) / w;
+    return true;
+}
+
+Camera Camera::lookAt(const double eye[3], const double target[3], double f, double cx, double cy) {
+    // Camera axes in world coordinates: z forward, x right, y down.
+    double z[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+    double n = sqrt(z[0] * z[0] + z[1] * z[1] + z[2] * z[2]);
+    for (int i = 0; i < 3; i++)
+        z[i] /= n;
+    double x[3] = { z[1], -z[0], 0 }; // z x up
+    n = sqrt(x[0] * x[0] + x[1] * x[1]);
+    if (n < 1e-9) {
+        x[0] = 1;
+        x[1] = 0;
+    } else {
+        x[0] /= n;
+        x[1] /= n;
+    }
+    double y[3] = { z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2], z[0] * x[1] - z[1] * x[0] };
+    const double* R[3] = { x, y, z };
+    Camera c;
+    for (int r = 0; r < 3; r++) {
+        double t = -(R[r][0] * eye[0] + R[r][1] * eye[1] + R[r][2] * eye[2]);
+        // K = [f 0 cx; 0 f cy; 0 0 1] times [R t]
+        for (int k = 0; k < 3; k++)
+            c.P[r * 4 + k] = R[r][k];
+        c.P[r * 4 + 3] = t;
+    }
+    for (int k = 0; k < 4; k++) {
+        c.P[k] = f * c.P[k] + cx * c.P[8 + k];
+        c.P[4 + k] = f * c.P[4 + k] + cy * c.P[8 + k];
+    }
+    return c;
+}
+
+bool loadCameras(const char* path, std::vector<Camera>& cameras) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    cameras.clear();
+    std::vector<double> v;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char* hash = strchr(line, '#');
+        if (hash)
+            *hash = 0;
+        char* p = line;
+        char* end;
+        for (double d = strtod(p, &end); end != p; d = strtod(p, &end)) {
+            v.push_back(d);
+            p = end;
+        }
+    }
+    fclose(f);
+    if (v.empty() || v.size() % 12) {
+        fprintf(stderr, "%s: expected twelve numbers per camera\n", path);
+        return false;
+    }
+    for (size_t i = 0; i < v.size(); i += 12) {
+        Camera c;
+        memcpy(c.P, &v[i], sizeof(c.P));
+        cameras.push_back(c);
+    }
+    return true;
+}
+
+bool calibrate(const double* world, const double* image, int n, Camera& camera) {
+    if (n < 6)
+        return false;
+    // Centre both sets of points on the origin, scaled to unit spread.
+    double wc[3] = { 0, 0, 0 }, ic[2] = { 0, 0 }, ws = 0, is = 0;
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 3; k++)
+            wc[k] += world[i * 3 + k] / n;
+        for (int k = 0; k < 2; k++)
+            ic[k] += image[i * 2 + k] / n;
+    }
+    for (int i = 0; i < n; i++) {
+        ws += sqrt(pow(world[i * 3] - wc[0], 2) + pow(world[i * 3 + 1] - wc[1], 2) + pow(world[i * 3 + 2] - wc[2], 2));
+        is += sqrt(pow(image[i * 2] - ic[0], 2) + pow(image[i * 2 + 1] - ic[1], 2));
+    }
+    if (ws <= 0 || is <= 0)
+        return false;
+    ws = n / ws;
+    is = n / is;
+
+    // With P[11] fixed at 1, each point gives two equations in the other
+    // eleven: u (P8 X + 1) = P0 X + P3 and likewise for v.
+    double AtA[11 * 11] = { 0 }, Atb[11] = { 0 };
+    for (int i = 0; i < n; i++) {
+        double X[3];
+        for (int k = 0; k < 3; k++)
+            X[k] = (world[i * 3 + k] - wc[k]) * ws;
+        double u = (image[i * 2] - ic[0]) * is, v = (image[i * 2 + 1] - ic[1]) * is;
+        double ru[11] = { X[0], X[1], X[2], 1, 0, 0, 0, 0, -u * X[0], -u * X[1], -u * X[2] };
+        double rv[11] = { 0, 0, 0, 0, X[0], X[1], X[2], 1, -v * X[0], -v * X[1], -v * X[2] };
+        accumulate(AtA, Atb, ru, u, 11);
+        accumulate(AtA, Atb, rv, v, 11);
+    }
+    if (!solve(AtA, Atb, 11))
+        return false;
+    double Pn[12];
+    memcpy(Pn, Atb, sizeof(Atb));
+    Pn[11] = 1;
+
+    // Undo the normalisation: P = T^-1 Pn U, where T takes pixels and U
+    // world points to their normalised forms.
+    double PU[12];
+    for (int r = 0; r < 3; r++) {
+        for (int k = 0; k < 3; k++)
+            PU[r * 4 + k] = Pn[r * 4 + k] * ws;
+        PU[r * 4 + 3] = Pn[r * 4 + 3] - ws * (Pn[r * 4] * wc[0] + Pn[r * 4 + 1] * wc[1] + Pn[r * 4 + 2] * wc[2]);
+    }
+    for (int k = 0; k < 4; k++) {
+        camera.P[k] = PU[k] / is + ic[0] * PU[8 + k];
+        camera.P[4 + k] = PU[4 + k] / is + ic[1] * PU[8 + k];
+        camera.P[8 + k] = PU[8 + k];
+    }
+    // Keep points in front at positive depth.
+    double X[3] = { wc[0], wc[1], wc[2] };
+    if (camera.P[8] * X[0] + camera.P[9] * X[1] + camera.P[10] * X[2] + camera.P[11] < 0)
+        for (int k = 0; k < 12; k++)
+            camera.P[k] = -camera.P[k];
+    return true;
+}
+
+double triangulate(const std::vector<Camera>& cameras, const Sighting* s, int n, double X[3]) {
+    if (n < 2)
+        return -1;
+    // Linear: (u P2 - P0) [X 1] = 0 and (v P2 - P1) [X 1] = 0 per sighting,
+    // each row scaled to unit length so no camera dominates.
+    double AtA[9] = { 0 }, Atb[3] = { 0 };
+    for (int i = 0; i < n; i++) {
+        const double* P = cameras[s[i].camera].P;
+        for (int a = 0; a < 2; a++) {
+            double q = a ? s[i].y : s[i].x;
+            double row[4];
+            for (int k = 0; k < 4; k++)
+                row[k] = q * P[8 + k] - P[a * 4 + k];
+            double len = sqrt(row[0] * row[0] + row[1] * row[1] + row[2] * row[2]);
+            if (len == 0)
+                continue;
+            for (int k = 0; k < 4; k++)
+                row[k] /= len;
+            accumulate(AtA, Atb, row, -row[3], 3);
+        }
+    }
+    if (!solve(AtA, Atb, 3))
+        return -1;
+    memcpy(X, Atb, 3 * sizeof(double));
+
+    // Gauss-Newton on the pixel residuals.
+    for (int step = 0; step < REFINE_STEPS; step++) {
+        double JtJ[9] = { 0 }, Jtr[3] = { 0 };
+        for (int i = 0; i < n; i++) {
+            const double* P = cameras[s[i].camera].P;
+            double w = P[8] * X[0] + P[9] * X[1] + P[10] * X[2] + P[11];
+            if (w <= 0)
+                return -1;
+            for (int a = 0; a < 2; a++) {
+                const double* R = P + a * 4;
+                double num = R[0] * X[0] + R[1] * X[1] + R[2] * X[2] + R[3];
+                double r = (a ? s[i].y : s[i].x) - num / w;
+                double J[3];
+                for (int k = 0; k < 3; k++)
+                    J[k] = (R[k] * w - num * P[8 + k]) / (w * w);
+                accumulate(JtJ, Jtr, J, r, 3);
+            }
+        }
+        if (!solve(JtJ, Jtr, 3))
+            break;
+        for (int k = 0; k < 3; k++)
+            X[k] += Jtr[k];
+    }
+
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        double x, y;
+        if (!cameras[s[i].camera].project(X, x, y))
+            return -1;
+        sum += (x - s[i].x) * (x - s[i].x) + (y - s[i].y) * (y - s[i].y);
+    }
+    return sqrt(sum / n);
+}
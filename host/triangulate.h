@@ -0,0 +1,42 @@
+/*
+  triangulate.h - Cameras as projection matrices, and points from several.
+
+  A camera is the 3x4 matrix P taking a world point X (metres, z up) to
+  the pixel P [X 1] in homogeneous coordinates.  calibrate() finds P by
+  the direct linear transform from six or more known points, normalised
+  first so that pixels and metres weigh alike.  triangulate() solves the
+  same kind of linear least squares for X from where two or more cameras
+  see it, then refines X by Gauss-Newton on the reprojection error.
+*/
+#ifndef Triangulate_h
+#define Triangulate_h
+
+#include <vector>
+
+struct Camera {
+    double P[12]; // row major
+
+    // Where X lands, or false if it is behind the camera.
+    bool project(const double X[3], double& x, double& y) const;
+    // A pinhole camera at eye looking at target, with z up, focal length f
+    // pixels and the optical axis through cx, cy.
+    static Camera lookAt(const double eye[3], const double target[3], double f, double cx, double cy);
+};
+
+// Reads cameras, twelve numbers each, row major, # to end of line a comment.
+bool loadCameras(const char* path, std::vector<Camera>& cameras);
+
+// From n >= 6 world points (x, y, z) and their pixels (x, y), not all in
+// one plane.  False if they don't determine a camera.
+bool calibrate(const double* world, const double* image, int n, Camera& camera);
+
+struct Sighting {
+    int camera;
+    double x, y; // pixels
+};
+
+// X from n >= 2 sightings.  Returns the RMS reprojection error in pixels,
+// or -1 if the sightings don't fix a point.
+double triangulate(const std::vector<Camera>& cameras, const Sighting* s, int n, double X[3]);
+
+#endif
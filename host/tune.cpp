@@ -0,0 +1,291 @@
+/*
+  tune - finds FleetController gains for each craft by simulated flight.
+
+    tune [-c craft] [-a airframes.txt] [-g generations] [-s seeds]
+         [-j threads] [-o gains.txt]
+
+  Each candidate set of gains flies a mission on the simulator (flight.h)
+  several times: take off to a metre, step 0.9 m across and up, and follow
+  a circle.  Its cost is the RMS tracking error on the circle plus a tenth
+  of the time taken to settle after the step, with a heavy penalty for a
+  crash, averaged over the flights.  CMA-ES (cmaes.h) searches the gains,
+  as factors of the starting ones on a log scale.  Every flight of every
+  candidate of every craft in a generation is a job for a work stealing
+  pool over all the cores; each generation's candidates fly the same
+  noise, so they are compared fairly.
+
+  airframes.txt gives each slot's CX10, a line of
+
+    slot mass maxThrust motorLag
+
+  (kg, N per motor, s), and each slot is tuned for its own, give or take a
+  few percent.  Without it, one set of gains is tuned for CX10s varying by
+  10% and given to slots 0 to craft - 1.  The table goes to gains.txt, for
+  FleetController::loadGains(), or to stdout; the start and tuned gains
+  are compared on flights neither has seen.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+
+#include "clock.h"
+#include "cmaes.h"
+#include "flight.h"
+#include "workpool.h"
+
+#define PARAMS 9
+#define CRASH_COST 10
+#define UNSETTLED 5 // seconds, the whole settling window
+#define TEST_SEEDS 32
+
+struct Slot {
+    int slot;
+    QuadParams airframe;
+    double spread; // how far the airframe varies, a fraction
+};
+
+// x is the log of each gain over its starting value: kp, maxSpeed, vkp,
+// vki and vkd for x and y alike, then kp, vkp, vki and vkd for z.
+static void gainsFrom(const double* x, AxisGains g[3]) {
+    flightGains(g);
+    AxisGains& flat = g[FleetController::X];
+    AxisGains& lift = g[FleetController::Z];
+    flat.kp *= exp(x[0]);
+    flat.maxSpeed *= exp(x[1]);
+    flat.vkp *= exp(x[2]);
+    flat.vki *= exp(x[3]);
+    flat.vkd *= exp(x[4]);
+    lift.kp *= exp(x[5]);
+    lift.vkp *= exp(x[6]);
+    lift.vki *= exp(x[7]);
+    lift.vkd *= exp(x[8]);
+    g[FleetController::Y] = flat;
+}
+
+static FlightPlan mission() {
+    FlightPlan plan;
+    plan.seconds = 16;
+    plan.target = [](double t, double target[3]) {
+        if (t < 3) {
+            target[0] = target[1] = 0;
+            target[2] = 1;
+        } else if (t < 8) {
+            target[0] = 0.8;
+            target[1] = -0.4;
+            target[2] = 1.4;
+        } else {
+            target[0] = 0.3 + 0.5 * cos(0.8 * (t - 8));
+            target[1] = -0.4 + 0.5 * sin(0.8 * (t - 8));
+            target[2] = 1.4;
+        }
+    };
+    plan.settleFrom = 3;
+    plan.settleTo = plan.trackFrom = 8;
+    return plan;
+}
+
+static double cost(const FlightResult& r) {
+    return r.rmsError + 0.1 * (r.settled < 0 ? UNSETTLED : r.settled) + (r.crashed ? CRASH_COST : 0);
+}
+
+// slot's airframe as it might be on flight seed.
+static QuadParams airframeFor(const Slot& slot, unsigned seed) {
+    std::mt19937 rng(seed * 7919 + slot.slot);
+    std::uniform_real_distribution<double> u(1 - slot.spread, 1 + slot.spread);
+    QuadParams p = slot.airframe;
+    p.mass *= u(rng);
+    p.maxThrust *= u(rng);
+    p.motorLag *= u(rng);
+    return p;
+}
+
+static bool loadAirframes(const char* path, std::vector<Slot>& slots) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    char line[1024];
+    bool ok = true;
+    for (int n = 1; fgets(line, sizeof(line), f); n++) {
+        char* hash = strchr(line, '#');
+        if (hash)
+            *hash = 0;
+        Slot s;
+        s.spread = 0.03;
+        int got = sscanf(line, "%d %lf %lf %lf", &s.slot, &s.airframe.mass, &s.airframe.maxThrust,
+                         &s.airframe.motorLag);
+        if (got <= 0)
+            continue;
+        if (got != 4 || s.slot < 0) {
+            fprintf(stderr, "%s:%d: expected slot mass maxThrust motorLag\n", path, n);
+            ok = false;
+            break;
+        }
+        slots.push_back(s);
+    }
+    fclose(f);
+    return ok && !slots.empty();
+}
+
+// Flies each of the slots' gains on seeds first..first + seeds - 1 and
+// returns the mean costs, with the mean RMS error, settling time (of
+// those that settled) and crashes.
+struct Score {
+    double cost, rms, settle;
+    int crashes;
+};
+
+static std::vector<Score> evaluate(WorkPool& pool, const std::vector<Slot>& slots,
+                                   const std::vector<std::vector<double> >& x, unsigned first, int seeds) {
+    FlightPlan plan = mission();
+    int n = (int)slots.size();
+    std::vector<FlightResult> results(n * seeds);
+    pool.run(n * seeds, [&](int job) {
+        int s = job / seeds;
+        unsigned seed = first + job % seeds;
+        AxisGains g[3];
+        gainsFrom(&x[s][0], g);
+        results[job] = fly(airframeFor(slots[s], seed), g, plan, seed);
+    });
+    std::vector<Score> scores(n);
+    for (int s = 0; s < n; s++) {
+        Score& sc = scores[s];
+        sc.cost = sc.rms = sc.settle = 0;
+        sc.crashes = 0;
+        int settled = 0;
+        for (int k = 0; k < seeds; k++) {
+            const FlightResult& r = results[s * seeds + k];
+            sc.cost += cost(r) / seeds;
+            sc.rms += r.rmsError / seeds;
+            sc.crashes += r.crashed;
+            if (r.settled >= 0 && !r.crashed) {
+                sc.settle += r.settled;
+                settled++;
+            }
+        }
+        sc.settle = settled ? sc.settle / settled : -1;
+    }
+    return scores;
+}
+
+int main(int argc, char** argv) {
+    int craft = 1, generations = 40, seeds = 4, threads = 0;
+    const char* airframes = NULL;
+    const char* out = NULL;
+    bool ok = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:a:g:s:j:o:")) != -1) {
+        if (opt == 'c')
+            craft = atoi(optarg);
+        else if (opt == 'a')
+            airframes = optarg;
+        else if (opt == 'g')
+            generations = atoi(optarg);
+        else if (opt == 's')
+            seeds = atoi(optarg);
+        else if (opt == 'j')
+            threads = atoi(optarg);
+        else if (opt == 'o')
+            out = optarg;
+        else
+            ok = false;
+    }
+    if (!ok || craft <= 0 || generations < 0 || seeds <= 0) {
+        fprintf(stderr, "usage: %s [-c craft] [-a airframes.txt] [-g generations] [-s seeds] [-j threads] "
+                "[-o gains.txt]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<Slot> slots;
+    if (airframes) {
+        if (!loadAirframes(airframes, slots))
+            return 1;
+    } else {
+        Slot s;
+        s.slot = 0;
+        s.spread = 0.1;
+        slots.push_back(s);
+    }
+
+    WorkPool pool(threads);
+    int n = (int)slots.size();
+    std::vector<Cmaes> search;
+    for (int s = 0; s < n; s++)
+        search.push_back(Cmaes(std::vector<double>(PARAMS, 0), 0.3, 0, slots[s].slot + 1));
+    int lambda = search[0].lambda();
+    fprintf(stderr, "%d slot%s, %d candidates of %d flights a generation, on %d threads\n", n, n == 1 ? "" : "s",
+            lambda, seeds, pool.threads());
+
+    uint64_t start = monotonicMicros();
+    FlightPlan plan = mission();
+    for (int gen = 0; gen < generations; gen++) {
+        // Every slot's candidates in one run, so the pool stays busy to
+        // the end of the generation.
+        std::vector<std::vector<double> > x;
+        std::vector<Slot> flown;
+        for (int s = 0; s < n; s++) {
+            const std::vector<std::vector<double> >& asked = search[s].ask();
+            for (int k = 0; k < lambda; k++) {
+                std::vector<double> c = asked[k];
+                for (int i = 0; i < PARAMS; i++)
+                    c[i] = fmin(fmax(c[i], -3), 3);
+                x.push_back(c);
+                flown.push_back(slots[s]);
+            }
+        }
+        std::vector<Score> scores = evaluate(pool, flown, x, (unsigned)gen * seeds + 1, seeds);
+        for (int s = 0; s < n; s++) {
+            std::vector<double> costs(lambda);
+            for (int k = 0; k < lambda; k++)
+                costs[k] = scores[s * lambda + k].cost;
+            search[s].tell(costs);
+        }
+        if (gen % 10 == 9 || gen == generations - 1) {
+            fprintf(stderr, "generation %d:", gen + 1);
+            for (int s = 0; s < n; s++)
+                fprintf(stderr, " %.3f", search[s].bestCost());
+            fprintf(stderr, "\n");
+        }
+    }
+    double wall = (monotonicMicros() - start) * 1e-6;
+    double flights = (double)generations * n * lambda * seeds;
+    fprintf(stderr, "%.0f flights in %.1f s, %.0fx real time, %llu stolen\n", flights, wall,
+            flights * plan.seconds / wall, (unsigned long long)pool.steals());
+
+    // The tuned mean, against where it started, on fresh flights.
+    std::vector<std::vector<double> > before(n, std::vector<double>(PARAMS, 0)), after;
+    for (int s = 0; s < n; s++)
+        after.push_back(search[s].mean());
+    unsigned fresh = (unsigned)generations * seeds + 1000;
+    std::vector<Score> b = evaluate(pool, slots, before, fresh, TEST_SEEDS);
+    std::vector<Score> a = evaluate(pool, slots, after, fresh, TEST_SEEDS);
+    for (int s = 0; s < n; s++)
+        fprintf(stderr, "slot %d: cost %.3f -> %.3f, rms %.3f -> %.3f m, settle %.2f -> %.2f s, crashes %d -> %d\n",
+                slots[s].slot, b[s].cost, a[s].cost, b[s].rms, a[s].rms, b[s].settle, a[s].settle, b[s].crashes,
+                a[s].crashes);
+
+    FILE* f = out ? fopen(out, "w") : stdout;
+    if (!f) {
+        perror(out);
+        return 1;
+    }
+    fprintf(f, "# slot axis kp maxSpeed vkp vki vkd trim maxRate\n");
+    for (int s = 0; s < n; s++) {
+        AxisGains g[3];
+        gainsFrom(&after[s][0], g);
+        int first = airframes ? slots[s].slot : 0, last = airframes ? slots[s].slot + 1 : craft;
+        for (int i = first; i < last; i++)
+            for (int ax = 0; ax < FleetController::AXES; ax++)
+                FleetController::writeGains(f, i, (FleetController::Axis)ax, g[ax]);
+    }
+    if (f != stdout && fclose(f) != 0) {
+        perror(out);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "workpool.h"
+
+#include <algorithm>
+
+WorkPool::WorkPool(int threads) : _job(NULL), _round(0), _busy(0), _stop(false), _steals(0) {
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 0; t < threads; t++)
+        _queues.push_back(std::unique_ptr<Queue>(new Queue));
+    for (int t = 1; t < threads; t++)
+        _threads.push_back(std::thread(&WorkPool::worker, this, t));
+}
+
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard<std::mutex> hold(_lock);
+        _stop = true;
+    }
+    _start.notify_all();
+    for (size_t t = 0; t < _threads.size(); t++)
+        _threads[t].join();
+}
+
+void WorkPool::run(int count, const std::function<void(int)>& job) {
+    int n = threads();
+    for (int t = 0; t < n; t++) {
+        Queue& q = *_queues[t];
+        std::lock_guard<std::mutex> hold(q.lock);
+        for (int i = (int)((int64_t)count * t / n); i < (int)((int64_t)count * (t + 1) / n); i++)
+            q.jobs.push_back(i);
+    }
+    {
+        std::lock_guard<std::mutex> hold(_lock);
+        _job = &job;
+        _busy = n - 1;
+        _round++;
+    }
+    _start.notify_all();
+    drain(0);
+    std::unique_lock<std::mutex> hold(_lock);
+    _finished.wait(hold, [this]() { return _busy == 0; });
+    _job = NULL;
+}
+
+void WorkPool::worker(int self) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> hold(_lock);
+            _start.wait(hold, [&]() { return _stop || _round != seen; });
+            if (_stop)
+                return;
+            seen = _round;
+        }
+        drain(self);
+        std::lock_guard<std::mutex> hold(_lock);
+        if (--_busy == 0)
+            _finished.notify_one();
+    }
+}
+
+void WorkPool::drain(int self) {
+    int job;
+    while (take(self, job))
+        (*_job)(job);
+}
+
+bool WorkPool::take(int self, int& job) {
+    int n = threads();
+    for (int k = 0; k < n; k++) {
+        Queue& q = *_queues[(self + k) % n];
+        std::lock_guard<std::mutex> hold(q.lock);
+        if (q.jobs.empty())
+            continue;
+        if (k == 0) {
+            job = q.jobs.front();
+            q.jobs.pop_front();
+        } else {
+            job = q.jobs.back();
+            q.jobs.pop_back();
+            _steals++;
+        }
+        return true;
+    }
+    return false;
+}
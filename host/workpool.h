@@ -0,0 +1,58 @@
+/*
+  workpool.h - A pool of threads sharing out runs of jobs, with stealing.
+
+  run(count, job) calls job(i) once for each i from 0 to count - 1 and
+  returns when they are all done.  The indices are dealt out in equal
+  blocks, a queue per thread (the caller's thread is one of them); each
+  thread works from the front of its own queue and, when that is empty,
+  steals from the back of another's.  Jobs that take very different times
+  (a simulated flight that crashes early, say) so don't leave threads
+  idle while one works through a slow block.  The threads wait between
+  runs rather than being made for each.
+*/
+#ifndef WorkPool_h
+#define WorkPool_h
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkPool {
+public:
+    // threads 0 for one per core.
+    WorkPool(int threads = 0);
+    ~WorkPool();
+
+    void run(int count, const std::function<void(int)>& job);
+    int threads() const { return (int)_queues.size(); }
+    // Jobs taken from another thread's queue, so far.
+    uint64_t steals() const { return _steals; }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<int> jobs;
+    };
+
+    void worker(int self);
+    void drain(int self);
+    bool take(int self, int& job);
+
+    std::vector<std::unique_ptr<Queue> > _queues;
+    std::vector<std::thread> _threads;
+    std::mutex _lock;
+    std::condition_variable _start, _finished;
+    const std::function<void(int)>* _job;
+    uint64_t _round;
+    int _busy;
+    bool _stop;
+    std::atomic<uint64_t> _steals;
+};
+
+#endif
@@ -0,0 +1,177 @@
+-- Training labels: where the craft are in each frame.
+--
+-- Reads and appends the store described in host/annotations.h: a fixed
+-- size record per frame, memory mapped, so looking a frame up costs the
+-- same however many are labelled.  New labels are appended to a journal
+-- beside the store instead of rewriting it; host/annotool compacts the two
+-- and converts the old torch.save()d trainingdata.
+
+local ffi = require 'ffi'
+local bit = require 'bit'
+
+ffi.cdef[[
+#pragma pack(push, 1)
+typedef struct { float x, y; int16_t craft; uint16_t flags; } LabelPoint;
+typedef struct { uint16_t flags; uint16_t count; LabelPoint points[16]; } FrameLabels;
+typedef struct { char magic[8]; uint32_t version, recordSize, frames, maxPoints, folded; } AnnotationsHeader;
+typedef struct { uint32_t frame; uint16_t op; uint16_t flags; LabelPoint point; } JournalEntry;
+#pragma pack(pop)
+int open(const char *path, int flags);
+int close(int fd);
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+int munmap(void *addr, size_t length);
+int truncate(const char *path, long length);
+]]
+
+local O_RDONLY, PROT_READ, MAP_SHARED = 0, 1, 1
+local MAX_POINTS = 16
+local JOURNAL_ADD, JOURNAL_CLEAR = 0, 1
+
+local annotations = {
+  FRAME_LABELLED = 1, FRAME_SKIP = 2,
+  POINT_OCCLUDED = 1, POINT_UNSURE = 2,
+}
+
+local Store = {}
+Store.__index = Store
+
+local function fileSize(path)
+  local f = io.open(path, 'rb')
+  if not f then
+    return nil
+  end
+  local size = f:seek('end')
+  f:close()
+  return size
+end
+
+-- The store at path, created empty if there isn't one.
+function annotations.open(path)
+  local self = setmetatable({path = path, mapped = 0, frames = 0, changed = {}}, Store)
+  local size = fileSize(path)
+  local folded = 0
+  if size then
+    -- Version 1 headers stop short of folded.
+    local v1size = ffi.offsetof('AnnotationsHeader', 'folded')
+    local fd = ffi.C.open(path, O_RDONLY)
+    assert(fd >= 0 and size >= v1size, path .. ': can\'t open')
+    local map = ffi.C.mmap(nil, size, PROT_READ, MAP_SHARED, fd, 0)
+    ffi.C.close(fd)
+    assert(ffi.cast('intptr_t', map) ~= -1, path .. ': can\'t map')
+    local h = ffi.cast('const AnnotationsHeader *', map)
+    local hsize = h.version == 1 and v1size or ffi.sizeof('AnnotationsHeader')
+    assert(ffi.string(h.magic, 8) == 'QCANNOT1' and (h.version == 1 or h.version == 2)
+           and h.recordSize == ffi.sizeof('FrameLabels') and h.maxPoints == MAX_POINTS
+           and size >= hsize + h.frames * h.recordSize, path .. ': not an annotation store')
+    if h.version ~= 1 then
+      folded = h.folded
+    end
+    self.map, self.size = map, size
+    self.records = ffi.cast('const FrameLabels *', ffi.cast('const char *', map) + hsize)
+    self.mapped, self.frames = h.frames, h.frames
+    ffi.gc(map, function(m) ffi.C.munmap(m, size) end)
+  end
+
+  -- The first folded bytes of the journal are already in the records,
+  -- left by a compact that didn't get as far as emptying it.  A journal
+  -- shorter than that has been emptied since, and the count must be
+  -- zeroed before appending, as Annotations::open does.
+  local esize = ffi.sizeof('JournalEntry')
+  local journal = io.open(path .. '.journal', 'rb')
+  local data = journal and journal:read('*a') or ''
+  if journal then
+    journal:close()
+  end
+  local skip = 0
+  if #data >= folded then
+    skip = folded
+    data = data:sub(skip + 1)
+  elseif folded ~= 0 then
+    local store = assert(io.open(path, 'r+b'))
+    store:seek('set', ffi.offsetof('AnnotationsHeader', 'folded'))
+    store:write(string.rep('\0', 4))
+    store:close()
+  end
+  local n = math.floor(#data / esize)
+  local entries = ffi.new('JournalEntry[?]', n)
+  ffi.copy(entries, data, n * esize)
+  for i = 0, n - 1 do
+    self:_apply(entries[i])
+  end
+  -- Drop any entry cut short by a crash, so appends stay aligned.
+  if journal then
+    assert(ffi.C.truncate(path .. '.journal', skip + n * esize) == 0, path .. '.journal: can\'t truncate')
+  end
+  self.journal = assert(io.open(path .. '.journal', 'ab'))
+  return self
+end
+
+local function toTable(r)
+  local t = {flags = r.flags}
+  for i = 0, r.count - 1 do
+    local p = r.points[i]
+    t[i + 1] = {x = p.x, y = p.y, craft = p.craft, flags = p.flags}
+  end
+  return t
+end
+
+-- {flags=, {x=, y=, craft=, flags=}, ...} for frame, or nil if it has no
+-- labels.
+function Store:get(frame)
+  local t = self.changed[frame]
+  if t then
+    return t
+  end
+  if frame < self.mapped then
+    local r = self.records[frame]
+    if r.flags ~= 0 or r.count ~= 0 then
+      return toTable(r)
+    end
+  end
+end
+
+function Store:_apply(e)
+  local t = self:get(e.frame) or {flags = 0}
+  self.changed[e.frame] = t
+  t.flags = e.flags
+  if e.op == JOURNAL_CLEAR then
+    for i = #t, 1, -1 do
+      t[i] = nil
+    end
+  elseif e.op == JOURNAL_ADD and #t < MAX_POINTS then
+    local p = e.point
+    table.insert(t, {x = p.x, y = p.y, craft = p.craft, flags = p.flags})
+  end
+  self.frames = math.max(self.frames, e.frame + 1)
+end
+
+function Store:_append(frame, op, flags, x, y, craft, pflags)
+  local e = ffi.new('JournalEntry', {frame = frame, op = op, flags = flags,
+                                     point = {x = x or 0, y = y or 0, craft = craft or -1, flags = pflags or 0}})
+  self.journal:write(ffi.string(e, ffi.sizeof(e)))
+  self.journal:flush()
+  self:_apply(e)
+end
+
+-- Adds a craft at (x, y) in input pixels to frame.  craft is the router ID,
+-- if known.
+function Store:add(frame, x, y, craft, flags)
+  local t = self:get(frame)
+  if t and #t >= MAX_POINTS then
+    return false
+  end
+  self:_append(frame, JOURNAL_ADD, bit.bor(t and t.flags or 0, annotations.FRAME_LABELLED), x, y, craft, flags)
+  return true
+end
+
+-- Drops frame's points, leaving it labelled as having no craft.
+function Store:clear(frame)
+  local t = self:get(frame)
+  self:_append(frame, JOURNAL_CLEAR, bit.bor(t and t.flags or 0, annotations.FRAME_LABELLED))
+end
+
+function Store:close()
+  self.journal:close()
+end
+
+return annotations
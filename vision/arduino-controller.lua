@@ -1,25 +1,23 @@
 #!/usr/bin/env qlua
 
 -- sudo  chmod o+rw /dev/ttyU*; sudo stty -F /dev/ttyU* 115200
+-- or set QUAD_LINK to a fifo feeding host/linkd to get latency traces.
 
+local trace = require 'trace'
 
 
-function write(f, a)
-  f:write(string.char(a/256,a%256))
-  f:flush()
+local link = os.getenv("QUAD_LINK")
+if link then
+  f = assert(io.open(link, "w"))
+else
+  os.execute("stty -F /dev/ttyU* 115200 raw")
+  f = assert(io.open("/dev/ttyUSB0", "w"))
+  os.execute("sleep 4")
 end
-
-
-os.execute("stty -F /dev/ttyU* 115200 raw")
-
-f = assert(io.open("/dev/ttyUSB0", "w"))
-os.execute("sleep 4")
 for j=1,250 do
-   f:write(string.char(255))
-   write(f, 500);
-   write(f, 500);
-   write(f, (j%11)*100);
-   write(f, 500);
+   trace.frame()
+   trace.mark('controller')
+   trace.send(f, 0, 500, 500, (j%11)*100, 500, not link)
 
   os.execute("sleep 0.1")
 end
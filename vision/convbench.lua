@@ -0,0 +1,25 @@
+#!/usr/bin/env th
+-- Times the Torch forward pass of the vision network on random frames, to
+-- compare with host/convbench.
+--
+--   th convbench.lua [frames] [width] [height]
+
+require 'sys'
+local convnet = require 'convnet'
+
+local frames = tonumber(arg[1]) or 20
+local width = tonumber(arg[2]) or 640
+local height = tonumber(arg[3]) or 360
+
+local net = convnet.get_net()
+net:evaluate()
+local inp = {torch.rand(3, height, width), torch.rand(3, height, width)}
+net:forward(inp) -- warm up
+
+sys.tic()
+for i = 1, frames do
+  net:forward(inp)
+end
+local t = sys.toc() / frames
+print(string.format('%dx%d, %d threads', width, height, torch.getnumthreads()))
+print(string.format('%-8s %8.2f ms/frame %8.1f fps', 'torch', t * 1000, 1 / t))
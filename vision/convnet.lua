@@ -0,0 +1,47 @@
+-- The two-frame network, and export of its weights for the native engine
+-- in host/convnet.cpp.  Coarse to fine detection runs this same network
+-- over halved frames (host/pyramid.h), so it has no pooled branches of its
+-- own.
+
+require 'nngraph'
+
+local convnet = {}
+
+function convnet.get_net(from, to)
+
+    local input_x = nn.Identity()()
+    local input_y = nn.Identity()()
+    -- Planes are dimension 1 of a frame, or 2 of a minibatch of them.
+    local joined = nn.JoinTable(1, 3)({input_x, input_y})
+
+    local L1 = nn.SpatialMaxPooling(3,3,1,1,1,1)(nn.ReLU()(nn.Dropout()(nn.SpatialConvolution(6, 4, 3, 3,1,1)(joined))))
+    
+    local L2 = nn.SpatialMaxPooling(3,3,1,1,1,1)(nn.ReLU()(nn.Dropout()(nn.SpatialConvolution(4, 3, 3, 3,1,1)(L1))))
+    
+    local L3 = nn.SpatialConvolution(3, 1, 3, 3,1,1)(L2)
+
+    return nn.gModule({input_x, input_y},{L3})
+end
+
+-- Writes the convolution weights as text: "convnet <layers>", then for each
+-- layer "<nOut> <nIn> <kH> <kW>" and its weights and biases, one per line.
+function convnet.save(net, path)
+  local convs = net:findModules('nn.SpatialConvolution')
+  -- Each layer narrows, so this puts them in the order data flows.
+  table.sort(convs, function(a, b) return a.nInputPlane > b.nInputPlane end)
+  local f = assert(io.open(path .. '.tmp', 'w'))
+  f:write(string.format('convnet %d\n', #convs))
+  for _, c in ipairs(convs) do
+    f:write(string.format('%d %d %d %d\n', c.nOutputPlane, c.nInputPlane, c.kH, c.kW))
+    for _, t in ipairs({c.weight, c.bias}) do
+      local v = t:contiguous():view(-1)
+      for i = 1, v:size(1) do
+        f:write(string.format('%.9g\n', v[i]))
+      end
+    end
+  end
+  f:close()
+  os.rename(path .. '.tmp', path)
+end
+
+return convnet
@@ -0,0 +1,78 @@
+-- Stage timestamps for end to end latency tracing.
+--
+-- Stamps are taken with sys.clock(), which isn't the clock linkd uses, so
+-- they are sent as ages relative to the moment the sticks are written and
+-- linkd turns them back into its own time.  See host/linkd.cpp and
+-- arduino_proxy/protocol.h.
+
+require 'sys'
+local bit = require 'bit'
+
+local trace = {seq = 0, t = {}}
+
+local CMD_TRACE_STICKS = 0x80
+local CMD_TRACE_MARK = 0xC0
+local CMD_HOST_MIN = 0xC0 -- frames from here up are for linkd, not the node
+local stages = {'capture', 'inference', 'controller'}
+
+-- Start tracing a new update.  Returns its sequence number.
+function trace.frame()
+  trace.seq = (trace.seq + 1) % 65536
+  trace.t = {capture = sys.clock()}
+  return trace.seq
+end
+
+function trace.mark(stage)
+  trace.t[stage] = sys.clock()
+end
+
+local function bytes16(v)
+  v = math.floor(v)
+  return {math.floor(v / 256) % 256, v % 256}
+end
+
+local function bytes32(v)
+  v = math.floor(v)
+  return {math.floor(v / 16777216) % 256, math.floor(v / 65536) % 256,
+          math.floor(v / 256) % 256, v % 256}
+end
+
+local function frame(f, cmd, payload, direct)
+  if direct and cmd >= CMD_HOST_MIN then
+    return
+  end
+  local csum = bit.bxor(cmd, #payload)
+  for _, b in ipairs(payload) do
+    csum = bit.bxor(csum, b)
+  end
+  f:write(string.char(255, cmd, #payload, unpack(payload)) .. string.char(csum))
+end
+
+-- Write the stage marks for the current update followed by its stick values.
+-- direct is true when f is the node's own serial port rather than linkd,
+-- which alone has any use for the marks.
+function trace.send(f, slot, ail, ele, thr, rud, direct)
+  local now = sys.clock()
+  local mark = bytes16(trace.seq)
+  for _, stage in ipairs(stages) do
+    local age = 0xFFFFFFFF
+    if trace.t[stage] then
+      age = (now - trace.t[stage]) * 1e6
+    end
+    for _, b in ipairs(bytes32(age)) do
+      table.insert(mark, b)
+    end
+  end
+  frame(f, CMD_TRACE_MARK, mark, direct)
+
+  local sticks = {slot}
+  for _, v in ipairs({trace.seq, ail, ele, thr, rud}) do
+    for _, b in ipairs(bytes16(v)) do
+      table.insert(sticks, b)
+    end
+  end
+  frame(f, CMD_TRACE_STICKS, sticks, direct)
+  f:flush()
+end
+
+return trace
@@ -0,0 +1,203 @@
+#!/usr/bin/env th
+-- Offline training on every labelled frame, in shuffled minibatches.
+--
+--   th train.lua [-video testdata1.webm] [-labels annotations] [-batch 16]
+--                [-epochs 20] [-threads 4] [-seed 1] ...
+--
+-- The video is split into numbered pngs once (with ffmpeg, into -frames),
+-- so loader threads can each decode the frame pairs for a batch.  Targets
+-- are rendered once per labelled frame and shared with the loaders, which
+-- crop, flip and brighten pairs and targets together while the main thread
+-- trains on the batch before.  All randomness comes from -seed, shuffling
+-- in the main thread and augmentation from a generator seeded per batch, so
+-- a run gives the same model however many threads load it.
+--
+-- Frame numbers are vision.lua's: frame n is the nth decoded, from 0.
+
+require 'torch'
+require 'nn'
+require 'optim'
+require 'image'
+require 'paths'
+require 'sys'
+local bit = require 'bit'
+local threads = require 'threads'
+local convnet = require 'convnet'
+local annotations = require 'annotations'
+
+local cmd = torch.CmdLine()
+cmd:option('-video', 'testdata1.webm', 'training video')
+cmd:option('-labels', 'annotations', 'annotation store')
+cmd:option('-frames', 'frames', 'directory the video is split into')
+cmd:option('-width', 640, 'frame width')
+cmd:option('-height', 360, 'frame height')
+cmd:option('-batch', 16, 'frame pairs per minibatch')
+cmd:option('-epochs', 20, 'passes over the labelled frames')
+cmd:option('-rate', 0.01, 'learning rate')
+cmd:option('-momentum', 0.9, 'momentum')
+cmd:option('-threads', 4, 'loader threads')
+cmd:option('-seed', 1, 'random seed')
+cmd:option('-crop', 0.8, 'crop to this fraction of each side, at a random place (1 for none)')
+cmd:option('-noflip', false, 'don\'t flip pairs left to right')
+cmd:option('-brightness', 0.2, 'scale pairs\' brightness by up to this much either way')
+cmd:option('-holdout', 0, 'leave out frames numbered a multiple of this, for host/evaluate -H (0 for none)')
+cmd:option('-save', 'convnet.t7', 'where to save the model after each epoch')
+local opt = cmd:parse(arg)
+
+torch.manualSeed(opt.seed)
+torch.setdefaulttensortype('torch.FloatTensor')
+
+local function framePath(dir, n)
+  return paths.concat(dir, string.format('%06d.png', n))
+end
+
+-- Splits the video into frames, unless that has been done.
+local function extract()
+  local done = paths.concat(opt.frames, 'done')
+  if paths.filep(done) then
+    return
+  end
+  paths.mkdir(opt.frames)
+  local status = os.execute(string.format('ffmpeg -loglevel error -i %s -vf scale=%d:%d -start_number 0 %s',
+                                          opt.video, opt.width, opt.height, paths.concat(opt.frames, '%06d.png')))
+  assert(status == 0 or status == true, 'ffmpeg failed')
+  io.open(done, 'w'):close()
+end
+
+-- Labelled, usable frames with a frame before them, and each one's target:
+-- the network output it should give, stored as the height of the gaussian
+-- (0..255) under 0.5 to save space.
+local function targets()
+  local labels = annotations.open(opt.labels)
+  local frames = {}
+  for n = 1, labels.frames - 1 do
+    local l = labels:get(n)
+    if l and bit.band(l.flags, annotations.FRAME_LABELLED) ~= 0
+       and bit.band(l.flags, annotations.FRAME_SKIP) == 0 and (opt.holdout == 0 or n % opt.holdout ~= 0)
+       and paths.filep(framePath(opt.frames, n)) then
+      table.insert(frames, n)
+    end
+  end
+  local oh, ow = opt.height - 6, opt.width - 6
+  local all = torch.ByteTensor(#frames, oh, ow)
+  local t, blob = torch.FloatTensor(oh, ow), torch.FloatTensor(oh, ow)
+  for i, n in ipairs(frames) do
+    t:zero()
+    for _, p in ipairs(labels:get(n)) do
+      image.gaussian(0, 0, 1, false, 0, 0, 0.02, 0.02, p.x / opt.width, p.y / opt.height, blob)
+      t:cmax(blob)
+    end
+    all[i]:copy(t:mul(255):add(0.5))
+  end
+  labels:close()
+  return frames, all
+end
+
+sys.tic()
+extract()
+local frames, cached = targets()
+print(string.format('%d labelled frames, targets in %.1f s', #frames, sys.toc()))
+
+local cw, ch = math.floor(opt.width * opt.crop), math.floor(opt.height * opt.crop)
+threads.serialization('threads.sharedserialize') -- loaders share cached, not copy it
+local pool = threads.Threads(opt.threads, function()
+  require 'torch'
+  require 'image'
+  require 'paths'
+end)
+
+-- Runs on a loader: the frame pairs and targets for batch, augmented by
+-- draws from seed alone.
+local function loadBatch(dir, batch, seed)
+  torch.setdefaulttensortype('torch.FloatTensor')
+  local gen = torch.Generator()
+  torch.manualSeed(gen, seed)
+  local b = #batch
+  local cur, prev = torch.FloatTensor(b, 3, ch, cw), torch.FloatTensor(b, 3, ch, cw)
+  local target = torch.FloatTensor(b, 1, ch - 6, cw - 6)
+  for i, item in ipairs(batch) do
+    local x = torch.random(gen, 0, opt.width - cw)
+    local y = torch.random(gen, 0, opt.height - ch)
+    local flip = not opt.noflip and torch.random(gen, 0, 1) == 1
+    local gain = 1 + opt.brightness * (2 * torch.uniform(gen) - 1)
+    for k, frame in ipairs({item.n, item.n - 1}) do
+      local img = image.load(framePath(dir, frame), 3, 'float')
+      img = img:narrow(2, y + 1, ch):narrow(3, x + 1, cw)
+      local dst = k == 1 and cur[i] or prev[i]
+      if flip then
+        image.hflip(dst, img)
+      else
+        dst:copy(img)
+      end
+      dst:mul(gain):clamp(0, 1)
+    end
+    local t = item.target:narrow(1, y + 1, ch - 6):narrow(2, x + 1, cw - 6):float()
+    if flip then
+      image.hflip(target[i][1], t)
+    else
+      target[i][1]:copy(t)
+    end
+  end
+  -- 0.5 less the gaussian, as vision.lua trains towards.
+  target:div(-255):add(0.5)
+  return {cur, prev}, target
+end
+
+local net = convnet.get_net()
+local criterion = nn.MSECriterion()
+local params, grads = net:getParameters()
+local sgd = {learningRate = opt.rate, momentum = opt.momentum}
+net:training()
+
+for epoch = 1, opt.epochs do
+  sys.tic()
+  local order = torch.randperm(#frames)
+  local batches = {}
+  for i = 1, #frames, opt.batch do
+    local batch = {}
+    for k = i, math.min(i + opt.batch - 1, #frames) do
+      local j = order[k]
+      table.insert(batch, {n = frames[j], target = cached[j]})
+    end
+    table.insert(batches, batch)
+  end
+
+  -- Keep the loaders busy a couple of batches ahead, taking the results in
+  -- order whichever finishes first.
+  local ready, submitted = {}, 0
+  local function submit()
+    if submitted >= #batches then
+      return
+    end
+    submitted = submitted + 1
+    local i, batch, seed = submitted, batches[submitted], opt.seed * 1000003 + epoch * 10007 + submitted
+    pool:addjob(function() return loadBatch(opt.frames, batch, seed) end,
+                function(input, target) ready[i] = {input, target} end)
+  end
+  for i = 1, 2 * opt.threads do
+    submit()
+  end
+
+  local loss = 0
+  for i = 1, #batches do
+    while not ready[i] do
+      pool:dojob()
+    end
+    local input, target = ready[i][1], ready[i][2]
+    ready[i] = nil
+    submit()
+    optim.sgd(function()
+      grads:zero()
+      local out = net:forward(input)
+      local l = criterion:forward(out, target)
+      net:backward(input, criterion:backward(out, target))
+      loss = loss + l
+      return l, grads
+    end, params, sgd)
+  end
+  print(string.format('epoch %d: loss %.6f, %.1f s', epoch, loss / #batches, sys.toc()))
+  net:clearState()
+  torch.save(opt.save, net)
+  convnet.save(net, 'convnet.weights') -- for host/convnet
+end
+pool:terminate()
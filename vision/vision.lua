@@ -7,6 +7,10 @@ require 'image'
 require 'optim'
 require 'ffmpeg'
 require 'qt'
+local trace = require 'trace'
+local convnet = require 'convnet'
+local annotations = require 'annotations'
+local bit = require 'bit'
 
 
 -- generate SVG of the graph with the problem node highlighted
@@ -14,28 +18,7 @@ require 'qt'
 -- nodes will be annotated with local variable names even if debug mode is not enabled.
 nngraph.setDebug(true)
 
-local function get_net(from, to)
-
-    local input_x = nn.Identity()()
-    local input_y = nn.Identity()()
-    local joined = nn.JoinTable(1)({input_x, input_y})
-    
-    local smallj = nn.SpatialAveragePooling(6,6,6,6)(joined)
-
-    local L1 = nn.SpatialMaxPooling(3,3,1,1,1,1)(nn.ReLU()(nn.Dropout()(nn.SpatialConvolution(6, 4, 3, 3,1,1)(joined))))
-    
-    local smallL1 = nn.SpatialAveragePooling(3,3,3,3)(L1)
-    
-    local L2 = nn.SpatialMaxPooling(3,3,1,1,1,1)(nn.ReLU()(nn.Dropout()(nn.SpatialConvolution(4, 3, 3, 3,1,1)(L1))))
-    
-    local smallL2 = nn.SpatialAveragePooling(3,3,3,3)(L2)
-    
-    local L3 = nn.SpatialConvolution(3, 1, 3, 3,1,1)(L2)
-
-    return nn.gModule({input_x, input_y},{L3})
-end
-
-local net = get_net()
+local net = convnet.get_net()
 local criterion = nn.MSECriterion() 
 local cam
 if false then
@@ -47,25 +30,33 @@ end
 local trainer = nn.StochasticGradient(net, criterion)
 trainer.learningRate = 0.01
 
+-- The last HISTORY frames, in storage allocated once: each new frame is
+-- copied out of the decoder's buffer into the oldest slot, rather than
+-- cloning a new tensor every time.
+local HISTORY = 2
+local history = {}
 local input = cam:forward()
-local lastframe
+for i = 1, HISTORY do
+  history[i] = input:clone()
+end
+local newest = 1
 local framecount = 0
 
 local window, painter
 window, painter = image.window()
 
-local results = torch.load("trainingdata", 'ascii')
+-- Convert the old trainingdata with: host/annotool convert trainingdata annotations
+local labels = annotations.open('annotations')
 local frame = 0
 
 qt.connect(window.listener,
                  'sigMousePress(int,int,QByteArray,QByteArray,QByteArray)',
                  function (x,y,...)
                    
-                   results[frame] = {x=x, y=y}
-                   while results[frame] do
+                   labels:add(frame, x, y)
+                   while labels:get(frame) do
                      frame = frame+1
                      print(frame)
-                     torch.save("trainingdata", results , 'ascii')
                      dd = image.toDisplayTensor{input={cam:forward()},padding=1, scaleeach=true}
                      image.display{image=dd, win=painter}
                    end
@@ -73,50 +64,67 @@ qt.connect(window.listener,
 window:show()
 
 while true do
-  lastframe = input:clone()
-
+  newest = newest % HISTORY + 1
   frame = cam.current
-  input = cam:forward()
+  input = history[newest]:copy(cam:forward())
+  trace.frame()
 
   
   
-  local inp = {input, lastframe}
+  local inp = {input, history[(newest - 2) % HISTORY + 1]}
   local netout = net:forward(inp)
+  trace.mark('inference')
   
-  validoutput = netout:clone()
+  -- Only train on frames someone has labelled and not marked unusable, as
+  -- train.lua does: anything else would teach it there are no craft.
+  local l = labels:get(frame)
+  validoutput = nil
+  if l and bit.band(l.flags, annotations.FRAME_LABELLED) ~= 0
+     and bit.band(l.flags, annotations.FRAME_SKIP) == 0 then
+    validoutput = netout:clone()
   
-  validoutout = validoutput:squeeze()
+    validoutout = validoutput:squeeze()
   
-  image.gaussian(0, 0, 1, false, 0, 0, 0.02, 0.02, results[frame].x/640, results[frame].y/360, validoutout)
+    -- One gaussian per labelled craft, the highest winning where they meet.
+    validoutout:zero()
+    local blob = validoutout:clone()
+    for _, p in ipairs(l) do
+      image.gaussian(0, 0, 1, false, 0, 0, 0.02, 0.02, p.x/640, p.y/360, blob)
+      validoutout:cmax(blob)
+    end
   
-  validoutput:add(-0.5)
-   validoutput:mul(-1)
+    validoutput:add(-0.5)
+    validoutput:mul(-1)
   
-  --trainer:train(dataset)
+    --trainer:train(dataset)
 
-  out = criterion:forward(netout, validoutput)
-  
+    out = criterion:forward(netout, validoutput)
   
-  local critback = criterion:backward(netout, validoutput)
   
-  net:backward(inp, critback )
+    local critback = criterion:backward(netout, validoutput)
   
-  net:updateParameters(0.01)
-  net:zeroGradParameters()
+    net:backward(inp, critback )
   
-  print("loss: " .. out)
-  print("Target Max: " .. validoutput:max())
-  print("Target Min: " .. validoutput:min())
-  print("Out Max: " .. netout:max())
-  print("Out Min: " .. netout:min())
+    net:updateParameters(0.01)
+    net:zeroGradParameters()
   
+    print("loss: " .. out)
+    print("Target Max: " .. validoutput:max())
+    print("Target Min: " .. validoutput:min())
+    print("Out Max: " .. netout:max())
+    print("Out Min: " .. netout:min())
+  end
+
   -- netout:add(validoutput)
   if frame > 100 then
-    dd = image.toDisplayTensor{input={netout, validoutput},padding=1, scaleeach=true}
+    dd = image.toDisplayTensor{input={netout, validoutput or netout},padding=1, scaleeach=true}
     image.display{image=dd, win=painter}
   end
   
   print(frame)
+  if frame % 100 == 0 then
+    convnet.save(net, 'convnet.weights') -- for host/convnet
+  end
 end
 
 